@@ -15,6 +15,7 @@ public:
 	virtual std::string effect_type_id() const { return "AlphaMultiplicationEffect"; }
 	std::string output_fragment_shader();
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual float estimated_alu_cost() const { return 1.0f; }
 };
 
 }  // namespace movit
@@ -12,6 +12,30 @@
 using namespace std;
 
 namespace movit {
+
+namespace {
+
+// Work group size for the compute shader; see blur_effect.comp.
+const unsigned compute_tile_length = 64;
+const unsigned max_compute_num_lines = 4;
+
+// How many lines each work group of the compute shader can do, given
+// that it keeps compute_tile_length + 2 * (num_taps + 1) RGBA fp32 pixels
+// per line in shared memory. With many taps and the minimum OpenGL ES
+// allows (16 kB), four lines would not fit. Returns 0 if not even one does.
+unsigned get_compute_num_lines(int num_taps)
+{
+	const unsigned bytes_per_line = (compute_tile_length + 2 * (num_taps + 1)) * 4 * sizeof(float);
+	for (unsigned num_lines = max_compute_num_lines; num_lines >= 1; num_lines /= 2) {
+		if (num_lines * bytes_per_line <= unsigned(movit_max_compute_shared_memory_size) &&
+		    num_lines * compute_tile_length <= unsigned(movit_max_compute_work_group_invocations)) {
+			return num_lines;
+		}
+	}
+	return 0;
+}
+
+}  // namespace
 	
 BlurEffect::BlurEffect()
 	: num_taps(16),
@@ -111,7 +135,8 @@ SingleBlurPassEffect::SingleBlurPassEffect(BlurEffect *parent)
 	  direction(HORIZONTAL),
 	  width(1280),
 	  height(720),
-	  uniform_samples(NULL)
+	  uniform_samples(NULL),
+	  last_parameter_generation(0)
 {
 	register_float("radius", &radius);
 	register_int("direction", (int *)&direction);
@@ -127,20 +152,59 @@ SingleBlurPassEffect::~SingleBlurPassEffect()
 	delete[] uniform_samples;
 }
 
-string SingleBlurPassEffect::output_fragment_shader()
+string SingleBlurPassEffect::output_shader_defines()
 {
 	char buf[256];
 	sprintf(buf, "#define DIRECTION_VERTICAL %d\n#define NUM_TAPS %d\n",
 		(direction == VERTICAL), num_taps);
 	uniform_samples = new float[2 * (num_taps / 2 + 1)];
 	register_uniform_vec2_array("samples", uniform_samples, num_taps / 2 + 1);
-	return buf + read_file("blur_effect.frag");
+	return buf;
+}
+
+string SingleBlurPassEffect::output_fragment_shader()
+{
+	return output_shader_defines() + read_file("blur_effect.frag");
+}
+
+bool SingleBlurPassEffect::has_compute_shader() const
+{
+	return movit_compute_shaders_supported && get_compute_num_lines(num_taps) > 0;
+}
+
+string SingleBlurPassEffect::output_compute_shader()
+{
+	char buf[256];
+	sprintf(buf, "#define BLUR_TILE_LENGTH %u\n#define BLUR_NUM_LINES %u\n",
+		compute_tile_length, get_compute_num_lines(num_taps));
+	return output_shader_defines() + buf + read_file("blur_effect.comp");
+}
+
+void SingleBlurPassEffect::get_compute_dimensions(unsigned output_width, unsigned output_height,
+                                                  unsigned *x, unsigned *y, unsigned *z) const
+{
+	const unsigned compute_num_lines = get_compute_num_lines(num_taps);
+	if (direction == VERTICAL) {
+		*x = (output_width + compute_num_lines - 1) / compute_num_lines;
+		*y = (output_height + compute_tile_length - 1) / compute_tile_length;
+	} else {
+		*x = (output_width + compute_tile_length - 1) / compute_tile_length;
+		*y = (output_height + compute_num_lines - 1) / compute_num_lines;
+	}
+	*z = 1;
 }
 
 void SingleBlurPassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
 {
 	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
 
+	// The samples only depend on our parameters, so if none of them
+	// have changed since last frame, the ones we have are still good.
+	if (get_parameter_generation() == last_parameter_generation) {
+		return;
+	}
+	last_parameter_generation = get_parameter_generation();
+
 	// Compute the weights; they will be symmetrical, so we only compute
 	// the right side.
 	float* weight = new float[num_taps + 1];
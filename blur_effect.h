@@ -71,6 +71,20 @@ public:
 
 	std::string output_fragment_shader();
 
+	// The compute shader keeps a tile of the input (plus num_taps + 1
+	// pixels on each side) in shared memory, so with very many taps,
+	// it may not fit in what the driver allows.
+	//
+	// Note that EffectChain only uses it if the pass is the output of
+	// a phase that is not the last one. The vertical pass usually
+	// shares its phase with whatever comes after the blur (or renders
+	// to the final output), so in most chains, only the horizontal pass
+	// runs as a compute shader.
+	virtual bool has_compute_shader() const;
+	std::string output_compute_shader();
+	virtual void get_compute_dimensions(unsigned output_width, unsigned output_height,
+	                                    unsigned *x, unsigned *y, unsigned *z) const;
+
 	virtual bool needs_texture_bounce() const { return true; }
 	virtual bool needs_mipmaps() const { return true; }
 	virtual bool needs_srgb_primaries() const { return false; }
@@ -85,6 +99,11 @@ public:
 	virtual bool sets_virtual_output_size() const { return true; }
 	virtual bool one_to_one_sampling() const { return false; }  // Can sample outside the border.
 
+	// See blur_effect.frag; each of the num_taps / 2 sample pairs
+	// reads the input twice, plus one read in the center.
+	virtual float estimated_alu_cost() const { return 4.0f * (num_taps / 2 + 1); }
+	virtual float input_samples_per_pixel() const { return num_taps + 1; }
+
 	virtual void get_output_size(unsigned *width, unsigned *height, unsigned *virtual_width, unsigned *virtual_height) const {
 		*width = this->width;
 		*height = this->height;
@@ -98,12 +117,18 @@ public:
 	enum Direction { HORIZONTAL = 0, VERTICAL = 1 };
 
 private:
+	// The #defines common to both shaders. Also registers the uniforms.
+	std::string output_shader_defines();
+
 	BlurEffect *parent;
 	int num_taps;
 	float radius;
 	Direction direction;
 	int width, height, virtual_width, virtual_height;
 	float *uniform_samples;
+
+	// The parameter generation uniform_samples was last computed for.
+	unsigned last_parameter_generation;
 };
 
 }  // namespace movit
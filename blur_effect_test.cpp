@@ -1,13 +1,17 @@
 // Unit tests for BlurEffect.
 #include <epoxy/gl.h>
 #include <math.h>
+#include <stdio.h>
 #include <string.h>
+#include <vector>
 
 #include "blur_effect.h"
 #include "effect_chain.h"
 #include "gtest/gtest.h"
 #include "image_format.h"
+#include "init.h"
 #include "test_util.h"
+#include "util.h"
 
 namespace movit {
 
@@ -133,4 +137,119 @@ TEST(BlurEffectTest, BlurTwoDotsSmallRadiusFewerTaps) {
 	expect_equal(expected_data, out_data, size, size, 1e-3, 1e-5);
 }
 
+TEST(BlurEffectTest, ChangingRadiusBetweenFramesTakesEffect) {
+	const float sigma = 3.0f;
+	const int size = 32;
+	const int x1 = 8;
+	const int y1 = 8;
+
+	float data[size * size], out_data[size * size], expected_data[size * size];
+	memset(data, 0, sizeof(data));
+	memset(expected_data, 0, sizeof(expected_data));
+
+	data[y1 * size + x1] = 1.0f;
+	add_blurred_point(expected_data, size, x1, y1, 1.0f, sigma);
+
+	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+	ASSERT_TRUE(blur_effect->set_float("radius", 0.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, size, size);
+
+	// The weights are cached between frames, so make sure they are
+	// recomputed when the radius changes (and only then).
+	ASSERT_TRUE(blur_effect->set_float("radius", sigma));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, size, size, 1e-3, 1e-5);
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, size, size, 1e-3, 1e-5);
+}
+
+// The blur passes can run as compute shaders (see blur_effect.comp) if they
+// render to an intermediate texture, so put a bouncing effect after the blur
+// to get both of them that way, and compare against the fragment shaders.
+// The larger radius scales down, so that the first pass reads from mipmaps.
+TEST(BlurEffectTest, ComputeShaderMatchesFragmentShader) {
+	if (!movit_compute_shaders_supported) {
+		fprintf(stderr, "Skipping test; no support for compute shaders.\n");
+		return;
+	}
+
+	const int width = 80, height = 48;
+	float data[width * height], out_data[2][width * height];
+	for (int i = 0; i < width * height; ++i) {
+		data[i] = ((i * 7919) % 256) / 255.0f;
+	}
+
+	const float radii[] = { 3.0f, 20.0f };
+	for (unsigned radius_idx = 0; radius_idx < sizeof(radii) / sizeof(radii[0]); ++radius_idx) {
+		for (int use_compute = 0; use_compute < 2; ++use_compute) {
+			EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+			tester.get_chain()->enable_compute_shaders(use_compute);
+			Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+			ASSERT_TRUE(blur_effect->set_float("radius", radii[radius_idx]));
+			Effect *bounce_effect = tester.get_chain()->add_effect(new BouncingIdentityEffect());
+			tester.run(out_data[use_compute], GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+			Node *vpass = tester.get_chain()->find_node_for_effect(bounce_effect)->incoming_links[0];
+			Node *hpass = vpass->incoming_links[0];
+			ASSERT_EQ("SingleBlurPassEffect", vpass->effect->effect_type_id());
+			ASSERT_EQ("SingleBlurPassEffect", hpass->effect->effect_type_id());
+			EXPECT_EQ(bool(use_compute), vpass->containing_phase->is_compute_shader);
+			EXPECT_EQ(bool(use_compute), hpass->containing_phase->is_compute_shader);
+		}
+		expect_equal(out_data[0], out_data[1], width, height, 2e-3, 2e-4);
+	}
+}
+
+#ifdef HAVE_BENCHMARK
+
+// A 1080p blur (args: radius, number of taps), with the fragment shaders
+// or the compute shaders. As in the test above, the blur is followed by
+// a bouncing effect, so that both passes can run as compute shaders.
+void benchmark_blur(benchmark::State &state, bool use_compute)
+{
+	const int width = 1920, height = 1080;
+	const float radius = state.range(0);
+	const int num_taps = state.range(1);
+
+	std::vector<float> data(width * height * 4, 0.5f);
+	EffectChainTester tester(NULL, width, height);
+	if (use_compute && !movit_compute_shaders_supported) {
+		state.SkipWithError("No support for compute shaders");
+		return;
+	}
+	tester.add_input(&data[0], FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, width, height);
+	tester.get_chain()->enable_compute_shaders(use_compute);
+
+	Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+	CHECK(blur_effect->set_int("num_taps", num_taps));
+	CHECK(blur_effect->set_float("radius", radius));
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.benchmark(state, GL_RGBA16F, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+}
+
+void BM_BlurEffect(benchmark::State &state)
+{
+	benchmark_blur(state, false);
+}
+BENCHMARK(BM_BlurEffect)
+	->ArgPair(3, 16)
+	->ArgPair(20, 64)  // Large enough radius to need the taps, but not scale down.
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
+
+void BM_BlurEffectCompute(benchmark::State &state)
+{
+	benchmark_blur(state, true);
+}
+BENCHMARK(BM_BlurEffectCompute)
+	->ArgPair(3, 16)
+	->ArgPair(20, 64)
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
+
+#endif
+
 }  // namespace movit
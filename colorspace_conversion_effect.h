@@ -29,6 +29,7 @@ public:
 	virtual bool needs_srgb_primaries() const { return false; }
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual float estimated_alu_cost() const { return 9.0f; }
 
 	// Get a conversion matrix from the given color space to XYZ.
 	static Eigen::Matrix3d get_xyz_matrix(Colorspace space);
@@ -34,8 +34,11 @@ public:
 	virtual std::string effect_type_id() const { return "DeconvolutionSharpenEffect"; }
 	std::string output_fragment_shader();
 
-	// Samples a lot of times from its input.
+	// Samples a lot of times from its input; once for every element
+	// of the (2R + 1) x (2R + 1) kernel.
 	virtual bool needs_texture_bounce() const { return true; }
+	virtual float estimated_alu_cost() const { return 2.0f * (2 * R + 1) * (2 * R + 1); }
+	virtual float input_samples_per_pixel() const { return (2 * R + 1) * (2 * R + 1); }
 
 	virtual void inform_input_size(unsigned input_num, unsigned width, unsigned height)
 	{
@@ -43,6 +43,7 @@
 #include "image_format.h"
 #include "init.h"
 #include "lift_gamma_gain_effect.h"
+#include "readback_queue.h"
 #include "saturation_effect.h"
 #include "util.h"
 #include "widgets.h"
@@ -149,7 +150,7 @@ unsigned char *load_image(const char *filename, unsigned *w, unsigned *h)
 	return (unsigned char *)converted->pixels;
 }
 
-void write_png(const char *filename, unsigned char *screenbuf)
+void write_png(const char *filename, const unsigned char *screenbuf)
 {
 	FILE *fp = fopen(filename, "wb");
 	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -165,7 +166,7 @@ void write_png(const char *filename, unsigned char *screenbuf)
 
 	png_bytep *row_pointers = new png_bytep[HEIGHT];
 	for (unsigned y = 0; y < HEIGHT; ++y) {
-		row_pointers[y] = screenbuf + ((HEIGHT - y - 1) * WIDTH) * 4;
+		row_pointers[y] = (png_bytep)screenbuf + ((HEIGHT - y - 1) * WIDTH) * 4;
 	}
 
 	png_init_io(png_ptr, fp);
@@ -247,12 +248,9 @@ int main(int argc, char **argv)
 	chain.set_dither_bits(8);
 	chain.finalize();
 
-	// generate a PBO to hold the data we read back with glReadPixels()
-	// (Intel/DRI goes into a slow path if we don't read to PBO)
-	GLuint pbo;
-	glGenBuffers(1, &pbo);
-	glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbo);
-	glBufferData(GL_PIXEL_PACK_BUFFER_ARB, WIDTH * HEIGHT * 4, NULL, GL_STREAM_READ);
+	// read back each frame through a PBO, so that we do not stall
+	// before drawing the widgets and swapping
+	ReadbackQueue readback(1, WIDTH * HEIGHT * 4);
 
 	make_hsv_wheel_texture();
 
@@ -295,12 +293,8 @@ int main(int argc, char **argv)
 		input->set_pixel_data(src_img);
 		chain.render_to_screen();
 		
-		glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbo);
-		check_error();
-		glReadPixels(0, 0, WIDTH, HEIGHT, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, BUFFER_OFFSET(0));
-		check_error();
-		glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
-		check_error();
+		readback.read_pixels(0, 0, 0, 0, WIDTH, HEIGHT, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV);
+		unsigned readback_frame = readback.end_frame();
 
 		glLoadIdentity();
 		draw_hsv_wheel(0.0f, lift_rad, lift_theta, lift_v);
@@ -321,10 +315,7 @@ int main(int argc, char **argv)
 #endif
 		check_error();
 
-		glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbo);
-		check_error();
-		unsigned char *screenbuf = (unsigned char *)glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
-		check_error();
+		const unsigned char *screenbuf = (const unsigned char *)readback.map_frame(readback_frame);
 		if (screenshot) {
 			char filename[256];
 			sprintf(filename, "frame%05d.png", frame);
@@ -332,10 +323,7 @@ int main(int argc, char **argv)
 			printf("Screenshot: %s\n", filename);
 			screenshot = false;
 		}
-		glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
-		check_error();
-		glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
-		check_error();
+		readback.unmap_frame(readback_frame);
 
 #if 1
 #if _POSIX_C_SOURCE >= 199309L
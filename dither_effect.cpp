@@ -4,8 +4,10 @@
 #include <algorithm>
 
 #include "dither_effect.h"
+#include "effect_chain.h"
 #include "effect_util.h"
 #include "init.h"
+#include "resource_pool.h"
 #include "util.h"
 
 using namespace std;
@@ -30,7 +32,8 @@ unsigned lcg_rand(unsigned x)
 
 DitherEffect::DitherEffect()
 	: width(1280), height(720), num_bits(8),
-	  last_width(-1), last_height(-1), last_num_bits(-1)
+	  last_width(-1), last_height(-1), last_num_bits(-1),
+	  chain(NULL), texnum(0)
 {
 	register_int("output_width", &width);
 	register_int("output_height", &height);
@@ -39,13 +42,13 @@ DitherEffect::DitherEffect()
 	register_uniform_float("inv_round_fac", &uniform_inv_round_fac);
 	register_uniform_vec2("tc_scale", uniform_tc_scale);
 	register_uniform_sampler2d("dither_tex", &uniform_dither_tex);
-
-	glGenTextures(1, &texnum);
 }
 
 DitherEffect::~DitherEffect()
 {
-	glDeleteTextures(1, &texnum);
+	if (texnum != 0) {
+		chain->get_resource_pool()->release_keyed_texture(texnum);
+	}
 }
 
 string DitherEffect::output_fragment_shader()
@@ -57,15 +60,34 @@ string DitherEffect::output_fragment_shader()
 
 void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
 {
-	float *dither_noise = new float[width * height];
-	float dither_double_amplitude = 1.0f / (1 << num_bits);
-
 	// We don't need a strictly nonrepeating dither; reducing the resolution
 	// to max 128x128 saves a lot of texture bandwidth, without causing any
 	// noticeable harm to the dither's performance.
 	texture_width = min(width, 128);
 	texture_height = min(height, 128);
 
+	// The noise is fully given by these parameters, so chains of the same
+	// size and bit depth that share a ResourcePool can share the texture.
+	char texture_key[256];
+	snprintf(texture_key, sizeof(texture_key), "DitherEffect %d %d %d", width, height, num_bits);
+	ResourcePool *resource_pool = chain->get_resource_pool();
+	GLuint new_texnum = resource_pool->acquire_keyed_texture(texture_key);
+	if (new_texnum == 0) {
+		new_texnum = generate_texture(sampler_num);
+		new_texnum = resource_pool->add_keyed_texture(
+			texture_key, new_texnum, GL_R16F, texture_width, texture_height);
+	}
+	if (texnum != 0) {
+		resource_pool->release_keyed_texture(texnum);
+	}
+	texnum = new_texnum;
+}
+
+GLuint DitherEffect::generate_texture(unsigned *sampler_num)
+{
+	float *dither_noise = new float[texture_width * texture_height];
+	float dither_double_amplitude = 1.0f / (1 << num_bits);
+
 	// Using the resolution as a seed gives us a consistent dither from frame to frame.
 	// It also gives a different dither for e.g. different aspect ratios, which _feels_
 	// good, but probably shouldn't matter.
@@ -76,9 +98,12 @@ void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix,
 		dither_noise[i] = dither_double_amplitude * normalized_rand;
 	}
 
+	GLuint new_texnum;
+	glGenTextures(1, &new_texnum);
+	check_error();
 	glActiveTexture(GL_TEXTURE0 + *sampler_num);
 	check_error();
-	glBindTexture(GL_TEXTURE_2D, texnum);
+	glBindTexture(GL_TEXTURE_2D, new_texnum);
 	check_error();
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	check_error();
@@ -92,6 +117,7 @@ void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix,
 	check_error();
 
 	delete[] dither_noise;
+	return new_texnum;
 }
 
 void DitherEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
@@ -67,16 +67,28 @@ public:
 	// space as quantization, whether that be pre- or postmultiply.
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool commutes_with_clamping() const { return true; }  // The output is quantized to [0,1] anyway.
 
+	virtual void inform_added(EffectChain *chain) { this->chain = chain; }
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
 
 private:
+	// Point <texnum> at the right noise texture for the current parameters,
+	// generating it if nobody has done so yet.
 	void update_texture(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
 
+	// Creates a new noise texture for the current parameters, and leaves
+	// it bound to the given sampler.
+	GLuint generate_texture(unsigned *sampler_num);
+
 	int width, height, num_bits;
 	int last_width, last_height, last_num_bits;
 	int texture_width, texture_height;
 
+	EffectChain *chain;
+
+	// The noise texture, owned by the chain's ResourcePool (see
+	// ResourcePool::acquire_keyed_texture()). 0 if none yet.
 	GLuint texnum;
 	float uniform_round_fac, uniform_inv_round_fac;
 	float uniform_tc_scale[2];
@@ -17,7 +17,11 @@ bool Effect::set_int(const string &key, int value)
 	if (params_int.count(key) == 0) {
 		return false;
 	}
-	*params_int[key] = value;
+	int *ptr = params_int[key];
+	if (*ptr != value) {
+		*ptr = value;
+		++parameter_generation;
+	}
 	return true;
 }
 
@@ -26,7 +30,11 @@ bool Effect::set_float(const string &key, float value)
 	if (params_float.count(key) == 0) {
 		return false;
 	}
-	*params_float[key] = value;
+	float *ptr = params_float[key];
+	if (*ptr != value) {
+		*ptr = value;
+		++parameter_generation;
+	}
 	return true;
 }
 
@@ -35,7 +43,11 @@ bool Effect::set_vec2(const string &key, const float *values)
 	if (params_vec2.count(key) == 0) {
 		return false;
 	}
-	memcpy(params_vec2[key], values, sizeof(float) * 2);
+	float *ptr = params_vec2[key];
+	if (memcmp(ptr, values, sizeof(float) * 2) != 0) {
+		memcpy(ptr, values, sizeof(float) * 2);
+		++parameter_generation;
+	}
 	return true;
 }
 
@@ -44,7 +56,11 @@ bool Effect::set_vec3(const string &key, const float *values)
 	if (params_vec3.count(key) == 0) {
 		return false;
 	}
-	memcpy(params_vec3[key], values, sizeof(float) * 3);
+	float *ptr = params_vec3[key];
+	if (memcmp(ptr, values, sizeof(float) * 3) != 0) {
+		memcpy(ptr, values, sizeof(float) * 3);
+		++parameter_generation;
+	}
 	return true;
 }
 
@@ -53,7 +69,11 @@ bool Effect::set_vec4(const string &key, const float *values)
 	if (params_vec4.count(key) == 0) {
 		return false;
 	}
-	memcpy(params_vec4[key], values, sizeof(float) * 4);
+	float *ptr = params_vec4[key];
+	if (memcmp(ptr, values, sizeof(float) * 4) != 0) {
+		memcpy(ptr, values, sizeof(float) * 4);
+		++parameter_generation;
+	}
 	return true;
 }
 
@@ -102,6 +122,7 @@ void Effect::register_uniform_sampler2d(const std::string &key, const GLint *val
 	uniform.value = value;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_sampler2d.push_back(uniform);
 }
 
@@ -112,6 +133,7 @@ void Effect::register_uniform_bool(const std::string &key, const bool *value)
 	uniform.value = value;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_bool.push_back(uniform);
 }
 
@@ -122,6 +144,7 @@ void Effect::register_uniform_int(const std::string &key, const int *value)
 	uniform.value = value;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_int.push_back(uniform);
 }
 
@@ -132,6 +155,7 @@ void Effect::register_uniform_float(const std::string &key, const float *value)
 	uniform.value = value;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_float.push_back(uniform);
 }
 
@@ -142,6 +166,7 @@ void Effect::register_uniform_vec2(const std::string &key, const float *values)
 	uniform.value = values;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_vec2.push_back(uniform);
 }
 
@@ -152,6 +177,7 @@ void Effect::register_uniform_vec3(const std::string &key, const float *values)
 	uniform.value = values;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_vec3.push_back(uniform);
 }
 
@@ -162,6 +188,7 @@ void Effect::register_uniform_vec4(const std::string &key, const float *values)
 	uniform.value = values;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_vec4.push_back(uniform);
 }
 
@@ -172,6 +199,7 @@ void Effect::register_uniform_vec2_array(const std::string &key, const float *va
 	uniform.value = values;
 	uniform.num_values = num_values;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_vec2_array.push_back(uniform);
 }
 
@@ -182,6 +210,7 @@ void Effect::register_uniform_vec4_array(const std::string &key, const float *va
 	uniform.value = values;
 	uniform.num_values = num_values;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_vec4_array.push_back(uniform);
 }
 
@@ -192,6 +221,7 @@ void Effect::register_uniform_mat3(const std::string &key, const Matrix3d *matri
 	uniform.value = matrix;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.block_offset = -1;
 	uniforms_mat3.push_back(uniform);
 }
 
@@ -60,10 +60,16 @@ struct Uniform {
 	size_t num_values;  // Number of elements; for arrays only. _Not_ the vector length.
 	std::string prefix;  // Filled in only after phases have been constructed.
 	GLint location;  // Filled in only after phases have been constructed. -1 if no location.
+
+	// Byte offset within the phase's uniform block, if the uniform lives
+	// in one instead of being set with glUniform*(). Filled in only after
+	// phases have been constructed. -1 if not in a uniform block.
+	int block_offset;
 };
 
 class Effect {
 public:
+	Effect() : parameter_generation(1) {}
 	virtual ~Effect() {}
 
 	// An identifier for this type of effect, mostly used for debug output
@@ -198,6 +204,18 @@ public:
 	// Does not make a lot of sense together with needs_texture_bounce().
 	virtual bool one_to_one_sampling() const { return false; }
 
+	// Whether clamping the input to [0,1] before this effect gives the
+	// same output as clamping the output afterwards, e.g. because the effect
+	// only moves pixels around, or because it clamps or quantizes to
+	// the output range anyway. This includes how the input is sampled;
+	// interpolating between texels (as bilinear filtering does) does not
+	// commute with clamping. If this holds for every effect between an
+	// intermediate and the end of the chain, the intermediate may be stored
+	// in a format that clamps, such as GL_RGB10_A2; see
+	// EffectChain::choose_intermediate_format(). Most effects scale or mix
+	// their inputs in some way, so it is false by default.
+	virtual bool commutes_with_clamping() const { return false; }
+
 	// Whether this effect wants to output to a different size than
 	// its input(s) (see inform_input_size(), below). See also
 	// sets_virtual_output_size() below.
@@ -217,6 +235,24 @@ public:
 	//     and allow dependent effects to change that sampler state.
 	virtual bool is_single_texture() const { return false; }
 
+	// Rough estimates of how expensive this effect is per output pixel,
+	// used to decide whether an effect with several users should be
+	// bounced to a texture once, or simply computed again by each user
+	// (see EffectChain::print_planner_decisions()). estimated_alu_cost()
+	// is the number of arithmetic operations; estimated_texture_fetches()
+	// is the number of texture lookups the effect does by itself (e.g.
+	// into lookup tables, or the pixel data for inputs), not counting
+	// the ones made through INPUT(). Being within a factor of two or so
+	// is plenty.
+	virtual float estimated_alu_cost() const { return 8.0f; }
+	virtual float estimated_texture_fetches() const { return 0.0f; }
+
+	// How many times the effect samples each of its inputs per output pixel.
+	// If this is more than one and the input is expensive to compute, the
+	// framework may choose to bounce it to a texture even if
+	// needs_texture_bounce() is false, so the effect must work either way.
+	virtual float input_samples_per_pixel() const { return 1.0f; }
+
 	// If changes_output_size() is true, you must implement this to tell
 	// the framework what output size you want. Also, you can set a
 	// virtual width/height, which is the size the next effect (if any)
@@ -271,6 +307,40 @@ public:
 	// Returns the GLSL fragment shader string for this effect.
 	virtual std::string output_fragment_shader() = 0;
 
+	// Effects that sample a neighbourhood of their input for every output
+	// pixel (typically separable filters) can also supply a compute shader,
+	// where each work group loads the input pixels it needs into shared
+	// memory once, and then computes all of its output pixels from there.
+	// If has_compute_shader() returns true, and compute shaders are
+	// supported and enabled (see EffectChain::enable_compute_shaders()),
+	// the framework will use output_compute_shader() instead of
+	// output_fragment_shader() whenever the effect is the last one in
+	// a phase that renders to an intermediate texture. Otherwise,
+	// the fragment shader is used as usual, so you always need both.
+	// The effect should need texture bounce, so that its input is
+	// a texture and not something that is expensive to compute.
+	//
+	// The compute shader must declare its own work group size
+	// (layout(local_size_x = ...) in;) and define void FUNCNAME(),
+	// which is run once per invocation. It reads its input through
+	// INPUT() as usual (with normalized coordinates), and writes its
+	// output with OUTPUT(ivec2 pos, vec4 value); OUTPUT_SIZE is the
+	// output size in pixels. Uniforms and parameters work just as
+	// for fragment shaders.
+	virtual bool has_compute_shader() const { return false; }
+	virtual std::string output_compute_shader() {
+		assert(false);
+		return "";
+	}
+
+	// For compute shaders, how many work groups to dispatch for the given
+	// output size (in pixels). Must be implemented if has_compute_shader()
+	// returns true.
+	virtual void get_compute_dimensions(unsigned output_width, unsigned output_height,
+	                                    unsigned *x, unsigned *y, unsigned *z) const {
+		assert(false);
+	}
+
 	// Set all OpenGL state that this effect needs before rendering.
 	// The default implementation sets one uniform per registered parameter,
 	// but no other state.
@@ -293,6 +363,14 @@ public:
 	virtual bool set_vec3(const std::string &key, const float *values) MUST_CHECK_RESULT;
 	virtual bool set_vec4(const std::string &key, const float *values) MUST_CHECK_RESULT;
 
+	// A counter that increases every time one of the set_*() calls above
+	// actually changes the value of a registered parameter (setting
+	// a parameter to the value it already has does not count).
+	// Effects that derive expensive state from their parameters can store
+	// the value they last saw and skip recomputation if it is the same.
+	// Starts at 1, so that 0 is never a valid generation.
+	unsigned get_parameter_generation() const { return parameter_generation; }
+
 protected:
 	// Register a parameter. Whenever set_*() is called with the same key,
 	// it will update the value in the given pointer (typically a pointer
@@ -315,8 +393,10 @@ protected:
 	// Register uniforms, such that they will automatically be set
 	// before the shader runs. This is more efficient than set_uniform_*
 	// in effect_util.h, because it doesn't need to do name lookups
-	// every time. Also, in the future, it will use uniform buffer objects
-	// (UBOs) if available to reduce the number of calls into the driver.
+	// every time. Also, it will use uniform buffer objects (UBOs) if
+	// available to reduce the number of calls into the driver.
+	// Either way, the chain will not re-upload values that have not
+	// changed since the last frame.
 	//
 	// May not be called after output_fragment_shader() has returned.
 	// The pointer must be valid for the entire lifetime of the Effect,
@@ -344,6 +424,8 @@ protected:
 	void register_uniform_mat3(const std::string &key, const Eigen::Matrix3d *matrix);
 
 private:
+	unsigned parameter_generation;
+
 	std::map<std::string, int *> params_int;
 	std::map<std::string, float *> params_float;
 	std::map<std::string, float *> params_vec2;
@@ -40,11 +40,17 @@ EffectChain::EffectChain(float aspect_nom, float aspect_denom, ResourcePool *res
 	  output_color_rgba(false),
 	  output_color_ycbcr(false),
 	  dither_effect(NULL),
+	  ycbcr_conversion_effect(NULL),
 	  num_dither_bits(0),
 	  output_origin(OUTPUT_ORIGIN_BOTTOM_LEFT),
 	  finalized(false),
+	  ready(false),
+	  peak_intermediate_bytes(0),
+	  total_intermediate_bytes(0),
+	  uniform_buffer(0),
 	  resource_pool(resource_pool),
-	  do_phase_timing(false) {
+	  do_phase_timing(false),
+	  use_compute_shaders(true) {
 	if (resource_pool == NULL) {
 		this->resource_pool = new ResourcePool();
 		owns_resource_pool = true;
@@ -60,9 +66,15 @@ EffectChain::~EffectChain()
 		delete nodes[i];
 	}
 	for (unsigned i = 0; i < phases.size(); ++i) {
-		resource_pool->release_glsl_program(phases[i]->glsl_program_num);
+		if (phases[i]->fused_into == NULL) {
+			resource_pool->release_glsl_program(phases[i]->glsl_program_num);
+		}
 		delete phases[i];
 	}
+	if (uniform_buffer != 0) {
+		glDeleteBuffers(1, &uniform_buffer);
+		check_error();
+	}
 	if (owns_resource_pool) {
 		delete resource_pool;
 	}
@@ -96,8 +108,53 @@ void EffectChain::add_ycbcr_output(const ImageFormat &format, OutputAlphaFormat
 	output_ycbcr_format = ycbcr_format;
 	output_ycbcr_splitting = output_splitting;
 
-	assert(ycbcr_format.chroma_subsampling_x == 1);
-	assert(ycbcr_format.chroma_subsampling_y == 1);
+	switch (output_splitting) {
+	case YCBCR_OUTPUT_PACKED_UYVY:
+	case YCBCR_OUTPUT_PACKED_V210:
+		assert(ycbcr_format.chroma_subsampling_x == 2);
+		assert(ycbcr_format.chroma_subsampling_y == 1);
+		break;
+	case YCBCR_OUTPUT_PACKED_NV12:
+		assert(ycbcr_format.chroma_subsampling_x == 2);
+		assert(ycbcr_format.chroma_subsampling_y == 2);
+		break;
+	default:
+		assert(ycbcr_format.chroma_subsampling_x == 1);
+		assert(ycbcr_format.chroma_subsampling_y == 1);
+		break;
+	}
+}
+
+void get_ycbcr_output_texture_size(YCbCrOutputSplitting output_splitting,
+                                   unsigned width, unsigned height,
+                                   unsigned *texture_width, unsigned *texture_height)
+{
+	switch (output_splitting) {
+	case YCBCR_OUTPUT_PACKED_UYVY:
+		// Two pixels per RGBA texel.
+		assert(width % 2 == 0);
+		*texture_width = width / 2;
+		*texture_height = height;
+		break;
+	case YCBCR_OUTPUT_PACKED_V210:
+		// One 32-bit word per texel, six pixels per four words,
+		// and rows padded to 48 pixels.
+		assert(width % 2 == 0);
+		*texture_width = (width + 47) / 48 * 32;
+		*texture_height = height;
+		break;
+	case YCBCR_OUTPUT_PACKED_NV12:
+		// The CbCr plane goes below the Y' plane.
+		assert(width % 2 == 0);
+		assert(height % 2 == 0);
+		*texture_width = width;
+		*texture_height = height + height / 2;
+		break;
+	default:
+		*texture_width = width;
+		*texture_height = height;
+		break;
+	}
 }
 
 Node *EffectChain::add_node(Effect *effect)
@@ -114,6 +171,7 @@ Node *EffectChain::add_node(Effect *effect)
 	node->output_alpha_type = ALPHA_INVALID;
 	node->needs_mipmaps = false;
 	node->one_to_one_sampling = false;
+	node->intermediate_format = 0;
 
 	nodes.push_back(node);
 	node_map[effect] = node;
@@ -255,19 +313,61 @@ string replace_prefix(const string &text, const string &prefix)
 
 namespace {
 
+bool is_packed_ycbcr_output(YCbCrOutputSplitting output_splitting)
+{
+	return output_splitting == YCBCR_OUTPUT_PACKED_UYVY ||
+		output_splitting == YCBCR_OUTPUT_PACKED_V210 ||
+		output_splitting == YCBCR_OUTPUT_PACKED_NV12;
+}
+
+// Sizes and alignments of the types we put into uniform blocks,
+// as given by the std140 layout rules. Arrays and matrices have
+// every element (or column) padded out to a vec4.
+struct Std140Type {
+	size_t alignment, size;
+};
+const Std140Type std140_scalar = { 4, 4 };  // bool, int, float.
+const Std140Type std140_vec2 = { 8, 8 };
+const Std140Type std140_vec3 = { 16, 12 };
+const Std140Type std140_vec4 = { 16, 16 };
+const Std140Type std140_array_element = { 16, 16 };  // vec2 or vec4.
+const Std140Type std140_mat3 = { 16, 48 };
+
+size_t align_std140(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Declares the given uniforms both as plain uniforms (in <glsl_string>)
+// and as members of a uniform block (in <block_string>), giving each of them
+// its offset within the block. The caller decides which of the two to use.
+// <block_string> and <block_size> can be NULL for types that cannot
+// live in a block (ie., samplers).
 template<class T>
 void extract_uniform_declarations(const vector<Uniform<T> > &effect_uniforms,
                                   const string &type_specifier,
                                   const string &effect_id,
+                                  const Std140Type &std140_type,
                                   vector<Uniform<T> > *phase_uniforms,
-                                  string *glsl_string)
+                                  string *glsl_string,
+                                  string *block_string,
+                                  size_t *block_size)
 {
 	for (unsigned i = 0; i < effect_uniforms.size(); ++i) {
 		phase_uniforms->push_back(effect_uniforms[i]);
 		phase_uniforms->back().prefix = effect_id;
 
-		*glsl_string += string("uniform ") + type_specifier + " " + effect_id
+		const string declaration = type_specifier + " " + effect_id
 			+ "_" + effect_uniforms[i].name + ";\n";
+		*glsl_string += "uniform " + declaration;
+
+		if (block_string != NULL) {
+			assert(effect_uniforms[i].num_values == 1);
+			*block_size = align_std140(*block_size, std140_type.alignment);
+			phase_uniforms->back().block_offset = *block_size;
+			*block_size += std140_type.size;
+			*block_string += "\t" + declaration;
+		}
 	}
 }
 
@@ -276,19 +376,60 @@ void extract_uniform_array_declarations(const vector<Uniform<T> > &effect_unifor
                                         const string &type_specifier,
                                         const string &effect_id,
                                         vector<Uniform<T> > *phase_uniforms,
-                                        string *glsl_string)
+                                        string *glsl_string,
+                                        string *block_string,
+                                        size_t *block_size)
 {
 	for (unsigned i = 0; i < effect_uniforms.size(); ++i) {
 		phase_uniforms->push_back(effect_uniforms[i]);
 		phase_uniforms->back().prefix = effect_id;
 
 		char buf[256];
-		snprintf(buf, sizeof(buf), "uniform %s %s_%s[%d];\n",
+		snprintf(buf, sizeof(buf), "%s %s_%s[%d];\n",
 			type_specifier.c_str(), effect_id.c_str(),
 			effect_uniforms[i].name.c_str(),
 			int(effect_uniforms[i].num_values));
-		*glsl_string += buf;
+		*glsl_string += string("uniform ") + buf;
+
+		*block_size = align_std140(*block_size, std140_array_element.alignment);
+		phase_uniforms->back().block_offset = *block_size;
+		*block_size += std140_array_element.size * effect_uniforms[i].num_values;
+		*block_string += string("\t") + buf;
+	}
+}
+
+template<class T>
+void clear_block_offsets(vector<Uniform<T> > *phase_uniforms)
+{
+	for (unsigned i = 0; i < phase_uniforms->size(); ++i) {
+		(*phase_uniforms)[i].block_offset = -1;
+	}
+}
+
+// Copies a uniform value into our copy of a uniform block, and widens
+// the range [*dirty_begin, *dirty_end) to cover it if it actually changed.
+// Returns whether it did.
+bool update_uniform_block(unsigned char *block, size_t offset, const void *data, size_t size,
+                          size_t *dirty_begin, size_t *dirty_end)
+{
+	if (memcmp(block + offset, data, size) == 0) {
+		return false;
 	}
+	memcpy(block + offset, data, size);
+	*dirty_begin = min(*dirty_begin, offset);
+	*dirty_end = max(*dirty_end, offset + size);
+	return true;
+}
+
+size_t count_non_sampler_uniforms(const Phase *phase)
+{
+	return phase->uniforms_bool.size() +
+		phase->uniforms_int.size() +
+		phase->uniforms_float.size() +
+		phase->uniforms_vec2.size() +
+		phase->uniforms_vec3.size() +
+		phase->uniforms_vec4.size() +
+		phase->uniforms_mat3.size();
 }
 
 template<class T>
@@ -300,12 +441,47 @@ void collect_uniform_locations(GLuint glsl_program_num, vector<Uniform<T> > *pha
 	}
 }
 
+// The layout qualifier a compute shader needs to write the given
+// intermediate format through an image, or NULL if it cannot.
+const char *image_format_qualifier(GLint internal_format)
+{
+	switch (internal_format) {
+	case GL_RGBA32F:
+		return "rgba32f";
+	case GL_RGBA16F:
+		return "rgba16f";
+	case GL_RGBA8:
+		return "rgba8";
+	case GL_RGB10_A2:
+		// Not in GLES.
+		return (movit_shader_model == MOVIT_ESSL_300) ? NULL : "rgb10_a2";
+	default:
+		return NULL;
+	}
+}
+
 }  // namespace
 
 void EffectChain::compile_glsl_program(Phase *phase)
 {
-	string frag_shader_header = read_version_dependent_file("header", "frag");
+	// Compute shaders need a newer GLSL version than the rest of our
+	// shaders, so they have their own headers. Apart from that, and
+	// from how the output is written, they are put together just like
+	// fragment shaders.
+	string frag_shader_header;
 	string frag_shader = "";
+	if (phase->is_compute_shader) {
+		frag_shader_header = read_file(movit_shader_model == MOVIT_ESSL_300 ? "header.310es.comp" : "header.430.comp");
+
+		const char *qualifier = image_format_qualifier(choose_intermediate_format(phase));
+		assert(qualifier != NULL);
+		frag_shader += string("layout(") + qualifier + ", binding = 0) uniform writeonly highp image2D tex_outbuf;\n";
+		frag_shader += "#define OUTPUT(pos, value) imageStore(tex_outbuf, pos, value)\n";
+		frag_shader += "#define OUTPUT_SIZE imageSize(tex_outbuf)\n";
+		frag_shader += "\n";
+	} else {
+		frag_shader_header = read_version_dependent_file("header", "frag");
+	}
 
 	// Create functions and uniforms for all the texture inputs that we need.
 	for (unsigned i = 0; i < phase->inputs.size(); ++i) {
@@ -326,6 +502,7 @@ void EffectChain::compile_glsl_program(Phase *phase)
 		uniform.prefix = "tex";
 		uniform.num_values = 1;
 		uniform.location = -1;
+		uniform.block_offset = -1;
 		phase->uniforms_sampler2d.push_back(uniform);
 	}
 
@@ -352,7 +529,11 @@ void EffectChain::compile_glsl_program(Phase *phase)
 	
 		frag_shader += "\n";
 		frag_shader += string("#define FUNCNAME ") + effect_id + "\n";
-		frag_shader += replace_prefix(node->effect->output_fragment_shader(), effect_id);
+		if (phase->is_compute_shader && node == phase->output_node) {
+			frag_shader += replace_prefix(node->effect->output_compute_shader(), effect_id);
+		} else {
+			frag_shader += replace_prefix(node->effect->output_fragment_shader(), effect_id);
+		}
 		frag_shader += "#undef PREFIX\n";
 		frag_shader += "#undef FUNCNAME\n";
 		if (node->incoming_links.size() == 1) {
@@ -366,58 +547,137 @@ void EffectChain::compile_glsl_program(Phase *phase)
 		}
 		frag_shader += "\n";
 	}
-	frag_shader += string("#define INPUT ") + phase->effect_ids[phase->effects.back()] + "\n";
 
-	// If we're the last phase, add the right #defines for Y'CbCr multi-output as needed.
-	if (phase->output_node->outgoing_links.empty() && output_color_ycbcr) {
-		switch (output_ycbcr_splitting) {
-		case YCBCR_OUTPUT_INTERLEAVED:
-			// No #defines set.
-			break;
-		case YCBCR_OUTPUT_SPLIT_Y_AND_CBCR:
-			frag_shader += "#define YCBCR_OUTPUT_SPLIT_Y_AND_CBCR 1\n";
-			break;
-		case YCBCR_OUTPUT_PLANAR:
-			frag_shader += "#define YCBCR_OUTPUT_PLANAR 1\n";
-			break;
-		default:
-			assert(false);
+	if (phase->is_compute_shader) {
+		frag_shader += string("#define COMPUTE_MAIN ") + phase->effect_ids[phase->output_node] + "\n";
+		frag_shader.append(read_file("footer.comp"));
+	} else {
+		frag_shader += string("#define INPUT ") + phase->effect_ids[phase->output_node] + "\n";
+
+		// Outputs of any phases fused into this one; see fuse_phases().
+		for (unsigned i = 0; i < phase->fused_outputs.size(); ++i) {
+			char buf[256];
+			sprintf(buf, "#define EXTRA_OUTPUT%u %s\n", i + 1,
+				phase->effect_ids[phase->fused_outputs[i]->output_node].c_str());
+			frag_shader += buf;
 		}
 
-		if (output_color_rgba) {
-			// Note: Needs to come in the header, because not only the
-			// output needs to see it (YCbCrConversionEffect and DitherEffect
-			// do, too).
-			frag_shader_header += "#define YCBCR_ALSO_OUTPUT_RGBA 1\n";
+		// If we're the last phase, add the right #defines for Y'CbCr multi-output as needed.
+		if (phase->output_node->outgoing_links.empty() && output_color_ycbcr) {
+			switch (output_ycbcr_splitting) {
+			case YCBCR_OUTPUT_INTERLEAVED:
+				// No #defines set.
+				break;
+			case YCBCR_OUTPUT_SPLIT_Y_AND_CBCR:
+				frag_shader += "#define YCBCR_OUTPUT_SPLIT_Y_AND_CBCR 1\n";
+				break;
+			case YCBCR_OUTPUT_PLANAR:
+				frag_shader += "#define YCBCR_OUTPUT_PLANAR 1\n";
+				break;
+			case YCBCR_OUTPUT_PACKED_UYVY:
+				frag_shader += "#define YCBCR_OUTPUT_PACKED_UYVY 1\n";
+				break;
+			case YCBCR_OUTPUT_PACKED_V210:
+				frag_shader += "#define YCBCR_OUTPUT_PACKED_V210 1\n";
+				break;
+			case YCBCR_OUTPUT_PACKED_NV12:
+				frag_shader += "#define YCBCR_OUTPUT_PACKED_NV12 1\n";
+				break;
+			default:
+				assert(false);
+			}
+
+			if (is_packed_ycbcr_output(output_ycbcr_splitting)) {
+				// The footer needs to know where the pixels are, and where
+				// the chroma samples should be taken between them.
+				// The image size is a uniform on YCbCrConversionEffect
+				// (which is always in the last phase), set at render time.
+				assert(ycbcr_conversion_effect != NULL);
+				Node *ycbcr_node = find_node_for_effect(ycbcr_conversion_effect);
+				assert(phase->effect_ids.count(ycbcr_node));
+				frag_shader += "#define YCBCR_OUTPUT_PACKED 1\n";
+				frag_shader += "#define YCBCR_PACKED_IMAGE_SIZE " + phase->effect_ids[ycbcr_node] + "_image_size\n";
+				if (output_origin == OUTPUT_ORIGIN_TOP_LEFT) {
+					frag_shader += "#define YCBCR_PACKED_FLIP_ORIGIN 1\n";
+				}
+				frag_shader += output_glsl_vec2("ycbcr_packed_cb_position", output_ycbcr_format.cb_x_position, output_ycbcr_format.cb_y_position);
+				frag_shader += output_glsl_vec2("ycbcr_packed_cr_position", output_ycbcr_format.cr_x_position, output_ycbcr_format.cr_y_position);
+			}
+
+			if (output_color_rgba) {
+				// Note: Needs to come in the header, because not only the
+				// output needs to see it (YCbCrConversionEffect and DitherEffect
+				// do, too).
+				frag_shader_header += "#define YCBCR_ALSO_OUTPUT_RGBA 1\n";
+			}
 		}
+		frag_shader.append(read_file("footer.frag"));
 	}
-	frag_shader.append(read_file("footer.frag"));
 
 	// Collect uniforms from all effects and output them. Note that this needs
 	// to happen after output_fragment_shader(), even though the uniforms come
 	// before in the output source, since output_fragment_shader() is allowed
 	// to register new uniforms (e.g. arrays that are of unknown length until
 	// finalization time).
-	// TODO: Make a uniform block for platforms that support it.
+	//
+	// If we can, everything except the samplers goes into a std140 uniform
+	// block, so that setup_uniforms() can upload it all in one go.
 	string frag_shader_uniforms = "";
+	string frag_shader_plain_uniforms = "";
+	string frag_shader_uniform_block = "";
+	size_t uniform_block_size = 0;
 	for (unsigned i = 0; i < phase->effects.size(); ++i) {
 		Node *node = phase->effects[i];
 		Effect *effect = node->effect;
 		const string effect_id = phase->effect_ids[node];
-		extract_uniform_declarations(effect->uniforms_sampler2d, "sampler2D", effect_id, &phase->uniforms_sampler2d, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_bool, "bool", effect_id, &phase->uniforms_bool, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_int, "int", effect_id, &phase->uniforms_int, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_float, "float", effect_id, &phase->uniforms_float, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_vec2, "vec2", effect_id, &phase->uniforms_vec2, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_vec3, "vec3", effect_id, &phase->uniforms_vec3, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_vec4, "vec4", effect_id, &phase->uniforms_vec4, &frag_shader_uniforms);
-		extract_uniform_array_declarations(effect->uniforms_vec2_array, "vec2", effect_id, &phase->uniforms_vec2, &frag_shader_uniforms);
-		extract_uniform_array_declarations(effect->uniforms_vec4_array, "vec4", effect_id, &phase->uniforms_vec4, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_mat3, "mat3", effect_id, &phase->uniforms_mat3, &frag_shader_uniforms);
-	}
+		extract_uniform_declarations(effect->uniforms_sampler2d, "sampler2D", effect_id, std140_scalar, &phase->uniforms_sampler2d, &frag_shader_uniforms, NULL, NULL);
+		extract_uniform_declarations(effect->uniforms_bool, "bool", effect_id, std140_scalar, &phase->uniforms_bool, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+		extract_uniform_declarations(effect->uniforms_int, "int", effect_id, std140_scalar, &phase->uniforms_int, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+		extract_uniform_declarations(effect->uniforms_float, "float", effect_id, std140_scalar, &phase->uniforms_float, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+		extract_uniform_declarations(effect->uniforms_vec2, "vec2", effect_id, std140_vec2, &phase->uniforms_vec2, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+		extract_uniform_declarations(effect->uniforms_vec3, "vec3", effect_id, std140_vec3, &phase->uniforms_vec3, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+		extract_uniform_declarations(effect->uniforms_vec4, "vec4", effect_id, std140_vec4, &phase->uniforms_vec4, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+		extract_uniform_array_declarations(effect->uniforms_vec2_array, "vec2", effect_id, &phase->uniforms_vec2, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+		extract_uniform_array_declarations(effect->uniforms_vec4_array, "vec4", effect_id, &phase->uniforms_vec4, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+		extract_uniform_declarations(effect->uniforms_mat3, "mat3", effect_id, std140_mat3, &phase->uniforms_mat3, &frag_shader_plain_uniforms, &frag_shader_uniform_block, &uniform_block_size);
+	}
+
+	// The block is padded to a vec4 boundary, like std140 would do if it
+	// were an array element. Blocks that are too large (probably because
+	// of large arrays) fall back to plain uniforms.
+	uniform_block_size = align_std140(uniform_block_size, 16);
+	if (movit_uniform_buffers_supported &&
+	    uniform_block_size > 0 &&
+	    uniform_block_size <= size_t(movit_max_uniform_block_size)) {
+		frag_shader_uniforms += "layout(std140) uniform MovitUniforms {\n" + frag_shader_uniform_block + "};\n";
+		if (movit_shader_model == MOVIT_GLSL_130 && !phase->is_compute_shader) {
+			// Needs to come right after the #version line.
+			size_t pos = frag_shader_header.find('\n');
+			assert(pos != string::npos);
+			frag_shader_header.insert(pos + 1, "#extension GL_ARB_uniform_buffer_object : require\n");
+		}
+		phase->uniform_block_size = uniform_block_size;
+	} else {
+		frag_shader_uniforms += frag_shader_plain_uniforms;
+		clear_block_offsets(&phase->uniforms_bool);
+		clear_block_offsets(&phase->uniforms_int);
+		clear_block_offsets(&phase->uniforms_float);
+		clear_block_offsets(&phase->uniforms_vec2);
+		clear_block_offsets(&phase->uniforms_vec3);
+		clear_block_offsets(&phase->uniforms_vec4);
+		clear_block_offsets(&phase->uniforms_mat3);
+		phase->uniform_block_size = 0;
+	}
+	phase->uniform_block_offset = 0;
 
 	frag_shader = frag_shader_header + frag_shader_uniforms + frag_shader;
 
+	if (phase->is_compute_shader) {
+		const uint64_t program_hash = ResourcePool::hash_program_sources("", frag_shader);
+		phase->glsl_program_num = resource_pool->start_compile_glsl_compute_program(frag_shader, program_hash);
+		return;
+	}
+
 	string vert_shader = read_version_dependent_file("vs", "vert");
 
 	// If we're the last phase and need to flip the picture to compensate for
@@ -430,7 +690,45 @@ void EffectChain::compile_glsl_program(Phase *phase)
 		vert_shader[pos + needle.size() - 1] = '1';
 	}
 
-	phase->glsl_program_num = resource_pool->compile_glsl_program(vert_shader, frag_shader);
+	// The outputs of footer.frag, in the order of the draw buffers
+	// they go to.
+	vector<string> frag_shader_outputs;
+	if (phase->output_node->outgoing_links.empty() && output_color_ycbcr) {
+		switch (output_ycbcr_splitting) {
+		case YCBCR_OUTPUT_SPLIT_Y_AND_CBCR:
+			frag_shader_outputs.push_back("Y");
+			frag_shader_outputs.push_back("Chroma");
+			break;
+		case YCBCR_OUTPUT_PLANAR:
+			frag_shader_outputs.push_back("Y");
+			frag_shader_outputs.push_back("Cb");
+			frag_shader_outputs.push_back("Cr");
+			break;
+		default:
+			frag_shader_outputs.push_back("FragColor");
+			break;
+		}
+		if (output_color_rgba) {
+			frag_shader_outputs.push_back("RGBA");
+		}
+	} else {
+		frag_shader_outputs.push_back("FragColor");
+	}
+	for (unsigned i = 0; i < phase->fused_outputs.size(); ++i) {
+		char buf[256];
+		sprintf(buf, "FragColor%u", i + 1);
+		frag_shader_outputs.push_back(buf);
+	}
+
+	// Hash the sources once; the pool's program cache and its disk cache
+	// are both keyed on the hash.
+	const uint64_t program_hash = ResourcePool::hash_program_sources(vert_shader, frag_shader);
+	phase->glsl_program_num = resource_pool->start_compile_glsl_program(vert_shader, frag_shader, program_hash, frag_shader_outputs);
+}
+
+void EffectChain::finish_glsl_program(Phase *phase)
+{
+	resource_pool->finish_glsl_program(phase->glsl_program_num);
 
 	// Collect the resulting location numbers for each uniform.
 	collect_uniform_locations(phase->glsl_program_num, &phase->uniforms_sampler2d);
@@ -441,6 +739,175 @@ void EffectChain::compile_glsl_program(Phase *phase)
 	collect_uniform_locations(phase->glsl_program_num, &phase->uniforms_vec3);
 	collect_uniform_locations(phase->glsl_program_num, &phase->uniforms_vec4);
 	collect_uniform_locations(phase->glsl_program_num, &phase->uniforms_mat3);
+
+	if (phase->uniform_block_size > 0) {
+		GLuint block_index = glGetUniformBlockIndex(phase->glsl_program_num, "MovitUniforms");
+		check_error();
+		if (block_index != GL_INVALID_INDEX) {
+			glUniformBlockBinding(phase->glsl_program_num, block_index, 0);
+			check_error();
+		}
+	}
+}
+
+namespace {
+
+// Rough relative costs for the planner below, in the same units as
+// Effect::estimated_alu_cost(). Writing an intermediate texture costs
+// more than reading it, since it goes out to memory in full, while reads
+// can often be served from the texture cache.
+const float texture_fetch_cost = 8.0f;
+const float texture_write_cost = 16.0f;
+
+bool has_size_change_upstream(const Node *node, set<const Node *> *visited)
+{
+	if (!visited->insert(node).second) {
+		return false;
+	}
+	if (node->effect->changes_output_size()) {
+		return true;
+	}
+	for (unsigned i = 0; i < node->incoming_links.size(); ++i) {
+		if (has_size_change_upstream(node->incoming_links[i], visited)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+}  // namespace
+
+float EffectChain::estimate_inline_cost(Node *node)
+{
+	Effect *effect = node->effect;
+	float cost = effect->estimated_alu_cost() +
+		effect->estimated_texture_fetches() * texture_fetch_cost;
+	for (unsigned i = 0; i < node->incoming_links.size(); ++i) {
+		Node *dep = node->incoming_links[i];
+
+		// This mirrors the most important rules in construct_phase(),
+		// but it is only an estimate; e.g., we do not know yet what
+		// the planner will decide for shared inputs, so assume they
+		// are read from a texture.
+		float dep_cost;
+		if (dep->effect->is_single_texture()) {
+			dep_cost = estimate_inline_cost(dep);
+		} else if (effect->needs_texture_bounce() ||
+		           dep->outgoing_links.size() > 1 ||
+		           dep->effect->changes_output_size()) {
+			dep_cost = texture_fetch_cost;
+		} else {
+			dep_cost = estimate_inline_cost(dep);
+		}
+		cost += effect->input_samples_per_pixel() * dep_cost;
+	}
+	return cost;
+}
+
+// Decide whether an effect that is used by more than one other effect
+// should be bounced to a texture (which the users then read), or simply
+// be computed once more in every phase that uses it. The decision is
+// made once per node, so that all of its users agree.
+bool EffectChain::should_recompute(Node *node)
+{
+	map<Node *, bool>::const_iterator decision_it = recompute_decisions.find(node);
+	if (decision_it != recompute_decisions.end()) {
+		return decision_it->second;
+	}
+
+	// Mipmap and size change handling depend on where the phases end,
+	// which in turn depends on who is using us, so we could end up with
+	// different phase splits for the different copies. Don't try to be
+	// clever in those cases.
+	bool possible = true;
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		if (nodes[i]->effect->needs_mipmaps()) {
+			possible = false;
+		}
+	}
+	set<const Node *> visited;
+	if (has_size_change_upstream(node, &visited)) {
+		possible = false;
+	}
+	for (unsigned i = 0; i < node->outgoing_links.size(); ++i) {
+		if (node->outgoing_links[i]->effect->needs_texture_bounce()) {
+			possible = false;
+		}
+	}
+
+	// Effects that read their input from a texture of their own, or
+	// from anywhere but the same pixel, are blurs, resamplers and the
+	// like; recomputing them would duplicate all of their work (and
+	// their bounce) for every user, so don't, whatever their cost
+	// estimates say. Inputs are just texture lookups, though.
+	if (node->effect->num_inputs() > 0 &&
+	    (node->effect->needs_texture_bounce() || !node->effect->one_to_one_sampling())) {
+		possible = false;
+	}
+
+	const float cost = estimate_inline_cost(node);
+	float recompute_cost = 0.0f;
+	float bounce_cost = cost + texture_write_cost;
+	for (unsigned i = 0; i < node->outgoing_links.size(); ++i) {
+		const float samples = node->outgoing_links[i]->effect->input_samples_per_pixel();
+		recompute_cost += samples * cost;
+		bounce_cost += samples * texture_fetch_cost;
+	}
+	const bool recompute = possible && recompute_cost < bounce_cost;
+	recompute_decisions.insert(make_pair(node, recompute));
+
+	char buf[256];
+	if (possible) {
+		snprintf(buf, sizeof(buf), "%s (n%ld), used %u times: %s (est. cost %.1f recomputed, %.1f bounced)",
+			node->effect->effect_type_id().c_str(), (long)node,
+			unsigned(node->outgoing_links.size()),
+			recompute ? "recompute" : "bounce",
+			recompute_cost, bounce_cost);
+		for (unsigned i = 0; i < node->outgoing_links.size(); ++i) {
+			planner_edge_labels[make_pair(node, node->outgoing_links[i])] =
+				recompute ? "recompute" : "bounce";
+		}
+	} else {
+		snprintf(buf, sizeof(buf), "%s (n%ld), used %u times: bounce (required)",
+			node->effect->effect_type_id().c_str(), (long)node,
+			unsigned(node->outgoing_links.size()));
+	}
+	planner_decisions.push_back(buf);
+	return recompute;
+}
+
+// Effects that sample their input many times per output pixel (blurs,
+// resamplers) would evaluate everything inlined behind them once per sample.
+// If that is expensive enough, it is cheaper to bounce it to a texture
+// first, even though nothing else forces us to.
+bool EffectChain::should_bounce_for_sampling(Node *node, Node *dep)
+{
+	const float samples = node->effect->input_samples_per_pixel();
+	if (samples <= 1.0f ||
+	    dep->effect->num_inputs() == 0 ||
+	    dep->outgoing_links.size() > 1) {
+		// Textures are already textures, and shared effects are
+		// handled by should_recompute().
+		return false;
+	}
+
+	const float cost = estimate_inline_cost(dep);
+	const float inline_cost = samples * cost;
+	const float bounce_cost = cost + texture_write_cost + samples * texture_fetch_cost;
+	const bool bounce = bounce_cost < inline_cost;
+
+	pair<const Node *, const Node *> edge(dep, node);
+	if (planner_edge_labels.count(edge) == 0) {
+		char buf[256];
+		snprintf(buf, sizeof(buf), "%s (n%ld), sampled %.1f times by %s (n%ld): %s (est. cost %.1f inline, %.1f bounced)",
+			dep->effect->effect_type_id().c_str(), (long)dep,
+			samples, node->effect->effect_type_id().c_str(), (long)node,
+			bounce ? "bounce" : "inline",
+			inline_cost, bounce_cost);
+		planner_decisions.push_back(buf);
+		planner_edge_labels[edge] = bounce ? "bounce" : "inline";
+	}
+	return bounce;
 }
 
 // Construct GLSL programs, starting at the given effect and following
@@ -459,6 +926,10 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 
 	Phase *phase = new Phase;
 	phase->output_node = output;
+	phase->glsl_program_num = 0;
+	phase->fused_into = NULL;
+	phase->is_compute_shader = false;
+	phase->uniform_block_offset = phase->uniform_block_size = 0;
 
 	// If the output effect has one-to-one sampling, we try to trace this
 	// status down through the dependency chain. This is important in case
@@ -480,14 +951,13 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 			node->needs_mipmaps = true;
 		}
 
-		// This should currently only happen for effects that are inputs
-		// (either true inputs or phase outputs). We special-case inputs,
-		// and then deduplicate phase outputs below.
-		if (node->effect->num_inputs() == 0) {
-			if (find(phase->effects.begin(), phase->effects.end(), node) != phase->effects.end()) {
-				continue;
-			}
-		} else {
+		// Inputs can be reached by several paths, and so can effects
+		// we have chosen to recompute (see should_recompute());
+		// only include them once. Phase outputs are deduplicated below.
+		if (find(phase->effects.begin(), phase->effects.end(), node) != phase->effects.end()) {
+			continue;
+		}
+		if (node->effect->num_inputs() != 0) {
 			assert(completed_effects->count(node) == 0);
 		}
 
@@ -522,11 +992,13 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 			if (deps[i]->outgoing_links.size() > 1) {
 				if (!deps[i]->effect->is_single_texture()) {
 					// More than one effect uses this as the input,
-					// and it is not a texture itself.
-					// The easiest thing to do (and probably also the safest
-					// performance-wise in most cases) is to bounce it to a texture
-					// and then let the next passes read from that.
-					start_new_phase = true;
+					// and it is not a texture itself. We can either bounce
+					// it to a texture and let the next passes read from that,
+					// or compute it anew for each of them; should_recompute()
+					// picks whichever it thinks is cheaper.
+					if (!should_recompute(deps[i])) {
+						start_new_phase = true;
+					}
 				} else {
 					assert(deps[i]->effect->num_inputs() == 0);
 
@@ -555,6 +1027,10 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 				start_new_phase = true;
 			}
 
+			if (!start_new_phase && should_bounce_for_sampling(node, deps[i])) {
+				start_new_phase = true;
+			}
+
 			if (start_new_phase) {
 				phase->inputs.push_back(construct_phase(deps[i], completed_effects));
 			} else {
@@ -605,14 +1081,15 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 		phase->effects[i]->containing_phase = phase;
 	}
 
-	// Actually make the shader for this phase.
-	compile_glsl_program(phase);
+	phase->is_compute_shader = can_run_as_compute_shader(phase);
 
 	// Initialize timer objects.
 	if (movit_timer_queries_supported) {
 		glGenQueries(1, &phase->timer_query_object);
 		phase->time_elapsed_ns = 0;
 		phase->num_measured_iterations = 0;
+		phase->num_uniform_uploads = 0;
+		phase->num_skipped_uniform_uploads = 0;
 	}
 
 	assert(completed_effects->count(output) == 0);
@@ -621,6 +1098,124 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 	return phase;
 }
 
+// If a phase's output is used by more than one effect, it is bounced to
+// a texture (see construct_phase()), and every phase using it has to read
+// it back. For cheap, one-to-one effects reading nothing else (e.g. the
+// HighlightCutoffEffect in GlowEffect), it is better to compute them in the
+// phase that produces their input, and write their output as a second
+// render target, so that the input is only ever read once per pixel.
+void EffectChain::fuse_phases()
+{
+	// The last phase renders into the user's FBO, so it cannot be fused.
+	for (unsigned phase_num = 0; phase_num < phases.size() - 1; ++phase_num) {
+		Phase *phase = phases[phase_num];
+		if (!can_fuse_into_input(phase)) {
+			continue;
+		}
+		Phase *input = phase->inputs[0];
+
+		// All the outputs go to the same FBO, which has room for
+		// four attachments (see ResourcePool::create_fbo()).
+		if (input->fused_outputs.size() + 1 >= 4) {
+			continue;
+		}
+
+		// Somebody else has to want the input's own output, or we would
+		// just be moving the texture bounce to a different place
+		// (and, in any case, the phase would then not have been split).
+		bool has_other_readers = false;
+		for (unsigned i = 0; i < phases.size(); ++i) {
+			if (phases[i] != phase &&
+			    phases[i]->fused_into == NULL &&
+			    find(phases[i]->inputs.begin(), phases[i]->inputs.end(), input) != phases[i]->inputs.end()) {
+				has_other_readers = true;
+				break;
+			}
+		}
+		if (!has_other_readers) {
+			continue;
+		}
+
+		// The effects are already in topological order, and all of them
+		// come after the input's, so we can simply append them.
+		for (unsigned i = 0; i < phase->effects.size(); ++i) {
+			phase->effects[i]->containing_phase = input;
+			input->effects.push_back(phase->effects[i]);
+		}
+		phase->effects.clear();
+		phase->inputs.clear();
+		phase->input_samplers.clear();
+		phase->fused_into = input;
+		input->fused_outputs.push_back(phase);
+
+		char buf[256];
+		snprintf(buf, sizeof(buf), "%s (n%ld): fused into the phase computing %s (n%ld), as render target %u",
+			phase->output_node->effect->effect_type_id().c_str(), (long)phase->output_node,
+			input->output_node->effect->effect_type_id().c_str(), (long)input->output_node,
+			unsigned(input->fused_outputs.size()));
+		planner_decisions.push_back(buf);
+	}
+}
+
+bool EffectChain::can_fuse_into_input(Phase *phase)
+{
+	if (phase->inputs.size() != 1) {
+		return false;
+	}
+	Phase *input = phase->inputs[0];
+	if (input->fused_into != NULL) {
+		return false;
+	}
+
+	// Compute shaders only have the one output image.
+	if (input->is_compute_shader) {
+		return false;
+	}
+
+	// If the input renders at a different size than what we see it as,
+	// we cannot compute both at the same resolution.
+	if (input->output_node->effect->sets_virtual_output_size()) {
+		return false;
+	}
+
+	// Every effect must produce one output pixel from the same pixel of
+	// its input(s), so that evaluating it at the input's resolution gives
+	// the same result as reading the input back from a texture would.
+	// Inputs would need their own samplers and sizes, so leave them alone.
+	for (unsigned i = 0; i < phase->effects.size(); ++i) {
+		Effect *effect = phase->effects[i]->effect;
+		if (effect->num_inputs() == 0 ||
+		    effect->needs_texture_bounce() ||
+		    effect->needs_mipmaps() ||
+		    effect->changes_output_size() ||
+		    !effect->one_to_one_sampling()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool EffectChain::can_run_as_compute_shader(Phase *phase)
+{
+	if (!movit_compute_shaders_supported || !use_compute_shaders) {
+		return false;
+	}
+	Node *output = phase->output_node;
+	if (!output->effect->has_compute_shader()) {
+		return false;
+	}
+
+	// The last phase renders into the user's framebuffer,
+	// which a compute shader cannot write to.
+	if (output->outgoing_links.empty()) {
+		return false;
+	}
+
+	// The output is written through an image, whose format
+	// the shader needs to know.
+	return image_format_qualifier(choose_intermediate_format(phase)) != NULL;
+}
+
 void EffectChain::output_dot(const char *filename)
 {
 	if (movit_debug_level != MOVIT_DEBUG_ON) {
@@ -692,6 +1287,12 @@ vector<string> EffectChain::get_labels_for_edge(const Node *from, const Node *to
 		labels.push_back("resize");
 	}
 
+	map<pair<const Node *, const Node *>, string>::const_iterator planner_it =
+		planner_edge_labels.find(make_pair(from, to));
+	if (planner_it != planner_edge_labels.end()) {
+		labels.push_back(planner_it->second);
+	}
+
 	switch (from->output_color_space) {
 	case COLORSPACE_INVALID:
 		labels.push_back("spc[invalid]");
@@ -852,7 +1453,7 @@ void EffectChain::inform_input_sizes(Phase *phase)
 // desired output size might change based on the inputs.
 void EffectChain::find_output_size(Phase *phase)
 {
-	Node *output_node = phase->effects.back();
+	Node *output_node = phase->output_node;
 
 	// If the last effect explicitly sets an output size, use that.
 	if (output_node->effect->changes_output_size()) {
@@ -1537,6 +2138,11 @@ void EffectChain::add_ycbcr_conversion_if_needed()
 	Node *output = find_output_node();
 	Node *ycbcr = add_node(new YCbCrConversionEffect(output_ycbcr_format));
 	connect_nodes(output, ycbcr);
+	ycbcr_conversion_effect = ycbcr->effect;
+
+	// The packed modes render at a different resolution than the image,
+	// so there is no way we can output RGBA at the same time.
+	assert(!output_color_rgba || !is_packed_ycbcr_output(output_ycbcr_splitting));
 }
 	
 // If the user has requested dither, add a DitherEffect right at the end
@@ -1575,6 +2181,12 @@ Node *EffectChain::find_output_node()
 }
 
 void EffectChain::finalize()
+{
+	finalize_async();
+	finish_finalize();
+}
+
+void EffectChain::finalize_async()
 {
 	// Output the graph as it is before we do any conversions on it.
 	output_dot("step0-start.dot");
@@ -1634,17 +2246,207 @@ void EffectChain::finalize()
 	// multiple times.
 	map<Node *, Phase *> completed_effects;
 	construct_phase(find_output_node(), &completed_effects);
+	fuse_phases();
 
 	output_dot("step20-split-to-phases.dot");
 
+	// Actually make the shaders for all the phases. We only submit them
+	// for compiling here, so that the driver can work on all of them
+	// in parallel; see finish_finalize().
+	for (unsigned i = 0; i < phases.size(); ++i) {
+		if (phases[i]->fused_into == NULL) {
+			compile_glsl_program(phases[i]);
+		}
+	}
+
 	assert(phases[0]->inputs.empty());
-	
+
 	finalized = true;
 }
 
+bool EffectChain::is_ready()
+{
+	assert(finalized);
+	if (ready) {
+		return true;
+	}
+	for (unsigned i = 0; i < phases.size(); ++i) {
+		if (phases[i]->fused_into == NULL &&
+		    !resource_pool->is_glsl_program_ready(phases[i]->glsl_program_num)) {
+			return false;
+		}
+	}
+	finish_finalize();
+	return true;
+}
+
+void EffectChain::finish_finalize()
+{
+	assert(finalized);
+	if (ready) {
+		return;
+	}
+
+	// All the programs have been submitted for compiling by now,
+	// so we can wait for each in turn.
+	for (unsigned i = 0; i < phases.size(); ++i) {
+		if (phases[i]->fused_into == NULL) {
+			finish_glsl_program(phases[i]);
+		}
+	}
+
+	prepare_render_plan();
+
+	ready = true;
+}
+
+void EffectChain::prepare_render_plan()
+{
+	// All the phases use the same vertex shader (save for the origin flip),
+	// but the attribute locations are nominally up to the linker, so collect
+	// all of them instead of assuming they are the same everywhere.
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		if (phases[phase_num]->fused_into != NULL ||
+		    phases[phase_num]->is_compute_shader) {
+			continue;
+		}
+		const GLuint glsl_program_num = phases[phase_num]->glsl_program_num;
+		GLint position_attribute_index = glGetAttribLocation(glsl_program_num, "position");
+		GLint texcoord_attribute_index = glGetAttribLocation(glsl_program_num, "texcoord");
+		check_error();
+		if (position_attribute_index != -1) {
+			bound_attribute_indices.insert(position_attribute_index);
+		}
+		if (texcoord_attribute_index != -1) {
+			bound_attribute_indices.insert(texcoord_attribute_index);
+		}
+	}
+
+	// Figure out who should generate mipmaps for each phase output that needs
+	// them. Phases are already in execution order, so the first phase that reads
+	// a given output with mipmaps gets the job. At the same time, find the last
+	// reader of each output, which is where its texture dies.
+	vector<bool> has_mipmaps(phases.size(), false);
+	vector<unsigned> last_reader(phases.size(), 0);
+	map<Phase *, unsigned> phase_nums;
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		phase_nums[phases[phase_num]] = phase_num;
+	}
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		phase->generates_input_mipmaps.resize(phase->inputs.size());
+		for (unsigned sampler = 0; sampler < phase->inputs.size(); ++sampler) {
+			const unsigned input_phase_num = phase_nums[phase->inputs[sampler]];
+			assert(input_phase_num < phase_num);
+			if (phase->input_needs_mipmaps && !has_mipmaps[input_phase_num]) {
+				phase->generates_input_mipmaps[sampler] = true;
+				has_mipmaps[input_phase_num] = true;
+			} else {
+				phase->generates_input_mipmaps[sampler] = false;
+			}
+			last_reader[input_phase_num] = phase_num;
+		}
+		phase->output_texture = 0;
+		phase->inputs_to_release.clear();
+		if (phase_num != phases.size() - 1) {
+			phase->output_texture_format = choose_intermediate_format(phase);
+		} else {
+			phase->output_texture_format = 0;
+		}
+	}
+
+	// Lay out the uniform blocks of all the phases in one buffer,
+	// so that we can switch between them with glBindBufferRange().
+	// The buffer starts out as all zeros, and setup_uniforms() will
+	// upload whatever differs from that.
+	size_t uniform_buffer_size = 0;
+	if (movit_uniform_buffers_supported) {
+		GLint offset_alignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+		check_error();
+		for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+			Phase *phase = phases[phase_num];
+			if (phase->uniform_block_size == 0) {
+				continue;
+			}
+			uniform_buffer_size = (uniform_buffer_size + offset_alignment - 1) / offset_alignment * offset_alignment;
+			phase->uniform_block_offset = uniform_buffer_size;
+			uniform_buffer_size += phase->uniform_block_size;
+		}
+	}
+	if (uniform_buffer_size > 0) {
+		uniform_buffer_data.assign(uniform_buffer_size, 0);
+		glGenBuffers(1, &uniform_buffer);
+		check_error();
+		glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+		check_error();
+		glBufferData(GL_UNIFORM_BUFFER, uniform_buffer_size, &uniform_buffer_data[0], GL_DYNAMIC_DRAW);
+		check_error();
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		check_error();
+	}
+
+	for (unsigned phase_num = 0; phase_num < phases.size() - 1; ++phase_num) {
+		// Every phase but the last has to be read by someone.
+		assert(last_reader[phase_num] > phase_num);
+		phases[last_reader[phase_num]]->inputs_to_release.push_back(phases[phase_num]);
+	}
+}
+
+GLint EffectChain::choose_intermediate_format(Phase *phase)
+{
+	Node *node = phase->output_node;
+	if (node->intermediate_format != 0) {
+		return node->intermediate_format;
+	}
+
+	// If the user has told us the output is going to be at most eight bits
+	// (by asking for dither), and this intermediate is gamma-compressed
+	// (so that the quantization steps are perceptually even, just like
+	// in the output), ten bits is enough to keep the error from the
+	// intermediate well below one output step. RGB10_A2 only has two
+	// bits of alpha, though, so we can only use it if alpha is blank.
+	// Note that, unlike fp16, it clamps to [0,1]. The output will do
+	// the same, but values outside that range can still matter on the way
+	// there (say, superwhite that is scaled down again later), so we only
+	// clamp early if nothing downstream can tell the difference.
+	//
+	// Linear-light data needs more than ten bits in the darks to not band,
+	// so it always stays in fp16.
+	if (num_dither_bits > 0 && num_dither_bits <= 8 &&
+	    node->output_gamma_curve != GAMMA_LINEAR &&
+	    node->output_gamma_curve != GAMMA_INVALID &&
+	    node->output_alpha_type == ALPHA_BLANK &&
+	    all_consumers_commute_with_clamping(node)) {
+		return GL_RGB10_A2;
+	}
+
+	return GL_RGBA16F;
+}
+
+bool EffectChain::all_consumers_commute_with_clamping(Node *node)
+{
+	for (unsigned i = 0; i < node->outgoing_links.size(); ++i) {
+		Node *consumer = node->outgoing_links[i];
+		if (!consumer->effect->commutes_with_clamping() ||
+		    !all_consumers_commute_with_clamping(consumer)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void EffectChain::set_intermediate_format(Effect *effect, GLint internal_format)
+{
+	assert(!finalized);
+	assert(node_map.count(effect) != 0);
+	find_node_for_effect(effect)->intermediate_format = internal_format;
+}
+
 void EffectChain::render_to_fbo(GLuint dest_fbo, unsigned width, unsigned height)
 {
 	assert(finalized);
+	finish_finalize();
 
 	// This needs to be set anew, in case we are coming from a different context
 	// from when we initialized.
@@ -1670,32 +2472,30 @@ void EffectChain::render_to_fbo(GLuint dest_fbo, unsigned width, unsigned height
 	glDepthMask(GL_FALSE);
 	check_error();
 
-	// Generate a VAO. All the phases should have exactly the same vertex attributes,
-	// so it's safe to reuse this.
-	float vertices[] = {
-		0.0f, 2.0f,
-		0.0f, 0.0f,
-		2.0f, 0.0f
-	};
-
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	check_error();
+	// All the phases share the same full-screen triangle, so we can use
+	// the same VAO for everything; it is kept around between frames
+	// by the ResourcePool.
+	GLuint vao = resource_pool->create_fullscreen_vao(bound_attribute_indices);
 	glBindVertexArray(vao);
 	check_error();
 
-	GLuint position_vbo = fill_vertex_attribute(phases[0]->glsl_program_num, "position", 2, GL_FLOAT, sizeof(vertices), vertices);
-	GLuint texcoord_vbo = fill_vertex_attribute(phases[0]->glsl_program_num, "texcoord", 2, GL_FLOAT, sizeof(vertices), vertices);  // Same as vertices.
-
-	set<Phase *> generated_mipmaps;
-
-	// We choose the simplest option of having one texture per output,
-	// since otherwise this turns into an (albeit simple) register allocation problem.
-	map<Phase *, GLuint> output_textures;
+	size_t live_intermediate_bytes = 0;
+	peak_intermediate_bytes = total_intermediate_bytes = 0;
 
 	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
 		Phase *phase = phases[phase_num];
 
+		if (phase->fused_into != NULL) {
+			// Already rendered, together with the phase it is fused into.
+			// It has no inputs, so there is nothing to release.
+			assert(phase->inputs_to_release.empty());
+			size_t bytes = ResourcePool::estimate_texture_size(phase->output_texture_format, phase->output_width, phase->output_height);
+			live_intermediate_bytes += bytes;
+			total_intermediate_bytes += bytes;
+			peak_intermediate_bytes = max(peak_intermediate_bytes, live_intermediate_bytes);
+			continue;
+		}
+
 		if (do_phase_timing) {
 			glBeginQuery(GL_TIME_ELAPSED, phase->timer_query_object);
 		}
@@ -1705,39 +2505,67 @@ void EffectChain::render_to_fbo(GLuint dest_fbo, unsigned width, unsigned height
 			check_error();
 			GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
 			assert(status == GL_FRAMEBUFFER_COMPLETE);
-			glViewport(x, y, width, height);
+			if (output_color_ycbcr && is_packed_ycbcr_output(output_ycbcr_splitting)) {
+				// The image is still <width> x <height> (which is what
+				// the effects should see), but it is packed into
+				// a texture of a different size.
+				assert(width != 0 && height != 0);
+				unsigned texture_width, texture_height;
+				get_ycbcr_output_texture_size(output_ycbcr_splitting, width, height, &texture_width, &texture_height);
+				glViewport(x, y, texture_width, texture_height);
+			} else {
+				glViewport(x, y, width, height);
+			}
 			if (dither_effect != NULL) {
 				CHECK(dither_effect->set_int("output_width", width));
 				CHECK(dither_effect->set_int("output_height", height));
 			}
+			if (ycbcr_conversion_effect != NULL) {
+				CHECK(ycbcr_conversion_effect->set_int("output_width", width));
+				CHECK(ycbcr_conversion_effect->set_int("output_height", height));
+			}
 		}
-		execute_phase(phase, phase_num == phases.size() - 1, &output_textures, &generated_mipmaps);
+		execute_phase(phase, phase_num == phases.size() - 1);
 		if (do_phase_timing) {
 			glEndQuery(GL_TIME_ELAPSED);
 		}
-	}
 
-	for (map<Phase *, GLuint>::const_iterator texture_it = output_textures.begin();
-	     texture_it != output_textures.end();
-	     ++texture_it) {
-		resource_pool->release_2d_texture(texture_it->second);
+		if (phase_num != phases.size() - 1) {
+			size_t bytes = ResourcePool::estimate_texture_size(phase->output_texture_format, phase->output_width, phase->output_height);
+			live_intermediate_bytes += bytes;
+			total_intermediate_bytes += bytes;
+			peak_intermediate_bytes = max(peak_intermediate_bytes, live_intermediate_bytes);
+		}
+
+		// Give back the textures nobody is going to read anymore. If a later
+		// phase wants a texture of the same size, the ResourcePool will
+		// hand it the same one back, so in a long chain we only ever
+		// need a few intermediate textures in flight.
+		for (unsigned i = 0; i < phase->inputs_to_release.size(); ++i) {
+			Phase *input = phase->inputs_to_release[i];
+			live_intermediate_bytes -= ResourcePool::estimate_texture_size(input->output_texture_format, input->output_width, input->output_height);
+			resource_pool->release_2d_texture(input->output_texture);
+			input->output_texture = 0;
+		}
 	}
+	assert(live_intermediate_bytes == 0);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	check_error();
 	glUseProgram(0);
 	check_error();
 
-	cleanup_vertex_attribute(phases[0]->glsl_program_num, "position", position_vbo);
-	cleanup_vertex_attribute(phases[0]->glsl_program_num, "texcoord", texcoord_vbo);
-
-	glDeleteVertexArrays(1, &vao);
+	glBindVertexArray(0);
 	check_error();
+	resource_pool->release_fullscreen_vao(vao);
 
 	if (do_phase_timing) {
 		// Get back the timer queries.
 		for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
 			Phase *phase = phases[phase_num];
+			if (phase->fused_into != NULL) {
+				continue;
+			}
 			GLint available = 0;
 			while (!available) {
 				glGetQueryObjectiv(phase->timer_query_object, GL_QUERY_RESULT_AVAILABLE, &available);
@@ -1750,6 +2578,12 @@ void EffectChain::render_to_fbo(GLuint dest_fbo, unsigned width, unsigned height
 	}
 }
 
+void EffectChain::enable_compute_shaders(bool enable)
+{
+	assert(!finalized);
+	use_compute_shaders = enable;
+}
+
 void EffectChain::enable_phase_timing(bool enable)
 {
 	if (enable) {
@@ -1764,6 +2598,8 @@ void EffectChain::reset_phase_timing()
 		Phase *phase = phases[phase_num];
 		phase->time_elapsed_ns = 0;
 		phase->num_measured_iterations = 0;
+		phase->num_uniform_uploads = 0;
+		phase->num_skipped_uniform_uploads = 0;
 	}
 }
 
@@ -1772,6 +2608,11 @@ void EffectChain::print_phase_timing()
 	double total_time_ms = 0.0;
 	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
 		Phase *phase = phases[phase_num];
+		if (phase->fused_into != NULL) {
+			unsigned fused_into_num = find(phases.begin(), phases.end(), phase->fused_into) - phases.begin();
+			printf("Phase %d: (rendered as part of phase %d)\n", phase_num, fused_into_num);
+			continue;
+		}
 		double avg_time_ms = phase->time_elapsed_ns * 1e-6 / phase->num_measured_iterations;
 		printf("Phase %d: %5.1f ms  [", phase_num, avg_time_ms);
 		for (unsigned effect_num = 0; effect_num < phase->effects.size(); ++effect_num) {
@@ -1780,13 +2621,30 @@ void EffectChain::print_phase_timing()
 			}
 			printf("%s", phase->effects[effect_num]->effect->effect_type_id().c_str());
 		}
-		printf("]\n");
+		printf("]%s\n", phase->is_compute_shader ? " (compute shader)" : "");
+		printf("         uniforms: %llu uploaded, %llu skipped as unchanged\n",
+			(unsigned long long)phase->num_uniform_uploads,
+			(unsigned long long)phase->num_skipped_uniform_uploads);
 		total_time_ms += avg_time_ms;
 	}
 	printf("Total:   %5.1f ms\n", total_time_ms);
+	printf("Intermediate textures: %.1f MB peak (%.1f MB without reuse)\n",
+		peak_intermediate_bytes / 1048576.0, total_intermediate_bytes / 1048576.0);
 }
 
-void EffectChain::execute_phase(Phase *phase, bool last_phase, map<Phase *, GLuint> *output_textures, set<Phase *> *generated_mipmaps)
+void EffectChain::print_planner_decisions()
+{
+	assert(finalized);
+	if (planner_decisions.empty()) {
+		printf("No planner decisions (no shared effects or heavy samplers).\n");
+		return;
+	}
+	for (unsigned i = 0; i < planner_decisions.size(); ++i) {
+		printf("%s\n", planner_decisions[i].c_str());
+	}
+}
+
+void EffectChain::execute_phase(Phase *phase, bool last_phase)
 {
 	GLuint fbo = 0;
 
@@ -1795,8 +2653,15 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase, map<Phase *, GLui
 	if (!last_phase) {
 		find_output_size(phase);
 
-		GLuint tex_num = resource_pool->create_2d_texture(GL_RGBA16F, phase->output_width, phase->output_height);
-		output_textures->insert(make_pair(phase, tex_num));
+		phase->output_texture = resource_pool->create_2d_texture(phase->output_texture_format, phase->output_width, phase->output_height);
+
+		// Fused phases have the same size as us; see can_fuse_into_input().
+		for (unsigned i = 0; i < phase->fused_outputs.size(); ++i) {
+			Phase *fused = phase->fused_outputs[i];
+			fused->output_width = fused->virtual_output_width = phase->output_width;
+			fused->output_height = fused->virtual_output_height = phase->output_height;
+			fused->output_texture = resource_pool->create_2d_texture(fused->output_texture_format, fused->output_width, fused->output_height);
+		}
 	}
 
 	const GLuint glsl_program_num = phase->glsl_program_num;
@@ -1809,20 +2674,24 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase, map<Phase *, GLui
 		glActiveTexture(GL_TEXTURE0 + sampler);
 		Phase *input = phase->inputs[sampler];
 		input->output_node->bound_sampler_num = sampler;
-		glBindTexture(GL_TEXTURE_2D, (*output_textures)[input]);
+		glBindTexture(GL_TEXTURE_2D, input->output_texture);
 		check_error();
-		if (phase->input_needs_mipmaps && generated_mipmaps->count(input) == 0) {
+		if (phase->generates_input_mipmaps[sampler]) {
 			glGenerateMipmap(GL_TEXTURE_2D);
 			check_error();
-			generated_mipmaps->insert(input);
 		}
 		setup_rtt_sampler(sampler, phase->input_needs_mipmaps);
 		phase->input_samplers[sampler] = sampler;  // Bind the sampler to the right uniform.
 	}
 
 	// And now the output. (Already set up for us if it is the last phase.)
-	if (!last_phase) {
-		fbo = resource_pool->create_fbo((*output_textures)[phase]);
+	// Compute shaders write straight to the texture; see below.
+	if (!last_phase && !phase->is_compute_shader) {
+		GLuint textures[4] = { phase->output_texture, 0, 0, 0 };
+		for (unsigned i = 0; i < phase->fused_outputs.size(); ++i) {
+			textures[i + 1] = phase->fused_outputs[i]->output_texture;
+		}
+		fbo = resource_pool->create_fbo(textures[0], textures[1], textures[2], textures[3]);
 		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 		glViewport(0, 0, phase->output_width, phase->output_height);
 	}
@@ -1847,8 +2716,27 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase, map<Phase *, GLui
 	// from there.
 	setup_uniforms(phase);
 
-	glDrawArrays(GL_TRIANGLES, 0, 3);
-	check_error();
+	if (phase->is_compute_shader) {
+		assert(!last_phase);
+		glBindImageTexture(0, phase->output_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, phase->output_texture_format);
+		check_error();
+
+		unsigned x, y, z;
+		phase->output_node->effect->get_compute_dimensions(phase->output_width, phase->output_height, &x, &y, &z);
+		glDispatchCompute(x, y, z);
+		check_error();
+
+		// Later phases read the output as a texture (and may want
+		// to generate mipmaps for it), which is not synchronized
+		// with image stores by default.
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+		check_error();
+		glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, phase->output_texture_format);
+		check_error();
+	} else {
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		check_error();
+	}
 
 	glUseProgram(0);
 	check_error();
@@ -1858,20 +2746,30 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase, map<Phase *, GLui
 		node->effect->clear_gl_state();
 	}
 
-	if (!last_phase) {
+	if (fbo != 0) {
 		resource_pool->release_fbo(fbo);
 	}
 }
 
 void EffectChain::setup_uniforms(Phase *phase)
 {
-	// TODO: Use UBO blocks.
+	// Samplers cannot live in uniform blocks, so they are always set directly.
 	for (size_t i = 0; i < phase->uniforms_sampler2d.size(); ++i) {
 		const Uniform<int> &uniform = phase->uniforms_sampler2d[i];
 		if (uniform.location != -1) {
 			glUniform1iv(uniform.location, uniform.num_values, uniform.value);
 		}
 	}
+	if (phase->uniform_block_size > 0) {
+		setup_uniform_block(phase);
+		return;
+	}
+
+	// Without a uniform block, the values live in the program object,
+	// which we may share with other chains, so we cannot know what is
+	// already there; we need to set everything.
+	phase->num_uniform_uploads += count_non_sampler_uniforms(phase);
+
 	for (size_t i = 0; i < phase->uniforms_bool.size(); ++i) {
 		const Uniform<bool> &uniform = phase->uniforms_bool[i];
 		assert(uniform.num_values == 1);
@@ -1925,6 +2823,69 @@ void EffectChain::setup_uniforms(Phase *phase)
 	}
 }
 
+void EffectChain::setup_uniform_block(Phase *phase)
+{
+	unsigned char *block = &uniform_buffer_data[phase->uniform_block_offset];
+	size_t dirty_begin = phase->uniform_block_size, dirty_end = 0;
+	unsigned num_changed = 0;
+
+	for (size_t i = 0; i < phase->uniforms_bool.size(); ++i) {
+		const Uniform<bool> &uniform = phase->uniforms_bool[i];
+		int value = *uniform.value;  // Booleans are four bytes in std140.
+		num_changed += update_uniform_block(block, uniform.block_offset, &value, sizeof(value), &dirty_begin, &dirty_end);
+	}
+	for (size_t i = 0; i < phase->uniforms_int.size(); ++i) {
+		const Uniform<int> &uniform = phase->uniforms_int[i];
+		num_changed += update_uniform_block(block, uniform.block_offset, uniform.value, sizeof(int), &dirty_begin, &dirty_end);
+	}
+	for (size_t i = 0; i < phase->uniforms_float.size(); ++i) {
+		const Uniform<float> &uniform = phase->uniforms_float[i];
+		num_changed += update_uniform_block(block, uniform.block_offset, uniform.value, sizeof(float), &dirty_begin, &dirty_end);
+	}
+	for (size_t i = 0; i < phase->uniforms_vec2.size(); ++i) {
+		// Array elements are padded out to vec4 size.
+		const Uniform<float> &uniform = phase->uniforms_vec2[i];
+		bool changed = false;
+		for (size_t j = 0; j < uniform.num_values; ++j) {
+			changed |= update_uniform_block(block, uniform.block_offset + j * 4 * sizeof(float), uniform.value + j * 2, 2 * sizeof(float), &dirty_begin, &dirty_end);
+		}
+		num_changed += changed;
+	}
+	for (size_t i = 0; i < phase->uniforms_vec3.size(); ++i) {
+		const Uniform<float> &uniform = phase->uniforms_vec3[i];
+		num_changed += update_uniform_block(block, uniform.block_offset, uniform.value, 3 * sizeof(float), &dirty_begin, &dirty_end);
+	}
+	for (size_t i = 0; i < phase->uniforms_vec4.size(); ++i) {
+		const Uniform<float> &uniform = phase->uniforms_vec4[i];
+		num_changed += update_uniform_block(block, uniform.block_offset, uniform.value, uniform.num_values * 4 * sizeof(float), &dirty_begin, &dirty_end);
+	}
+	for (size_t i = 0; i < phase->uniforms_mat3.size(); ++i) {
+		// Convert to float (GLSL has no double matrices), with each column
+		// padded out to vec4 size.
+		const Uniform<Matrix3d> &uniform = phase->uniforms_mat3[i];
+		float matrixf[12] = { 0.0f };
+		for (unsigned y = 0; y < 3; ++y) {
+			for (unsigned x = 0; x < 3; ++x) {
+				matrixf[y + x * 4] = (*uniform.value)(y, x);
+			}
+		}
+		num_changed += update_uniform_block(block, uniform.block_offset, matrixf, sizeof(matrixf), &dirty_begin, &dirty_end);
+	}
+	phase->num_uniform_uploads += num_changed;
+	phase->num_skipped_uniform_uploads += count_non_sampler_uniforms(phase) - num_changed;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+	check_error();
+	if (dirty_begin < dirty_end) {
+		glBufferSubData(GL_UNIFORM_BUFFER, phase->uniform_block_offset + dirty_begin, dirty_end - dirty_begin, block + dirty_begin);
+		check_error();
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, uniform_buffer, phase->uniform_block_offset, phase->uniform_block_size);
+	check_error();
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	check_error();
+}
+
 void EffectChain::setup_rtt_sampler(int sampler_num, bool use_mipmaps)
 {
 	glActiveTexture(GL_TEXTURE0 + sampler_num);
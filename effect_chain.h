@@ -81,8 +81,43 @@ enum YCbCrOutputSplitting {
 	// (Effect on the other channels is undefined.) Essentially gives you
 	// 4:4:4 planar, or ”yuv444p”.
 	YCBCR_OUTPUT_PLANAR,
+
+	// The packed modes below render the final, subsampled layout directly,
+	// so that reading the output back gives exactly the bytes an encoder
+	// or playout card wants, with no repacking on the CPU. The output
+	// texture does not have the same size as the image; use
+	// get_ycbcr_output_texture_size() to find out what to allocate, but give
+	// render_to_fbo() the size of the image as usual. Chroma is subsampled
+	// by linear interpolation between the nearest pixels, according to
+	// the chroma positions in the YCbCrFormat. You cannot have an RGBA
+	// output in addition to these.
+
+	// 8-bit 4:2:2, as U Y V Y bytes; render into a GL_RGBA8 texture
+	// and read it back as GL_RGBA/GL_UNSIGNED_BYTE. chroma_subsampling_x
+	// must be 2, chroma_subsampling_y must be 1, and the width must be even.
+	YCBCR_OUTPUT_PACKED_UYVY,
+
+	// 10-bit 4:2:2 as v210 (see V210Input), including the row padding;
+	// render into a GL_RGB10_A2 texture and read it back as
+	// GL_RGBA/GL_UNSIGNED_INT_2_10_10_10_REV. The subsampling must be as for
+	// UYVY, and num_levels should be 1024. The padding at the end of
+	// each row is undefined.
+	YCBCR_OUTPUT_PACKED_V210,
+
+	// 8-bit 4:2:0 as NV12, ie., the Y' plane followed by a half-height
+	// plane of interleaved Cb and Cr, in one GL_R8 texture. Read it back
+	// as GL_RED/GL_UNSIGNED_BYTE. Both chroma_subsampling_x and
+	// chroma_subsampling_y must be 2, and the width and height must be even.
+	YCBCR_OUTPUT_PACKED_NV12,
 };
 
+// Given the size of the image, returns the size of the texture you need
+// to render into for the given output splitting (see above). For the
+// non-packed modes, this is just the size of the image.
+void get_ycbcr_output_texture_size(YCbCrOutputSplitting output_splitting,
+                                   unsigned width, unsigned height,
+                                   unsigned *texture_width, unsigned *texture_height);
+
 // Where (0,0) is taken to be in the output. If you want to render to an
 // OpenGL screen, you should keep the default of bottom-left, as that is
 // OpenGL's natural coordinate system. However, there are cases, such as if you
@@ -139,6 +174,11 @@ private:
 	// (in the same phase) have one_to_one_sampling() set.
 	bool one_to_one_sampling;
 
+	// Internal format to use if the output of this node is stored in
+	// an intermediate texture, or 0 to let the chain decide.
+	// See EffectChain::set_intermediate_format().
+	GLint intermediate_format;
+
 	friend class EffectChain;
 };
 
@@ -159,6 +199,48 @@ struct Phase {
 	std::vector<Node *> effects;  // In order.
 	unsigned output_width, output_height, virtual_output_width, virtual_output_height;
 
+	// Other phases that this phase also computes the output of, into
+	// color attachments 1 and up of its FBO. They read nothing but our
+	// output, at the same resolution, so instead of bouncing our output
+	// through a texture for them, their effects are added to our program.
+	// Their own <fused_into> points back to us; they have no effects or
+	// inputs of their own, and are not rendered separately.
+	std::vector<Phase *> fused_outputs;
+	Phase *fused_into;
+
+	// Whether the phase is run as a compute shader instead of a fullscreen
+	// draw (see Effect::has_compute_shader()). If so, <output_node> is the
+	// effect supplying it, and the phase never renders to the final output
+	// or has fused outputs.
+	bool is_compute_shader;
+
+	// For each input, whether this phase is the first one to sample from it
+	// with mipmaps, and thus responsible for generating them. Precomputed
+	// at finalize() time, so that rendering does not need to keep track.
+	std::vector<bool> generates_input_mipmaps;
+
+	// The texture this phase renders into. Only valid during render_to_fbo(),
+	// and never set for the last phase (which renders to the user's FBO).
+	// This (and the FBO around it) is deliberately not part of the render
+	// plan: the texture is taken from the ResourcePool when the phase
+	// runs and given back after its last reader, so that chains sharing
+	// a pool can share intermediates, and the pool's memory budget sees
+	// what is actually in use. Since every frame asks for the same formats
+	// in the same order, it gets the textures the previous frame released,
+	// and the FBOs around them are found in the pool's FBO cache; once
+	// the chain has settled, this is a few map lookups per phase, and no
+	// GL calls.
+	GLuint output_texture;
+
+	// Internal format of output_texture. Chosen at finalize() time;
+	// see EffectChain::choose_intermediate_format().
+	GLint output_texture_format;
+
+	// The inputs for which this phase is the last reader. Their textures
+	// are given back to the ResourcePool as soon as this phase has been
+	// rendered, so that later phases can reuse them.
+	std::vector<Phase *> inputs_to_release;
+
 	// Identifier used to create unique variables in GLSL.
 	// Unique per-phase to increase cacheability of compiled shaders.
 	std::map<Node *, std::string> effect_ids;
@@ -173,10 +255,21 @@ struct Phase {
 	std::vector<Uniform<float> > uniforms_vec4;
 	std::vector<Uniform<Eigen::Matrix3d> > uniforms_mat3;
 
+	// If uniform buffers are in use, all the non-sampler uniforms above
+	// live in a std140 block of uniform_block_size bytes, which is stored
+	// at uniform_block_offset in the chain's uniform buffer. If not,
+	// uniform_block_size is zero, and we use glUniform*() as usual.
+	size_t uniform_block_offset, uniform_block_size;
+
 	// For measurement of GPU time used.
 	GLuint timer_query_object;
 	uint64_t time_elapsed_ns;
 	uint64_t num_measured_iterations;
+
+	// How many uniforms we have sent to the GPU, and how many we did not
+	// need to send since they had not changed since the last frame.
+	// Reset by reset_phase_timing().
+	uint64_t num_uniform_uploads, num_skipped_uniform_uploads;
 };
 
 class EffectChain {
@@ -227,8 +320,9 @@ public:
 	void add_output(const ImageFormat &format, OutputAlphaFormat alpha_format);
 
 	// Adds an YCbCr output. Note that you can only have one output.
-	// Currently, only chunked packed output is supported, and only 4:4:4
-	// (so chroma_subsampling_x and chroma_subsampling_y must both be 1).
+	// Chroma subsampling is only supported by the packed output modes
+	// (see YCbCrOutputSplitting); for the others, chroma_subsampling_x and
+	// chroma_subsampling_y must both be 1.
 	//
 	// If you have both RGBA and Y'CbCr output, the RGBA output will come
 	// in the last draw buffer. Also, <format> and <alpha_format> must be
@@ -245,6 +339,15 @@ public:
 		this->num_dither_bits = num_bits;
 	}
 
+	// Set the internal format of the intermediate texture holding the output
+	// of <effect>, if it ends up being one (ie., if it is the last effect in
+	// a phase other than the last). The default, 0, lets the chain choose
+	// the narrowest format it knows to be safe; GL_RGBA16F unless it can
+	// prove otherwise. Use e.g. GL_RGBA32F if an effect's output needs more
+	// precision than fp16 can give it, or GL_RGBA8 if you know it is
+	// 8-bit data anyway and want to save bandwidth.
+	void set_intermediate_format(Effect *effect, GLint internal_format);
+
 	// Set where (0,0) is taken to be in the output. The default is
 	// OUTPUT_ORIGIN_BOTTOM_LEFT, which is usually what you want
 	// (see OutputOrigin above for more details).
@@ -255,6 +358,21 @@ public:
 
 	void finalize();
 
+	// Does the same as finalize(), but only submits the shaders for
+	// compiling, without waiting for them to be done. This is useful if
+	// you want to build a chain for later use (e.g. for an upcoming
+	// transition) without stalling the chains you are rendering right now.
+	// is_ready() will then tell you whether rendering would need to wait
+	// for the compiler; if you render before it returns true, the render
+	// will block until the compiler is done. Both need the OpenGL context
+	// to be current.
+	//
+	// Note that is_ready() can only know this if the driver supports
+	// parallel shader compilation (see movit_parallel_shader_compile_supported);
+	// if not, it returns true right away, and the first render will block.
+	void finalize_async();
+	bool is_ready();
+
 	// Measure the GPU time used for each actual phase during rendering.
 	// Note that this is only available if GL_ARB_timer_query
 	// (or, equivalently, OpenGL 3.3) is available. Also note that measurement
@@ -264,6 +382,29 @@ public:
 	void reset_phase_timing();
 	void print_phase_timing();
 
+	// Whether to run effects that have a compute shader version
+	// (see Effect::has_compute_shader()) as compute shaders, if the
+	// driver supports it (see movit_compute_shaders_supported).
+	// The default is true. Must be called before finalize().
+	void enable_compute_shaders(bool enable);
+
+	// When an effect is used by several others, finalize() decides from
+	// the effects' cost estimates (see Effect::estimated_alu_cost())
+	// whether to compute it once into a texture that they all read, or
+	// to compute it again in every phase that needs it. This prints those
+	// decisions, with the estimated costs, and which phases were fused
+	// (see Phase::fused_outputs). With MOVIT_DEBUG_ON, they are also shown
+	// as edge labels in the .dot files that finalize() writes.
+	void print_planner_decisions();
+
+	// The largest amount of memory (as estimated by ResourcePool) held in
+	// intermediate textures at any one time during the last call to
+	// render_to_fbo(). Compare to get_total_intermediate_bytes(), which is
+	// the sum of all intermediate textures in that frame; that is what
+	// we would need if no texture were reused between phases.
+	size_t get_peak_intermediate_bytes() const { return peak_intermediate_bytes; }
+	size_t get_total_intermediate_bytes() const { return total_intermediate_bytes; }
+
 	//void render(unsigned char *src, unsigned char *dst);
 	void render_to_screen()
 	{
@@ -271,7 +412,8 @@ public:
 	}
 
 	// Render the effect chain to the given FBO. If width=height=0, keeps
-	// the current viewport.
+	// the current viewport (not allowed for packed Y'CbCr output, since
+	// the size of the image cannot be derived from it).
 	void render_to_fbo(GLuint fbo, unsigned width, unsigned height);
 
 	Effect *last_added_effect() {
@@ -328,19 +470,60 @@ private:
 	void find_all_nonlinear_inputs(Node *effect, std::vector<Node *> *nonlinear_inputs);
 
 	// Create a GLSL program computing the effects for this phase in order.
+	// This only submits the program for compiling; finish_glsl_program()
+	// waits for the result and collects the uniform locations.
 	void compile_glsl_program(Phase *phase);
+	void finish_glsl_program(Phase *phase);
 
-	// Create all GLSL programs needed to compute the given effect, and all outputs
-	// that depend on it (whenever possible). Returns the phase that has <output>
-	// as the last effect. Also pushes all phases in order onto <phases>.
+	// Split the graph into phases needed to compute the given effect, and all
+	// outputs that depend on it (whenever possible). Returns the phase that has
+	// <output> as the last effect. Also pushes all phases in order onto <phases>.
+	// The programs are compiled later; see finalize_async().
 	Phase *construct_phase(Node *output, std::map<Node *, Phase *> *completed_effects);
 
+	// Find phases that could just as well be computed by the (only) phase
+	// they read from, and move their effects into that phase, which then
+	// writes both outputs at once (see Phase::fused_outputs).
+	void fuse_phases();
+	bool can_fuse_into_input(Phase *phase);
+
+	// The cost-based decisions in construct_phase(). should_recompute() is
+	// for effects with several users that could either be bounced or
+	// computed by each user; should_bounce_for_sampling() is for effects
+	// that could be computed inline by <node>, but that <node> samples
+	// more than once per pixel. estimate_inline_cost() is the estimated
+	// cost of computing <node> (and whatever would be computed along with
+	// it in the same phase) for one pixel.
+	bool should_recompute(Node *node);
+	bool should_bounce_for_sampling(Node *node, Node *dep);
+	float estimate_inline_cost(Node *node);
+
+	// Whether the given phase can be run as a compute shader;
+	// see Effect::has_compute_shader().
+	bool can_run_as_compute_shader(Phase *phase);
+
+	// Precompute everything about rendering that does not change from frame
+	// to frame, so that render_to_fbo() does not need to.
+	void prepare_render_plan();
+
+	// Find out what internal format to store the output of the given
+	// (non-last) phase in.
+	GLint choose_intermediate_format(Phase *phase);
+
+	// Whether every effect reading from the given node, directly or
+	// indirectly, commutes with clamping, so that the
+	// node's output may be clamped to [0,1] without changing the result.
+	bool all_consumers_commute_with_clamping(Node *node);
+
 	// Execute one phase, ie. set up all inputs, effects and outputs, and render the quad.
-	void execute_phase(Phase *phase, bool last_phase, std::map<Phase *, GLuint> *output_textures, std::set<Phase *> *generated_mipmaps);
+	void execute_phase(Phase *phase, bool last_phase);
 
 	// Set up uniforms for one phase. The program must already be bound.
 	void setup_uniforms(Phase *phase);
 
+	// Used by setup_uniforms() if the phase has a uniform block.
+	void setup_uniform_block(Phase *phase);
+
 	// Set up the given sampler number for sampling from an RTT texture.
 	void setup_rtt_sampler(int sampler_num, bool use_mipmaps);
 
@@ -369,6 +552,7 @@ private:
 	void topological_sort_visit_node(Node *node, std::set<Node *> *nodes_left_to_visit, std::vector<Node *> *sorted_list);
 
 	// Used during finalize().
+	void finish_finalize();
 	void find_color_spaces_for_inputs();
 	void propagate_alpha();
 	void propagate_gamma_and_color_space();
@@ -400,18 +584,44 @@ private:
 	std::vector<Node *> nodes;
 	std::map<Effect *, Node *> node_map;
 	Effect *dither_effect;
+	Effect *ycbcr_conversion_effect;  // NULL if no Y'CbCr output.
 
 	std::vector<Input *> inputs;  // Also contained in nodes.
 	std::vector<Phase *> phases;
 
+	// The vertex attribute indices (for “position” and “texcoord”) used
+	// by any of the phases; the VAO needs to have all of them bound.
+	std::set<GLint> bound_attribute_indices;
+
 	unsigned num_dither_bits;
 	OutputOrigin output_origin;
 	bool finalized;
 
+	// Whether finish_finalize() has been run, i.e., the programs are
+	// compiled and the render plan has been made.
+	bool ready;
+
+	// See get_peak_intermediate_bytes().
+	size_t peak_intermediate_bytes, total_intermediate_bytes;
+
+	// The uniform blocks of all phases, back to back (see Phase).
+	// We keep a copy of what we last uploaded, so that we only need to
+	// send the parts that actually changed.
+	GLuint uniform_buffer;
+	std::vector<unsigned char> uniform_buffer_data;
+
 	ResourcePool *resource_pool;
 	bool owns_resource_pool;
 
 	bool do_phase_timing;
+	bool use_compute_shaders;
+
+	// What the planner decided; see print_planner_decisions().
+	// <recompute_decisions> also makes sure should_recompute() gives
+	// the same answer for all users of a node.
+	std::map<Node *, bool> recompute_decisions;
+	std::map<std::pair<const Node *, const Node *>, std::string> planner_edge_labels;
+	std::vector<std::string> planner_decisions;
 };
 
 }  // namespace movit
@@ -2,13 +2,26 @@
 //
 // Note that this also contains the tests for some of the simpler effects.
 
+#include <algorithm>
 #include <locale>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <epoxy/gl.h>
+#ifdef HAVE_SDL2
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_video.h>
+#endif
 #include <assert.h>
-
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "blur_effect.h"
+#include "deconvolution_sharpen_effect.h"
 #include "effect.h"
 #include "effect_chain.h"
 #include "flat_input.h"
@@ -16,10 +29,14 @@
 #include "init.h"
 #include "input.h"
 #include "mirror_effect.h"
+#include "mix_effect.h"
 #include "multiply_effect.h"
+#include "readback_queue.h"
 #include "resize_effect.h"
+#include "resource_pool.h"
 #include "test_util.h"
 #include "util.h"
+#include "ycbcr.h"
 
 using namespace std;
 
@@ -58,16 +75,6 @@ TEST(EffectChainTest, Identity) {
 	expect_equal(data, out_data, 3, 2);
 }
 
-// An effect that does nothing, but requests texture bounce.
-class BouncingIdentityEffect : public Effect {
-public:
-	BouncingIdentityEffect() {}
-	virtual string effect_type_id() const { return "IdentityEffect"; }
-	string output_fragment_shader() { return read_file("identity.frag"); }
-	bool needs_texture_bounce() const { return true; }
-	AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
-};
-
 TEST(EffectChainTest, TextureBouncePreservesIdentity) {
 	float data[] = {
 		0.0f, 0.25f, 0.3f,
@@ -81,6 +88,222 @@ TEST(EffectChainTest, TextureBouncePreservesIdentity) {
 	expect_equal(data, out_data, 3, 2);
 }
 
+TEST(EffectChainTest, IntermediateTexturesAreReleasedAfterLastUse) {
+	float data[] = {
+		0.0f, 0.25f, 0.3f, 0.1f,
+		0.75f, 1.0f, 1.0f, 0.2f,
+		0.1f, 0.2f, 0.3f, 0.4f,
+		0.5f, 0.6f, 0.7f, 0.8f,
+	};
+	float out_data[16];
+	EffectChainTester tester(data, 4, 4, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (unsigned i = 0; i < 5; ++i) {
+		tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	}
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(data, out_data, 4, 4);
+
+	// Five phases, and thus four intermediate 4x4 RGBA16F textures
+	// (128 bytes each), but never more than two alive at the same time.
+	EXPECT_EQ(4 * 128u, tester.get_chain()->get_total_intermediate_bytes());
+	EXPECT_EQ(2 * 128u, tester.get_chain()->get_peak_intermediate_bytes());
+}
+
+// Intermediate textures and their FBOs are taken from the pool every frame
+// (see Phase::output_texture); check that once the first frame has been
+// rendered, later frames get them all from the freelists.
+TEST(EffectChainTest, SteadyStateFramesCreateNoNewResources) {
+	const int width = 4, height = 4;
+	float data[width * height] = {
+		0.0f, 0.25f, 0.3f, 0.1f,
+		0.75f, 1.0f, 1.0f, 0.2f,
+		0.1f, 0.2f, 0.3f, 0.4f,
+		0.5f, 0.6f, 0.7f, 0.8f,
+	};
+
+	ResourcePool pool;
+	{
+		EffectChain chain(width, height, &pool);
+
+		ImageFormat format;
+		format.color_space = COLORSPACE_sRGB;
+		format.gamma_curve = GAMMA_LINEAR;
+
+		FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+		input->set_pixel_data(data);
+		chain.add_input(input);
+		for (unsigned i = 0; i < 3; ++i) {
+			chain.add_effect(new BouncingIdentityEffect());
+		}
+		chain.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+		chain.finalize();
+
+		GLuint out_texnum = pool.create_2d_texture(GL_RGBA8, width, height);
+		GLuint out_fbo = pool.create_fbo(out_texnum);
+
+		chain.render_to_fbo(out_fbo, width, height);
+
+		void *context = get_gl_context_identifier();
+		size_t misses = pool.get_texture_freelist_misses();
+		size_t hits = pool.get_texture_freelist_hits();
+		ResourcePool::Stats stats = pool.get_stats();
+		size_t num_fbos = stats.num_live_fbos[context] + stats.num_free_fbos[context];
+
+		for (unsigned frame = 0; frame < 3; ++frame) {
+			chain.render_to_fbo(out_fbo, width, height);
+		}
+
+		EXPECT_EQ(misses, pool.get_texture_freelist_misses());
+		EXPECT_LT(hits, pool.get_texture_freelist_hits());
+		stats = pool.get_stats();
+		EXPECT_EQ(num_fbos, stats.num_live_fbos[context] + stats.num_free_fbos[context]);
+
+		pool.release_fbo(out_fbo);
+		pool.release_2d_texture(out_texnum);
+	}
+}
+
+// Like BouncingIdentityEffect, but does not need linear light,
+// so the data stays gamma-compressed through the bounce. It reads its
+// input texel by texel, so it also commutes with clamping.
+class NonLinearBouncingIdentityEffect : public BouncingIdentityEffect {
+public:
+	NonLinearBouncingIdentityEffect() {}
+	bool needs_linear_light() const { return false; }
+	bool commutes_with_clamping() const { return true; }
+};
+
+TEST(EffectChainTest, NarrowIntermediatesMatchFP16) {
+	const unsigned width = 64, height = 4;
+	float data[width * height];
+	for (unsigned i = 0; i < width * height; ++i) {
+		data[i] = i / float(width * height - 1);
+	}
+	unsigned char out_data[width * height], expected_data[width * height];
+
+	{
+		// Gamma-compressed, blank alpha and eight-bit output,
+		// so the chain should choose RGB10_A2 (four bytes per pixel).
+		EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_sRGB, GL_RGBA8);
+		tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+		tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+		tester.get_chain()->add_effect(new MirrorEffect());
+		tester.get_chain()->set_dither_bits(8);
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_sRGB);
+		EXPECT_EQ(width * height * 4, tester.get_chain()->get_total_intermediate_bytes());
+	}
+	{
+		// The same chain, but forced to go through fp16.
+		EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_sRGB, GL_RGBA8);
+		Effect *effect = tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+		tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+		tester.get_chain()->add_effect(new MirrorEffect());
+		tester.get_chain()->set_dither_bits(8);
+		tester.get_chain()->set_intermediate_format(effect, GL_RGBA16F);
+		tester.run(expected_data, GL_RED, COLORSPACE_sRGB, GAMMA_sRGB);
+		EXPECT_EQ(width * height * 8, tester.get_chain()->get_total_intermediate_bytes());
+	}
+
+	// The ten-bit intermediate can move a value across a rounding boundary
+	// in the output, but never by more than one step.
+	expect_equal(expected_data, out_data, width, height, 2, 0.5);
+}
+
+TEST(EffectChainTest, NarrowIntermediatesKeepOutOfRangeValuesForLaterEffects) {
+	const unsigned width = 64, height = 4;
+	float data[width * height];
+	for (unsigned i = 0; i < width * height; ++i) {
+		data[i] = 1.25f * i / float(width * height - 1);
+	}
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	unsigned char out_data[width * height], expected_data[width * height];
+
+	{
+		// The intermediates hold values up to 1.25, which the multiply
+		// (in linear light) brings back into range, so they must not
+		// be clamped by going through RGB10_A2.
+		EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_sRGB, GL_RGBA8);
+		tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+		tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+		Effect *multiply = tester.get_chain()->add_effect(new MultiplyEffect());
+		ASSERT_TRUE(multiply->set_vec4("factor", half));
+		tester.get_chain()->set_dither_bits(8);
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_sRGB);
+		EXPECT_EQ(width * height * 8, tester.get_chain()->get_total_intermediate_bytes());
+	}
+	{
+		// The same chain, forced to go through fp16.
+		EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_sRGB, GL_RGBA8);
+		Effect *effect = tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+		tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+		Effect *multiply = tester.get_chain()->add_effect(new MultiplyEffect());
+		ASSERT_TRUE(multiply->set_vec4("factor", half));
+		tester.get_chain()->set_dither_bits(8);
+		tester.get_chain()->set_intermediate_format(effect, GL_RGBA16F);
+		tester.run(expected_data, GL_RED, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+
+	expect_equal(expected_data, out_data, width, height);
+
+	// Had the intermediate been clamped, the brightest pixel would have
+	// come out as half of linear white, ie. about 188.
+	EXPECT_GT(out_data[width * height - 1], 230);
+}
+
+TEST(EffectChainTest, ParameterGenerationOnlyChangesWithValue) {
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	const float one[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	MultiplyEffect effect;
+	ASSERT_TRUE(effect.set_vec4("factor", one));
+	unsigned generation = effect.get_parameter_generation();
+
+	// Setting the value it already has is not a change.
+	ASSERT_TRUE(effect.set_vec4("factor", one));
+	EXPECT_EQ(generation, effect.get_parameter_generation());
+
+	ASSERT_TRUE(effect.set_vec4("factor", half));
+	EXPECT_NE(generation, effect.get_parameter_generation());
+}
+
+// Uniforms are only uploaded when they change (if we have uniform buffers),
+// so check that changing them between frames actually takes effect,
+// in both phases.
+TEST(EffectChainTest, ChangedUniformsAreUploadedBetweenFrames) {
+	float data[] = {
+		1.0f, 0.5f,
+		0.25f, 0.0f,
+	};
+	float expected_data[] = {
+		0.5f, 0.25f,
+		0.125f, 0.0f,
+	};
+	float out_data[2 * 2];
+
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	const float one[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	EffectChainTester tester(data, 2, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *mul1 = tester.get_chain()->add_effect(new MultiplyEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	Effect *mul2 = tester.get_chain()->add_effect(new MultiplyEffect());
+
+	ASSERT_TRUE(mul1->set_vec4("factor", half));
+	ASSERT_TRUE(mul2->set_vec4("factor", one));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, 2, 2);
+
+	ASSERT_TRUE(mul1->set_vec4("factor", one));
+	ASSERT_TRUE(mul2->set_vec4("factor", half));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, 2, 2);
+
+	ASSERT_TRUE(mul2->set_vec4("factor", one));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, 2, 2);
+}
+
 TEST(MirrorTest, BasicTest) {
 	float data[] = {
 		0.0f, 0.25f, 0.3f,
@@ -865,6 +1088,245 @@ TEST(EffectChainTest, DiamondGraphWithOneInputUsedInTwoPhases) {
 	expect_equal(expected_data, out_data, 2, 2);
 }
 
+// Constructs the graph
+//
+//             FlatInput               |
+//                 |                   |
+//          MultiplyEffect (half)      |
+//            /         \              |
+//           |     MultiplyEffect (two)|
+//           |           |             |
+//           |   BouncingIdentityEffect|
+//            \         /              |
+//             AddEffect               |
+//
+// The first MultiplyEffect is (claimed to be) expensive, so it should be
+// bounced, since it has two users; the second one only reads that, so it
+// should be computed together with it (writing to a second render target)
+// instead of in its own phase.
+class ExpensiveMultiplyEffect : public MultiplyEffect {
+public:
+	virtual float estimated_alu_cost() const { return 1000.0f; }
+};
+
+TEST(EffectChainTest, SiblingPhaseIsFusedIntoInput) {
+	float data[] = {
+		1.0f, 1.0f,
+		1.0f, 0.0f,
+	};
+	float expected_data[] = {
+		1.5f, 1.5f,
+		1.5f, 0.0f,
+	};
+	float out_data[2 * 2];
+
+	const float half[] = { 0.5f, 0.5f, 0.5f, 0.5f };
+	const float two[] = { 2.0f, 2.0f, 2.0f, 1.0f };  // So that the alphas add up to 1.
+
+	MultiplyEffect *mul_half = new ExpensiveMultiplyEffect();
+	ASSERT_TRUE(mul_half->set_vec4("factor", half));
+
+	MultiplyEffect *mul_two = new MultiplyEffect();
+	ASSERT_TRUE(mul_two->set_vec4("factor", two));
+
+	BouncingIdentityEffect *bounce = new BouncingIdentityEffect();
+
+	EffectChainTester tester(NULL, 2, 2);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, 2, 2);
+	input->set_pixel_data(data);
+
+	EffectChain *chain = tester.get_chain();
+	chain->add_input(input);
+	chain->add_effect(mul_half, input);
+	chain->add_effect(mul_two, mul_half);
+	chain->add_effect(bounce, mul_two);
+	chain->add_effect(new AddEffect(), mul_half, bounce);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, 2, 2);
+
+	Node *mul_half_node = chain->find_node_for_effect(mul_half);
+	Node *mul_two_node = chain->find_node_for_effect(mul_two);
+	Node *bounce_node = chain->find_node_for_effect(bounce);
+	EXPECT_EQ(mul_half_node->containing_phase, mul_two_node->containing_phase);
+	EXPECT_NE(mul_two_node->containing_phase, bounce_node->containing_phase);
+	EXPECT_EQ(1u, mul_half_node->containing_phase->fused_outputs.size());
+}
+
+// Same graph, but combined with a MixEffect instead of an AddEffect,
+// so that the result would be different if the fused phase's two render
+// targets (and thus the two textures) were swapped.
+TEST(EffectChainTest, FusedPhaseWritesTheRightRenderTargets) {
+	float data[] = {
+		1.0f, 1.0f,
+		1.0f, 0.0f,
+	};
+	float expected_data[] = {  // 1.0 * 0.5x + 0.25 * x.
+		0.75f, 0.75f,
+		0.75f, 0.0f,
+	};
+	float out_data[2 * 2];
+
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	const float two[] = { 2.0f, 2.0f, 2.0f, 1.0f };  // Mix clamps the alpha back to 1.
+
+	MultiplyEffect *mul_half = new ExpensiveMultiplyEffect();
+	ASSERT_TRUE(mul_half->set_vec4("factor", half));
+
+	MultiplyEffect *mul_two = new MultiplyEffect();
+	ASSERT_TRUE(mul_two->set_vec4("factor", two));
+
+	BouncingIdentityEffect *bounce = new BouncingIdentityEffect();
+
+	Effect *mix = new MixEffect();
+	ASSERT_TRUE(mix->set_float("strength_first", 1.0f));
+	ASSERT_TRUE(mix->set_float("strength_second", 0.25f));
+
+	EffectChainTester tester(NULL, 2, 2);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, 2, 2);
+	input->set_pixel_data(data);
+
+	EffectChain *chain = tester.get_chain();
+	chain->add_input(input);
+	chain->add_effect(mul_half, input);
+	chain->add_effect(mul_two, mul_half);
+	chain->add_effect(bounce, mul_two);
+	chain->add_effect(mix, mul_half, bounce);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	ASSERT_EQ(1u, chain->find_node_for_effect(mul_half)->containing_phase->fused_outputs.size());
+	expect_equal(expected_data, out_data, 2, 2);
+}
+
+// Same graph, but with a cheap effect being shared; it is cheaper
+// to compute it again in both phases than to bounce it to a texture.
+TEST(EffectChainTest, CheapSharedEffectIsRecomputed) {
+	float data[] = {
+		1.0f, 1.0f,
+		1.0f, 0.0f,
+	};
+	float expected_data[] = {
+		1.5f, 1.5f,
+		1.5f, 0.0f,
+	};
+	float out_data[2 * 2];
+
+	const float half[] = { 0.5f, 0.5f, 0.5f, 0.5f };
+	const float two[] = { 2.0f, 2.0f, 2.0f, 1.0f };  // So that the alphas add up to 1.
+
+	MultiplyEffect *mul_half = new MultiplyEffect();
+	ASSERT_TRUE(mul_half->set_vec4("factor", half));
+
+	MultiplyEffect *mul_two = new MultiplyEffect();
+	ASSERT_TRUE(mul_two->set_vec4("factor", two));
+
+	BouncingIdentityEffect *bounce = new BouncingIdentityEffect();
+	Effect *add = new AddEffect();
+
+	EffectChainTester tester(NULL, 2, 2);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, 2, 2);
+	input->set_pixel_data(data);
+
+	EffectChain *chain = tester.get_chain();
+	chain->add_input(input);
+	chain->add_effect(mul_half, input);
+	chain->add_effect(mul_two, mul_half);
+	chain->add_effect(bounce, mul_two);
+	chain->add_effect(add, mul_half, bounce);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, 2, 2);
+
+	Node *mul_half_node = chain->find_node_for_effect(mul_half);
+	Phase *mul_two_phase = chain->find_node_for_effect(mul_two)->containing_phase;
+	Phase *add_phase = chain->find_node_for_effect(add)->containing_phase;
+	ASSERT_NE(mul_two_phase, add_phase);
+	EXPECT_NE(mul_two_phase->effects.end(),
+		find(mul_two_phase->effects.begin(), mul_two_phase->effects.end(), mul_half_node));
+	EXPECT_NE(add_phase->effects.end(),
+		find(add_phase->effects.begin(), add_phase->effects.end(), mul_half_node));
+	EXPECT_TRUE(mul_two_phase->fused_outputs.empty());
+}
+
+// Same graph again, but with an effect that samples its input many times
+// (and thus also needs a bounce of its own) as the shared one. However cheap
+// the one-to-one users are, it should be computed once and bounced, not once
+// for each user. The output values are left to the effects' own tests.
+void check_shared_effect_is_bounced(Effect *shared_effect, const string &effect_type_id)
+{
+	const unsigned size = 16;
+	float data[size * size];
+	for (unsigned i = 0; i < size * size; ++i) {
+		data[i] = 0.5f;
+	}
+	float out_data[size * size];
+
+	const float half[] = { 0.5f, 0.5f, 0.5f, 0.5f };
+	const float two[] = { 2.0f, 2.0f, 2.0f, 2.0f };
+
+	MultiplyEffect *mul_half = new MultiplyEffect();
+	ASSERT_TRUE(mul_half->set_vec4("factor", half));
+
+	MultiplyEffect *mul_two = new MultiplyEffect();
+	ASSERT_TRUE(mul_two->set_vec4("factor", two));
+
+	EffectChainTester tester(NULL, size, size);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, size, size);
+	input->set_pixel_data(data);
+
+	EffectChain *chain = tester.get_chain();
+	chain->add_input(input);
+	chain->add_effect(shared_effect, input);
+	chain->add_effect(mul_half, shared_effect);
+	chain->add_effect(mul_two, shared_effect);
+	chain->add_effect(new AddEffect(), mul_half, mul_two);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	// The effect may have replaced itself with other nodes
+	// (e.g. BlurEffect with two passes), so find the one actually
+	// feeding the two multiplications.
+	Node *mul_half_node = chain->find_node_for_effect(mul_half);
+	Node *mul_two_node = chain->find_node_for_effect(mul_two);
+	ASSERT_EQ(1u, mul_half_node->incoming_links.size());
+	Node *shared_node = mul_half_node->incoming_links[0];
+	EXPECT_EQ(effect_type_id, shared_node->effect->effect_type_id());
+	ASSERT_EQ(1u, mul_two_node->incoming_links.size());
+	EXPECT_EQ(shared_node, mul_two_node->incoming_links[0]);
+
+	EXPECT_NE(shared_node->containing_phase, mul_half_node->containing_phase);
+	EXPECT_NE(shared_node->containing_phase, mul_two_node->containing_phase);
+}
+
+TEST(EffectChainTest, SharedBlurIsBounced) {
+	BlurEffect *blur = new BlurEffect();
+	ASSERT_TRUE(blur->set_float("radius", 2.0f));
+	check_shared_effect_is_bounced(blur, "SingleBlurPassEffect");
+}
+
+TEST(EffectChainTest, SharedDeconvolutionSharpenIsBounced) {
+	check_shared_effect_is_bounced(new DeconvolutionSharpenEffect(), "DeconvolutionSharpenEffect");
+}
+
 TEST(EffectChainTest, EffectUsedTwiceOnlyGetsOneGammaConversion) {
 	float data[] = {
 		0.735f, 0.0f,
@@ -1226,6 +1688,315 @@ TEST(EffectChainTest, IdentityWithOwnPool) {
 	movit_debug_level = MOVIT_DEBUG_OFF;
 }
 
+// Like IdentityWithOwnPool, does not use EffectChainTester, since that
+// wants to finalize the chain itself.
+TEST(EffectChainTest, FinalizeAsync) {
+	const int width = 3, height = 2;
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	const float expected_data[] = {
+		0.75f, 1.0f, 1.0f,
+		0.0f, 0.25f, 0.3f,
+	};
+	float out_data[6], temp[6 * 4];
+
+	// Render one chain as soon as it is ready, and the other one right away
+	// (which needs to wait for the compiler).
+	for (int wait_until_ready = 0; wait_until_ready < 2; ++wait_until_ready) {
+		EffectChain chain(width, height);
+
+		ImageFormat format;
+		format.color_space = COLORSPACE_sRGB;
+		format.gamma_curve = GAMMA_LINEAR;
+
+		FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+		input->set_pixel_data(data);
+		chain.add_input(input);
+		chain.add_effect(new BouncingIdentityEffect());
+		chain.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+
+		GLuint texnum, fbo;
+		glGenTextures(1, &texnum);
+		check_error();
+		glBindTexture(GL_TEXTURE_2D, texnum);
+		check_error();
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+		check_error();
+
+		glGenFramebuffers(1, &fbo);
+		check_error();
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		check_error();
+		glFramebufferTexture2D(
+			GL_FRAMEBUFFER,
+			GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D,
+			texnum,
+			0);
+		check_error();
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		check_error();
+
+		chain.finalize_async();
+		if (wait_until_ready) {
+			while (!chain.is_ready()) {
+				usleep(1000);
+			}
+		}
+
+		chain.render_to_fbo(fbo, width, height);
+		EXPECT_TRUE(chain.is_ready());
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		check_error();
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, temp);
+		check_error();
+		for (unsigned i = 0; i < 6; ++i) {
+			out_data[i] = temp[i * 4];
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		check_error();
+
+		expect_equal(expected_data, out_data, width, height);
+
+		glDeleteFramebuffers(1, &fbo);
+		check_error();
+		glDeleteTextures(1, &texnum);
+		check_error();
+	}
+}
+
+// Makes the binary length in each program cache file in the given
+// directory claim far more data than the file has.
+void corrupt_program_cache_files(const char *dirname)
+{
+	DIR *dir = opendir(dirname);
+	ASSERT_TRUE(dir != NULL);
+	dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		FILE *fp = fopen((string(dirname) + "/" + de->d_name).c_str(), "r+b");
+		ASSERT_TRUE(fp != NULL);
+
+		// Magic, then the binary format and four lengths, the last
+		// of which is the binary length.
+		const uint32_t huge_length = 0xffffffffu;
+		ASSERT_EQ(0, fseek(fp, 8 + 4 * sizeof(uint32_t), SEEK_SET));
+		ASSERT_EQ(1u, fwrite(&huge_length, sizeof(huge_length), 1, fp));
+		fclose(fp);
+	}
+	closedir(dir);
+}
+
+TEST(EffectChainTest, ProgramDiskCache) {
+	if (!movit_program_binaries_supported) {
+		fprintf(stderr, "Skipping test; no support for program binaries.\n");
+		return;
+	}
+
+	char dirname[] = "/tmp/movit-program-cache-XXXXXX";
+	ASSERT_TRUE(mkdtemp(dirname) != NULL);
+
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+
+	// The first chain needs to compile everything; the second one,
+	// which has its own pool, should find it all on disk. Then we damage
+	// the files, so the third one has to compile everything again.
+	size_t num_programs = 0;
+	for (int i = 0; i < 3; ++i) {
+		if (i == 2) {
+			corrupt_program_cache_files(dirname);
+		}
+		ResourcePool pool;
+		pool.set_program_cache_directory(dirname);
+		EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, GL_RGBA16F_ARB, &pool);
+		tester.get_chain()->add_effect(new BouncingIdentityEffect());
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		expect_equal(data, out_data, 3, 2);
+
+		if (i == 0) {
+			num_programs = pool.get_program_cache_misses();
+			EXPECT_GT(num_programs, 0u);
+			EXPECT_EQ(0u, pool.get_program_cache_hits());
+		} else if (i == 1) {
+			EXPECT_EQ(num_programs, pool.get_program_cache_hits());
+			EXPECT_EQ(0u, pool.get_program_cache_misses());
+		} else {
+			EXPECT_EQ(0u, pool.get_program_cache_hits());
+			EXPECT_EQ(num_programs, pool.get_program_cache_misses());
+		}
+	}
+
+	DIR *dir = opendir(dirname);
+	ASSERT_TRUE(dir != NULL);
+	dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] != '.') {
+			unlink((string(dirname) + "/" + de->d_name).c_str());
+		}
+	}
+	closedir(dir);
+	rmdir(dirname);
+}
+
+TEST(EffectChainTest, TextureFreelistReusesByFormat) {
+	// Room for two 16x16 RGBA8 textures on the freelist.
+	ResourcePool pool(100, 2 * ResourcePool::estimate_texture_size(GL_RGBA8, 16, 16), 100);
+
+	GLuint tex1 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+	GLuint tex2 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+	GLuint tex3 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+	GLuint other_tex = pool.create_2d_texture(GL_RGBA8, 16, 32);
+	pool.release_2d_texture(other_tex);
+	EXPECT_EQ(4u, pool.get_texture_freelist_misses());
+
+	// Different dimensions, so this should not reuse <other_tex>.
+	GLuint tex4 = pool.create_2d_texture(GL_RGBA8, 32, 16);
+	EXPECT_NE(other_tex, tex4);
+	EXPECT_EQ(0u, pool.get_texture_freelist_hits());
+	pool.release_2d_texture(tex4);
+
+	// The least recently freed textures should go first.
+	pool.release_2d_texture(tex1);
+	pool.release_2d_texture(tex2);
+	pool.release_2d_texture(tex3);
+	EXPECT_EQ(3u, pool.get_texture_freelist_evictions());
+	EXPECT_EQ(2 * ResourcePool::estimate_texture_size(GL_RGBA8, 16, 16), pool.get_texture_freelist_bytes());
+
+	// And the most recently freed one of the right format should be reused.
+	EXPECT_EQ(tex3, pool.create_2d_texture(GL_RGBA8, 16, 16));
+	EXPECT_EQ(tex2, pool.create_2d_texture(GL_RGBA8, 16, 16));
+	EXPECT_EQ(2u, pool.get_texture_freelist_hits());
+	EXPECT_EQ(0u, pool.get_texture_freelist_bytes());
+	pool.release_2d_texture(tex2);
+	pool.release_2d_texture(tex3);
+}
+
+TEST(EffectChainTest, ResourcePoolStatsAndTrim) {
+	const size_t rgba_size = ResourcePool::estimate_texture_size(GL_RGBA8, 16, 16);
+	const size_t r_size = ResourcePool::estimate_texture_size(GL_R8, 16, 16);
+	ResourcePool pool;
+
+	GLuint tex1 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+	GLuint tex2 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+	GLuint tex3 = pool.create_2d_texture(GL_R8, 16, 16);
+	pool.release_2d_texture(tex2);
+
+	ResourcePool::Stats stats = pool.get_stats();
+	EXPECT_EQ(2u, stats.textures.size());
+	EXPECT_EQ(1u, stats.textures[GL_RGBA8].num_live);
+	EXPECT_EQ(rgba_size, stats.textures[GL_RGBA8].live_bytes);
+	EXPECT_EQ(1u, stats.textures[GL_RGBA8].num_free);
+	EXPECT_EQ(rgba_size, stats.textures[GL_RGBA8].free_bytes);
+	EXPECT_EQ(1u, stats.textures[GL_R8].num_live);
+	EXPECT_EQ(0u, stats.textures[GL_R8].num_free);
+	EXPECT_EQ(2 * rgba_size + r_size, stats.total_texture_bytes);
+
+	// Only the free texture can go.
+	EXPECT_EQ(rgba_size + r_size, pool.trim(0));
+	stats = pool.get_stats();
+	EXPECT_EQ(0u, stats.textures[GL_RGBA8].num_free);
+	EXPECT_EQ(1u, stats.textures[GL_RGBA8].num_live);
+
+	pool.release_2d_texture(tex1);
+	pool.release_2d_texture(tex3);
+	EXPECT_EQ(0u, pool.trim(0));
+}
+
+namespace {
+
+void record_memory_pressure(ResourcePool *pool, size_t bytes_held, void *data)
+{
+	((vector<size_t> *)data)->push_back(bytes_held);
+}
+
+}  // namespace
+
+TEST(EffectChainTest, ResourcePoolMemoryBudget) {
+	const size_t size = ResourcePool::estimate_texture_size(GL_RGBA8, 16, 16);
+	ResourcePool pool;
+	vector<size_t> pressure;
+	pool.set_memory_budget(size + size / 2, record_memory_pressure, &pressure);
+
+	GLuint tex1 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+	EXPECT_TRUE(pressure.empty());
+
+	// Nothing to trim, so the callback has to be called.
+	GLuint tex2 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+	ASSERT_EQ(1u, pressure.size());
+	EXPECT_EQ(2 * size, pressure[0]);
+
+	// Releasing does not allocate anything, so no callback; the next
+	// allocation should first get rid of the free texture and then
+	// still be over budget.
+	pool.release_2d_texture(tex1);
+	EXPECT_EQ(1u, pressure.size());
+	GLuint tex3 = pool.create_2d_texture(GL_RGBA8, 32, 8);
+	ASSERT_EQ(2u, pressure.size());
+	EXPECT_EQ(2 * size, pressure[1]);
+	EXPECT_EQ(1u, pool.get_texture_freelist_evictions());
+
+	pool.set_memory_budget(0);
+	pool.release_2d_texture(tex2);
+	pool.release_2d_texture(tex3);
+	EXPECT_EQ(2u, pressure.size());
+}
+
+#ifdef HAVE_SDL2
+// Moves textures between the context the tests run in and a second one
+// sharing objects with it.
+TEST(EffectChainTest, ResourcePoolMovesTexturesBetweenContexts) {
+	if (!movit_sync_objects_supported) {
+		// Without fences, the pool cannot know when it is safe.
+		return;
+	}
+	SDL_Window *window = SDL_GL_GetCurrentWindow();
+	SDL_GLContext main_context = SDL_GL_GetCurrentContext();
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+	SDL_GLContext other_context = SDL_GL_CreateContext(window);
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+	ASSERT_TRUE(other_context != NULL);
+
+	{
+		ResourcePool pool;
+
+		// Only one context so far, so this is released without a fence.
+		SDL_GL_MakeCurrent(window, main_context);
+		GLuint tex1 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+		pool.release_2d_texture(tex1);
+
+		// ...which means the other context cannot take it over.
+		SDL_GL_MakeCurrent(window, other_context);
+		GLuint tex2 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+		EXPECT_NE(tex1, tex2);
+		pool.release_2d_texture(tex2);
+
+		// Now that the pool knows about both contexts, tex2 was fenced
+		// and can move back to the main context. tex1 is still usable
+		// in the context it was released in.
+		SDL_GL_MakeCurrent(window, main_context);
+		GLuint tex3 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+		EXPECT_EQ(tex2, tex3);
+		GLuint tex4 = pool.create_2d_texture(GL_RGBA8, 16, 16);
+		EXPECT_EQ(tex1, tex4);
+		EXPECT_EQ(2u, pool.get_texture_freelist_hits());
+		pool.release_2d_texture(tex3);
+		pool.release_2d_texture(tex4);
+	}
+
+	SDL_GL_DeleteContext(other_context);
+	SDL_GL_MakeCurrent(window, main_context);
+}
+#endif
+
 // A dummy effect whose only purpose is to test sprintf decimal behavior.
 class PrintfingBlueEffect : public Effect {
 public:
@@ -1267,4 +2038,252 @@ TEST(EffectChainTest, StringStreamLocalesWork) {
 }
 
 
+// Queues several frames before mapping any of them, to check that each one
+// ends up in its own buffer.
+TEST(EffectChainTest, ReadbackQueueKeepsFramesApart) {
+	const int width = 4, height = 2, num_frames = 3;
+	float data[num_frames][width * height];
+	unsigned char expected_data[num_frames][width * height];
+	for (int frame = 0; frame < num_frames; ++frame) {
+		for (int i = 0; i < width * height; ++i) {
+			expected_data[frame][i] = frame * 64 + i * 8;
+			data[frame][i] = expected_data[frame][i] / 255.0f;
+		}
+	}
+
+	EffectChain chain(width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	chain.add_input(input);
+	chain.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain.set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+	chain.finalize();
+
+	ResourcePool *pool = chain.get_resource_pool();
+	GLuint texnum = pool->create_2d_texture(GL_RGBA8, width, height);
+	GLuint fbo = pool->create_fbo(texnum);
+
+	ReadbackQueue queue(num_frames, width * height);
+	for (int frame = 0; frame < num_frames; ++frame) {
+		input->set_pixel_data(data[frame]);
+		chain.render_to_fbo(fbo, width, height);
+		EXPECT_EQ(0u, queue.read_pixels(fbo, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE));
+		EXPECT_EQ(unsigned(frame), queue.end_frame());
+	}
+
+	for (int frame = 0; frame < num_frames; ++frame) {
+		const unsigned char *out_data = (const unsigned char *)queue.map_frame(frame);
+		expect_equal(expected_data[frame], out_data, width, height);
+		queue.unmap_frame(frame);
+	}
+
+	pool->release_fbo(fbo);
+	pool->release_2d_texture(texnum);
+}
+
+TEST(EffectChainTest, ReadbackQueueReadsPlanarYCbCr) {
+	const int width = 2, height = 1;
+	float data[width * height] = {
+		1.0f, 0.0f,
+	};
+	unsigned char expected_y[width * height] = {
+		235, 16,
+	};
+	unsigned char expected_cbcr[width * height] = {
+		128, 128,
+	};
+
+	EffectChain chain(width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = 1;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	input->set_pixel_data(data);
+	chain.add_input(input);
+	chain.add_ycbcr_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, ycbcr_format, YCBCR_OUTPUT_PLANAR);
+	chain.finalize();
+
+	ResourcePool *pool = chain.get_resource_pool();
+	GLuint y_tex = pool->create_2d_texture(GL_R8, width, height);
+	GLuint cb_tex = pool->create_2d_texture(GL_R8, width, height);
+	GLuint cr_tex = pool->create_2d_texture(GL_R8, width, height);
+	GLuint fbo = pool->create_fbo(y_tex, cb_tex, cr_tex);
+	chain.render_to_fbo(fbo, width, height);
+
+	ReadbackQueue queue(1, 64);
+	size_t plane_offsets[3];
+	EXPECT_EQ(3u, queue.read_ycbcr_output(fbo, YCBCR_OUTPUT_PLANAR, width, height, GL_UNSIGNED_BYTE, plane_offsets));
+	unsigned frame = queue.end_frame();
+
+	// Each plane starts on a new 16-byte boundary.
+	EXPECT_EQ(0u, plane_offsets[0]);
+	EXPECT_EQ(16u, plane_offsets[1]);
+	EXPECT_EQ(32u, plane_offsets[2]);
+
+	const unsigned char *out_data = (const unsigned char *)queue.map_frame(frame);
+	expect_equal(expected_y, out_data + plane_offsets[0], width, height);
+	expect_equal(expected_cbcr, out_data + plane_offsets[1], width, height);
+	expect_equal(expected_cbcr, out_data + plane_offsets[2], width, height);
+	queue.unmap_frame(frame);
+
+	pool->release_fbo(fbo);
+	pool->release_2d_texture(y_tex);
+	pool->release_2d_texture(cb_tex);
+	pool->release_2d_texture(cr_tex);
+}
+
+
+#ifdef HAVE_BENCHMARK
+
+// Renders a chain of tiny phases, where the GPU has next to nothing to do,
+// so that what we measure is the per-frame and per-phase CPU overhead
+// in render_to_fbo(). Items processed is the number of phases rendered;
+// in debug builds, the label gives the number of GL calls per frame.
+void BM_DeepChainOverhead(benchmark::State &state)
+{
+	const unsigned size = 4;
+	float data[size * size] = { 0.0f };
+
+	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (int i = 0; i < state.range(0); ++i) {
+		tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	}
+	tester.benchmark(state, GL_RGBA16F, COLORSPACE_sRGB, GAMMA_LINEAR);
+	state.SetItemsProcessed(state.iterations() * (state.range(0) + 1));
+}
+BENCHMARK(BM_DeepChainOverhead)->Arg(1)->Arg(8)->Arg(32)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+// Finalizes 100 structurally identical chains sharing the same ResourcePool,
+// as e.g. a server setting up one chain per channel would. Everything but
+// the very first iteration should find its programs in the pool.
+// Items processed is the number of chains finalized.
+void BM_FinalizeIdenticalChains(benchmark::State &state)
+{
+	const unsigned size = 16;
+	const unsigned num_chains = 100;
+	float data[size * size] = { 0.0f };
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	ResourcePool pool;
+	while (state.KeepRunning()) {
+		vector<EffectChain *> chains;
+		for (unsigned i = 0; i < num_chains; ++i) {
+			EffectChain *chain = new EffectChain(size, size, &pool);
+			FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, size, size);
+			input->set_pixel_data(data);
+			chain->add_input(input);
+			for (int j = 0; j < state.range(0); ++j) {
+				chain->add_effect(new BouncingIdentityEffect());
+			}
+			chain->add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+			chain->finalize();
+			chains.push_back(chain);
+		}
+
+		state.PauseTiming();
+		for (unsigned i = 0; i < num_chains; ++i) {
+			delete chains[i];
+		}
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(state.iterations() * num_chains);
+}
+BENCHMARK(BM_FinalizeIdenticalChains)->Arg(1)->Arg(8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Allocates and releases textures of many different resolutions from a
+// freelist holding one of each; the time per allocation should not depend
+// on the number of resolutions.
+void BM_TextureFreelist(benchmark::State &state)
+{
+	const unsigned num_formats = state.range(0);
+	ResourcePool pool(100, size_t(1) << 30, 100);
+
+	vector<GLuint> textures;
+	for (unsigned i = 0; i < num_formats; ++i) {
+		textures.push_back(pool.create_2d_texture(GL_RGBA8, 1 + i % 64, 1 + i / 64));
+	}
+	for (unsigned i = 0; i < num_formats; ++i) {
+		pool.release_2d_texture(textures[i]);
+	}
+
+	unsigned i = 0;
+	while (state.KeepRunning()) {
+		i = (i + 7919) % num_formats;
+		GLuint tex = pool.create_2d_texture(GL_RGBA8, 1 + i % 64, 1 + i / 64);
+		pool.release_2d_texture(tex);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TextureFreelist)->Arg(16)->Arg(256)->Arg(4096)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+
+// Renders and reads back 1080p frames, mapping each one only when
+// range(0) - 1 later frames have been queued after it. With one buffer,
+// this is the same as a synchronous glReadPixels().
+void BM_ReadbackQueue(benchmark::State &state)
+{
+	const unsigned width = 1920, height = 1080;
+	const unsigned num_buffers = state.range(0);
+	float *data = new float[width * height];
+	for (unsigned i = 0; i < width * height; ++i) {
+		data[i] = (i % 256) / 255.0f;
+	}
+
+	EffectChain chain(width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	input->set_pixel_data(data);
+	chain.add_input(input);
+	chain.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain.finalize();
+
+	ResourcePool *pool = chain.get_resource_pool();
+	GLuint texnum = pool->create_2d_texture(GL_RGBA8, width, height);
+	GLuint fbo = pool->create_fbo(texnum);
+
+	ReadbackQueue queue(num_buffers, width * height * 4);
+	while (state.KeepRunning()) {
+		chain.render_to_fbo(fbo, width, height);
+		queue.read_pixels(fbo, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+		unsigned frame = queue.end_frame();
+		if (frame + 1 >= num_buffers) {
+			unsigned done_frame = frame + 1 - num_buffers;
+			benchmark::DoNotOptimize(queue.map_frame(done_frame));
+			queue.unmap_frame(done_frame);
+		}
+	}
+	state.SetBytesProcessed(state.iterations() * width * height * 4);
+
+	pool->release_fbo(fbo);
+	pool->release_2d_texture(texnum);
+	delete[] data;
+}
+BENCHMARK(BM_ReadbackQueue)->Arg(1)->Arg(2)->Arg(3)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+#endif
+
 }  // namespace movit
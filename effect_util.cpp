@@ -1,7 +1,11 @@
 #include <epoxy/gl.h>
 #include <Eigen/Core>
 #include <stddef.h>
+#include <algorithm>
 #include <string>
+#include <vector>
+#include "effect_util.h"
+#include "input.h"
 #include "util.h"
 
 using namespace std;
@@ -111,4 +115,41 @@ void set_uniform_mat3(GLuint glsl_program_num, const string &prefix, const strin
 	check_error();
 }
 
+void add_dirty_rect(vector<InputRect> *rects, unsigned x, unsigned y, unsigned width, unsigned height, unsigned image_width, unsigned image_height)
+{
+	static const size_t max_dirty_rects = 16;
+
+	if (x >= image_width || y >= image_height) {
+		return;
+	}
+	width = min(width, image_width - x);
+	height = min(height, image_height - y);
+	if (width == 0 || height == 0) {
+		return;
+	}
+
+	InputRect rect;
+	rect.x = x;
+	rect.y = y;
+	rect.width = width;
+	rect.height = height;
+	rects->push_back(rect);
+
+	if (rects->size() > max_dirty_rects) {
+		unsigned x0 = image_width, y0 = image_height, x1 = 0, y1 = 0;
+		for (size_t i = 0; i < rects->size(); ++i) {
+			const InputRect &r = (*rects)[i];
+			x0 = min(x0, r.x);
+			y0 = min(y0, r.y);
+			x1 = max(x1, r.x + r.width);
+			y1 = max(y1, r.y + r.height);
+		}
+		rect.x = x0;
+		rect.y = y0;
+		rect.width = x1 - x0;
+		rect.height = y1 - y0;
+		rects->assign(1, rect);
+	}
+}
+
 }  // namespace movit
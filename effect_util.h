@@ -18,6 +18,7 @@ namespace movit {
 
 class EffectChain;
 class Node;
+struct InputRect;
 
 // Convenience functions that deal with prepending the prefix.
 // Note that using EffectChain::register_uniform_*() is more efficient
@@ -32,6 +33,13 @@ void set_uniform_vec2_array(GLuint glsl_program_num, const std::string &prefix,
 void set_uniform_vec4_array(GLuint glsl_program_num, const std::string &prefix, const std::string &key, const float *values, size_t num_values);
 void set_uniform_mat3(GLuint glsl_program_num, const std::string &prefix, const std::string &key, const Eigen::Matrix3d &matrix);
 
+// For inputs that support partial updates: Clips the given rectangle to
+// an image of the given size, and adds it to the list of rectangles to
+// upload. If the list grows too long, it is replaced by a single rectangle
+// bounding all of them; uploading a few extra pixels is cheaper than
+// issuing lots of tiny uploads.
+void add_dirty_rect(std::vector<InputRect> *rects, unsigned x, unsigned y, unsigned width, unsigned height, unsigned image_width, unsigned image_height);
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_EFFECT_UTIL_H)
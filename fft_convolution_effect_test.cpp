@@ -2,6 +2,7 @@
 
 #include <epoxy/gl.h>
 #include <math.h>
+#include <vector>
 
 #include "effect_chain.h"
 #include "gtest/gtest.h"
@@ -208,4 +209,34 @@ TEST(FFTConvolutionEffectTest, NegativeCoefficients) {
 	expect_equal(expected_data, out_data, size, size, 0.02, 0.003);
 }
 
+#ifdef HAVE_BENCHMARK
+
+// A full FFT convolution (forward FFTs, multiplication, inverse FFTs)
+// of a grayscale frame. There are many passes, each with its own support
+// texture (see FFTPassEffect), so this is sensitive to per-pass overhead.
+// In debug builds, the label gives the number of GL calls per frame.
+// (args: frame height, for a 16:9 frame, and kernel size).
+void BM_FFTConvolution(benchmark::State &state)
+{
+	const int height = state.range(0), width = height * 16 / 9;
+	const int convolve_size = state.range(1);
+	std::vector<float> data(width * height, 0.5f);
+	std::vector<float> kernel(convolve_size * convolve_size, 1.0f / (convolve_size * convolve_size));
+
+	EffectChainTester tester(NULL, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	tester.add_input(&data[0], FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, width, height);
+
+	FFTConvolutionEffect *fft_effect = new FFTConvolutionEffect(width, height, convolve_size, convolve_size);
+	tester.get_chain()->add_effect(fft_effect);
+	fft_effect->set_convolution_kernel(&kernel[0]);
+	tester.benchmark(state, GL_RGBA16F, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+}
+BENCHMARK(BM_FFTConvolution)
+	->ArgPair(720, 16)
+	->ArgPair(1080, 32)
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
+
+#endif
+
 }  // namespace movit
@@ -1,10 +1,12 @@
 #include <epoxy/gl.h>
 #include <math.h>
+#include <stdio.h>
 
 #include "effect_chain.h"
 #include "effect_util.h"
 #include "fp16.h"
 #include "fft_pass_effect.h"
+#include "resource_pool.h"
 #include "util.h"
 
 using namespace std;
@@ -12,8 +14,10 @@ using namespace std;
 namespace movit {
 
 FFTPassEffect::FFTPassEffect()
-	: input_width(1280),
+	: chain(NULL),
+	  input_width(1280),
 	  input_height(720),
+	  tex(0),
 	  direction(HORIZONTAL),
 	  last_fft_size(-1),
 	  last_direction(INVALID),
@@ -27,12 +31,13 @@ FFTPassEffect::FFTPassEffect()
 	register_int("inverse", &inverse);
 	register_uniform_float("num_repeats", &uniform_num_repeats);
 	register_uniform_sampler2d("support_tex", &uniform_support_tex);
-	glGenTextures(1, &tex);
 }
 
 FFTPassEffect::~FFTPassEffect()
 {
-	glDeleteTextures(1, &tex);
+	if (tex != 0) {
+		chain->get_resource_pool()->release_keyed_texture(tex);
+	}
 }
 
 string FFTPassEffect::output_fragment_shader()
@@ -59,22 +64,8 @@ void FFTPassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix,
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	check_error();
 
-	// Because of the memory layout (see below) and because we use offsets,
-	// the support texture values for many consecutive values will be
-	// the same. Thus, we can store a smaller texture (giving a small
-	// performance boost) and just sample it with NEAREST. Also, this
-	// counteracts any precision issues we might get from linear
-	// interpolation.
 	glActiveTexture(GL_TEXTURE0 + *sampler_num);
 	check_error();
-	glBindTexture(GL_TEXTURE_2D, tex);
-	check_error();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	check_error();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	check_error();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	check_error();
 
 	int input_size = (direction == VERTICAL) ? input_height : input_width;
 	if (last_fft_size != fft_size ||
@@ -82,9 +73,12 @@ void FFTPassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix,
 	    last_pass_number != pass_number ||
 	    last_inverse != inverse ||
 	    last_input_size != input_size) {
-		generate_support_texture();
+		update_support_texture();
 	}
 
+	glBindTexture(GL_TEXTURE_2D, tex);
+	check_error();
+
 	uniform_support_tex = *sampler_num;
 	++*sampler_num;
 
@@ -92,7 +86,37 @@ void FFTPassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix,
 	uniform_num_repeats = input_size / fft_size;
 }
 
-void FFTPassEffect::generate_support_texture()
+void FFTPassEffect::update_support_texture()
+{
+	int input_size = (direction == VERTICAL) ? input_height : input_width;
+
+	// Every pass with the same parameters needs the same support texture,
+	// so share it with any other FFTPassEffect using our ResourcePool
+	// (e.g. in other chains doing the same FFT).
+	char texture_key[256];
+	snprintf(texture_key, sizeof(texture_key), "FFTPassEffect %d %d %d %d %d",
+		fft_size, int(direction), pass_number, inverse, input_size);
+	ResourcePool *resource_pool = chain->get_resource_pool();
+	GLuint new_tex = resource_pool->acquire_keyed_texture(texture_key);
+	if (new_tex == 0) {
+		int subfft_size = 1 << pass_number;
+		new_tex = generate_support_texture();
+		new_tex = resource_pool->add_keyed_texture(
+			texture_key, new_tex, GL_RGBA16F, subfft_size, 1);
+	}
+	if (tex != 0) {
+		resource_pool->release_keyed_texture(tex);
+	}
+	tex = new_tex;
+
+	last_fft_size = fft_size;
+	last_direction = direction;
+	last_pass_number = pass_number;
+	last_inverse = inverse;
+	last_input_size = input_size;
+}
+
+GLuint FFTPassEffect::generate_support_texture()
 {
 	int input_size = (direction == VERTICAL) ? input_height : input_width;
 
@@ -182,16 +206,29 @@ void FFTPassEffect::generate_support_texture()
 	// which gives a nice speed boost.
 	//
 	// Note that the source coordinates become somewhat less accurate too, though.
+	//
+	// Because of the memory layout (see above) and because we use offsets,
+	// the support texture values for many consecutive values will be
+	// the same. Thus, we can store a smaller texture (giving a small
+	// performance boost) and just sample it with NEAREST. Also, this
+	// counteracts any precision issues we might get from linear
+	// interpolation.
+	GLuint new_tex;
+	glGenTextures(1, &new_tex);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, new_tex);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	check_error();
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, subfft_size, 1, 0, GL_RGBA, GL_HALF_FLOAT, tmp);
 	check_error();
 
 	delete[] tmp;
-
-	last_fft_size = fft_size;
-	last_direction = direction;
-	last_pass_number = pass_number;
-	last_inverse = inverse;
-	last_input_size = input_size;
+	return new_tex;
 }
 
 }  // namespace movit
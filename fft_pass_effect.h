@@ -87,6 +87,12 @@ public:
 	virtual bool changes_output_size() const { return true; }
 	virtual bool sets_virtual_output_size() const { return false; }
 
+	// One lookup in the support texture, two input samples and
+	// a complex multiply-add; see fft_pass_effect.frag.
+	virtual float estimated_alu_cost() const { return 12.0f; }
+	virtual float estimated_texture_fetches() const { return 1.0f; }
+	virtual float input_samples_per_pixel() const { return 2.0f; }
+
 	virtual void inform_input_size(unsigned input_num, unsigned width, unsigned height)
 	{
 		assert(input_num == 0);
@@ -105,10 +111,20 @@ public:
 	enum Direction { INVALID = -1, HORIZONTAL = 0, VERTICAL = 1 };
 
 private:
-	void generate_support_texture();
+	// Point <tex> at the right support texture for the current parameters,
+	// generating it if nobody has done so yet.
+	void update_support_texture();
+
+	// Creates a new support texture for the current parameters.
+	// Leaves it bound to the active texture unit.
+	GLuint generate_support_texture();
 
 	EffectChain *chain;
 	int input_width, input_height;
+
+	// The support texture, owned by the chain's ResourcePool (see
+	// ResourcePool::acquire_keyed_texture()), so that all passes with the
+	// same parameters share one. 0 if none yet.
 	GLuint tex;
 	float uniform_num_repeats;
 	GLint uniform_support_tex;
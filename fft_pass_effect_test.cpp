@@ -10,6 +10,7 @@
 #include "fft_pass_effect.h"
 #include "image_format.h"
 #include "multiply_effect.h"
+#include "resource_pool.h"
 #include "test_util.h"
 
 namespace movit {
@@ -337,4 +338,21 @@ TEST(FFTPassEffectTest, BigFFTAccuracy) {
 	}
 }
 
+
+TEST(FFTPassEffectTest, SupportTexturesAreShared) {
+	const int fft_size = 64;
+	float data[fft_size * 4] = { 0 };
+	float out_data[fft_size * 4];
+
+	// Two identical forward FFTs after each other; the second one should
+	// use the same support textures as the first.
+	EffectChainTester tester(data, fft_size, 1, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	setup_fft(tester.get_chain(), fft_size, false);
+	setup_fft(tester.get_chain(), fft_size, false);
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	ResourcePool::Stats stats = tester.get_chain()->get_resource_pool()->get_stats();
+	EXPECT_EQ(6u, stats.keyed_textures[GL_RGBA16F].num_live);  // log2(64).
+}
+
 }  // namespace movit
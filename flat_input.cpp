@@ -5,6 +5,7 @@
 #include "effect_util.h"
 #include "flat_input.h"
 #include "resource_pool.h"
+#include "upload_ring.h"
 #include "util.h"
 
 using namespace std;
@@ -18,17 +19,21 @@ FlatInput::FlatInput(ImageFormat image_format, MovitPixelFormat pixel_format_in,
 	  texture_num(0),
 	  output_linear_gamma(false),
 	  needs_mipmaps(false),
+	  num_upload_buffers(0),
 	  width(width),
 	  height(height),
 	  pitch(width),
 	  owns_texture(false),
 	  pixel_data(NULL),
+	  upload_ring(NULL),
+	  lent_pbo(0),
 	  fixup_swap_rb(false),
 	  fixup_red_to_grayscale(false)
 {
 	assert(type == GL_FLOAT || type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || type == GL_UNSIGNED_BYTE);
 	register_int("output_linear_gamma", &output_linear_gamma);
 	register_int("needs_mipmaps", &needs_mipmaps);
+	register_int("num_upload_buffers", &num_upload_buffers);
 	register_uniform_sampler2d("tex", &uniform_tex);
 
 	// Some types are not supported in all GL versions (e.g. GLES),
@@ -59,6 +64,7 @@ FlatInput::FlatInput(ImageFormat image_format, MovitPixelFormat pixel_format_in,
 FlatInput::~FlatInput()
 {
 	possibly_release_texture();
+	delete upload_ring;
 }
 
 void FlatInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsigned *sampler_num)
@@ -66,10 +72,23 @@ void FlatInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsi
 	glActiveTexture(GL_TEXTURE0 + *sampler_num);
 	check_error();
 
+	// Translate the input format to OpenGL's enums.
+	GLenum format;
+	if (pixel_format == FORMAT_RGB) {
+		format = GL_RGB;
+	} else if (pixel_format == FORMAT_RGBA_PREMULTIPLIED_ALPHA ||
+		   pixel_format == FORMAT_RGBA_POSTMULTIPLIED_ALPHA) {
+		format = GL_RGBA;
+	} else if (pixel_format == FORMAT_RG) {
+		format = GL_RG;
+	} else if (pixel_format == FORMAT_R) {
+		format = GL_RED;
+	} else {
+		assert(false);
+	}
+
 	if (texture_num == 0) {
-		// Translate the input format to OpenGL's enums.
 		GLint internal_format;
-		GLenum format;
 		if (type == GL_FLOAT) {
 			if (pixel_format == FORMAT_R) {
 				internal_format = GL_R32F;
@@ -121,24 +140,29 @@ void FlatInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsi
 				internal_format = GL_RGBA8;
 			}
 		}
-		if (pixel_format == FORMAT_RGB) {
-			format = GL_RGB;
-		} else if (pixel_format == FORMAT_RGBA_PREMULTIPLIED_ALPHA ||
-			   pixel_format == FORMAT_RGBA_POSTMULTIPLIED_ALPHA) {
-			format = GL_RGBA;
-		} else if (pixel_format == FORMAT_RG) {
-			format = GL_RG;
-		} else if (pixel_format == FORMAT_R) {
-			format = GL_RED;
-		} else {
-			assert(false);
+
+		// If we have been asked to, copy the data into our own PBO first.
+		GLuint upload_pbo = pbo;
+		const void *upload_data = pixel_data;
+		bool use_upload_ring = (num_upload_buffers > 0 && pbo == 0 && pixel_data != NULL);
+		if (use_upload_ring) {
+			size_t size = get_pixel_data_size();
+			possibly_recreate_upload_ring(size);
+			memcpy(upload_ring->begin_write(), pixel_data, size);
+			upload_pbo = upload_ring->end_write();
+			upload_data = BUFFER_OFFSET(0);
+		} else if (pbo != 0 && pbo == lent_pbo) {
+			// The data was written straight into the ring
+			// (see begin_write_pixel_data()).
+			use_upload_ring = true;
+			lent_pbo = 0;
 		}
 
 		// (Re-)upload the texture.
 		texture_num = resource_pool->create_2d_texture(internal_format, width, height);
 		glBindTexture(GL_TEXTURE_2D, texture_num);
 		check_error();
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, upload_pbo);
 		check_error();
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, needs_mipmaps ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
 		check_error();
@@ -146,16 +170,17 @@ void FlatInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsi
 		check_error();
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
 		check_error();
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, pixel_data);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, upload_data);
 		check_error();
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 		check_error();
+		if (use_upload_ring) {
+			upload_ring->fence();
+		}
 		if (needs_mipmaps) {
 			glGenerateMipmap(GL_TEXTURE_2D);
 			check_error();
 		}
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-		check_error();
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		check_error();
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -166,6 +191,9 @@ void FlatInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsi
 	} else {
 		glBindTexture(GL_TEXTURE_2D, texture_num);
 		check_error();
+		if (!dirty_rects.empty()) {
+			upload_dirty_rects(format);
+		}
 	}
 
 	// Bind it to a sampler.
@@ -181,13 +209,106 @@ string FlatInput::output_fragment_shader()
 	return buf + read_file("flat_input.frag");
 }
 
+void *FlatInput::begin_write_pixel_data()
+{
+	assert(num_upload_buffers > 0);
+	possibly_recreate_upload_ring(get_pixel_data_size());
+	return upload_ring->begin_write();
+}
+
+void FlatInput::end_write_pixel_data()
+{
+	lent_pbo = upload_ring->end_write();
+	pixel_data = BUFFER_OFFSET(0);
+	pbo = lent_pbo;
+	invalidate_pixel_data();
+}
+
+void FlatInput::possibly_recreate_upload_ring(size_t size)
+{
+	if (upload_ring != NULL &&
+	    (upload_ring->get_num_buffers() != unsigned(num_upload_buffers) ||
+	     upload_ring->get_buffer_size() < size)) {
+		delete upload_ring;
+		upload_ring = NULL;
+	}
+	if (upload_ring == NULL) {
+		upload_ring = new UploadRing(num_upload_buffers, size);
+	}
+}
+
+void FlatInput::upload_dirty_rects(GLenum format)
+{
+	assert(owns_texture);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+	check_error();
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	check_error();
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
+	check_error();
+	for (size_t i = 0; i < dirty_rects.size(); ++i) {
+		const InputRect &rect = dirty_rects[i];
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, rect.x);
+		check_error();
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, rect.y);
+		check_error();
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, format, type, pixel_data);
+		check_error();
+	}
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	check_error();
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	check_error();
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	check_error();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	check_error();
+	if (needs_mipmaps) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+		check_error();
+	}
+	dirty_rects.clear();
+}
+
 void FlatInput::invalidate_pixel_data()
 {
 	possibly_release_texture();
 }
 
+size_t FlatInput::get_pixel_data_size() const
+{
+	size_t bytes_per_component;
+	if (type == GL_FLOAT) {
+		bytes_per_component = sizeof(float);
+	} else if (type == GL_HALF_FLOAT) {
+		bytes_per_component = sizeof(fp16_int_t);
+	} else if (type == GL_UNSIGNED_SHORT) {
+		bytes_per_component = sizeof(unsigned short);
+	} else {
+		assert(type == GL_UNSIGNED_BYTE);
+		bytes_per_component = sizeof(unsigned char);
+	}
+
+	size_t num_components;
+	if (pixel_format == FORMAT_R) {
+		num_components = 1;
+	} else if (pixel_format == FORMAT_RG) {
+		num_components = 2;
+	} else if (pixel_format == FORMAT_RGB) {
+		num_components = 3;
+	} else {
+		assert(pixel_format == FORMAT_RGBA_PREMULTIPLIED_ALPHA ||
+		       pixel_format == FORMAT_RGBA_POSTMULTIPLIED_ALPHA);
+		num_components = 4;
+	}
+
+	// The last row does not need to be padded out to the full pitch.
+	return (size_t(pitch) * (height - 1) + width) * num_components * bytes_per_component;
+}
+
 void FlatInput::possibly_release_texture()
 {
+	dirty_rects.clear();
 	if (texture_num != 0 && owns_texture) {
 		resource_pool->release_2d_texture(texture_num);
 		texture_num = 0;
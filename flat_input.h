@@ -3,10 +3,13 @@
 
 #include <epoxy/gl.h>
 #include <assert.h>
+#include <stddef.h>
 #include <string>
+#include <vector>
 
 #include "effect.h"
 #include "effect_chain.h"
+#include "effect_util.h"
 #include "fp16.h"
 #include "image_format.h"
 #include "init.h"
@@ -15,6 +18,7 @@
 namespace movit {
 
 class ResourcePool;
+class UploadRing;
 
 // A FlatInput is the normal, “classic” case of an input, where everything
 // comes from a single 2D array with chunky pixels.
@@ -73,6 +77,13 @@ public:
 	// asynchronously to the GPU, if you have any CPU-intensive work between the
 	// call to set_pixel_data() and the actual rendering. In either case,
 	// the pointer (and PBO, if set) has to be valid at the time of the render call.
+	//
+	// If you do not want to manage PBOs yourself, you can set the integer
+	// parameter “num_upload_buffers” to e.g. 2 or 3 instead; the input will
+	// then copy data given as a regular pointer into a ring of that many
+	// PBOs of its own (see UploadRing) and upload from there, which is faster
+	// than uploading from client memory on many drivers. The default is 0,
+	// which uploads straight from the pointer.
 	void set_pixel_data(const unsigned char *pixel_data, GLuint pbo = 0)
 	{
 		assert(this->type == GL_UNSIGNED_BYTE);
@@ -105,8 +116,50 @@ public:
 		invalidate_pixel_data();
 	}
 
+	// Zero-copy alternative to set_pixel_data(), for use with the upload
+	// ring (“num_upload_buffers” must be set): Returns a pointer into the
+	// next buffer in the ring, where you can write the next frame directly
+	// (e.g. from a decoder), laid out as set_pixel_data() would expect it
+	// with the current pitch and type. If the GPU is still reading from that
+	// buffer, waits until it is done. When you are done writing, call
+	// end_write_pixel_data(), which hands the buffer back to the input
+	// and replaces any pixel data you have set earlier; the data will be
+	// uploaded on the next render, after which the buffer is fenced until
+	// the GPU is done with it.
+	//
+	// Both calls need the OpenGL context to be current, but the writing in
+	// between can happen from any thread. Do not call invalidate_pixel_data()
+	// to re-upload the same frame later; the buffer might have been reused
+	// by then.
+	void *begin_write_pixel_data();
+	void end_write_pixel_data();
+
 	void invalidate_pixel_data();
 
+	// Like invalidate_pixel_data(), but only the given rectangle of the
+	// pixel data has changed (given in pixels, in the same coordinates as
+	// the data itself). Instead of uploading the entire frame anew, the
+	// next render will upload only the rectangles marked since the last
+	// render into the texture it already has, and then regenerate
+	// the mipmaps if “needs_mipmaps” is set. This is useful for e.g.
+	// graphics overlays where only a small part changes from frame to frame.
+	// You can call it multiple times to mark several rectangles; they do not
+	// need to be disjoint. Rectangles are clipped to the image.
+	//
+	// The data is read from where set_pixel_data() pointed it, even if
+	// “num_upload_buffers” is set (the upload ring is only used for full
+	// uploads), so you must keep the data there (with the changes) until
+	// the next render. For the same reason, you cannot use it together
+	// with begin_write_pixel_data(). If there is no texture to update
+	// (e.g. because the pixel data has been fully invalidated since last
+	// render), the whole frame will be uploaded as usual.
+	void invalidate_pixel_data(unsigned x, unsigned y, unsigned width, unsigned height)
+	{
+		if (texture_num != 0 && owns_texture) {
+			add_dirty_rect(&dirty_rects, x, y, width, height, this->width, this->height);
+		}
+	}
+
 	void set_pitch(unsigned pitch) {
 		this->pitch = pitch;
 		invalidate_pixel_data();
@@ -139,15 +192,35 @@ private:
 	// Release the texture if we have any, and it is owned by us.
 	void possibly_release_texture();
 
+	// The number of bytes set_pixel_data() points to, given the pitch.
+	size_t get_pixel_data_size() const;
+
+	// Create the upload ring if we don't have one, or recreate it if
+	// its number of buffers or their size is not what we need.
+	void possibly_recreate_upload_ring(size_t size);
+
+	// Upload the rectangles in dirty_rects into the (bound) texture,
+	// and clear the list.
+	void upload_dirty_rects(GLenum format);
+
 	ImageFormat image_format;
 	MovitPixelFormat pixel_format;
 	GLenum type;
 	GLuint pbo, texture_num;
-	int output_linear_gamma, needs_mipmaps;
+	int output_linear_gamma, needs_mipmaps, num_upload_buffers;
 	unsigned width, height, pitch;
 	bool owns_texture;
 	const void *pixel_data;
 	ResourcePool *resource_pool;
+	UploadRing *upload_ring;  // NULL if not created yet.
+
+	// Parts of the texture that need to be uploaded anew
+	// (see invalidate_pixel_data(x, y, width, height)).
+	std::vector<InputRect> dirty_rects;
+
+	// The PBO from the last end_write_pixel_data() that has not been
+	// uploaded from yet, or 0.
+	GLuint lent_pbo;
 	bool fixup_swap_rb, fixup_red_to_grayscale;
 	GLint uniform_tex;
 };
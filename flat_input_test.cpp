@@ -2,6 +2,7 @@
 
 #include <epoxy/gl.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "effect_chain.h"
 #include "flat_input.h"
@@ -268,6 +269,112 @@ TEST(FlatInput, PBO) {
 	glDeleteBuffers(1, &pbo);
 }
 
+TEST(FlatInput, UploadRing) {
+	const int width = 3;
+	const int height = 2;
+
+	float data[width * height] = {
+		0.0, 1.0, 0.5,
+		0.5, 0.5, 0.2,
+	};
+	float out_data[width * height];
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	ASSERT_TRUE(input->set_int("num_upload_buffers", 2));
+	input->set_pixel_data(data);
+	tester.get_chain()->add_input(input);
+
+	// Go around the ring a few times, to make sure we never upload
+	// stale data from an old buffer.
+	for (int i = 0; i < 5; ++i) {
+		data[1] = 0.1f * i;
+		input->invalidate_pixel_data();
+
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		expect_equal(data, out_data, width, height);
+	}
+}
+
+TEST(FlatInput, WriteDirectlyIntoUploadBuffer) {
+	const int width = 3;
+	const int height = 2;
+
+	float data[width * height] = {
+		0.0, 1.0, 0.5,
+		0.5, 0.5, 0.2,
+	};
+	float out_data[width * height];
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	ASSERT_TRUE(input->set_int("num_upload_buffers", 2));
+	tester.get_chain()->add_input(input);
+
+	for (int i = 0; i < 5; ++i) {
+		data[1] = 0.1f * i;
+		memcpy(input->begin_write_pixel_data(), data, sizeof(data));
+		input->end_write_pixel_data();
+
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		expect_equal(data, out_data, width, height);
+	}
+}
+
+TEST(FlatInput, DirtyRectangles) {
+	const int width = 4;
+	const int height = 3;
+
+	float data[width * height] = {
+		0.0, 1.0, 0.5, 0.3,
+		0.5, 0.5, 0.2, 0.1,
+		0.9, 0.8, 0.7, 0.6,
+	};
+	float out_data[width * height];
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	input->set_pixel_data(data);
+	tester.get_chain()->add_input(input);
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+
+	// Change three pixels, but only mark two of them as dirty
+	// (one of them with a rectangle going outside the image).
+	// The third one should keep its old value.
+	float expected_data[width * height];
+	memcpy(expected_data, data, sizeof(data));
+	data[1 * width + 1] = expected_data[1 * width + 1] = 0.25f;
+	data[2 * width + 3] = expected_data[2 * width + 3] = 0.75f;
+	data[0 * width + 3] = 0.0f;
+	input->invalidate_pixel_data(1, 1, 1, 1);
+	input->invalidate_pixel_data(3, 2, 10, 10);
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+
+	// A full invalidation picks up everything.
+	input->invalidate_pixel_data();
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+}
+
 TEST(FlatInput, ExternalTexture) {
 	const int size = 5;
 
@@ -320,4 +427,88 @@ TEST(FlatInput, ExternalTexture) {
 	expect_equal(expected_data, out_data, 4, size);
 }
 
+#ifdef HAVE_BENCHMARK
+
+namespace {
+
+void invalidate_input(void *input)
+{
+	((FlatInput *)input)->invalidate_pixel_data();
+}
+
+const unsigned ticker_height = 200;
+
+// Marks a ticker strip near the bottom of the frame as changed.
+void invalidate_ticker(void *input)
+{
+	FlatInput *flat_input = (FlatInput *)input;
+	flat_input->invalidate_pixel_data(0, flat_input->get_height() - ticker_height - 40, flat_input->get_width(), ticker_height);
+}
+
+}  // namespace
+
+// Uploads a new RGBA8 frame every iteration, either straight from client
+// memory (0 buffers) or through the input's own upload ring; the output
+// is as small as possible so that we mostly measure the upload
+// (args: frame height, for a 16:9 frame, and number of upload buffers).
+void BM_FlatInputUpload(benchmark::State &state)
+{
+	const unsigned height = state.range(0), width = height * 16 / 9;
+	const int num_upload_buffers = state.range(1);
+	unsigned char *data = new unsigned char[width * height * 4];
+	memset(data, 0x80, width * height * 4);
+
+	EffectChainTester tester(NULL, 1, 1, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, GL_RGBA8);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, GL_UNSIGNED_BYTE, width, height);
+	CHECK(input->set_int("num_upload_buffers", num_upload_buffers));
+	input->set_pixel_data(data);
+	tester.get_chain()->add_input(input);
+
+	tester.benchmark(state, GL_RGBA8, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, invalidate_input, input);
+	state.SetBytesProcessed(int64_t(state.iterations()) * width * height * 4);
+
+	delete[] data;
+}
+BENCHMARK(BM_FlatInputUpload)
+	->ArgPair(1080, 0)
+	->ArgPair(1080, 3)
+	->ArgPair(2160, 0)
+	->ArgPair(2160, 3)
+	->UseRealTime()
+	->Unit(benchmark::kMicrosecond);
+
+// A 4K RGBA overlay where only a 200-pixel ticker strip changes every frame;
+// either the whole frame is uploaded anew (0), or only the strip (1).
+void BM_FlatInputTicker(benchmark::State &state)
+{
+	const unsigned width = 3840, height = 2160;
+	const bool partial = state.range(0);
+	unsigned char *data = new unsigned char[width * height * 4];
+	memset(data, 0x80, width * height * 4);
+
+	EffectChainTester tester(NULL, 1, 1, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, GL_RGBA8);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, GL_UNSIGNED_BYTE, width, height);
+	input->set_pixel_data(data);
+	tester.get_chain()->add_input(input);
+
+	tester.benchmark(state, GL_RGBA8, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED,
+		partial ? invalidate_ticker : invalidate_input, input);
+	state.SetBytesProcessed(int64_t(state.iterations()) * width * (partial ? ticker_height : height) * 4);
+
+	delete[] data;
+}
+BENCHMARK(BM_FlatInputTicker)->Arg(0)->Arg(1)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+#endif
+
 }  // namespace movit
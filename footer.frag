@@ -1,20 +1,116 @@
+// Every output goes to its own draw buffer, in the order they are declared
+// here. On desktop OpenGL, EffectChain binds them by name (see
+// ResourcePool::start_compile_glsl_program()), but GLSL ES needs
+// explicit locations.
+#ifdef GL_ES
+#define OUTPUT_LOCATION(n) layout(location = n)
+#else
+#define OUTPUT_LOCATION(n)
+#endif
+
 #if YCBCR_OUTPUT_PLANAR
-out vec4 Y;
-out vec4 Cb;
-out vec4 Cr;
+OUTPUT_LOCATION(0) out vec4 Y;
+OUTPUT_LOCATION(1) out vec4 Cb;
+OUTPUT_LOCATION(2) out vec4 Cr;
+#define RGBA_LOCATION 3
 #elif YCBCR_OUTPUT_SPLIT_Y_AND_CBCR
-out vec4 Y;
-out vec4 Chroma;
+OUTPUT_LOCATION(0) out vec4 Y;
+OUTPUT_LOCATION(1) out vec4 Chroma;
+#define RGBA_LOCATION 2
 #else
-out vec4 FragColor;
+OUTPUT_LOCATION(0) out vec4 FragColor;
+#define RGBA_LOCATION 1
+#endif
+
+#if YCBCR_OUTPUT_PACKED
+// For the packed Y'CbCr outputs, every output texel is made from one or more
+// pixels of the image, so we evaluate the chain at each of them, given
+// in the coordinates of the output memory (ie., the texel coordinates).
+vec4 ycbcr_pixel(int x, int y)
+{
+	ivec2 size = ivec2(YCBCR_PACKED_IMAGE_SIZE);
+	vec2 pixel_tc = (vec2(min(x, size.x - 1), min(y, size.y - 1)) + 0.5) / YCBCR_PACKED_IMAGE_SIZE;
+#if YCBCR_PACKED_FLIP_ORIGIN
+	pixel_tc.y = 1.0 - pixel_tc.y;
+#endif
+	return INPUT(pixel_tc);
+}
 #endif
 
 #if YCBCR_ALSO_OUTPUT_RGBA
-out vec4 RGBA;
+OUTPUT_LOCATION(RGBA_LOCATION) out vec4 RGBA;
+#endif
+
+// Outputs of other phases computed in this one (see EffectChain::fuse_phases()).
+// Such phases are never the last one, so they only have FragColor besides.
+#ifdef EXTRA_OUTPUT1
+OUTPUT_LOCATION(1) out vec4 FragColor1;
+#endif
+#ifdef EXTRA_OUTPUT2
+OUTPUT_LOCATION(2) out vec4 FragColor2;
+#endif
+#ifdef EXTRA_OUTPUT3
+OUTPUT_LOCATION(3) out vec4 FragColor3;
 #endif
 
 void main()
 {
+#if YCBCR_OUTPUT_PACKED
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+#if YCBCR_OUTPUT_PACKED_UYVY
+	// U Y0 V Y1 in R, G, B and A.
+	vec4 p0 = ycbcr_pixel(texel.x * 2, texel.y);
+	vec4 p1 = ycbcr_pixel(texel.x * 2 + 1, texel.y);
+	FragColor = vec4(mix(p0.y, p1.y, ycbcr_packed_cb_position.x), p0.x,
+	                 mix(p0.z, p1.z, ycbcr_packed_cr_position.x), p1.x);
+#elif YCBCR_OUTPUT_PACKED_V210
+	// Every group of four texels (32-bit words) holds six pixels in twelve
+	// slots, Cb0 Y0 Cr0 Y1 Cb1 Y2 Cr1 Y3 Cb2 Y4 Cr2 Y5, three to a word.
+	// The slots in any given word only need four consecutive pixels.
+	int block = texel.x / 4;
+	int word = texel.x % 4;
+	int first_pixel = (word >= 2) ? 2 : 0;
+	vec4 p[4];
+	for (int i = 0; i < 4; ++i) {
+		p[i] = ycbcr_pixel(block * 6 + first_pixel + i, texel.y);
+	}
+	vec3 slots;
+	for (int i = 0; i < 3; ++i) {
+		int slot = word * 3 + i;
+		if (slot % 2 == 1) {
+			slots[i] = p[slot / 2 - first_pixel].x;
+		} else {
+			int left = (slot / 4) * 2 - first_pixel;
+			if (slot % 4 == 0) {
+				slots[i] = mix(p[left].y, p[left + 1].y, ycbcr_packed_cb_position.x);
+			} else {
+				slots[i] = mix(p[left].z, p[left + 1].z, ycbcr_packed_cr_position.x);
+			}
+		}
+	}
+	FragColor = vec4(slots, 0.0);
+#elif YCBCR_OUTPUT_PACKED_NV12
+	// The Y' plane, and then the CbCr plane below it.
+	int height = int(YCBCR_PACKED_IMAGE_SIZE.y);
+	if (texel.y < height) {
+		FragColor = vec4(ycbcr_pixel(texel.x, texel.y).x);
+	} else {
+		int x = (texel.x / 2) * 2;
+		int y = (texel.y - height) * 2;
+		vec4 p00 = ycbcr_pixel(x, y);
+		vec4 p10 = ycbcr_pixel(x + 1, y);
+		vec4 p01 = ycbcr_pixel(x, y + 1);
+		vec4 p11 = ycbcr_pixel(x + 1, y + 1);
+		if (texel.x % 2 == 0) {
+			vec2 pos = ycbcr_packed_cb_position;
+			FragColor = vec4(mix(mix(p00.y, p10.y, pos.x), mix(p01.y, p11.y, pos.x), pos.y));
+		} else {
+			vec2 pos = ycbcr_packed_cr_position;
+			FragColor = vec4(mix(mix(p00.z, p10.z, pos.x), mix(p01.z, p11.z, pos.x), pos.y));
+		}
+	}
+#endif
+#else
 #if YCBCR_ALSO_OUTPUT_RGBA
 	vec4 color[2] = INPUT(tc);
 	vec4 color0 = color[0];
@@ -33,8 +129,19 @@ void main()
 #else
 	FragColor = color0;
 #endif
+#endif
 
 #if YCBCR_ALSO_OUTPUT_RGBA
 	RGBA = color1;
 #endif
+
+#ifdef EXTRA_OUTPUT1
+	FragColor1 = EXTRA_OUTPUT1(tc);
+#endif
+#ifdef EXTRA_OUTPUT2
+	FragColor2 = EXTRA_OUTPUT2(tc);
+#endif
+#ifdef EXTRA_OUTPUT3
+	FragColor3 = EXTRA_OUTPUT3(tc);
+#endif
 }
@@ -1,5 +1,9 @@
 #include "fp16.h"
 
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
 namespace movit {
 namespace {
 
@@ -243,4 +247,95 @@ fp32_int_t fp64_to_fp32(double x)
 	       FP64_BIAS, FP64_MANTISSA_BITS, FP64_EXPONENT_BITS, FP64_MAX_EXPONENT>(x);
 }
 
+void fp32_to_fp16_array(const float *src, fp16_int_t *dst, size_t num)
+{
+	size_t i = 0;
+#if defined(__F16C__)
+	for ( ; i + 8 <= num; i += 8) {
+		__m128i x = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i *)(dst + i), x);
+	}
+#elif defined(__SSE2__)
+	// Based on Fabian Giesen's float_to_half_fast3_rtne; handles denormals,
+	// infinities and NaNs. Works on four fp32 values, giving four fp16 values
+	// in the lower half of each 32-bit lane.
+	const __m128i sign_mask = _mm_set1_epi32(0x80000000u);
+	const __m128i f16_max = _mm_set1_epi32((127 + 16) << 23);  // Anything at least this large becomes infinity.
+	const __m128i min_normal = _mm_set1_epi32((127 - 14) << 23);  // Anything smaller becomes a denormal.
+	const __m128i denormal_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128i normal_bias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+	const __m128i infinity = _mm_set1_epi32(0x7c00);
+	const __m128i nan_bit = _mm_set1_epi32(0x200);
+	for ( ; i + 8 <= num; i += 8) {
+		__m128i halves[2];
+		for (unsigned j = 0; j < 2; ++j) {
+			__m128i x = _mm_castps_si128(_mm_loadu_ps(src + i + j * 4));
+			__m128i sign = _mm_and_si128(x, sign_mask);
+			__m128i abs_x = _mm_xor_si128(x, sign);
+
+			__m128i is_nan = _mm_castps_si128(_mm_cmpunord_ps(_mm_castsi128_ps(abs_x), _mm_castsi128_ps(abs_x)));
+			__m128i is_regular = _mm_cmpgt_epi32(f16_max, abs_x);
+			__m128i is_denormal = _mm_cmpgt_epi32(min_normal, abs_x);
+			__m128i special = _mm_or_si128(infinity, _mm_and_si128(is_nan, nan_bit));
+
+			// Denormal results: Let the FPU do the rounding for us.
+			__m128i denormal = _mm_sub_epi32(
+				_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(abs_x), _mm_castsi128_ps(denormal_magic))),
+				denormal_magic);
+
+			// Normal results: Rebias the exponent and round the mantissa,
+			// nudging odd mantissas upwards to get round-to-even.
+			__m128i mantissa_odd = _mm_srai_epi32(_mm_slli_epi32(abs_x, 31 - 13), 31);
+			__m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(abs_x, normal_bias), mantissa_odd), 13);
+
+			__m128i result = _mm_or_si128(_mm_and_si128(is_denormal, denormal), _mm_andnot_si128(is_denormal, normal));
+			result = _mm_or_si128(_mm_and_si128(is_regular, result), _mm_andnot_si128(is_regular, special));
+			result = _mm_or_si128(result, _mm_srli_epi32(sign, 16));
+
+			// Sign-extend from 16 bits, so that the saturating pack below leaves the bits alone.
+			halves[j] = _mm_srai_epi32(_mm_slli_epi32(result, 16), 16);
+		}
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(halves[0], halves[1]));
+	}
+#endif
+	for ( ; i < num; ++i) {
+		dst[i] = fp64_to_fp16(src[i]);
+	}
+}
+
+void fp16_to_fp32_array(const fp16_int_t *src, float *dst, size_t num)
+{
+	size_t i = 0;
+#if defined(__F16C__)
+	for ( ; i + 8 <= num; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(x));
+	}
+#elif defined(__SSE2__)
+	// Based on Fabian Giesen's half_to_float_SSE2; the multiplication
+	// takes care of rebiasing the exponent and normalizing denormals.
+	const __m128i no_sign_mask = _mm_set1_epi32(0x7fff);
+	const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+	const __m128i largest_finite = _mm_set1_epi32(0x7bff);
+	const __m128 infinity_exponent = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+	const __m128i zero = _mm_setzero_si128();
+	for ( ; i + 8 <= num; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		for (unsigned j = 0; j < 2; ++j) {
+			__m128i h = (j == 0) ? _mm_unpacklo_epi16(x, zero) : _mm_unpackhi_epi16(x, zero);
+			__m128i exponent_mantissa = _mm_and_si128(h, no_sign_mask);
+			__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, exponent_mantissa), 16);
+			__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(exponent_mantissa, 13)), magic);
+			__m128 was_inf_or_nan = _mm_castsi128_ps(_mm_cmpgt_epi32(exponent_mantissa, largest_finite));
+			__m128 result = _mm_or_ps(scaled, _mm_and_ps(was_inf_or_nan, infinity_exponent));
+			result = _mm_or_ps(result, _mm_castsi128_ps(sign));
+			_mm_storeu_ps(dst + i + j * 4, result);
+		}
+	}
+#endif
+	for ( ; i < num; ++i) {
+		dst[i] = fp16_to_fp64(src[i]);
+	}
+}
+
 }  // namespace
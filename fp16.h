@@ -1,6 +1,8 @@
 #ifndef _MOVIT_FP16_H
 #define _MOVIT_FP16_H 1
 
+#include <stddef.h>
+
 #ifdef __F16C__
 #include <immintrin.h>
 #endif
@@ -10,7 +12,8 @@
 // handling of NaNs and infinities). This is needed because some OpenGL
 // drivers don't properly round off when asked to convert data themselves.
 //
-// These routines are not particularly fast.
+// The scalar routines are not particularly fast; if you have many values
+// to convert, use fp32_to_fp16_array() and fp16_to_fp32_array() instead.
 
 namespace movit {
 
@@ -47,6 +50,14 @@ fp16_int_t fp64_to_fp16(double x);
 
 #endif
 
+// Convert <num> values at a time, with the same round-to-nearest-even
+// behavior as fp64_to_fp16() (fp16 to fp32 is always exact). NaNs stay NaNs,
+// but their payload is not necessarily kept. Uses F16C or SSE2 if we know
+// at compile time that they are available, and falls back to the scalar
+// routines otherwise.
+void fp32_to_fp16_array(const float *src, fp16_int_t *dst, size_t num);
+void fp16_to_fp32_array(const fp16_int_t *src, float *dst, size_t num);
+
 // These are not very useful by themselves, but are implemented using the same
 // code as the fp16 ones (just with different constants), so they are useful
 // for verifying against the FPU in unit tests.
@@ -1,7 +1,12 @@
 #include "fp16.h"
 
 #include <math.h>
+#include <stdlib.h>
 #include <gtest/gtest.h>
+#include <vector>
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
 
 namespace movit {
 namespace {
@@ -143,4 +148,169 @@ TEST(FP16Test, FP32ReferenceUpconvert) {
 	}
 }
 
+// Convert every possible fp16 value in bulk, and check that we get the same
+// as from the scalar routine (which is exact).
+TEST(FP16Test, ArrayUpconvertAllValues) {
+	std::vector<fp16_int_t> src(65536);
+	std::vector<float> result(65536);
+	for (unsigned i = 0; i < 65536; ++i) {
+		src[i] = make_fp16(i);
+	}
+	fp16_to_fp32_array(&src[0], &result[0], src.size());
+
+	for (unsigned i = 0; i < 65536; ++i) {
+		union fp32 reference, got;
+		reference.f = fp16_to_fp64(src[i]);
+		got.f = result[i];
+
+		EXPECT_EQ(isnan(reference.f), isnan(got.f)) << "fp16 value " << i;
+		if (!isnan(reference.f)) {
+			EXPECT_EQ(reference.u, got.u) << "fp16 value " << i;
+		}
+	}
+}
+
+namespace {
+
+// Check that converting <src> in bulk gives the same as fp64_to_fp16().
+// Skips the first element, so that the vector code also sees unaligned
+// pointers, and the tail is handled by the scalar code.
+void expect_array_downconvert_matches_scalar(const std::vector<float> &src)
+{
+	std::vector<fp16_int_t> result(src.size() - 1);
+	fp32_to_fp16_array(&src[1], &result[0], result.size());
+
+	for (unsigned i = 0; i < result.size(); ++i) {
+		fp16_int_t reference = fp64_to_fp16(src[i + 1]);
+		bool reference_is_nan = ((reference.val & 0x7c00) == 0x7c00 && (reference.val & 0x3ff) != 0);
+		bool result_is_nan = ((result[i].val & 0x7c00) == 0x7c00 && (result[i].val & 0x3ff) != 0);
+
+		EXPECT_EQ(reference_is_nan, result_is_nan) << src[i + 1];
+		if (!reference_is_nan) {
+			EXPECT_EQ(reference.val, result[i].val)
+			    << src[i + 1] << " got rounded to " << result[i].val << " instead of " << reference.val;
+		}
+	}
+}
+
+}  // namespace
+
+// Every fp16 value, the midpoint to the next one (where round-to-even kicks in)
+// and the fp32 values right next to both. This covers every rounding decision
+// the fp32 -> fp16 conversion can make, including denormals and overflow.
+TEST(FP16Test, ArrayDownconvertAllRoundingBoundaries) {
+	std::vector<float> src;
+	src.push_back(0.0f);
+	for (unsigned i = 0; i < 0x7c00; ++i) {
+		double x = fp16_to_fp64(make_fp16(i));
+		double next_x = (i == 0x7bff) ? 65520.0 : fp16_to_fp64(make_fp16(i + 1));  // 65520 is where we overflow.
+		float candidates[] = {
+			float(x),
+			nextafterf(float(x), -INFINITY),
+			nextafterf(float(x), INFINITY),
+			float(0.5 * (x + next_x)),
+			nextafterf(float(0.5 * (x + next_x)), -INFINITY),
+			nextafterf(float(0.5 * (x + next_x)), INFINITY),
+		};
+		for (unsigned j = 0; j < sizeof(candidates) / sizeof(candidates[0]); ++j) {
+			src.push_back(candidates[j]);
+			src.push_back(-candidates[j]);
+		}
+	}
+	expect_array_downconvert_matches_scalar(src);
+}
+
+// Every fp32 exponent (including denormals, infinities and NaNs), with a sweep
+// of mantissas.
+TEST(FP16Test, ArrayDownconvertAllExponents) {
+	std::vector<float> src;
+	src.push_back(0.0f);
+	for (unsigned exponent = 0; exponent < 256; ++exponent) {
+		for (unsigned mantissa = 0; mantissa < (1u << 23); mantissa += 4099) {
+			union fp32 x;
+			x.u = (exponent << 23) | mantissa;
+			src.push_back(x.f);
+			x.u |= 0x80000000u;
+			src.push_back(x.f);
+		}
+	}
+	expect_array_downconvert_matches_scalar(src);
+}
+
+// Random values, in a range where nearly all of them are finite fp16 values.
+TEST(FP16Test, ArrayRoundTrip) {
+	srand(12345);
+
+	std::vector<float> src(1000003);
+	for (unsigned i = 0; i < src.size(); ++i) {
+		src[i] = (rand() / (RAND_MAX + 1.0) - 0.5) * 1000.0;
+	}
+	expect_array_downconvert_matches_scalar(src);
+
+	std::vector<fp16_int_t> fp16(src.size());
+	std::vector<float> roundtrip(src.size());
+	fp32_to_fp16_array(&src[0], &fp16[0], src.size());
+	fp16_to_fp32_array(&fp16[0], &roundtrip[0], src.size());
+	for (unsigned i = 0; i < src.size(); ++i) {
+		// Ten bits of mantissa, rounded to nearest.
+		EXPECT_NEAR(src[i], roundtrip[i], fabs(src[i]) / 2048.0f + 1e-7);
+	}
+}
+
+#ifdef HAVE_BENCHMARK
+
+namespace {
+
+std::vector<float> make_benchmark_values(unsigned num)
+{
+	std::vector<float> values(num);
+	for (unsigned i = 0; i < num; ++i) {
+		values[i] = (i % 1000) / 999.0f - 0.5f;
+	}
+	return values;
+}
+
+}  // namespace
+
+void BM_FP64ToFP16Scalar(benchmark::State &state)
+{
+	std::vector<float> src = make_benchmark_values(state.range(0));
+	std::vector<fp16_int_t> dst(src.size());
+	while (state.KeepRunning()) {
+		for (unsigned i = 0; i < src.size(); ++i) {
+			dst[i] = fp64_to_fp16(src[i]);
+		}
+		benchmark::DoNotOptimize(&dst[0]);
+	}
+	state.SetItemsProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_FP64ToFP16Scalar)->Arg(65536);
+
+void BM_FP32ToFP16Array(benchmark::State &state)
+{
+	std::vector<float> src = make_benchmark_values(state.range(0));
+	std::vector<fp16_int_t> dst(src.size());
+	while (state.KeepRunning()) {
+		fp32_to_fp16_array(&src[0], &dst[0], src.size());
+		benchmark::DoNotOptimize(&dst[0]);
+	}
+	state.SetItemsProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_FP32ToFP16Array)->Arg(65536);
+
+void BM_FP16ToFP32Array(benchmark::State &state)
+{
+	std::vector<float> values = make_benchmark_values(state.range(0));
+	std::vector<fp16_int_t> src(values.size());
+	fp32_to_fp16_array(&values[0], &src[0], values.size());
+	while (state.KeepRunning()) {
+		fp16_to_fp32_array(&src[0], &values[0], src.size());
+		benchmark::DoNotOptimize(&values[0]);
+	}
+	state.SetItemsProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_FP16ToFP32Array)->Arg(65536);
+
+#endif
+
 }  // namespace movit
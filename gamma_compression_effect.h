@@ -30,6 +30,8 @@ public:
 
 	virtual bool needs_srgb_primaries() const { return false; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool commutes_with_clamping() const { return true; }  // Clamps its input itself.
+	virtual float estimated_alu_cost() const { return 16.0f; }
 
 	// Actually needs postmultiplied input as well as outputting it.
 	// EffectChain will take care of that.
@@ -11,8 +11,12 @@
 #endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "gtest/gtest.h"
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
 
 int main(int argc, char **argv) {
 	// Set up an OpenGL context using SDL.
@@ -50,8 +54,23 @@ int main(int argc, char **argv) {
 	SDL_WM_SetCaption("OpenGL window for unit test", NULL);
 #endif
 
-	testing::InitGoogleTest(&argc, argv);
-	int err = RUN_ALL_TESTS();
+	int err;
+	if (argc >= 2 && strcmp(argv[1], "--benchmark") == 0) {
+#ifdef HAVE_BENCHMARK
+		// Run microbenchmarks instead of unit tests; the remaining
+		// arguments are passed on to the benchmark framework.
+		--argc;
+		::benchmark::Initialize(&argc, argv + 1);
+		::benchmark::RunSpecifiedBenchmarks();
+		err = 0;
+#else
+		fprintf(stderr, "No support for microbenchmarks compiled in.\n");
+		err = 1;
+#endif
+	} else {
+		testing::InitGoogleTest(&argc, argv);
+		err = RUN_ALL_TESTS();
+	}
 	SDL_Quit();
 	exit(err);
 }
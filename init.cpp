@@ -17,6 +17,16 @@ MovitDebugLevel movit_debug_level = MOVIT_DEBUG_ON;
 float movit_texel_subpixel_precision;
 bool movit_srgb_textures_supported;
 bool movit_timer_queries_supported;
+bool movit_uniform_buffers_supported;
+int movit_max_uniform_block_size;
+bool movit_sync_objects_supported;
+bool movit_buffer_storage_supported;
+bool movit_program_binaries_supported;
+bool movit_parallel_shader_compile_supported;
+bool movit_compute_shaders_supported;
+int movit_max_compute_shared_memory_size;
+int movit_max_compute_work_group_invocations;
+bool movit_norm16_textures_supported;
 int movit_num_wrongly_rounded;
 bool movit_shader_rounding_supported;
 MovitShaderModel movit_shader_model;
@@ -306,22 +316,113 @@ const RequiredExtension required_extensions[] = {
 	{ 30, "GL_ARB_texture_rg" },
 };
 
+// Optional features that are probed the same way on desktop OpenGL and GLES;
+// called from check_extensions().
+bool check_optional_features()
+{
+	// Uniform buffers let us upload all the uniforms of a phase in one go.
+	// On desktop, we need the extension even if OpenGL is new enough,
+	// since our shaders are GLSL 1.30 and need to ask for it explicitly.
+	if (epoxy_is_desktop_gl()) {
+		movit_uniform_buffers_supported = epoxy_has_gl_extension("GL_ARB_uniform_buffer_object");
+	} else {
+		movit_uniform_buffers_supported = (epoxy_gl_version() >= 30);
+	}
+	if (movit_uniform_buffers_supported) {
+		glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &movit_max_uniform_block_size);
+		check_error();
+	} else {
+		movit_max_uniform_block_size = 0;
+	}
+
+	// Sync objects let ResourcePool hand resources safely from one context
+	// to another; they are part of GLES 3.0.
+	if (epoxy_is_desktop_gl()) {
+		movit_sync_objects_supported =
+			(epoxy_gl_version() >= 32 || epoxy_has_gl_extension("GL_ARB_sync"));
+	} else {
+		movit_sync_objects_supported = (epoxy_gl_version() >= 30);
+	}
+
+	// Persistently mapped buffers make the upload ring in the inputs
+	// cheaper (see UploadRing); without them, we fall back to mapping
+	// the buffers anew every frame. GLES only has them as a vendor
+	// extension, so we don't bother there.
+	if (epoxy_is_desktop_gl()) {
+		movit_buffer_storage_supported =
+			(epoxy_gl_version() >= 44 || epoxy_has_gl_extension("GL_ARB_buffer_storage")) &&
+			movit_sync_objects_supported;
+	} else {
+		movit_buffer_storage_supported = false;
+	}
+
+	// With this extension, the driver can compile shaders in background
+	// threads, and tell us when they are done without blocking. Ask for
+	// as many threads as it is willing to give us.
+	if (epoxy_has_gl_extension("GL_KHR_parallel_shader_compile")) {
+		movit_parallel_shader_compile_supported = true;
+		glMaxShaderCompilerThreadsKHR(0xffffffff);
+		check_error();
+	} else if (epoxy_has_gl_extension("GL_ARB_parallel_shader_compile")) {
+		movit_parallel_shader_compile_supported = true;
+		glMaxShaderCompilerThreadsARB(0xffffffff);
+		check_error();
+	} else {
+		movit_parallel_shader_compile_supported = false;
+	}
+
+	// Program binaries let ResourcePool keep compiled shaders on disk
+	// between runs. Even if the entry points are there, the driver
+	// does not need to support any binary formats.
+	movit_program_binaries_supported =
+		(epoxy_is_desktop_gl() && (epoxy_gl_version() >= 41 || epoxy_has_gl_extension("GL_ARB_get_program_binary"))) ||
+		(!epoxy_is_desktop_gl() && epoxy_gl_version() >= 30);
+	if (movit_program_binaries_supported) {
+		GLint num_formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		check_error();
+		movit_program_binaries_supported = (num_formats > 0);
+	}
+
+	// Used for 16-bit Y'CbCr input.
+	movit_norm16_textures_supported =
+		epoxy_is_desktop_gl() || epoxy_has_gl_extension("GL_EXT_texture_norm16");
+
+	// The compute shader headers ask for GLSL 4.30 or ESSL 3.10, so the
+	// extensions alone (on an older context) are not enough.
+	if (epoxy_is_desktop_gl()) {
+		movit_compute_shaders_supported = (epoxy_gl_version() >= 43);
+	} else {
+		movit_compute_shaders_supported = (epoxy_gl_version() >= 31);
+	}
+	if (movit_compute_shaders_supported) {
+		glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &movit_max_compute_shared_memory_size);
+		check_error();
+		glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &movit_max_compute_work_group_invocations);
+		check_error();
+	} else {
+		movit_max_compute_shared_memory_size = 0;
+		movit_max_compute_work_group_invocations = 0;
+	}
+
+	return true;
+}
+
 bool check_extensions()
 {
 	// GLES generally doesn't use extensions as actively as desktop OpenGL.
 	// For now, we say that for GLES, we require GLES 3, which has everything
 	// we need.
 	if (!epoxy_is_desktop_gl()) {
-		if (epoxy_gl_version() >= 30) {
-			movit_srgb_textures_supported = true;
-			movit_shader_rounding_supported = true;
-			return true;
-		} else {
+		if (epoxy_gl_version() < 30) {
 			fprintf(stderr, "Movit system requirements: GLES version %.1f is too old (GLES 3.0 needed).\n",
 				0.1f * epoxy_gl_version());
 			fprintf(stderr, "Movit initialization failed.\n");
 			return false;
 		}
+		movit_srgb_textures_supported = true;
+		movit_shader_rounding_supported = true;
+		return check_optional_features();
 	}
 
 	// Check all extensions, and output errors for the ones that we are missing.
@@ -362,7 +463,7 @@ bool check_extensions()
 	movit_timer_queries_supported =
 		(epoxy_gl_version() >= 33 || epoxy_has_gl_extension("GL_ARB_timer_query"));
 
-	return true;
+	return check_optional_features();
 }
 
 double get_glsl_version()
@@ -70,6 +70,46 @@ extern bool movit_srgb_textures_supported;
 // Whether the OpenGL driver (or GPU) in use supports GL_ARB_timer_query.
 extern bool movit_timer_queries_supported;
 
+// Whether the OpenGL driver (or GPU) in use supports uniform buffer objects
+// (GL_ARB_uniform_buffer_object, or OpenGL ES 3.0), and if so, how large
+// a single uniform block can be.
+extern bool movit_uniform_buffers_supported;
+extern int movit_max_uniform_block_size;
+
+// Whether the OpenGL driver in use supports sync objects (GL_ARB_sync,
+// or OpenGL ES 3.0).
+extern bool movit_sync_objects_supported;
+
+// Whether the OpenGL driver in use supports persistently mapped buffers
+// (GL_ARB_buffer_storage) together with sync objects.
+extern bool movit_buffer_storage_supported;
+
+// Whether the OpenGL driver in use can give us compiled programs as binary
+// blobs and load them back (GL_ARB_get_program_binary, or OpenGL ES 3.0),
+// with at least one binary format.
+extern bool movit_program_binaries_supported;
+
+// Whether the driver can compile shaders in the background and tell us
+// when they are done (GL_KHR_parallel_shader_compile or
+// GL_ARB_parallel_shader_compile). See EffectChain::finalize_async().
+extern bool movit_parallel_shader_compile_supported;
+
+// Whether we can run compute shaders, with image load/store (OpenGL 4.3,
+// or OpenGL ES 3.1). See Effect::has_compute_shader().
+extern bool movit_compute_shaders_supported;
+
+// If compute shaders are supported, how much shared memory (in bytes) and
+// how many invocations a single work group can have. The minimums the
+// standards guarantee are 32768 bytes and 1024 invocations for OpenGL 4.3,
+// but only 16384 bytes and 128 invocations for OpenGL ES 3.1.
+extern int movit_max_compute_shared_memory_size;
+extern int movit_max_compute_work_group_invocations;
+
+// Whether we can use 16-bit normalized textures (GL_R16, GL_RG16 etc.).
+// They are core in desktop OpenGL, but need GL_EXT_texture_norm16 on GLES.
+// See YCbCrInput.
+extern bool movit_norm16_textures_supported;
+
 // What shader model we are compiling for. This only affects the choice
 // of a few files (like header.frag); most of the shaders are the same.
 enum MovitShaderModel {
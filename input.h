@@ -8,6 +8,13 @@
 
 namespace movit {
 
+// A rectangle of pixels in an input, for partial updates. The coordinates
+// are the same as for the pixel data the input is given, ie., (0, 0) is
+// the first pixel in memory.
+struct InputRect {
+	unsigned x, y, width, height;
+};
+
 // An input is a degenerate case of an effect; it represents the picture data
 // that comes from the user. As such, it has zero “inputs” itself.
 //
@@ -19,6 +26,10 @@ class Input : public Effect {
 public:
 	virtual unsigned num_inputs() const { return 0; }
 
+	// Most inputs are a texture lookup and a little arithmetic.
+	virtual float estimated_alu_cost() const { return 2.0f; }
+	virtual float estimated_texture_fetches() const { return 1.0f; }
+
 	// Whether this input can deliver linear gamma directly if it's
 	// asked to. (If so, set the parameter “output_linear_gamma”
 	// to activate it.)
@@ -33,6 +33,7 @@ public:
 	virtual std::string effect_type_id() const { return "LiftGammaGainEffect"; }
 	virtual AlphaHandling alpha_handling() const { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual float estimated_alu_cost() const { return 30.0f; }  // Two pow() calls.
 	std::string output_fragment_shader();
 
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
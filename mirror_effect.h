@@ -19,6 +19,7 @@ public:
 	virtual bool needs_srgb_primaries() const { return false; }
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool commutes_with_clamping() const { return true; }
 };
 
 }  // namespace movit
@@ -19,6 +19,7 @@ public:
 	virtual std::string effect_type_id() const { return "MultiplyEffect"; }
 	std::string output_fragment_shader();
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual float estimated_alu_cost() const { return 1.0f; }
 
 private:
 	RGBATuple factor;
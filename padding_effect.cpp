@@ -136,6 +136,14 @@ void PaddingEffect::inform_input_size(unsigned input_num, unsigned width, unsign
 
 IntegralPaddingEffect::IntegralPaddingEffect() {}
 
+bool IntegralPaddingEffect::commutes_with_clamping() const
+{
+	return border_color.r >= 0.0f && border_color.r <= 1.0f &&
+	       border_color.g >= 0.0f && border_color.g <= 1.0f &&
+	       border_color.b >= 0.0f && border_color.b <= 1.0f &&
+	       border_color.a >= 0.0f && border_color.a <= 1.0f;
+}
+
 bool IntegralPaddingEffect::set_int(const std::string &key, int value)
 {
 	if (key == "top" || key == "left") {
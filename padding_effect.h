@@ -49,8 +49,10 @@ public:
 	virtual void get_output_size(unsigned *width, unsigned *height, unsigned *virtual_width, unsigned *virtual_height) const;
 	virtual void inform_input_size(unsigned input_num, unsigned width, unsigned height);
 
-private:
+protected:
 	RGBATuple border_color;
+
+private:
 	int input_width, input_height;
 	int output_width, output_height;
 	float top, left;
@@ -66,6 +68,11 @@ public:
 	IntegralPaddingEffect();
 	virtual std::string effect_type_id() const { return "IntegralPaddingEffect"; }
 	virtual bool one_to_one_sampling() const { return true; }
+
+	// Only moves pixels around, so true as long as the border color
+	// is also within [0,1].
+	virtual bool commutes_with_clamping() const;
+
 	virtual bool set_int(const std::string&, int value);
 	virtual bool set_float(const std::string &key, float value);
 };
@@ -310,4 +310,15 @@ TEST(PaddingEffectTest, BorderOffsetLeftAndRight) {
 	expect_equal(expected_data, out_data, 4, 2);
 }
 
+TEST(PaddingEffectTest, IntegralPaddingCommutesWithClampingOnlyForInRangeBorder) {
+	const float black[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	const float superwhite[] = { 2.0f, 2.0f, 2.0f, 1.0f };
+
+	IntegralPaddingEffect effect;
+	CHECK(effect.set_vec4("border_color", black));
+	EXPECT_TRUE(effect.commutes_with_clamping());
+	CHECK(effect.set_vec4("border_color", superwhite));
+	EXPECT_FALSE(effect.commutes_with_clamping());
+}
+
 }  // namespace movit
@@ -0,0 +1,318 @@
+#include <epoxy/gl.h>
+#include <assert.h>
+
+#include "init.h"
+#include "readback_queue.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+const GLbitfield persistent_map_flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+// Reads are started on this boundary within each frame.
+const size_t read_alignment = 16;
+
+}  // namespace
+
+ReadbackQueue::ReadbackQueue(unsigned num_buffers, size_t buffer_size)
+	: buffers(num_buffers),
+	  buffer_size(buffer_size),
+	  persistent(movit_buffer_storage_supported),
+	  current(0),
+	  next_frame(0),
+	  in_frame(false)
+{
+	assert(num_buffers > 0);
+	for (unsigned i = 0; i < num_buffers; ++i) {
+		Buffer *buf = &buffers[i];
+		glGenBuffers(1, &buf->pbo);
+		check_error();
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, buf->pbo);
+		check_error();
+		if (persistent) {
+			glBufferStorage(GL_PIXEL_PACK_BUFFER_ARB, buffer_size, NULL, persistent_map_flags);
+			check_error();
+			buf->ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER_ARB, 0, buffer_size, persistent_map_flags);
+			check_error();
+			assert(buf->ptr != NULL);
+		} else {
+			glBufferData(GL_PIXEL_PACK_BUFFER_ARB, buffer_size, NULL, GL_STREAM_READ);
+			check_error();
+			buf->ptr = NULL;
+		}
+		buf->sync = NULL;
+		buf->frame = -1;
+		buf->bytes_used = 0;
+		buf->mapped = false;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+	check_error();
+}
+
+ReadbackQueue::~ReadbackQueue()
+{
+	for (unsigned i = 0; i < buffers.size(); ++i) {
+		Buffer *buf = &buffers[i];
+		assert(!buf->mapped);
+		if (buf->sync != NULL) {
+			glDeleteSync(buf->sync);
+			check_error();
+		}
+		if (persistent) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, buf->pbo);
+			check_error();
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+			check_error();
+		}
+		glDeleteBuffers(1, &buf->pbo);
+		check_error();
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+	check_error();
+}
+
+size_t ReadbackQueue::get_image_size(unsigned width, unsigned height, GLenum format, GLenum type)
+{
+	size_t bytes_per_pixel;
+	switch (type) {
+	case GL_UNSIGNED_INT_2_10_10_10_REV:
+	case GL_UNSIGNED_INT_10_10_10_2:
+	case GL_UNSIGNED_INT_8_8_8_8:
+	case GL_UNSIGNED_INT_8_8_8_8_REV:
+		bytes_per_pixel = 4;
+		break;
+	case GL_UNSIGNED_SHORT_5_6_5:
+		bytes_per_pixel = 2;
+		break;
+	default: {
+		size_t num_components;
+		switch (format) {
+		case GL_RED:
+		case GL_RED_INTEGER:
+			num_components = 1;
+			break;
+		case GL_RG:
+		case GL_RG_INTEGER:
+			num_components = 2;
+			break;
+		case GL_RGB:
+		case GL_BGR:
+			num_components = 3;
+			break;
+		case GL_RGBA:
+		case GL_BGRA:
+			num_components = 4;
+			break;
+		default:
+			assert(false);
+		}
+
+		size_t bytes_per_component;
+		switch (type) {
+		case GL_UNSIGNED_BYTE:
+		case GL_BYTE:
+			bytes_per_component = 1;
+			break;
+		case GL_UNSIGNED_SHORT:
+		case GL_SHORT:
+		case GL_HALF_FLOAT:
+			bytes_per_component = 2;
+			break;
+		case GL_UNSIGNED_INT:
+		case GL_INT:
+		case GL_FLOAT:
+			bytes_per_component = 4;
+			break;
+		default:
+			assert(false);
+		}
+		bytes_per_pixel = num_components * bytes_per_component;
+		break;
+	}
+	}
+	return size_t(width) * height * bytes_per_pixel;
+}
+
+void ReadbackQueue::start_frame()
+{
+	if (in_frame) {
+		return;
+	}
+	Buffer *buf = &buffers[current];
+	assert(!buf->mapped);
+
+	// If nobody picked up the frame that was here, just drop it;
+	// the GPU will not write the new data until it is done with
+	// the old anyway.
+	if (buf->sync != NULL) {
+		glDeleteSync(buf->sync);
+		check_error();
+		buf->sync = NULL;
+	}
+	buf->frame = next_frame;
+	buf->bytes_used = 0;
+	in_frame = true;
+}
+
+size_t ReadbackQueue::read_pixels(GLuint fbo, unsigned attachment,
+                                  unsigned x, unsigned y, unsigned width, unsigned height,
+                                  GLenum format, GLenum type)
+{
+	start_frame();
+	Buffer *buf = &buffers[current];
+
+	size_t offset = (buf->bytes_used + read_alignment - 1) / read_alignment * read_alignment;
+	size_t size = get_image_size(width, height, format, type);
+	assert(offset + size <= buffer_size);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	check_error();
+	if (fbo != 0) {
+		glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+		check_error();
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, buf->pbo);
+	check_error();
+
+	GLint old_alignment;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &old_alignment);
+	check_error();
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	check_error();
+	glReadPixels(x, y, width, height, format, type, BUFFER_OFFSET(offset));
+	check_error();
+	glPixelStorei(GL_PACK_ALIGNMENT, old_alignment);
+	check_error();
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+	check_error();
+	if (fbo != 0) {
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		check_error();
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	check_error();
+
+	buf->bytes_used = offset + size;
+	return offset;
+}
+
+unsigned ReadbackQueue::read_ycbcr_output(GLuint fbo, YCbCrOutputSplitting output_splitting,
+                                          unsigned width, unsigned height, GLenum type,
+                                          size_t *plane_offsets)
+{
+	unsigned texture_width, texture_height;
+	get_ycbcr_output_texture_size(output_splitting, width, height, &texture_width, &texture_height);
+
+	switch (output_splitting) {
+	case YCBCR_OUTPUT_INTERLEAVED:
+		plane_offsets[0] = read_pixels(fbo, 0, 0, 0, width, height, GL_RGBA, type);
+		return 1;
+	case YCBCR_OUTPUT_SPLIT_Y_AND_CBCR:
+		plane_offsets[0] = read_pixels(fbo, 0, 0, 0, width, height, GL_RED, type);
+		plane_offsets[1] = read_pixels(fbo, 1, 0, 0, width, height, GL_RG, type);
+		return 2;
+	case YCBCR_OUTPUT_PLANAR:
+		plane_offsets[0] = read_pixels(fbo, 0, 0, 0, width, height, GL_RED, type);
+		plane_offsets[1] = read_pixels(fbo, 1, 0, 0, width, height, GL_RED, type);
+		plane_offsets[2] = read_pixels(fbo, 2, 0, 0, width, height, GL_RED, type);
+		return 3;
+	case YCBCR_OUTPUT_PACKED_UYVY:
+		plane_offsets[0] = read_pixels(fbo, 0, 0, 0, texture_width, texture_height, GL_RGBA, GL_UNSIGNED_BYTE);
+		return 1;
+	case YCBCR_OUTPUT_PACKED_V210:
+		plane_offsets[0] = read_pixels(fbo, 0, 0, 0, texture_width, texture_height, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+		return 1;
+	case YCBCR_OUTPUT_PACKED_NV12:
+		// Y' and CbCr live in the same texture, so the CbCr plane
+		// starts right after the Y' plane.
+		plane_offsets[0] = read_pixels(fbo, 0, 0, 0, texture_width, texture_height, GL_RED, GL_UNSIGNED_BYTE);
+		plane_offsets[1] = plane_offsets[0] + size_t(width) * height;
+		return 2;
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+unsigned ReadbackQueue::end_frame()
+{
+	assert(in_frame);
+	Buffer *buf = &buffers[current];
+	if (movit_sync_objects_supported) {
+		assert(buf->sync == NULL);
+		buf->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		check_error();
+	}
+	in_frame = false;
+	current = (current + 1) % buffers.size();
+	return next_frame++;
+}
+
+bool ReadbackQueue::is_ready(unsigned frame)
+{
+	Buffer *buf = &buffers[frame % buffers.size()];
+	assert(frame < next_frame && buf->frame == frame);
+	if (buf->sync == NULL) {
+		return true;
+	}
+	GLenum ret = glClientWaitSync(buf->sync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	check_error();
+	assert(ret != GL_WAIT_FAILED);
+	return (ret == GL_ALREADY_SIGNALED || ret == GL_CONDITION_SATISFIED);
+}
+
+const void *ReadbackQueue::map_frame(unsigned frame)
+{
+	Buffer *buf = &buffers[frame % buffers.size()];
+	assert(frame < next_frame && buf->frame == frame);
+	assert(!buf->mapped);
+	buf->mapped = true;
+
+	if (buf->sync != NULL) {
+		GLenum ret;
+		do {
+			ret = glClientWaitSync(buf->sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			check_error();
+		} while (ret == GL_TIMEOUT_EXPIRED);
+		assert(ret != GL_WAIT_FAILED);
+		glDeleteSync(buf->sync);
+		check_error();
+		buf->sync = NULL;
+	}
+	if (persistent) {
+		return buf->ptr;
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, buf->pbo);
+	check_error();
+	void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER_ARB, 0, buf->bytes_used, GL_MAP_READ_BIT);
+	check_error();
+	assert(ptr != NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+	check_error();
+	return ptr;
+}
+
+void ReadbackQueue::unmap_frame(unsigned frame)
+{
+	Buffer *buf = &buffers[frame % buffers.size()];
+	assert(buf->frame == frame);
+	assert(buf->mapped);
+	buf->mapped = false;
+
+	if (!persistent) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, buf->pbo);
+		check_error();
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+		check_error();
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+		check_error();
+	}
+}
+
+}  // namespace movit
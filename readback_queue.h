@@ -0,0 +1,119 @@
+#ifndef _MOVIT_READBACK_QUEUE_H
+#define _MOVIT_READBACK_QUEUE_H 1
+
+// A ReadbackQueue is a small ring of pixel pack buffers (PBOs) to read
+// rendered frames back into, the reverse of UploadRing. Calling
+// glReadPixels() into client memory makes the CPU wait until the GPU has
+// finished rendering the frame (and on some drivers, such as Intel/DRI,
+// also takes a slow path); instead, we read into the next buffer in the ring
+// and put a fence after it, so that you can render frame N+1 (and N+2, etc.)
+// while the transfer for frame N is still in flight, and only map the frame
+// once it is done.
+//
+// Typical use, after EffectChain::render_to_fbo():
+//
+//   queue.read_pixels(fbo, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+//   unsigned frame = queue.end_frame();
+//   ...
+//   if (queue.is_ready(frame)) {  // Or just call map_frame(), which waits.
+//     const void *data = queue.map_frame(frame);
+//     ...
+//     queue.unmap_frame(frame);
+//   }
+//
+// As with UploadRing, the buffers are persistently mapped if the driver
+// supports it (see movit_buffer_storage_supported), and mapped anew every
+// time if not. If the driver does not have sync objects at all,
+// is_ready() always returns true, and map_frame() waits for the GPU.
+//
+// It must be created, used and destroyed with an OpenGL context current
+// (or one sharing objects with it).
+
+#include <epoxy/gl.h>
+#include <stddef.h>
+#include <vector>
+
+#include "effect_chain.h"
+
+namespace movit {
+
+class ReadbackQueue {
+public:
+	// Each buffer holds one frame of up to <buffer_size> bytes. You can have
+	// up to <num_buffers> frames queued at any given time; if you queue more,
+	// the oldest one is overwritten (and must not be mapped at the time).
+	ReadbackQueue(unsigned num_buffers, size_t buffer_size);
+	~ReadbackQueue();
+
+	unsigned get_num_buffers() const { return buffers.size(); }
+	size_t get_buffer_size() const { return buffer_size; }
+
+	// Number of bytes read_pixels() needs for a <width> x <height>
+	// rectangle in the given format and type, with rows tightly packed.
+	static size_t get_image_size(unsigned width, unsigned height, GLenum format, GLenum type);
+
+	// Queues reading a rectangle back from the given color attachment of
+	// <fbo> (or from the current read buffer of the default framebuffer,
+	// if <fbo> is 0; <attachment> is then ignored) into the frame being
+	// built. Rows are tightly packed (GL_PACK_ALIGNMENT is 1), and each
+	// read starts on a 16-byte boundary after the previous one in the
+	// same frame. As usual for glReadPixels(), the bottom row comes first
+	// unless the chain was rendered with OUTPUT_ORIGIN_TOP_LEFT.
+	// Returns the offset of the first pixel within the frame.
+	size_t read_pixels(GLuint fbo, unsigned attachment,
+	                   unsigned x, unsigned y, unsigned width, unsigned height,
+	                   GLenum format, GLenum type);
+
+	// Queues reading back all the outputs of a chain set up with
+	// EffectChain::add_ycbcr_output(), as rendered into <fbo> by
+	// render_to_fbo(fbo, width, height). Y' is read as GL_RED, CbCr as
+	// GL_RG and interleaved Y'CbCr as GL_RGBA, all with the given <type>;
+	// the packed modes are read back as described in YCbCrOutputSplitting,
+	// and <type> is ignored for them. Fills in the offset of each plane
+	// (up to three) in <plane_offsets>, and returns the number of planes.
+	unsigned read_ycbcr_output(GLuint fbo, YCbCrOutputSplitting output_splitting,
+	                           unsigned width, unsigned height, GLenum type,
+	                           size_t *plane_offsets);
+
+	// Done queueing reads for this frame (there must have been at least
+	// one). Inserts a fence and moves on to the next buffer. Returns the
+	// number to use for this frame in the functions below; frames are
+	// numbered 0, 1, 2, etc.
+	unsigned end_frame();
+
+	// Whether the reads for the given frame have finished, so that
+	// map_frame() would not need to wait. Never blocks, but flushes
+	// the command stream, so that the GPU will get to it eventually.
+	bool is_ready(unsigned frame);
+
+	// Returns a pointer to the data for the given frame, waiting for
+	// the GPU if it is not done yet. Valid until unmap_frame(). The frame
+	// must not have been overwritten by a later one yet.
+	const void *map_frame(unsigned frame);
+	void unmap_frame(unsigned frame);
+
+private:
+	struct Buffer {
+		GLuint pbo;
+		void *ptr;  // Only if persistently mapped.
+		GLsync sync;  // NULL if there are no reads in flight.
+		unsigned frame;  // Which frame the buffer holds, if any.
+		size_t bytes_used;
+		bool mapped;
+	};
+
+	// Makes the current buffer ready to receive a new frame, if that
+	// has not already been done.
+	void start_frame();
+
+	std::vector<Buffer> buffers;
+	size_t buffer_size;
+	bool persistent;
+	unsigned current;
+	unsigned next_frame;
+	bool in_frame;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_READBACK_QUEUE_H)
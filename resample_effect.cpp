@@ -7,17 +7,30 @@
 #include <assert.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <algorithm>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
 #include <Eigen/Sparse>
 #include <Eigen/SparseQR>
 #include <Eigen/OrderingMethods>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #include "effect_chain.h"
 #include "effect_util.h"
 #include "fp16.h"
 #include "init.h"
 #include "resample_effect.h"
+#include "resource_pool.h"
 #include "util.h"
 
 using namespace Eigen;
@@ -27,6 +40,25 @@ namespace movit {
 
 namespace {
 
+// Work group size and largest shared memory size (in pixels per line)
+// for the compute shader; see resample_effect.comp.
+const unsigned compute_tile_length = 64;
+const unsigned compute_num_lines = 2;
+const unsigned max_compute_tile_capacity = 512;
+
+// How many RGBA fp32 pixels per line the compute shader can keep in shared
+// memory, next to the span_start and span_end arrays. 2 x 512 pixels would
+// be 16 kB, which is all OpenGL ES guarantees, so there it gets a bit less.
+unsigned get_compute_tile_capacity()
+{
+	const int span_bytes = 2 * compute_num_lines * sizeof(int);
+	if (movit_max_compute_shared_memory_size <= span_bytes) {
+		return 0;
+	}
+	const unsigned capacity = (movit_max_compute_shared_memory_size - span_bytes) / (compute_num_lines * 4 * sizeof(float));
+	return min(capacity, max_compute_tile_capacity);
+}
+
 template<class T>
 struct Tap {
 	T weight;
@@ -103,6 +135,140 @@ float lanczos_weight_cached(float x)
 		table_pos_frac * (lanczos_table[table_pos_int + 1] - lanczos_table[table_pos_int]);
 }
 
+// Compute the (unnormalized) Lanczos taps for destination samples
+// <first_y> and up; see calculate_scaling_weights(). This is the reference
+// version; see compute_taps() below.
+void compute_taps_scalar(unsigned first_y, unsigned dst_samples, unsigned src_samples, int int_radius, float scaling_factor,
+                         float radius_scaling_factor, float subpixel_offset, unsigned src_size, Tap<float> *taps)
+{
+	for (unsigned y = first_y; y < dst_samples; ++y) {
+		// Find the point around which we want to sample the source image,
+		// compensating for differing pixel centers as the scale changes.
+		float center_src_y = (y + 0.5f) / scaling_factor - 0.5f;
+		int base_src_y = lrintf(center_src_y);
+
+		// Now sample <int_radius> pixels on each side around that point.
+		for (unsigned i = 0; i < src_samples; ++i) {
+			int src_y = base_src_y + i - int_radius;
+			float weight = lanczos_weight_cached(radius_scaling_factor * (src_y - center_src_y - subpixel_offset));
+			taps[y * src_samples + i].weight = weight * radius_scaling_factor;
+			taps[y * src_samples + i].pos = (src_y + 0.5) / float(src_size);
+		}
+	}
+}
+
+// Compute the (unnormalized) Lanczos taps for all destination samples.
+// This is where much of the time goes when computing new weights, so we
+// have SIMD versions (selected at compile time, like in fp16.h). Since the
+// number of taps per sample is often small and odd, they work on several
+// destination samples at a time instead of several taps; the scalar version
+// takes care of any leftover samples. The positions are computed in double
+// precision, like in the scalar version, so that they come out exactly the same.
+void compute_taps(unsigned dst_samples, unsigned src_samples, int int_radius, float scaling_factor,
+                  float radius_scaling_factor, float subpixel_offset, unsigned src_size, Tap<float> *taps)
+{
+	unsigned y = 0;
+#if defined(__AVX2__)
+	{
+		const __m256 lane_offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+		const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+		const __m256 radius = _mm256_set1_ps(LANCZOS_RADIUS);
+		const __m256 table_scale = _mm256_set1_ps(LANCZOS_TABLE_SIZE / LANCZOS_RADIUS);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 scaling = _mm256_set1_ps(scaling_factor);
+		const __m256 radius_scaling = _mm256_set1_ps(radius_scaling_factor);
+		const __m256 subpixel = _mm256_set1_ps(subpixel_offset);
+		const __m256d half_d = _mm256_set1_pd(0.5);
+		const __m256d size = _mm256_set1_pd(src_size);
+		for ( ; y + 8 <= dst_samples; y += 8) {
+			__m256 dst_y = _mm256_add_ps(_mm256_set1_ps(float(y)), lane_offsets);
+			__m256 center_src_y = _mm256_sub_ps(_mm256_div_ps(_mm256_add_ps(dst_y, half), scaling), half);
+			__m256i base_src_y = _mm256_cvtps_epi32(center_src_y);  // Round to nearest, like lrintf().
+			__m256 first_src_y = _mm256_cvtepi32_ps(_mm256_sub_epi32(base_src_y, _mm256_set1_epi32(int_radius)));
+			for (unsigned i = 0; i < src_samples; ++i) {
+				__m256 src_y = _mm256_add_ps(first_src_y, _mm256_set1_ps(float(i)));
+				__m256 x = _mm256_mul_ps(radius_scaling, _mm256_sub_ps(_mm256_sub_ps(src_y, center_src_y), subpixel));
+				x = _mm256_andnot_ps(sign_mask, x);
+				__m256 in_range = _mm256_cmp_ps(x, radius, _CMP_LE_OQ);
+
+				// Clamp so that out-of-range taps still read inside the table.
+				__m256 table_pos = _mm256_mul_ps(_mm256_min_ps(x, radius), table_scale);
+				__m256i table_pos_int = _mm256_cvttps_epi32(table_pos);
+				__m256 table_pos_frac = _mm256_sub_ps(table_pos, _mm256_cvtepi32_ps(table_pos_int));
+				__m256 w0 = _mm256_i32gather_ps(lanczos_table, table_pos_int, 4);
+				__m256 w1 = _mm256_i32gather_ps(lanczos_table + 1, table_pos_int, 4);
+				__m256 weight = _mm256_add_ps(w0, _mm256_mul_ps(table_pos_frac, _mm256_sub_ps(w1, w0)));
+				weight = _mm256_and_ps(_mm256_mul_ps(weight, radius_scaling), in_range);
+				__m256d src_y_lo = _mm256_cvtps_pd(_mm256_castps256_ps128(src_y));
+				__m256d src_y_hi = _mm256_cvtps_pd(_mm256_extractf128_ps(src_y, 1));
+				__m128 pos_lo = _mm256_cvtpd_ps(_mm256_div_pd(_mm256_add_pd(src_y_lo, half_d), size));
+				__m128 pos_hi = _mm256_cvtpd_ps(_mm256_div_pd(_mm256_add_pd(src_y_hi, half_d), size));
+
+				float weights[8], positions[8];
+				_mm256_storeu_ps(weights, weight);
+				_mm_storeu_ps(positions, pos_lo);
+				_mm_storeu_ps(positions + 4, pos_hi);
+				for (unsigned j = 0; j < 8; ++j) {
+					taps[(y + j) * src_samples + i].weight = weights[j];
+					taps[(y + j) * src_samples + i].pos = positions[j];
+				}
+			}
+		}
+	}
+#elif defined(__SSE2__)
+	{
+		const __m128 lane_offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		const __m128 sign_mask = _mm_set1_ps(-0.0f);
+		const __m128 radius = _mm_set1_ps(LANCZOS_RADIUS);
+		const __m128 table_scale = _mm_set1_ps(LANCZOS_TABLE_SIZE / LANCZOS_RADIUS);
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 scaling = _mm_set1_ps(scaling_factor);
+		const __m128 radius_scaling = _mm_set1_ps(radius_scaling_factor);
+		const __m128 subpixel = _mm_set1_ps(subpixel_offset);
+		const __m128d half_d = _mm_set1_pd(0.5);
+		const __m128d size = _mm_set1_pd(src_size);
+		for ( ; y + 4 <= dst_samples; y += 4) {
+			__m128 dst_y = _mm_add_ps(_mm_set1_ps(float(y)), lane_offsets);
+			__m128 center_src_y = _mm_sub_ps(_mm_div_ps(_mm_add_ps(dst_y, half), scaling), half);
+			__m128i base_src_y = _mm_cvtps_epi32(center_src_y);  // Round to nearest, like lrintf().
+			__m128 first_src_y = _mm_cvtepi32_ps(_mm_sub_epi32(base_src_y, _mm_set1_epi32(int_radius)));
+			for (unsigned i = 0; i < src_samples; ++i) {
+				__m128 src_y = _mm_add_ps(first_src_y, _mm_set1_ps(float(i)));
+				__m128 x = _mm_mul_ps(radius_scaling, _mm_sub_ps(_mm_sub_ps(src_y, center_src_y), subpixel));
+				x = _mm_andnot_ps(sign_mask, x);
+				__m128 in_range = _mm_cmple_ps(x, radius);
+
+				// Clamp so that out-of-range taps still read inside the table.
+				// SSE2 has no gathers, so the table lookups are done one by one.
+				__m128 table_pos = _mm_mul_ps(_mm_min_ps(x, radius), table_scale);
+				__m128i table_pos_int = _mm_cvttps_epi32(table_pos);
+				__m128 table_pos_frac = _mm_sub_ps(table_pos, _mm_cvtepi32_ps(table_pos_int));
+				int idx[4];
+				_mm_storeu_si128((__m128i *)idx, table_pos_int);
+				__m128 w0 = _mm_setr_ps(lanczos_table[idx[0]], lanczos_table[idx[1]], lanczos_table[idx[2]], lanczos_table[idx[3]]);
+				__m128 w1 = _mm_setr_ps(lanczos_table[idx[0] + 1], lanczos_table[idx[1] + 1], lanczos_table[idx[2] + 1], lanczos_table[idx[3] + 1]);
+				__m128 weight = _mm_add_ps(w0, _mm_mul_ps(table_pos_frac, _mm_sub_ps(w1, w0)));
+				weight = _mm_and_ps(_mm_mul_ps(weight, radius_scaling), in_range);
+				__m128d src_y_lo = _mm_cvtps_pd(src_y);
+				__m128d src_y_hi = _mm_cvtps_pd(_mm_movehl_ps(src_y, src_y));
+				__m128 pos_lo = _mm_cvtpd_ps(_mm_div_pd(_mm_add_pd(src_y_lo, half_d), size));
+				__m128 pos_hi = _mm_cvtpd_ps(_mm_div_pd(_mm_add_pd(src_y_hi, half_d), size));
+				__m128 pos = _mm_movelh_ps(pos_lo, pos_hi);
+
+				float weights[4], positions[4];
+				_mm_storeu_ps(weights, weight);
+				_mm_storeu_ps(positions, pos);
+				for (unsigned j = 0; j < 4; ++j) {
+					taps[(y + j) * src_samples + i].weight = weights[j];
+					taps[(y + j) * src_samples + i].pos = positions[j];
+				}
+			}
+		}
+	}
+#endif
+	compute_taps_scalar(y, dst_samples, src_samples, int_radius, scaling_factor, radius_scaling_factor, subpixel_offset, src_size, taps);
+}
+
 // Euclid's algorithm, from Wikipedia.
 unsigned gcd(unsigned a, unsigned b)
 {
@@ -114,8 +280,25 @@ unsigned gcd(unsigned a, unsigned b)
 	return a;
 }
 
+// Convert a row of taps from fp32 to the given type. Tap<T> is just two T's
+// after each other, so a row of taps is simply an array of 2 * num values.
+void pack_taps(const Tap<float> *src, Tap<float> *dst, unsigned num)
+{
+	memcpy(dst, src, num * sizeof(Tap<float>));
+}
+
+void pack_taps(const Tap<float> *src, Tap<fp16_int_t> *dst, unsigned num)
+{
+	fp32_to_fp16_array(&src[0].weight, &dst[0].weight, num * 2);
+}
+
+void unpack_taps(const Tap<fp16_int_t> *src, Tap<float> *dst, unsigned num)
+{
+	fp16_to_fp32_array(&src[0].weight, &dst[0].weight, num * 2);
+}
+
 template<class DestFloat>
-unsigned combine_samples(const Tap<float> *src, Tap<DestFloat> *dst, float num_subtexels, float inv_num_subtexels, unsigned num_src_samples, unsigned max_samples_saved)
+unsigned combine_samples(const Tap<float> *src, const Tap<DestFloat> *src_packed, Tap<DestFloat> *dst, float num_subtexels, float inv_num_subtexels, unsigned num_src_samples, unsigned max_samples_saved)
 {
 	// Cut off near-zero values at both sides.
 	unsigned num_samples_saved = 0;
@@ -123,6 +306,9 @@ unsigned combine_samples(const Tap<float> *src, Tap<DestFloat> *dst, float num_s
 	       num_src_samples > 0 &&
 	       fabs(src[0].weight) < 1e-6) {
 		++src;
+		if (src_packed != NULL) {
+			++src_packed;
+		}
 		--num_src_samples;
 		++num_samples_saved;
 	}
@@ -136,8 +322,7 @@ unsigned combine_samples(const Tap<float> *src, Tap<DestFloat> *dst, float num_s
 	for (unsigned i = 0, j = 0; i < num_src_samples; ++i, ++j) {
 		// Copy the sample directly; it will be overwritten later if we can combine.
 		if (dst != NULL) {
-			dst[j].weight = convert_float<float, DestFloat>(src[i].weight);
-			dst[j].pos = convert_float<float, DestFloat>(src[i].pos);
+			dst[j] = src_packed[i];
 		}
 
 		if (i == num_src_samples - 1) {
@@ -186,21 +371,80 @@ unsigned combine_samples(const Tap<float> *src, Tap<DestFloat> *dst, float num_s
 	return num_samples_saved;
 }
 
-// Normalize so that the sum becomes one. Note that we do it twice;
-// this sometimes helps a tiny little bit when we have many samples.
-template<class T>
-void normalize_sum(Tap<T>* vals, unsigned num)
+double sum_weights(const Tap<float> *vals, unsigned num)
 {
-	for (int normalize_pass = 0; normalize_pass < 2; ++normalize_pass) {
-		double sum = 0.0;
-		for (unsigned i = 0; i < num; ++i) {
-			sum += to_fp64(vals[i].weight);
+	unsigned i = 0;
+	double sum = 0.0;
+#ifdef __SSE2__
+	__m128d sum_lo = _mm_setzero_pd(), sum_hi = _mm_setzero_pd();
+	for ( ; i + 4 <= num; i += 4) {
+		__m128 a = _mm_loadu_ps(&vals[i].weight);
+		__m128 b = _mm_loadu_ps(&vals[i + 2].weight);
+		__m128 weights = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		sum_lo = _mm_add_pd(sum_lo, _mm_cvtps_pd(weights));
+		sum_hi = _mm_add_pd(sum_hi, _mm_cvtps_pd(_mm_movehl_ps(weights, weights)));
+	}
+	sum_lo = _mm_add_pd(sum_lo, sum_hi);
+	sum = _mm_cvtsd_f64(_mm_add_sd(sum_lo, _mm_unpackhi_pd(sum_lo, sum_lo)));
+#endif
+	for ( ; i < num; ++i) {
+		sum += vals[i].weight;
+	}
+	return sum;
+}
+
+void scale_weights(Tap<float> *vals, unsigned num, double factor)
+{
+	unsigned i = 0;
+#ifdef __SSE2__
+	const __m128d factor_pd = _mm_set1_pd(factor);
+	for ( ; i + 4 <= num; i += 4) {
+		__m128 a = _mm_loadu_ps(&vals[i].weight);
+		__m128 b = _mm_loadu_ps(&vals[i + 2].weight);
+		__m128 weights = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 pos = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+		// Multiply in fp64, like the scalar version.
+		__m128d lo = _mm_mul_pd(_mm_cvtps_pd(weights), factor_pd);
+		__m128d hi = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(weights, weights)), factor_pd);
+		weights = _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+
+		_mm_storeu_ps(&vals[i].weight, _mm_unpacklo_ps(weights, pos));
+		_mm_storeu_ps(&vals[i + 2].weight, _mm_unpackhi_ps(weights, pos));
+	}
+#endif
+	for ( ; i < num; ++i) {
+		vals[i].weight = vals[i].weight * factor;
+	}
+}
+
+// Normalize each of the <num_rows> rows of <num> taps so that the sum
+// becomes one. Note that we do it twice; this sometimes helps a tiny
+// little bit when we have many samples.
+void normalize_sum(Tap<float>* vals, unsigned num, unsigned num_rows)
+{
+	for (unsigned y = 0; y < num_rows; ++y) {
+		for (int normalize_pass = 0; normalize_pass < 2; ++normalize_pass) {
+			scale_weights(vals + y * num, num, 1.0 / sum_weights(vals + y * num, num));
 		}
-		double inv_sum = 1.0 / sum;
-		for (unsigned i = 0; i < num; ++i) {
-			vals[i].weight = from_fp64<T>(to_fp64(vals[i].weight) * inv_sum);
+	}
+}
+
+// The same for fp16 taps. We work on an fp32 copy (fp16 to fp32 is exact),
+// but round back to fp16 after each pass, as that is what will be stored
+// in the end. Converting all rows at once lets the conversions run at
+// full SIMD width even when the rows are short.
+void normalize_sum(Tap<fp16_int_t>* vals, unsigned num, unsigned num_rows)
+{
+	Tap<float> *vals_fp32 = new Tap<float>[num * num_rows];
+	for (int normalize_pass = 0; normalize_pass < 2; ++normalize_pass) {
+		unpack_taps(vals, vals_fp32, num * num_rows);
+		for (unsigned y = 0; y < num_rows; ++y) {
+			scale_weights(vals_fp32 + y * num, num, 1.0 / sum_weights(vals_fp32 + y * num, num));
 		}
+		pack_taps(vals_fp32, vals, num * num_rows);
 	}
+	delete[] vals_fp32;
 }
 
 // Make use of the bilinear filtering in the GPU to reduce the number of samples
@@ -219,25 +463,31 @@ unsigned combine_many_samples(const Tap<float> *weights, unsigned src_size, unsi
 
 	unsigned max_samples_saved = UINT_MAX;
 	for (unsigned y = 0; y < dst_samples && max_samples_saved > 0; ++y) {
-		unsigned num_samples_saved = combine_samples<DestFloat>(weights + y * src_samples, NULL, num_subtexels, inv_num_subtexels, src_samples, max_samples_saved);
+		unsigned num_samples_saved = combine_samples<DestFloat>(weights + y * src_samples, NULL, NULL, num_subtexels, inv_num_subtexels, src_samples, max_samples_saved);
 		max_samples_saved = min(max_samples_saved, num_samples_saved);
 	}
 
 	// Now that we know the right width, actually combine the samples.
+	// The weights are converted to the destination format up-front,
+	// so that samples that are not combined can simply be copied.
 	unsigned src_bilinear_samples = src_samples - max_samples_saved;
 	*bilinear_weights = new Tap<DestFloat>[dst_samples * src_bilinear_samples];
+	Tap<DestFloat> *packed_weights = new Tap<DestFloat>[dst_samples * src_samples];
+	pack_taps(weights, packed_weights, dst_samples * src_samples);
 	for (unsigned y = 0; y < dst_samples; ++y) {
 		Tap<DestFloat> *bilinear_weights_ptr = *bilinear_weights + y * src_bilinear_samples;
 		unsigned num_samples_saved = combine_samples(
 			weights + y * src_samples,
+			packed_weights + y * src_samples,
 			bilinear_weights_ptr,
 			num_subtexels,
 			inv_num_subtexels,
 			src_samples,
 			max_samples_saved);
 		assert(num_samples_saved == max_samples_saved);
-		normalize_sum(bilinear_weights_ptr, src_bilinear_samples);
 	}
+	delete[] packed_weights;
+	normalize_sum(*bilinear_weights, src_bilinear_samples, dst_samples);
 	return src_bilinear_samples;
 }
 
@@ -247,27 +497,29 @@ unsigned combine_many_samples(const Tap<float> *weights, unsigned src_size, unsi
 // is inaccuracy in the sampling positions, both due to limited precision
 // in storing them (already inherent in sending them in as fp16_int_t)
 // and in subtexel sampling precision (which we calculate in this function).
-template<class T>
 double compute_sum_sq_error(const Tap<float>* weights, unsigned num_weights,
-                            const Tap<T>* bilinear_weights, unsigned num_bilinear_weights,
+                            const Tap<float>* bilinear_weights, unsigned num_bilinear_weights,
                             unsigned size)
 {
 	// Find the effective range of the bilinear-optimized kernel.
 	// Due to rounding of the positions, this is not necessarily the same
 	// as the intended range (ie., the range of the original weights).
-	int lower_pos = int(floor(to_fp64(bilinear_weights[0].pos) * size - 0.5));
-	int upper_pos = int(ceil(to_fp64(bilinear_weights[num_bilinear_weights - 1].pos) * size - 0.5)) + 2;
+	int lower_pos = int(floor(bilinear_weights[0].pos * size - 0.5));
+	int upper_pos = int(ceil(bilinear_weights[num_bilinear_weights - 1].pos * size - 0.5)) + 2;
 	lower_pos = min<int>(lower_pos, lrintf(weights[0].pos * size - 0.5));
 	upper_pos = max<int>(upper_pos, lrintf(weights[num_weights - 1].pos * size - 0.5) + 1);
 
-	float* effective_weights = new float[upper_pos - lower_pos];
+	// This is called once for every row, so avoid going to the heap
+	// for the common case of not too many samples.
+	float effective_weights_buf[64];
+	float* effective_weights = (upper_pos - lower_pos <= 64) ? effective_weights_buf : new float[upper_pos - lower_pos];
 	for (int i = 0; i < upper_pos - lower_pos; ++i) {
 		effective_weights[i] = 0.0f;
 	}
 
 	// Now find the effective weights that result from this sampling.
 	for (unsigned i = 0; i < num_bilinear_weights; ++i) {
-		const float pixel_pos = to_fp64(bilinear_weights[i].pos) * size - 0.5f;
+		const float pixel_pos = bilinear_weights[i].pos * size - 0.5f;
 		const int x0 = int(floor(pixel_pos)) - lower_pos;
 		const int x1 = x0 + 1;
 		const float f = lrintf((pixel_pos - (x0 + lower_pos)) / movit_texel_subpixel_precision) * movit_texel_subpixel_precision;
@@ -277,8 +529,8 @@ double compute_sum_sq_error(const Tap<float>* weights, unsigned num_weights,
 		assert(x0 < upper_pos - lower_pos);
 		assert(x1 < upper_pos - lower_pos);
 
-		effective_weights[x0] += to_fp64(bilinear_weights[i].weight) * (1.0 - f);
-		effective_weights[x1] += to_fp64(bilinear_weights[i].weight) * f;
+		effective_weights[x0] += bilinear_weights[i].weight * (1.0 - f);
+		effective_weights[x1] += bilinear_weights[i].weight * f;
 	}
 
 	// Subtract the desired weights to get the error.
@@ -295,12 +547,413 @@ double compute_sum_sq_error(const Tap<float>* weights, unsigned num_weights,
 		sum_sq_error += effective_weights[i] * effective_weights[i];
 	}
 
-	delete[] effective_weights;
+	if (effective_weights != effective_weights_buf) {
+		delete[] effective_weights;
+	}
 	return sum_sq_error;
 }
 
+// The bilinear-optimized weights for one set of resampling parameters,
+// ready to be uploaded as a texture. For horizontal scaling, we use the
+// exact same texture as for vertical; the shader just interprets it differently.
+struct ScalingWeights {
+	unsigned src_samples;  // Before combining samples.
+	unsigned src_bilinear_samples;
+	unsigned dst_samples, num_loops;
+
+	// Exactly one of these is non-NULL, depending on whether fp16
+	// was precise enough to hold the weights.
+	Tap<fp16_int_t> *bilinear_weights_fp16;
+	Tap<float> *bilinear_weights_fp32;
+};
+
+// Everything a ScalingWeights depends on. Note that only the subpixel part
+// of the offset matters; whole pixels are taken care of in the shader.
+struct ScalingWeightsKey {
+	unsigned src_size, dst_size;
+	float zoom, subpixel_offset;
+
+	bool operator< (const ScalingWeightsKey &other) const
+	{
+		if (src_size != other.src_size) {
+			return src_size < other.src_size;
+		}
+		if (dst_size != other.dst_size) {
+			return dst_size < other.dst_size;
+		}
+		if (zoom != other.zoom) {
+			return zoom < other.zoom;
+		}
+		return subpixel_offset < other.subpixel_offset;
+	}
+};
+
+ScalingWeightsKey make_scaling_weights_key(unsigned src_size, unsigned dst_size, float zoom, float offset)
+{
+	ScalingWeightsKey key;
+	key.src_size = src_size;
+	key.dst_size = dst_size;
+	key.zoom = zoom;
+	key.subpixel_offset = offset - lrintf(offset);  // The part not covered by whole_pixel_offset.
+	return key;
+}
+
+// Using vertical scaling as an example:
+//
+// Generally out[y] = w0 * in[yi] + w1 * in[yi + 1] + w2 * in[yi + 2] + ...
+//
+// Obviously, yi will depend on y (in a not-quite-linear way), but so will
+// the weights w0, w1, w2, etc.. The easiest way of doing this is to encode,
+// for each sample, the weight and the yi value, e.g. <yi, w0>, <yi + 1, w1>,
+// and so on. For each y, we encode these along the x-axis (since that is spare),
+// so out[0] will read from parameters <x,y> = <0,0>, <1,0>, <2,0> and so on.
+ScalingWeights *calculate_scaling_weights(unsigned src_size, unsigned dst_size, float zoom, float subpixel_offset)
+{
+	// For many resamplings (e.g. 640 -> 1280), we will end up with the same
+	// set of samples over and over again in a loop. Thus, we can compute only
+	// the first such loop, and then ask the card to repeat the texture for us.
+	// This is both easier on the texture cache and lowers our CPU cost for
+	// generating the kernel somewhat.
+	unsigned num_loops;
+	float scaling_factor;
+	if (fabs(zoom - 1.0f) < 1e-6) {
+		num_loops = gcd(src_size, dst_size);
+		scaling_factor = float(dst_size) / float(src_size);
+	} else {
+		// If zooming is enabled (ie., zoom != 1), we turn off the looping.
+		// We _could_ perhaps do it for rational zoom levels (especially
+		// things like 2:1), but it doesn't seem to be worth it, given that
+		// the most common use case would seem to be varying the zoom
+		// from frame to frame.
+		num_loops = 1;
+		scaling_factor = zoom * float(dst_size) / float(src_size);
+	}
+	unsigned dst_samples = dst_size / num_loops;
+
+	// Sample the kernel in the right place. A diagram with a triangular kernel
+	// (corresponding to linear filtering, and obviously with radius 1)
+	// for easier ASCII art drawing:
+	//
+	//                *
+	//               / \                      |
+	//              /   \                     |
+	//             /     \                    |
+	//    x---x---x   x   x---x---x---x
+	//
+	// Scaling up (in this case, 2x) means sampling more densely:
+	//
+	//                *
+	//               / \                      |
+	//              /   \                     |
+	//             /     \                    |
+	//   x-x-x-x-x-x x x x-x-x-x-x-x-x-x
+	//
+	// When scaling up, any destination pixel will only be influenced by a few
+	// (in this case, two) neighboring pixels, and more importantly, the number
+	// will not be influenced by the scaling factor. (Note, however, that the
+	// pixel centers have moved, due to OpenGL's center-pixel convention.)
+	// The only thing that changes is the weights themselves, as the sampling
+	// points are at different distances from the original pixels.
+	//
+	// Scaling down is a different story:
+	//
+	//                *
+	//               / \                      |
+	//              /   \                     |
+	//             /     \                    |
+	//    --x------ x     --x-------x--
+	//
+	// Again, the pixel centers have moved in a maybe unintuitive fashion,
+	// although when you consider that there are multiple source pixels around,
+	// it's not so bad as at first look:
+	//
+	//            *   *   *   *
+	//           / \ / \ / \ / \              |
+	//          /   X   X   X   \             |
+	//         /   / \ / \ / \   \            |
+	//    --x-------x-------x-------x--
+	//
+	// As you can see, the new pixels become averages of the two neighboring old
+	// ones (the situation for Lanczos is of course more complex).
+	//
+	// Anyhow, in this case we clearly need to look at more source pixels
+	// to compute the destination pixel, and how many depend on the scaling factor.
+	// Thus, the kernel width will vary with how much we scale.
+	float radius_scaling_factor = min(scaling_factor, 1.0f);
+	int int_radius = lrintf(LANCZOS_RADIUS / radius_scaling_factor);
+	int src_samples = int_radius * 2 + 1;
+	Tap<float> *weights = new Tap<float>[dst_samples * src_samples];
+	assert(subpixel_offset >= -0.5f && subpixel_offset <= 0.5f);
+	compute_taps(dst_samples, src_samples, int_radius, scaling_factor, radius_scaling_factor, subpixel_offset, src_size, weights);
+
+	// Now make use of the bilinear filtering in the GPU to reduce the number of samples
+	// we need to make. Try fp16 first; if it's not accurate enough, we go to fp32.
+	// Our tolerance level for total error is a bit higher than the one for invididual
+	// samples, since one would assume overall errors in the shape don't matter as much.
+	const float max_error = 2.0f / (255.0f * 255.0f);
+	Tap<fp16_int_t> *bilinear_weights_fp16;
+	unsigned src_bilinear_samples = combine_many_samples(weights, src_size, src_samples, dst_samples, &bilinear_weights_fp16);
+	Tap<float> *bilinear_weights_fp32 = NULL;
+	double max_sum_sq_error_fp16 = 0.0;
+	Tap<float> *bilinear_weights_fp16_as_fp32 = new Tap<float>[dst_samples * src_bilinear_samples];
+	unpack_taps(bilinear_weights_fp16, bilinear_weights_fp16_as_fp32, dst_samples * src_bilinear_samples);
+	for (unsigned y = 0; y < dst_samples; ++y) {
+		double sum_sq_error_fp16 = compute_sum_sq_error(
+			weights + y * src_samples, src_samples,
+			bilinear_weights_fp16_as_fp32 + y * src_bilinear_samples, src_bilinear_samples,
+			src_size);
+		max_sum_sq_error_fp16 = std::max(max_sum_sq_error_fp16, sum_sq_error_fp16);
+		if (max_sum_sq_error_fp16 > max_error) {
+			break;
+		}
+	}
+	delete[] bilinear_weights_fp16_as_fp32;
+
+	if (max_sum_sq_error_fp16 > max_error) {
+		delete[] bilinear_weights_fp16;
+		bilinear_weights_fp16 = NULL;
+		src_bilinear_samples = combine_many_samples(weights, src_size, src_samples, dst_samples, &bilinear_weights_fp32);
+	}
+	delete[] weights;
+
+	ScalingWeights *ret = new ScalingWeights;
+	ret->src_samples = src_samples;
+	ret->src_bilinear_samples = src_bilinear_samples;
+	ret->dst_samples = dst_samples;
+	ret->num_loops = num_loops;
+	ret->bilinear_weights_fp16 = bilinear_weights_fp16;
+	ret->bilinear_weights_fp32 = bilinear_weights_fp32;
+	return ret;
+}
+
+// Computing the weights is fairly expensive, and the same parameters tend
+// to come up again and again (many scalers with the same settings, or zoom
+// and pan animations going back and forth), so we keep a process-wide cache
+// of them. Entries nobody is using are evicted, least recently used first,
+// once the cache goes above SCALING_WEIGHTS_CACHE_MAX_BYTES.
+#define SCALING_WEIGHTS_CACHE_MAX_BYTES (32 << 20)
+
+struct ScalingWeightsCacheEntry {
+	ScalingWeights *weights;
+	size_t bytes;
+	int refcount;
+	list<ScalingWeightsKey>::iterator lru_it;
+};
+
+// Protects all of the following. The containers are deliberately never freed,
+// so that the worker threads below can keep using them while the process exits.
+pthread_mutex_t scaling_weights_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+map<ScalingWeightsKey, ScalingWeightsCacheEntry> &scaling_weights_cache = *new map<ScalingWeightsKey, ScalingWeightsCacheEntry>;
+list<ScalingWeightsKey> &scaling_weights_lru = *new list<ScalingWeightsKey>;  // Most recently used first.
+size_t scaling_weights_cache_bytes = 0;
+
+// Must be called with scaling_weights_cache_lock held.
+void shrink_scaling_weights_cache()
+{
+	list<ScalingWeightsKey>::iterator lru_it = scaling_weights_lru.end();
+	while (scaling_weights_cache_bytes > SCALING_WEIGHTS_CACHE_MAX_BYTES &&
+	       lru_it != scaling_weights_lru.begin()) {
+		--lru_it;
+		map<ScalingWeightsKey, ScalingWeightsCacheEntry>::iterator cache_it = scaling_weights_cache.find(*lru_it);
+		assert(cache_it != scaling_weights_cache.end());
+		if (cache_it->second.refcount > 0) {
+			continue;
+		}
+		ScalingWeights *weights = cache_it->second.weights;
+		scaling_weights_cache_bytes -= cache_it->second.bytes;
+		delete[] weights->bilinear_weights_fp16;
+		delete[] weights->bilinear_weights_fp32;
+		delete weights;
+		scaling_weights_cache.erase(cache_it);
+		lru_it = scaling_weights_lru.erase(lru_it);
+	}
+}
+
+// Get the weights for the given parameters, computing them if they are not
+// already in the cache. Takes a reference to the cache entry, which keeps
+// it from being evicted; give it back with release_scaling_weights().
+const ScalingWeights *get_scaling_weights(const ScalingWeightsKey &key)
+{
+	pthread_mutex_lock(&scaling_weights_cache_lock);
+	map<ScalingWeightsKey, ScalingWeightsCacheEntry>::iterator cache_it = scaling_weights_cache.find(key);
+	if (cache_it == scaling_weights_cache.end()) {
+		// Compute without holding the lock, so that we do not block
+		// others that want different weights.
+		pthread_mutex_unlock(&scaling_weights_cache_lock);
+		ScalingWeights *weights = calculate_scaling_weights(key.src_size, key.dst_size, key.zoom, key.subpixel_offset);
+		pthread_mutex_lock(&scaling_weights_cache_lock);
+
+		cache_it = scaling_weights_cache.find(key);
+		if (cache_it != scaling_weights_cache.end()) {
+			// Somebody else computed the same weights in the meantime.
+			delete[] weights->bilinear_weights_fp16;
+			delete[] weights->bilinear_weights_fp32;
+			delete weights;
+		} else {
+			ScalingWeightsCacheEntry entry;
+			entry.weights = weights;
+			if (weights->bilinear_weights_fp16 != NULL) {
+				entry.bytes = weights->src_bilinear_samples * weights->dst_samples * sizeof(Tap<fp16_int_t>);
+			} else {
+				entry.bytes = weights->src_bilinear_samples * weights->dst_samples * sizeof(Tap<float>);
+			}
+			entry.refcount = 0;
+			entry.lru_it = scaling_weights_lru.insert(scaling_weights_lru.begin(), key);
+			cache_it = scaling_weights_cache.insert(make_pair(key, entry)).first;
+			scaling_weights_cache_bytes += entry.bytes;
+		}
+	}
+
+	// Mark as most recently used.
+	scaling_weights_lru.splice(scaling_weights_lru.begin(), scaling_weights_lru, cache_it->second.lru_it);
+	++cache_it->second.refcount;
+	const ScalingWeights *weights = cache_it->second.weights;
+
+	shrink_scaling_weights_cache();
+	pthread_mutex_unlock(&scaling_weights_cache_lock);
+	return weights;
+}
+
+// Like get_scaling_weights(), but never computes anything; returns NULL
+// if the weights are not in the cache (yet).
+const ScalingWeights *try_get_scaling_weights(const ScalingWeightsKey &key)
+{
+	pthread_mutex_lock(&scaling_weights_cache_lock);
+	const ScalingWeights *weights = NULL;
+	map<ScalingWeightsKey, ScalingWeightsCacheEntry>::iterator cache_it = scaling_weights_cache.find(key);
+	if (cache_it != scaling_weights_cache.end()) {
+		scaling_weights_lru.splice(scaling_weights_lru.begin(), scaling_weights_lru, cache_it->second.lru_it);
+		++cache_it->second.refcount;
+		weights = cache_it->second.weights;
+	}
+	pthread_mutex_unlock(&scaling_weights_cache_lock);
+	return weights;
+}
+
+void release_scaling_weights(const ScalingWeightsKey &key)
+{
+	pthread_mutex_lock(&scaling_weights_cache_lock);
+	map<ScalingWeightsKey, ScalingWeightsCacheEntry>::iterator cache_it = scaling_weights_cache.find(key);
+	assert(cache_it != scaling_weights_cache.end());
+	assert(cache_it->second.refcount > 0);
+	--cache_it->second.refcount;
+	shrink_scaling_weights_cache();
+	pthread_mutex_unlock(&scaling_weights_cache_lock);
+}
+
+// Weights can also be computed in the background, by a small pool of
+// worker threads that take keys off a queue and put the results into the
+// cache. Nobody ever waits for the workers, so they are detached and live
+// for as long as the process does. If requests come in faster than we can
+// compute them (e.g. a fast zoom), the oldest ones are simply dropped,
+// since they are the least likely to still be interesting.
+#define SCALING_WEIGHTS_MAX_WORKERS 4
+#define SCALING_WEIGHTS_MAX_QUEUED 64
+
+// Protected by scaling_weights_cache_lock.
+pthread_cond_t scaling_weights_queue_changed = PTHREAD_COND_INITIALIZER;
+deque<ScalingWeightsKey> &scaling_weights_queue = *new deque<ScalingWeightsKey>;
+set<ScalingWeightsKey> &scaling_weights_queued = *new set<ScalingWeightsKey>;  // Queued or being computed.
+bool scaling_weights_workers_started = false;
+
+void *scaling_weights_worker(void *)
+{
+	pthread_mutex_lock(&scaling_weights_cache_lock);
+	for ( ;; ) {
+		while (scaling_weights_queue.empty()) {
+			pthread_cond_wait(&scaling_weights_queue_changed, &scaling_weights_cache_lock);
+		}
+		ScalingWeightsKey key = scaling_weights_queue.front();
+		scaling_weights_queue.pop_front();
+		pthread_mutex_unlock(&scaling_weights_cache_lock);
+
+		get_scaling_weights(key);
+		release_scaling_weights(key);
+
+		pthread_mutex_lock(&scaling_weights_cache_lock);
+		scaling_weights_queued.erase(key);
+	}
+	return NULL;
+}
+
+// Must be called with scaling_weights_cache_lock held.
+void start_scaling_weights_workers()
+{
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int num_workers = max<int>(min<long>(num_cpus - 1, SCALING_WEIGHTS_MAX_WORKERS), 1);
+	for (int i = 0; i < num_workers; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, scaling_weights_worker, NULL) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+		pthread_detach(thread);
+	}
+	scaling_weights_workers_started = true;
+}
+
+// Ask for the given weights to be computed in the background,
+// unless they are already in the cache or on their way there.
+void request_scaling_weights(const ScalingWeightsKey &key)
+{
+	pthread_mutex_lock(&scaling_weights_cache_lock);
+	if (scaling_weights_cache.count(key) == 0 &&
+	    scaling_weights_queued.count(key) == 0) {
+		if (!scaling_weights_workers_started) {
+			start_scaling_weights_workers();
+		}
+		while (scaling_weights_queue.size() >= SCALING_WEIGHTS_MAX_QUEUED) {
+			scaling_weights_queued.erase(scaling_weights_queue.front());
+			scaling_weights_queue.pop_front();
+		}
+		scaling_weights_queue.push_back(key);
+		scaling_weights_queued.insert(key);
+		pthread_cond_signal(&scaling_weights_queue_changed);
+	}
+	pthread_mutex_unlock(&scaling_weights_cache_lock);
+}
+
 }  // namespace
 
+unsigned compute_lanczos_taps(unsigned src_size, unsigned dst_samples, float scaling_factor, float subpixel_offset,
+                              bool use_simd, vector<float> *taps)
+{
+	if (!lanczos_table_init_done) {
+		init_lanczos_table();
+	}
+	float radius_scaling_factor = min(scaling_factor, 1.0f);
+	int int_radius = lrintf(LANCZOS_RADIUS / radius_scaling_factor);
+	unsigned src_samples = int_radius * 2 + 1;
+	Tap<float> *weights = new Tap<float>[dst_samples * src_samples];
+	if (use_simd) {
+		compute_taps(dst_samples, src_samples, int_radius, scaling_factor, radius_scaling_factor, subpixel_offset, src_size, weights);
+	} else {
+		compute_taps_scalar(0, dst_samples, src_samples, int_radius, scaling_factor, radius_scaling_factor, subpixel_offset, src_size, weights);
+	}
+	taps->resize(dst_samples * src_samples * 2);
+	for (unsigned i = 0; i < dst_samples * src_samples; ++i) {
+		(*taps)[i * 2 + 0] = weights[i].weight;
+		(*taps)[i * 2 + 1] = weights[i].pos;
+	}
+	delete[] weights;
+	return src_samples;
+}
+
+unsigned compute_resampling_weights_uncached(unsigned src_size, unsigned dst_size, float zoom, float subpixel_offset)
+{
+	if (!lanczos_table_init_done) {
+		init_lanczos_table();
+	}
+	ScalingWeights *weights = calculate_scaling_weights(src_size, dst_size, zoom, subpixel_offset);
+
+	unsigned num_taps = weights->dst_samples * weights->src_samples;
+
+	delete[] weights->bilinear_weights_fp16;
+	delete[] weights->bilinear_weights_fp32;
+	delete weights;
+	return num_taps;
+}
+
 ResampleEffect::ResampleEffect()
 	: input_width(1280),
 	  input_height(720),
@@ -377,23 +1030,49 @@ void ResampleEffect::update_size()
 	update_offset_and_zoom();
 }
 
-void ResampleEffect::update_offset_and_zoom()
+void ResampleEffect::get_pass_offsets(float zoom_x, float zoom_y, float offset_x, float offset_y, float *hpass_offset, float *vpass_offset) const
 {
-	bool ok = true;
-
 	// Zoom from the right origin. (zoom_center is given in normalized coordinates,
 	// i.e. 0..1.)
 	float extra_offset_x = zoom_center_x * (1.0f - 1.0f / zoom_x) * input_width;
 	float extra_offset_y = (1.0f - zoom_center_y) * (1.0f - 1.0f / zoom_y) * input_height;
 
-	ok |= hpass->set_float("offset", extra_offset_x + offset_x);
-	ok |= vpass->set_float("offset", extra_offset_y - offset_y);  // Compensate for the bottom-left origin.
+	*hpass_offset = extra_offset_x + offset_x;
+	*vpass_offset = extra_offset_y - offset_y;  // Compensate for the bottom-left origin.
+}
+
+void ResampleEffect::update_offset_and_zoom()
+{
+	bool ok = true;
+
+	float hpass_offset, vpass_offset;
+	get_pass_offsets(zoom_x, zoom_y, offset_x, offset_y, &hpass_offset, &vpass_offset);
+
+	ok |= hpass->set_float("offset", hpass_offset);
+	ok |= vpass->set_float("offset", vpass_offset);
 	ok |= hpass->set_float("zoom", zoom_x);
 	ok |= vpass->set_float("zoom", zoom_y);
 
 	assert(ok);
 }
 
+void ResampleEffect::prewarm_weights(float zoom_x, float zoom_y, float left, float top)
+{
+	float hpass_offset, vpass_offset;
+	get_pass_offsets(zoom_x, zoom_y, left, top, &hpass_offset, &vpass_offset);
+	hpass->prewarm_weights(zoom_x, hpass_offset);
+	vpass->prewarm_weights(zoom_y, vpass_offset);
+}
+
+bool ResampleEffect::set_int(const string &key, int value) {
+	if (key == "async_weights") {
+		bool ok = hpass->set_int("async_weights", value);
+		ok &= vpass->set_int("async_weights", value);
+		return ok;
+	}
+	return Effect::set_int(key, value);
+}
+
 bool ResampleEffect::set_float(const string &key, float value) {
 	if (key == "width") {
 		output_width = value;
@@ -457,7 +1136,13 @@ SingleResamplePassEffect::SingleResamplePassEffect(ResampleEffect *parent)
 	  last_output_height(-1),
 	  last_offset(0.0 / 0.0),  // NaN.
 	  last_zoom(0.0 / 0.0),  // NaN.
-	  last_texture_width(-1), last_texture_height(-1)
+	  async_weights(0),
+	  src_bilinear_samples(0),
+	  texnum(0),
+	  texture_src_size(0),
+	  texture_dst_size(0),
+	  texture_offset(0.0f),
+	  waiting_for_weights(false)
 {
 	register_int("direction", (int *)&direction);
 	register_int("input_width", &input_width);
@@ -466,6 +1151,7 @@ SingleResamplePassEffect::SingleResamplePassEffect(ResampleEffect *parent)
 	register_int("output_height", &output_height);
 	register_float("offset", &offset);
 	register_float("zoom", &zoom);
+	register_int("async_weights", &async_weights);
 	register_uniform_sampler2d("sample_tex", &uniform_sample_tex);
 	register_uniform_int("num_samples", &uniform_num_samples);
 	register_uniform_float("num_loops", &uniform_num_loops);
@@ -474,8 +1160,6 @@ SingleResamplePassEffect::SingleResamplePassEffect(ResampleEffect *parent)
 	register_uniform_float("sample_x_offset", &uniform_sample_x_offset);
 	register_uniform_float("whole_pixel_offset", &uniform_whole_pixel_offset);
 
-	glGenTextures(1, &texnum);
-
 	if (!lanczos_table_init_done) {
 		// Could in theory race between two threads if we are unlucky,
 		// but that is harmless, since they'll write the same data.
@@ -485,7 +1169,9 @@ SingleResamplePassEffect::SingleResamplePassEffect(ResampleEffect *parent)
 
 SingleResamplePassEffect::~SingleResamplePassEffect()
 {
-	glDeleteTextures(1, &texnum);
+	if (texnum != 0) {
+		chain->get_resource_pool()->release_keyed_texture(texnum);
+	}
 }
 
 string SingleResamplePassEffect::output_fragment_shader()
@@ -495,194 +1181,170 @@ string SingleResamplePassEffect::output_fragment_shader()
 	return buf + read_file("resample_effect.frag");
 }
 
-// Using vertical scaling as an example:
-//
-// Generally out[y] = w0 * in[yi] + w1 * in[yi + 1] + w2 * in[yi + 2] + ...
-//
-// Obviously, yi will depend on y (in a not-quite-linear way), but so will
-// the weights w0, w1, w2, etc.. The easiest way of doing this is to encode,
-// for each sample, the weight and the yi value, e.g. <yi, w0>, <yi + 1, w1>,
-// and so on. For each y, we encode these along the x-axis (since that is spare),
-// so out[0] will read from parameters <x,y> = <0,0>, <1,0>, <2,0> and so on.
-//
-// For horizontal scaling, we fill in the exact same texture;
-// the shader just interprets it differently.
-void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+bool SingleResamplePassEffect::has_compute_shader() const
+{
+	// Lines whose input does not fit in the tile still work (see
+	// resample_effect.comp), but if even scaling up would not fit,
+	// the compute shader has nothing to gain.
+	return movit_compute_shaders_supported &&
+		get_compute_tile_capacity() >= 2 * compute_tile_length &&
+		compute_tile_length * compute_num_lines <= unsigned(movit_max_compute_work_group_invocations);
+}
+
+string SingleResamplePassEffect::output_compute_shader()
+{
+	register_uniform_float("src_size", &uniform_src_size);
+
+	char buf[256];
+	sprintf(buf, "#define DIRECTION_VERTICAL %d\n#define RESAMPLE_TILE_LENGTH %u\n#define RESAMPLE_NUM_LINES %u\n#define RESAMPLE_TILE_CAPACITY %u\n",
+		(direction == VERTICAL), compute_tile_length, compute_num_lines, get_compute_tile_capacity());
+	return buf + read_file("resample_effect.comp");
+}
+
+void SingleResamplePassEffect::get_compute_dimensions(unsigned output_width, unsigned output_height,
+                                                      unsigned *x, unsigned *y, unsigned *z) const
+{
+	if (direction == VERTICAL) {
+		*x = (output_width + compute_num_lines - 1) / compute_num_lines;
+		*y = (output_height + compute_tile_length - 1) / compute_tile_length;
+	} else {
+		*x = (output_width + compute_tile_length - 1) / compute_tile_length;
+		*y = (output_height + compute_num_lines - 1) / compute_num_lines;
+	}
+	*z = 1;
+}
+
+void SingleResamplePassEffect::get_sizes(unsigned *src_size, unsigned *dst_size) const
 {
-	unsigned src_size, dst_size;
 	if (direction == SingleResamplePassEffect::HORIZONTAL) {
 		assert(input_height == output_height);
-		src_size = input_width;
-		dst_size = output_width;
+		*src_size = input_width;
+		*dst_size = output_width;
 	} else if (direction == SingleResamplePassEffect::VERTICAL) {
 		assert(input_width == output_width);
-		src_size = input_height;
-		dst_size = output_height;
+		*src_size = input_height;
+		*dst_size = output_height;
 	} else {
 		assert(false);
 	}
+}
 
-	// For many resamplings (e.g. 640 -> 1280), we will end up with the same
-	// set of samples over and over again in a loop. Thus, we can compute only
-	// the first such loop, and then ask the card to repeat the texture for us.
-	// This is both easier on the texture cache and lowers our CPU cost for
-	// generating the kernel somewhat.
-	float scaling_factor;
-	if (fabs(zoom - 1.0f) < 1e-6) {
-		num_loops = gcd(src_size, dst_size);
-		scaling_factor = float(dst_size) / float(src_size);
-	} else {
-		// If zooming is enabled (ie., zoom != 1), we turn off the looping.
-		// We _could_ perhaps do it for rational zoom levels (especially
-		// things like 2:1), but it doesn't seem to be worth it, given that
-		// the most common use case would seem to be varying the zoom
-		// from frame to frame.
-		num_loops = 1;
-		scaling_factor = zoom * float(dst_size) / float(src_size);
-	}
-	slice_height = 1.0f / num_loops;
-	unsigned dst_samples = dst_size / num_loops;
-
-	// Sample the kernel in the right place. A diagram with a triangular kernel
-	// (corresponding to linear filtering, and obviously with radius 1)
-	// for easier ASCII art drawing:
-	//
-	//                *
-	//               / \                      |
-	//              /   \                     |
-	//             /     \                    |
-	//    x---x---x   x   x---x---x---x
-	//
-	// Scaling up (in this case, 2x) means sampling more densely:
-	//
-	//                *
-	//               / \                      |
-	//              /   \                     |
-	//             /     \                    |
-	//   x-x-x-x-x-x x x x-x-x-x-x-x-x-x
-	//
-	// When scaling up, any destination pixel will only be influenced by a few
-	// (in this case, two) neighboring pixels, and more importantly, the number
-	// will not be influenced by the scaling factor. (Note, however, that the
-	// pixel centers have moved, due to OpenGL's center-pixel convention.)
-	// The only thing that changes is the weights themselves, as the sampling
-	// points are at different distances from the original pixels.
-	//
-	// Scaling down is a different story:
-	//
-	//                *
-	//               / \                      |
-	//              /   \                     |
-	//             /     \                    |
-	//    --x------ x     --x-------x--
-	//
-	// Again, the pixel centers have moved in a maybe unintuitive fashion,
-	// although when you consider that there are multiple source pixels around,
-	// it's not so bad as at first look:
-	//
-	//            *   *   *   *
-	//           / \ / \ / \ / \              |
-	//          /   X   X   X   \             |
-	//         /   / \ / \ / \   \            |
-	//    --x-------x-------x-------x--
-	//
-	// As you can see, the new pixels become averages of the two neighboring old
-	// ones (the situation for Lanczos is of course more complex).
-	//
-	// Anyhow, in this case we clearly need to look at more source pixels
-	// to compute the destination pixel, and how many depend on the scaling factor.
-	// Thus, the kernel width will vary with how much we scale.
-	float radius_scaling_factor = min(scaling_factor, 1.0f);
-	int int_radius = lrintf(LANCZOS_RADIUS / radius_scaling_factor);
-	int src_samples = int_radius * 2 + 1;
-	Tap<float> *weights = new Tap<float>[dst_samples * src_samples];
-	float subpixel_offset = offset - lrintf(offset);  // The part not covered by whole_pixel_offset.
-	assert(subpixel_offset >= -0.5f && subpixel_offset <= 0.5f);
-	for (unsigned y = 0; y < dst_samples; ++y) {
-		// Find the point around which we want to sample the source image,
-		// compensating for differing pixel centers as the scale changes.
-		float center_src_y = (y + 0.5f) / scaling_factor - 0.5f;
-		int base_src_y = lrintf(center_src_y);
+void SingleResamplePassEffect::prewarm_weights(float zoom, float offset)
+{
+	unsigned src_size, dst_size;
+	get_sizes(&src_size, &dst_size);
+	request_scaling_weights(make_scaling_weights_key(src_size, dst_size, zoom, offset));
+}
 
-		// Now sample <int_radius> pixels on each side around that point.
-		for (int i = 0; i < src_samples; ++i) {
-			int src_y = base_src_y + i - int_radius;
-			float weight = lanczos_weight_cached(radius_scaling_factor * (src_y - center_src_y - subpixel_offset));
-			weights[y * src_samples + i].weight = weight * radius_scaling_factor;
-			weights[y * src_samples + i].pos = (src_y + 0.5) / float(src_size);
+void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	unsigned src_size, dst_size;
+	get_sizes(&src_size, &dst_size);
+
+	ScalingWeightsKey key = make_scaling_weights_key(src_size, dst_size, zoom, offset);
+	float weights_offset = offset;
+	const ScalingWeights *weights;
+	if (async_weights && texnum != 0 &&
+	    src_size == texture_src_size && dst_size == texture_dst_size) {
+		// Don't compute the weights on the render thread; have them computed
+		// in the background, and keep using the newest weights we have until
+		// they are done. (If the size changed, the old weights would be
+		// not just slightly off but wrong, so then we have to wait.)
+		weights = try_get_scaling_weights(key);
+		if (weights == NULL) {
+			request_scaling_weights(key);
+
+			// What we asked for last time might be done by now, though,
+			// and that would still be better than what we have.
+			if (waiting_for_weights && (pending_zoom != zoom || pending_offset != offset)) {
+				ScalingWeightsKey pending_key = make_scaling_weights_key(src_size, dst_size, pending_zoom, pending_offset);
+				weights = try_get_scaling_weights(pending_key);
+				if (weights != NULL) {
+					key = pending_key;
+					weights_offset = pending_offset;
+				}
+			}
+			waiting_for_weights = true;
+			pending_zoom = zoom;
+			pending_offset = offset;
+			if (weights == NULL) {
+				return;
+			}
+		} else {
+			waiting_for_weights = false;
 		}
+	} else {
+		weights = get_scaling_weights(key);
+		waiting_for_weights = false;
 	}
 
-	// Now make use of the bilinear filtering in the GPU to reduce the number of samples
-	// we need to make. Try fp16 first; if it's not accurate enough, we go to fp32.
-	// Our tolerance level for total error is a bit higher than the one for invididual
-	// samples, since one would assume overall errors in the shape don't matter as much.
-	const float max_error = 2.0f / (255.0f * 255.0f);
-	Tap<fp16_int_t> *bilinear_weights_fp16;
-	src_bilinear_samples = combine_many_samples(weights, src_size, src_samples, dst_samples, &bilinear_weights_fp16);
-	Tap<float> *bilinear_weights_fp32 = NULL;
-	bool fallback_to_fp32 = false;
-	double max_sum_sq_error_fp16 = 0.0;
-	for (unsigned y = 0; y < dst_samples; ++y) {
-		double sum_sq_error_fp16 = compute_sum_sq_error(
-			weights + y * src_samples, src_samples,
-			bilinear_weights_fp16 + y * src_bilinear_samples, src_bilinear_samples,
-			src_size);
-		max_sum_sq_error_fp16 = std::max(max_sum_sq_error_fp16, sum_sq_error_fp16);
-		if (max_sum_sq_error_fp16 > max_error) {
-			break;
+	src_bilinear_samples = weights->src_bilinear_samples;
+	num_loops = weights->num_loops;
+	slice_height = 1.0f / num_loops;
+	texture_src_size = src_size;
+	texture_dst_size = dst_size;
+	texture_offset = weights_offset;
+
+	// Other effects sharing our ResourcePool may already have uploaded
+	// the same weights, in which case we can just use their texture.
+	char texture_key[256];
+	snprintf(texture_key, sizeof(texture_key), "SingleResamplePassEffect %u %u %a %a",
+		key.src_size, key.dst_size, key.zoom, key.subpixel_offset);
+	ResourcePool *resource_pool = chain->get_resource_pool();
+	GLuint new_texnum = resource_pool->acquire_keyed_texture(texture_key);
+	if (new_texnum == 0) {
+		GLenum type, internal_format;
+		const void *pixels;
+		if (weights->bilinear_weights_fp32 != NULL) {
+			type = GL_FLOAT;
+			internal_format = GL_RG32F;
+			pixels = weights->bilinear_weights_fp32;
+		} else {
+			type = GL_HALF_FLOAT;
+			internal_format = GL_RG16F;
+			pixels = weights->bilinear_weights_fp16;
 		}
-	}
 
-	if (max_sum_sq_error_fp16 > max_error) {
-		fallback_to_fp32 = true;
-		src_bilinear_samples = combine_many_samples(weights, src_size, src_samples, dst_samples, &bilinear_weights_fp32);
-	}
+		// Uploaded straight from the cached weights; going through a PBO
+		// would only add a copy, since the weights are already in memory
+		// and a new texture is only needed when they change.
 
-	// Encode as a two-component texture. Note the GL_REPEAT.
-	glActiveTexture(GL_TEXTURE0 + *sampler_num);
-	check_error();
-	glBindTexture(GL_TEXTURE_2D, texnum);
-	check_error();
-	if (last_texture_width == -1) {
-		// Need to set this state the first time.
+		// Encode as a two-component texture. Note the GL_REPEAT.
+		glGenTextures(1, &new_texnum);
+		check_error();
+		glActiveTexture(GL_TEXTURE0 + *sampler_num);
+		check_error();
+		glBindTexture(GL_TEXTURE_2D, new_texnum);
+		check_error();
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		check_error();
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		check_error();
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		check_error();
-	}
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, weights->src_bilinear_samples, weights->dst_samples, 0, GL_RG, type, pixels);
+		check_error();
 
-	GLenum type, internal_format;
-	void *pixels;
-	if (fallback_to_fp32) {
-		type = GL_FLOAT;
-		internal_format = GL_RG32F;
-		pixels = bilinear_weights_fp32;
-	} else {
-		type = GL_HALF_FLOAT;
-		internal_format = GL_RG16F;
-		pixels = bilinear_weights_fp16;
+		new_texnum = resource_pool->add_keyed_texture(
+			texture_key, new_texnum, internal_format, weights->src_bilinear_samples, weights->dst_samples);
 	}
+	release_scaling_weights(key);
 
-	if (int(src_bilinear_samples) == last_texture_width &&
-	    int(dst_samples) == last_texture_height &&
-	    internal_format == last_texture_internal_format) {
-		// Texture dimensions and type are unchanged; it is more efficient
-		// to just update it rather than making an entirely new texture.
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, src_bilinear_samples, dst_samples, GL_RG, type, pixels);
-	} else {
-		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, src_bilinear_samples, dst_samples, 0, GL_RG, type, pixels);
-		last_texture_width = src_bilinear_samples;
-		last_texture_height = dst_samples;
-		last_texture_internal_format = internal_format;
+	if (texnum != 0) {
+		resource_pool->release_keyed_texture(texnum);
 	}
-	check_error();
+	texnum = new_texnum;
+}
 
-	delete[] weights;
-	delete[] bilinear_weights_fp16;
-	delete[] bilinear_weights_fp32;
+float SingleResamplePassEffect::input_samples_per_pixel() const
+{
+	// The exact number is only known once the weights have been computed.
+	// Until then, assume the six taps of an unscaled Lanczos-3 kernel,
+	// roughly halved by the bilinear sampling (see combine_many_samples()).
+	if (src_bilinear_samples > 0) {
+		return src_bilinear_samples;
+	}
+	return 4.0f;
 }
 
 void SingleResamplePassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
@@ -699,7 +1361,8 @@ void SingleResamplePassEffect::set_gl_state(GLuint glsl_program_num, const strin
 	    output_width != last_output_width ||
 	    output_height != last_output_height ||
 	    offset != last_offset ||
-	    zoom != last_zoom) {
+	    zoom != last_zoom ||
+	    waiting_for_weights) {
 		update_texture(glsl_program_num, prefix, sampler_num);
 		last_input_width = input_width;
 		last_input_height = input_height;
@@ -725,9 +1388,11 @@ void SingleResamplePassEffect::set_gl_state(GLuint glsl_program_num, const strin
 	uniform_sample_x_offset = 0.5f / src_bilinear_samples;
 
 	if (direction == SingleResamplePassEffect::VERTICAL) {
-		uniform_whole_pixel_offset = lrintf(offset) / float(input_height);
+		uniform_whole_pixel_offset = lrintf(texture_offset) / float(input_height);
+		uniform_src_size = input_height;
 	} else {
-		uniform_whole_pixel_offset = lrintf(offset) / float(input_width);
+		uniform_whole_pixel_offset = lrintf(texture_offset) / float(input_width);
+		uniform_src_size = input_width;
 	}
 
 	// We specifically do not want mipmaps on the input texture;
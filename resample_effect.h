@@ -14,11 +14,22 @@
 // Works in two passes; first horizontal, then vertical (ResampleEffect,
 // which is what the user is intended to use, instantiates two copies of
 // SingleResamplePassEffect behind the scenes).
+//
+// Changing the zoom or offset means computing new filter weights, which is
+// done on the CPU, and by default synchronously when the frame is rendered.
+// If you animate these parameters, you can set "async_weights" to 1 instead;
+// the weights will then be computed by background threads, and until they
+// are ready, the effect will keep using the newest weights it has (ie., it
+// will lag slightly behind the parameters you asked for). Set it back to 0
+// for a frame where you need the exact result. prewarm_weights() lets you
+// get the computation going ahead of time if you know what values are
+// coming up.
 
 #include <epoxy/gl.h>
 #include <assert.h>
 #include <stddef.h>
 #include <string>
+#include <vector>
 
 #include "effect.h"
 
@@ -49,11 +60,20 @@ public:
 	}
 
 	virtual void rewrite_graph(EffectChain *graph, Node *self);
+	virtual bool set_int(const std::string &key, int value);
 	virtual bool set_float(const std::string &key, float value);
+
+	// Start computing the weights for the given zoom and "left"/"top"
+	// values in the background (see above). Uses the current width, height
+	// and zoom center. The input size is not known until the chain has been
+	// finalized, so call this after finalize(); call it once for every set
+	// of values you expect to need.
+	void prewarm_weights(float zoom_x, float zoom_y, float left, float top);
 	
 private:
 	void update_size();
 	void update_offset_and_zoom();
+	void get_pass_offsets(float zoom_x, float zoom_y, float offset_x, float offset_y, float *hpass_offset, float *vpass_offset) const;
 	
 	SingleResamplePassEffect *hpass, *vpass;
 	int input_width, input_height, output_width, output_height;
@@ -75,10 +95,26 @@ public:
 
 	std::string output_fragment_shader();
 
+	// See resample_effect.comp. As for the blur passes, EffectChain only
+	// uses it if the pass is the output of a phase that is not the last
+	// one; the vertical pass usually shares its phase with whatever comes
+	// after the resample (or renders to the final output), so in most
+	// chains, only the horizontal pass runs as a compute shader.
+	virtual bool has_compute_shader() const;
+	std::string output_compute_shader();
+	virtual void get_compute_dimensions(unsigned output_width, unsigned output_height,
+	                                    unsigned *x, unsigned *y, unsigned *z) const;
+
 	virtual bool needs_texture_bounce() const { return true; }
 	virtual bool needs_srgb_primaries() const { return false; }
 	virtual AlphaHandling alpha_handling() const { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
 
+	// Every sample reads its weight and position from the weight
+	// texture, and then the input; see resample_effect.frag.
+	virtual float estimated_alu_cost() const { return 4.0f * input_samples_per_pixel(); }
+	virtual float estimated_texture_fetches() const { return input_samples_per_pixel(); }
+	virtual float input_samples_per_pixel() const;
+
 	virtual void inform_added(EffectChain *chain) { this->chain = chain; }
 	virtual void inform_input_size(unsigned input_num, unsigned width, unsigned height) {
 		if (parent != NULL) {
@@ -94,31 +130,63 @@ public:
 	}
 
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
+
+	// See ResampleEffect::prewarm_weights().
+	void prewarm_weights(float zoom, float offset);
 	
 	enum Direction { HORIZONTAL = 0, VERTICAL = 1 };
 
 private:
+	void get_sizes(unsigned *src_size, unsigned *dst_size) const;
 	void update_texture(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
 
 	ResampleEffect *parent;
 	EffectChain *chain;
 	Direction direction;
-	GLuint texnum;
 	GLint uniform_sample_tex;
 	float uniform_num_loops, uniform_slice_height, uniform_sample_x_scale, uniform_sample_x_offset;
 	float uniform_whole_pixel_offset;
 	int uniform_num_samples;
+	float uniform_src_size;  // Only used by the compute shader.
 
 	int input_width, input_height, output_width, output_height;
 	float offset, zoom;
 	int last_input_width, last_input_height, last_output_width, last_output_height;
 	float last_offset, last_zoom;
+	int async_weights;
 	int src_bilinear_samples, num_loops;
 	float slice_height;
-	int last_texture_width, last_texture_height;
-	GLuint last_texture_internal_format;
+
+	// The weight texture, owned by the chain's ResourcePool (see
+	// ResourcePool::acquire_keyed_texture()). 0 if none yet.
+	GLuint texnum;
+
+	// What the weight texture was computed for. With async_weights,
+	// the zoom and offset can lag behind the ones we were asked for.
+	unsigned texture_src_size, texture_dst_size;
+	float texture_offset;
+
+	// If async_weights is set and the weights for the current parameters
+	// were not ready, the zoom and offset we are waiting for.
+	bool waiting_for_weights;
+	float pending_zoom, pending_offset;
 };
 
+// For unit tests only. Do not use from other code.
+// Computes the unnormalized Lanczos taps for the first <dst_samples> samples
+// of resampling from <src_size> pixels with the given scaling factor, as
+// (weight, position) pairs, sample by sample. If use_simd is false, uses
+// only the plain C++ code, which the SIMD versions must match.
+// Returns the number of taps per sample.
+unsigned compute_lanczos_taps(unsigned src_size, unsigned dst_samples, float scaling_factor, float subpixel_offset,
+                              bool use_simd, std::vector<float> *taps);
+
+// For unit tests and benchmarks only. Do not use from other code.
+// Computes the weights for resampling from src_size to dst_size pixels
+// along one axis from scratch, bypassing the cache, and throws them away.
+// Returns the number of Lanczos taps evaluated.
+unsigned compute_resampling_weights_uncached(unsigned src_size, unsigned dst_size, float zoom, float subpixel_offset);
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_RESAMPLE_EFFECT_H)
@@ -3,12 +3,17 @@
 #include <epoxy/gl.h>
 #include <gtest/gtest.h>
 #include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
 
 #include "effect_chain.h"
 #include "flat_input.h"
 #include "image_format.h"
+#include "init.h"
 #include "resample_effect.h"
 #include "test_util.h"
+#include "util.h"
 
 namespace movit {
 
@@ -367,6 +372,100 @@ TEST(ResampleEffectTest, Zoom) {
 	expect_equal(expected_data, out_data, width, height);
 }
 
+TEST(ResampleEffectTest, ZoomingBackAndForthGivesSameResult) {
+	const int width = 5;
+	const int height = 3;
+
+	float data[width * height] = {
+		0.0, 0.0, 0.0, 0.0, 0.0,
+		0.2, 0.4, 0.6, 0.4, 0.2,
+		0.0, 0.0, 0.0, 0.0, 0.0,
+	};
+	float expected_data[width * height] = {
+		0.0, 0.0,    0.0, 0.0,    0.0,
+		0.4, 0.5396, 0.6, 0.5396, 0.4,
+		0.0, 0.0,    0.0, 0.0,    0.0,
+	};
+	float out_data[width * height];
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *resample_effect = tester.get_chain()->add_effect(new ResampleEffect());
+	ASSERT_TRUE(resample_effect->set_int("width", width));
+	ASSERT_TRUE(resample_effect->set_int("height", height));
+
+	// The weights for zoom 2.0 will be cached after the first frame;
+	// make sure that we get the right ones back, and not the ones from
+	// the frame in between.
+	ASSERT_TRUE(resample_effect->set_float("zoom_x", 2.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+
+	ASSERT_TRUE(resample_effect->set_float("zoom_x", 1.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+
+	ASSERT_TRUE(resample_effect->set_float("zoom_x", 2.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+}
+
+TEST(ResampleEffectTest, AsyncWeightsAreExactWhenAskedFor) {
+	const int width = 5;
+	const int height = 3;
+
+	float data[width * height] = {
+		0.0, 0.0, 0.0, 0.0, 0.0,
+		0.2, 0.4, 0.6, 0.4, 0.2,
+		0.0, 0.0, 0.0, 0.0, 0.0,
+	};
+	float expected_data[width * height] = {
+		0.0, 0.0,    0.0, 0.0,    0.0,
+		0.4, 0.5396, 0.6, 0.5396, 0.4,
+		0.0, 0.0,    0.0, 0.0,    0.0,
+	};
+	float out_data[width * height];
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	ResampleEffect *resample_effect = new ResampleEffect();
+	tester.get_chain()->add_effect(resample_effect);
+	ASSERT_TRUE(resample_effect->set_int("width", width));
+	ASSERT_TRUE(resample_effect->set_int("height", height));
+	ASSERT_TRUE(resample_effect->set_int("async_weights", 1));
+
+	// There are no old weights to fall back to, so the first frame is exact.
+	ASSERT_TRUE(resample_effect->set_float("zoom_x", 2.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+
+	// This frame may or may not use the new weights, but should not crash.
+	resample_effect->prewarm_weights(1.5f, 1.0f, 0.0f, 0.0f);
+	ASSERT_TRUE(resample_effect->set_float("zoom_x", 1.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	// Soon, the background threads should be done, and the output
+	// should then be exactly what the synchronous path would give.
+	bool converged = false;
+	for (unsigned i = 0; i < 500 && !converged; ++i) {
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		converged = true;
+		for (unsigned j = 0; j < width * height; ++j) {
+			if (fabs(out_data[j] - data[j]) > 1e-3) {
+				converged = false;
+			}
+		}
+		if (!converged) {
+			usleep(10000);
+		}
+	}
+	EXPECT_TRUE(converged);
+	expect_equal(data, out_data, width, height);
+
+	// Turning off async_weights gives the exact result.
+	ASSERT_TRUE(resample_effect->set_int("async_weights", 0));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+}
+
 TEST(ResampleEffectTest, VerticalZoomFromTop) {
 	const int width = 5;
 	const int height = 5;
@@ -425,4 +524,170 @@ TEST(ResampleEffectTest, Precision) {
 	expect_equal(expected_data, out_data, size, 1);
 }
 
+// The SIMD versions of the weight computation (if compiled in) need to give
+// the same taps as the plain C++ code, also for the samples left over after
+// the last full SIMD vector, and for zooms and offsets that make the kernel
+// straddle the edges.
+TEST(ResampleEffectTest, SIMDTapsMatchScalar) {
+	const unsigned sizes[][2] = {
+		{ 1920, 3840 }, { 3840, 1280 }, { 1280, 720 }, { 720, 1281 }, { 17, 5 }, { 5, 17 },
+	};
+	const float zooms[] = { 1.0f, 1.37f, 0.5f, 2.9f };
+	const float offsets[] = { 0.0f, 0.25f, -0.4f, 0.5f };
+
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		for (unsigned j = 0; j < sizeof(zooms) / sizeof(zooms[0]); ++j) {
+			for (unsigned k = 0; k < sizeof(offsets) / sizeof(offsets[0]); ++k) {
+				const unsigned src_size = sizes[i][0], dst_size = sizes[i][1];
+				const float scaling_factor = zooms[j] * float(dst_size) / float(src_size);
+				std::vector<float> taps, expected_taps;
+				unsigned src_samples = compute_lanczos_taps(src_size, dst_size, scaling_factor, offsets[k], true, &taps);
+				compute_lanczos_taps(src_size, dst_size, scaling_factor, offsets[k], false, &expected_taps);
+				ASSERT_EQ(dst_size * src_samples * 2, taps.size());
+				ASSERT_EQ(expected_taps.size(), taps.size());
+
+				for (unsigned t = 0; t < dst_size * src_samples; ++t) {
+					// The weights may differ in the last bit, depending on
+					// whether the compiler fuses multiplies and adds in the
+					// scalar code; the positions are computed exactly alike.
+					EXPECT_NEAR(expected_taps[t * 2 + 0], taps[t * 2 + 0], 1e-6)
+						<< "src_size=" << src_size << " dst_size=" << dst_size
+						<< " zoom=" << zooms[j] << " offset=" << offsets[k] << " tap=" << t;
+					EXPECT_EQ(expected_taps[t * 2 + 1], taps[t * 2 + 1])
+						<< "src_size=" << src_size << " dst_size=" << dst_size
+						<< " zoom=" << zooms[j] << " offset=" << offsets[k] << " tap=" << t;
+				}
+			}
+		}
+	}
+}
+
+// The resample passes can run as compute shaders (see resample_effect.comp)
+// if they render to an intermediate texture, so put a bouncing effect after
+// the resample to get both of them that way, and compare against the
+// fragment shaders. The last case scales down so much that the input
+// for a row of output pixels does not fit in shared memory, so the
+// compute shader has to fall back to sampling the input directly.
+TEST(ResampleEffectTest, ComputeShaderMatchesFragmentShader) {
+	if (!movit_compute_shaders_supported) {
+		fprintf(stderr, "Skipping test; no support for compute shaders.\n");
+		return;
+	}
+
+	struct {
+		int swidth, sheight, dwidth, dheight;
+	} sizes[] = {
+		{ 64, 48, 150, 90 },
+		{ 64, 48, 37, 23 },
+		{ 1280, 8, 20, 8 },
+	};
+	for (unsigned size_idx = 0; size_idx < sizeof(sizes) / sizeof(sizes[0]); ++size_idx) {
+		const int swidth = sizes[size_idx].swidth, sheight = sizes[size_idx].sheight;
+		const int dwidth = sizes[size_idx].dwidth, dheight = sizes[size_idx].dheight;
+		std::vector<float> data(swidth * sheight);
+		for (int i = 0; i < swidth * sheight; ++i) {
+			data[i] = ((i * 7919) % 256) / 255.0f;
+		}
+
+		std::vector<float> out_data[2];
+		for (int use_compute = 0; use_compute < 2; ++use_compute) {
+			out_data[use_compute].resize(dwidth * dheight);
+			EffectChainTester tester(NULL, dwidth, dheight);
+			tester.get_chain()->enable_compute_shaders(use_compute);
+
+			ImageFormat format;
+			format.color_space = COLORSPACE_sRGB;
+			format.gamma_curve = GAMMA_LINEAR;
+
+			FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, swidth, sheight);
+			input->set_pixel_data(&data[0]);
+			tester.get_chain()->add_input(input);
+
+			Effect *resample_effect = tester.get_chain()->add_effect(new ResampleEffect());
+			ASSERT_TRUE(resample_effect->set_int("width", dwidth));
+			ASSERT_TRUE(resample_effect->set_int("height", dheight));
+			Effect *bounce_effect = tester.get_chain()->add_effect(new BouncingIdentityEffect());
+			tester.run(&out_data[use_compute][0], GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+			Node *vpass = tester.get_chain()->find_node_for_effect(bounce_effect)->incoming_links[0];
+			Node *hpass = vpass->incoming_links[0];
+			ASSERT_EQ("SingleResamplePassEffect", vpass->effect->effect_type_id());
+			ASSERT_EQ("SingleResamplePassEffect", hpass->effect->effect_type_id());
+			EXPECT_EQ(bool(use_compute), vpass->containing_phase->is_compute_shader);
+			EXPECT_EQ(bool(use_compute), hpass->containing_phase->is_compute_shader);
+		}
+		expect_equal(&out_data[0][0], &out_data[1][0], dwidth, dheight, 2e-3, 2e-4);
+	}
+}
+
+#ifdef HAVE_BENCHMARK
+
+// Computes new weights for one axis, as happens every frame when the zoom
+// is animated (which turns off looping, so that every destination sample
+// needs its own weights). Items processed is the number of Lanczos taps
+// evaluated, so that upscaling and downscaling can be compared.
+void BM_ResampleWeights(benchmark::State &state)
+{
+	CHECK(init_movit(".", MOVIT_DEBUG_OFF));
+	const unsigned src_size = state.range(0);
+	const unsigned dst_size = state.range(1);
+
+	size_t num_taps = 0;
+	while (state.KeepRunning()) {
+		num_taps += compute_resampling_weights_uncached(src_size, dst_size, 1.001f, 0.0f);
+	}
+	state.SetItemsProcessed(num_taps);
+}
+BENCHMARK(BM_ResampleWeights)
+	->ArgPair(1920, 3840)->ArgPair(1080, 2160)  // 1080p to 4K.
+	->ArgPair(3840, 1280)->ArgPair(2160, 720)  // 4K to 720p.
+	->Unit(benchmark::kMicrosecond);
+
+// Scaling a 1080p frame (args: output width, output height), with the
+// fragment shaders or the compute shaders. As in the test above, the resample
+// is followed by a bouncing effect, so that both passes can run as compute
+// shaders.
+void benchmark_resample(benchmark::State &state, bool use_compute)
+{
+	const int swidth = 1920, sheight = 1080;
+	const int dwidth = state.range(0), dheight = state.range(1);
+
+	std::vector<float> data(swidth * sheight * 4, 0.5f);
+	EffectChainTester tester(NULL, dwidth, dheight);
+	if (use_compute && !movit_compute_shaders_supported) {
+		state.SkipWithError("No support for compute shaders");
+		return;
+	}
+	tester.add_input(&data[0], FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, swidth, sheight);
+	tester.get_chain()->enable_compute_shaders(use_compute);
+
+	Effect *resample_effect = tester.get_chain()->add_effect(new ResampleEffect());
+	CHECK(resample_effect->set_int("width", dwidth));
+	CHECK(resample_effect->set_int("height", dheight));
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.benchmark(state, GL_RGBA16F, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+}
+
+void BM_ResampleEffect(benchmark::State &state)
+{
+	benchmark_resample(state, false);
+}
+BENCHMARK(BM_ResampleEffect)
+	->ArgPair(3840, 2160)  // Upscale to 4K.
+	->ArgPair(640, 360)  // Downscale by 3.
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
+
+void BM_ResampleEffectCompute(benchmark::State &state)
+{
+	benchmark_resample(state, true);
+}
+BENCHMARK(BM_ResampleEffectCompute)
+	->ArgPair(3840, 2160)
+	->ArgPair(640, 360)
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
+
+#endif
+
 }  // namespace movit
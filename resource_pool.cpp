@@ -1,11 +1,16 @@
 #include <assert.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <algorithm>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
+#include <vector>
 #include <epoxy/gl.h>
 
 #include "init.h"
@@ -16,15 +21,62 @@ using namespace std;
 
 namespace movit {
 
+namespace {
+
+// 64-bit FNV-1a. Only used for naming files in the program cache,
+// so it does not need to be strong.
+uint64_t fnv1a_hash(const string &str, uint64_t hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < str.size(); ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// The on-disk format of a cached program binary; the header is followed
+// by the GL identification string, the vertex shader, the fragment shader
+// and the binary itself. Native byte order, since the binaries are
+// not portable anyway.
+const char program_cache_magic[8] = { 'M', 'o', 'v', 'i', 't', 'P', 'B', '1' };
+struct ProgramCacheHeader {
+	char magic[8];
+	uint32_t binary_format;
+	uint32_t gl_id_length, vertex_shader_length, fragment_shader_length, binary_length;
+};
+
+bool read_string(FILE *fp, size_t length, string *str)
+{
+	str->resize(length);
+	return length == 0 || fread(&(*str)[0], length, 1, fp) == 1;
+}
+
+}  // namespace
+
 ResourcePool::ResourcePool(size_t program_freelist_max_length,
                            size_t texture_freelist_max_bytes,
                            size_t fbo_freelist_max_length)
 	: program_freelist_max_length(program_freelist_max_length),
 	  texture_freelist_max_bytes(texture_freelist_max_bytes),
 	  fbo_freelist_max_length(fbo_freelist_max_length),
-	  texture_freelist_bytes(0)
+	  program_cache_hits(0),
+	  program_cache_misses(0),
+	  texture_freelist_bytes(0),
+	  texture_freelist_hits(0),
+	  texture_freelist_misses(0),
+	  texture_freelist_evictions(0),
+	  total_texture_bytes(0),
+	  memory_budget_bytes(0),
+	  memory_pressure_callback(NULL),
+	  memory_pressure_callback_data(NULL),
+	  texture_context(NULL),
+	  multiple_texture_contexts(false),
+	  keyed_texture_freelist_bytes(0),
+	  fullscreen_vbo(0)
 {
-	pthread_mutex_init(&lock, NULL);
+	pthread_mutex_init(&program_lock, NULL);
+	pthread_mutex_init(&texture_lock, NULL);
+	pthread_mutex_init(&fbo_lock, NULL);
 }
 
 ResourcePool::~ResourcePool()
@@ -37,21 +89,26 @@ ResourcePool::~ResourcePool()
 		delete_program(*freelist_it);
 	}
 	assert(programs.empty());
-	assert(program_shaders.empty());
+	assert(program_info.empty());
 
-	for (list<GLuint>::const_iterator freelist_it = texture_freelist.begin();
-	     freelist_it != texture_freelist.end();
-	     ++freelist_it) {
-		GLuint free_texture_num = *freelist_it;
-		assert(texture_formats.count(free_texture_num) != 0);
-		texture_freelist_bytes -= estimate_texture_size(texture_formats[free_texture_num]);
+	while (!texture_freelist.empty()) {
+		GLuint free_texture_num = pop_oldest_freelist_texture();
 		texture_formats.erase(free_texture_num);
+		clear_fence(&texture_fences[free_texture_num]);
+		texture_fences.erase(free_texture_num);
 		glDeleteTextures(1, &free_texture_num);
 		check_error();
 	}
 	assert(texture_formats.empty());
+	assert(texture_fences.empty());
+	assert(texture_freelist_buckets.empty());
 	assert(texture_freelist_bytes == 0);
 
+	shrink_keyed_texture_freelist(0);
+	assert(keyed_textures.empty());
+	assert(keyed_texture_info.empty());
+	assert(keyed_texture_freelist_bytes == 0);
+
 	void *context = get_gl_context_identifier();
 	cleanup_unlinked_fbos(context);
 
@@ -74,13 +131,32 @@ ResourcePool::~ResourcePool()
 	}
 
 	assert(fbo_formats.empty());
+
+	shrink_vao_freelist(context, 0);
+	for (map<void *, std::list<VAOFormatIterator> >::iterator context_it = vao_freelist.begin();
+	     context_it != vao_freelist.end();
+	     ++context_it) {
+		// If this does not hold, the client should have called clean_context() earlier.
+		assert(context_it->second.empty());
+	}
+	assert(vao_formats.empty());
+
+	if (fullscreen_vbo != 0) {
+		glDeleteBuffers(1, &fullscreen_vbo);
+		check_error();
+	}
 }
 
 void ResourcePool::delete_program(GLuint glsl_program_num)
 {
+	map<GLuint, Program>::iterator info_it = program_info.find(glsl_program_num);
+	assert(info_it != program_info.end());
+
 	bool found_program = false;
-	for (map<pair<string, string>, GLuint>::iterator program_it = programs.begin();
-	     program_it != programs.end();
+	pair<multimap<uint64_t, GLuint>::iterator, multimap<uint64_t, GLuint>::iterator> range =
+		programs.equal_range(info_it->second.hash);
+	for (multimap<uint64_t, GLuint>::iterator program_it = range.first;
+	     program_it != range.second;
 	     ++program_it) {
 		if (program_it->second == glsl_program_num) {
 			programs.erase(program_it);
@@ -91,83 +167,436 @@ void ResourcePool::delete_program(GLuint glsl_program_num)
 	assert(found_program);
 	glDeleteProgram(glsl_program_num);
 
-	map<GLuint, pair<GLuint, GLuint> >::iterator shader_it =
-		program_shaders.find(glsl_program_num);
-	assert(shader_it != program_shaders.end());
+	// Programs loaded from the disk cache have no shaders (see
+	// compile_glsl_program()), but deleting shader 0 is a no-op.
+	glDeleteShader(info_it->second.vs_obj);
+	glDeleteShader(info_it->second.fs_obj);
+	program_info.erase(info_it);
+}
 
-	glDeleteShader(shader_it->second.first);
-	glDeleteShader(shader_it->second.second);
-	program_shaders.erase(shader_it);
+uint64_t ResourcePool::hash_program_sources(const string& vertex_shader, const string& fragment_shader)
+{
+	// Include the length of the vertex shader, so that moving text
+	// from the end of one to the start of the other changes the hash.
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%lu\n", (unsigned long)vertex_shader.size());
+	uint64_t hash = fnv1a_hash(buf);
+	hash = fnv1a_hash(vertex_shader, hash);
+	return fnv1a_hash(fragment_shader, hash);
 }
 
 GLuint ResourcePool::compile_glsl_program(const string& vertex_shader, const string& fragment_shader)
 {
-	GLuint glsl_program_num;
-	pthread_mutex_lock(&lock);
-	const pair<string, string> key(vertex_shader, fragment_shader);
-	if (programs.count(key)) {
-		// Already in the cache. Increment the refcount, or take it off the freelist
-		// if it's zero.
-		glsl_program_num = programs[key];
-		map<GLuint, int>::iterator refcount_it = program_refcount.find(glsl_program_num);
-		if (refcount_it != program_refcount.end()) {
-			++refcount_it->second;
-		} else {
-			list<GLuint>::iterator freelist_it =
-				find(program_freelist.begin(), program_freelist.end(), glsl_program_num);
-			assert(freelist_it != program_freelist.end());
-			program_freelist.erase(freelist_it);
-			program_refcount.insert(make_pair(glsl_program_num, 1));
+	return compile_glsl_program(vertex_shader, fragment_shader, hash_program_sources(vertex_shader, fragment_shader));
+}
+
+GLuint ResourcePool::compile_glsl_program(const string& vertex_shader, const string& fragment_shader, uint64_t hash)
+{
+	GLuint glsl_program_num = start_compile_glsl_program(vertex_shader, fragment_shader, hash);
+	finish_glsl_program(glsl_program_num);
+	return glsl_program_num;
+}
+
+GLuint ResourcePool::start_compile_glsl_compute_program(const string& compute_shader, uint64_t hash)
+{
+	assert(movit_compute_shaders_supported);
+	return start_compile_glsl_program("", compute_shader, hash);
+}
+
+GLuint ResourcePool::take_cached_program(const string& vertex_shader, const string& fragment_shader, uint64_t hash)
+{
+	// Look through everything with the same hash (normally at most one program)
+	// for one with exactly the same sources.
+	GLuint glsl_program_num = 0;
+	pair<multimap<uint64_t, GLuint>::const_iterator, multimap<uint64_t, GLuint>::const_iterator> range =
+		programs.equal_range(hash);
+	for (multimap<uint64_t, GLuint>::const_iterator program_it = range.first;
+	     program_it != range.second;
+	     ++program_it) {
+		const Program &program = program_info[program_it->second];
+		if (program.vertex_shader == vertex_shader &&
+		    program.fragment_shader == fragment_shader) {
+			glsl_program_num = program_it->second;
+			break;
 		}
+	}
+	if (glsl_program_num == 0) {
+		return 0;
+	}
+
+	// Increment the refcount, or take it off the freelist if it's zero.
+	map<GLuint, int>::iterator refcount_it = program_refcount.find(glsl_program_num);
+	if (refcount_it != program_refcount.end()) {
+		++refcount_it->second;
 	} else {
-		// Not in the cache. Compile the shaders.
+		list<GLuint>::iterator freelist_it =
+			find(program_freelist.begin(), program_freelist.end(), glsl_program_num);
+		assert(freelist_it != program_freelist.end());
+		program_freelist.erase(freelist_it);
+		program_refcount.insert(make_pair(glsl_program_num, 1));
+	}
+	return glsl_program_num;
+}
+
+GLuint ResourcePool::start_compile_glsl_program(const string& vertex_shader, const string& fragment_shader, uint64_t hash,
+                                                const vector<string>& fragment_shader_outputs)
+{
+	pthread_mutex_lock(&program_lock);
+	GLuint glsl_program_num = take_cached_program(vertex_shader, fragment_shader, hash);
+	if (glsl_program_num != 0) {
+		pthread_mutex_unlock(&program_lock);
+		return glsl_program_num;
+	}
+
+	// Not in the cache. See if we have it on disk; the file I/O is done
+	// without holding the lock, so that other threads can keep getting
+	// their programs from the pool in the meantime.
+	string cache_filename, gl_id;
+	if (!program_cache_directory.empty() && movit_program_binaries_supported) {
+		if (program_cache_gl_id.empty()) {
+			program_cache_gl_id = get_program_cache_gl_id();
+		}
+		cache_filename = get_program_cache_filename(hash);
+		gl_id = program_cache_gl_id;
+	}
+	if (!cache_filename.empty()) {
+		pthread_mutex_unlock(&program_lock);
+		glsl_program_num = load_program_from_disk_cache(cache_filename, gl_id, vertex_shader, fragment_shader);
+		pthread_mutex_lock(&program_lock);
+
+		// Someone else might have made the same program while we were
+		// loading; if so, use theirs.
+		GLuint other_program_num = take_cached_program(vertex_shader, fragment_shader, hash);
+		if (other_program_num != 0) {
+			pthread_mutex_unlock(&program_lock);
+			if (glsl_program_num != 0) {
+				glDeleteProgram(glsl_program_num);
+				check_error();
+			}
+			return other_program_num;
+		}
+
+		if (glsl_program_num != 0) {
+			++program_cache_hits;
+		} else {
+			++program_cache_misses;
+		}
+	}
+
+	// Or else compile the shaders.
+	GLuint vs_obj = 0, fs_obj = 0;
+	bool finished = (glsl_program_num != 0);
+	if (glsl_program_num == 0) {
+		// Only submit the work here; we check the results in
+		// finish_glsl_program(), so that the driver can work on
+		// several programs in parallel if it wants to.
 		glsl_program_num = glCreateProgram();
 		check_error();
-		GLuint vs_obj = compile_shader(vertex_shader, GL_VERTEX_SHADER);
-		check_error();
-		GLuint fs_obj = compile_shader(fragment_shader, GL_FRAGMENT_SHADER);
-		check_error();
-		glAttachShader(glsl_program_num, vs_obj);
-		check_error();
+		if (vertex_shader.empty()) {
+			// A compute program; see start_compile_glsl_compute_program().
+			fs_obj = start_compile_shader(fragment_shader, GL_COMPUTE_SHADER);
+			check_error();
+		} else {
+			vs_obj = start_compile_shader(vertex_shader, GL_VERTEX_SHADER);
+			check_error();
+			fs_obj = start_compile_shader(fragment_shader, GL_FRAGMENT_SHADER);
+			check_error();
+			glAttachShader(glsl_program_num, vs_obj);
+			check_error();
+		}
 		glAttachShader(glsl_program_num, fs_obj);
 		check_error();
+		if (fragment_shader_outputs.size() > 1 && epoxy_is_desktop_gl()) {
+			// Otherwise, the linker is free to map the outputs
+			// to draw buffers in any order it likes.
+			for (unsigned i = 0; i < fragment_shader_outputs.size(); ++i) {
+				glBindFragDataLocation(glsl_program_num, i, fragment_shader_outputs[i].c_str());
+				check_error();
+			}
+		}
+		if (!cache_filename.empty()) {
+			glProgramParameteri(glsl_program_num, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			check_error();
+		}
 		glLinkProgram(glsl_program_num);
 		check_error();
+	}
 
-		GLint success;
-		glGetProgramiv(glsl_program_num, GL_LINK_STATUS, &success);
-		if (success == GL_FALSE) {
-			GLchar error_log[1024] = {0};
-			glGetProgramInfoLog(glsl_program_num, 1024, NULL, error_log);
-			fprintf(stderr, "Error linking program: %s\n", error_log);
+	if (movit_debug_level == MOVIT_DEBUG_ON) {
+		// Output shader to a temporary file, for easier debugging.
+		static int compiled_shader_num = 0;
+		char filename[256];
+		sprintf(filename, "chain-%03d.%s", compiled_shader_num++,
+			vertex_shader.empty() ? "comp" : "frag");
+		FILE *fp = fopen(filename, "w");
+		if (fp == NULL) {
+			perror(filename);
 			exit(1);
 		}
+		fprintf(fp, "%s\n", fragment_shader.c_str());
+		fclose(fp);
+	}
 
-		if (movit_debug_level == MOVIT_DEBUG_ON) {
-			// Output shader to a temporary file, for easier debugging.
-			static int compiled_shader_num = 0;
-			char filename[256];
-			sprintf(filename, "chain-%03d.frag", compiled_shader_num++);
-			FILE *fp = fopen(filename, "w");
-			if (fp == NULL) {
-				perror(filename);
-				exit(1);
-			}
-			fprintf(fp, "%s\n", fragment_shader.c_str());
-			fclose(fp);
+	Program program;
+	program.vertex_shader = vertex_shader;
+	program.fragment_shader = fragment_shader;
+	program.hash = hash;
+	program.vs_obj = vs_obj;
+	program.fs_obj = fs_obj;
+	program.finished = finished;
+	program.cache_filename = finished ? "" : cache_filename;
+	programs.insert(make_pair(hash, glsl_program_num));
+	program_refcount.insert(make_pair(glsl_program_num, 1));
+	program_info.insert(make_pair(glsl_program_num, program));
+	pthread_mutex_unlock(&program_lock);
+	return glsl_program_num;
+}
+
+bool ResourcePool::is_glsl_program_ready(GLuint glsl_program_num)
+{
+	pthread_mutex_lock(&program_lock);
+	map<GLuint, Program>::const_iterator info_it = program_info.find(glsl_program_num);
+	assert(info_it != program_info.end());
+	GLint ready = GL_TRUE;
+	if (!info_it->second.finished && movit_parallel_shader_compile_supported) {
+		glGetProgramiv(glsl_program_num, GL_COMPLETION_STATUS_KHR, &ready);
+		check_error();
+	}
+	pthread_mutex_unlock(&program_lock);
+	return ready;
+}
+
+void ResourcePool::finish_glsl_program(GLuint glsl_program_num)
+{
+	pthread_mutex_lock(&program_lock);
+	map<GLuint, Program>::iterator info_it = program_info.find(glsl_program_num);
+	assert(info_it != program_info.end());
+	Program *program = &info_it->second;
+	if (program->finished) {
+		pthread_mutex_unlock(&program_lock);
+		return;
+	}
+
+	if (program->vs_obj != 0) {
+		check_shader_compiled(program->vs_obj, program->vertex_shader);
+	}
+	check_shader_compiled(program->fs_obj, program->fragment_shader);
+
+	GLint success;
+	glGetProgramiv(glsl_program_num, GL_LINK_STATUS, &success);
+	if (success == GL_FALSE) {
+		GLchar error_log[1024] = {0};
+		glGetProgramInfoLog(glsl_program_num, 1024, NULL, error_log);
+		fprintf(stderr, "Error linking program: %s\n", error_log);
+		exit(1);
+	}
+
+	program->finished = true;
+	if (program->cache_filename.empty()) {
+		pthread_mutex_unlock(&program_lock);
+		return;
+	}
+
+	// Write the binary to the disk cache without holding the lock.
+	// The caller holds a reference to the program, so it will not
+	// go away in the meantime.
+	string cache_filename;
+	swap(cache_filename, program->cache_filename);
+	string vertex_shader = program->vertex_shader;
+	string fragment_shader = program->fragment_shader;
+	string gl_id = program_cache_gl_id;
+	pthread_mutex_unlock(&program_lock);
+
+	save_program_to_disk_cache(glsl_program_num, cache_filename, gl_id, vertex_shader, fragment_shader);
+}
+
+void ResourcePool::set_program_cache_directory(const string &directory)
+{
+	pthread_mutex_lock(&program_lock);
+	program_cache_directory = directory;
+	pthread_mutex_unlock(&program_lock);
+}
+
+size_t ResourcePool::get_program_cache_hits()
+{
+	pthread_mutex_lock(&program_lock);
+	size_t ret = program_cache_hits;
+	pthread_mutex_unlock(&program_lock);
+	return ret;
+}
+
+size_t ResourcePool::get_program_cache_misses()
+{
+	pthread_mutex_lock(&program_lock);
+	size_t ret = program_cache_misses;
+	pthread_mutex_unlock(&program_lock);
+	return ret;
+}
+
+size_t ResourcePool::get_texture_freelist_hits()
+{
+	pthread_mutex_lock(&texture_lock);
+	size_t ret = texture_freelist_hits;
+	pthread_mutex_unlock(&texture_lock);
+	return ret;
+}
+
+size_t ResourcePool::get_texture_freelist_misses()
+{
+	pthread_mutex_lock(&texture_lock);
+	size_t ret = texture_freelist_misses;
+	pthread_mutex_unlock(&texture_lock);
+	return ret;
+}
+
+size_t ResourcePool::get_texture_freelist_evictions()
+{
+	pthread_mutex_lock(&texture_lock);
+	size_t ret = texture_freelist_evictions;
+	pthread_mutex_unlock(&texture_lock);
+	return ret;
+}
+
+size_t ResourcePool::get_texture_freelist_bytes()
+{
+	pthread_mutex_lock(&texture_lock);
+	size_t ret = texture_freelist_bytes;
+	pthread_mutex_unlock(&texture_lock);
+	return ret;
+}
+
+string ResourcePool::get_program_cache_gl_id()
+{
+	// The binaries are only valid for the same driver, so make sure
+	// everything identifying it is part of the key.
+	string gl_id;
+	const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		const GLubyte *str = glGetString(names[i]);
+		check_error();
+		if (str != NULL) {
+			gl_id += (const char *)str;
 		}
+		gl_id += '\n';
+	}
+	return gl_id;
+}
 
-		programs.insert(make_pair(key, glsl_program_num));
-		program_refcount.insert(make_pair(glsl_program_num, 1));
-		program_shaders.insert(make_pair(glsl_program_num, make_pair(vs_obj, fs_obj)));
+string ResourcePool::get_program_cache_filename(uint64_t source_hash)
+{
+	uint64_t hash = fnv1a_hash(program_cache_gl_id, source_hash);
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "/%016llx.bin", (unsigned long long)hash);
+	return program_cache_directory + buf;
+}
+
+GLuint ResourcePool::load_program_from_disk_cache(const string &filename, const string &expected_gl_id, const string &vertex_shader, const string &fragment_shader)
+{
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) {
+		return 0;
+	}
+	long file_size = -1;
+	if (fseek(fp, 0, SEEK_END) == 0) {
+		file_size = ftell(fp);
+	}
+	rewind(fp);
+
+	// The hash in the file name is not collision-proof, so we store
+	// the full key in the file and compare it. The file could also
+	// be truncated or otherwise damaged, so check that the lengths in
+	// the header add up to the file size before trusting them.
+	ProgramCacheHeader header;
+	string gl_id, file_vertex_shader, file_fragment_shader, binary;
+	bool ok = (file_size >= long(sizeof(header)) &&
+	           fread(&header, sizeof(header), 1, fp) == 1 &&
+	           memcmp(header.magic, program_cache_magic, sizeof(header.magic)) == 0);
+	if (ok) {
+		uint64_t total_size = uint64_t(sizeof(header)) +
+			header.gl_id_length + header.vertex_shader_length +
+			header.fragment_shader_length + header.binary_length;
+		ok = (total_size == uint64_t(file_size) &&
+		      read_string(fp, header.gl_id_length, &gl_id) &&
+		      read_string(fp, header.vertex_shader_length, &file_vertex_shader) &&
+		      read_string(fp, header.fragment_shader_length, &file_fragment_shader) &&
+		      read_string(fp, header.binary_length, &binary));
+	}
+	fclose(fp);
+	if (!ok ||
+	    gl_id != expected_gl_id ||
+	    file_vertex_shader != vertex_shader ||
+	    file_fragment_shader != fragment_shader) {
+		return 0;
+	}
+
+	GLuint glsl_program_num = glCreateProgram();
+	check_error();
+	glProgramBinary(glsl_program_num, header.binary_format, binary.data(), binary.size());
+
+	// The driver is free to reject the binary for any reason (in which case
+	// we just compile as usual), so we cannot use check_error() here.
+	GLenum err = glGetError();
+	GLint success = GL_FALSE;
+	glGetProgramiv(glsl_program_num, GL_LINK_STATUS, &success);
+	check_error();
+	if (err != GL_NO_ERROR || success == GL_FALSE) {
+		glDeleteProgram(glsl_program_num);
+		check_error();
+		return 0;
 	}
-	pthread_mutex_unlock(&lock);
 	return glsl_program_num;
 }
 
+void ResourcePool::save_program_to_disk_cache(GLuint glsl_program_num, const string &filename, const string &gl_id, const string &vertex_shader, const string &fragment_shader)
+{
+	GLint binary_length = 0;
+	glGetProgramiv(glsl_program_num, GL_PROGRAM_BINARY_LENGTH, &binary_length);
+	check_error();
+	if (binary_length <= 0) {
+		return;
+	}
+	vector<char> binary(binary_length);
+	GLenum binary_format;
+	GLsizei written_length = 0;
+	glGetProgramBinary(glsl_program_num, binary_length, &written_length, &binary_format, &binary[0]);
+	check_error();
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, program_cache_magic, sizeof(header.magic));
+	header.binary_format = binary_format;
+	header.gl_id_length = gl_id.size();
+	header.vertex_shader_length = vertex_shader.size();
+	header.fragment_shader_length = fragment_shader.size();
+	header.binary_length = written_length;
+
+	// Write to a temporary file and rename it into place, so that other
+	// processes using the same directory never see a half-written file.
+	char tmp_suffix[32];
+	snprintf(tmp_suffix, sizeof(tmp_suffix), ".tmp.%ld", (long)getpid());
+	string tmp_filename = filename + tmp_suffix;
+	FILE *fp = fopen(tmp_filename.c_str(), "wb");
+	if (fp == NULL) {
+		perror(tmp_filename.c_str());
+		return;
+	}
+	bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+	           fwrite(gl_id.data(), gl_id.size(), 1, fp) == 1 &&
+	           fwrite(vertex_shader.data(), vertex_shader.size(), 1, fp) == 1 &&
+	           fwrite(fragment_shader.data(), fragment_shader.size(), 1, fp) == 1 &&
+	           fwrite(&binary[0], written_length, 1, fp) == 1);
+	if (fclose(fp) != 0) {
+		ok = false;
+	}
+	if (!ok || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		perror(filename.c_str());
+		unlink(tmp_filename.c_str());
+	}
+}
+
 void ResourcePool::release_glsl_program(GLuint glsl_program_num)
 {
-	pthread_mutex_lock(&lock);
+	pthread_mutex_lock(&program_lock);
 	map<GLuint, int>::iterator refcount_it = program_refcount.find(glsl_program_num);
 	assert(refcount_it != program_refcount.end());
 
@@ -182,7 +611,7 @@ void ResourcePool::release_glsl_program(GLuint glsl_program_num)
 		}
 	}
 
-	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&program_lock);
 }
 
 GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLsizei height)
@@ -190,23 +619,52 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	assert(width > 0);
 	assert(height > 0);
 
-	pthread_mutex_lock(&lock);
-	// See if there's a texture on the freelist we can use.
-	for (list<GLuint>::iterator freelist_it = texture_freelist.begin();
-	     freelist_it != texture_freelist.end();
-	     ++freelist_it) {
-		GLuint texture_num = *freelist_it;
-		map<GLuint, Texture2D>::const_iterator format_it = texture_formats.find(texture_num);
-		assert(format_it != texture_formats.end());
-		if (format_it->second.internal_format == internal_format &&
-		    format_it->second.width == width &&
-		    format_it->second.height == height) {
-			texture_freelist_bytes -= estimate_texture_size(format_it->second);
+	pthread_mutex_lock(&texture_lock);
+	void *context = note_texture_context();
+	Texture2D texture_format;
+	texture_format.internal_format = internal_format;
+	texture_format.width = width;
+	texture_format.height = height;
+
+	// See if there's a texture on the freelist we can use; if so, take
+	// the most recently freed one, as it is the most likely to still be hot.
+	map<Texture2D, TextureBucket>::iterator bucket_it = texture_freelist_buckets.find(texture_format);
+	if (bucket_it != texture_freelist_buckets.end()) {
+		assert(!bucket_it->second.empty());
+		for (TextureBucket::iterator entry_it = bucket_it->second.begin();
+		     entry_it != bucket_it->second.end();
+		     ++entry_it) {
+			list<GLuint>::iterator freelist_it = *entry_it;
+			GLuint texture_num = *freelist_it;
+
+			// The last user could have been in a different context.
+			// If it released the texture before we knew about more
+			// than one context, there is no fence to wait for,
+			// so we cannot safely take it over.
+			map<GLuint, Fence>::iterator fence_it = texture_fences.find(texture_num);
+			assert(fence_it != texture_fences.end());
+			if (fence_it->second.context != context &&
+			    fence_it->second.sync == NULL &&
+			    movit_sync_objects_supported) {
+				continue;
+			}
+			wait_for_fence(fence_it->second);
+			clear_fence(&fence_it->second);
+			texture_fences.erase(fence_it);
+
 			texture_freelist.erase(freelist_it);
-			pthread_mutex_unlock(&lock);
+			bucket_it->second.erase(entry_it);
+			if (bucket_it->second.empty()) {
+				texture_freelist_buckets.erase(bucket_it);
+			}
+			texture_freelist_bytes -= estimate_texture_size(texture_format);
+			++texture_freelist_hits;
+
+			pthread_mutex_unlock(&texture_lock);
 			return texture_num;
 		}
 	}
+	++texture_freelist_misses;
 
 	// Find any reasonable format given the internal format; OpenGL validates it
 	// even though we give NULL as pointer.
@@ -216,6 +674,8 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_RGBA16F_ARB:
 	case GL_RGBA8:
 	case GL_SRGB8_ALPHA8:
+	case GL_RGB10_A2:
+	case GL_RGBA16:
 		format = GL_RGBA;
 		break;
 	case GL_RGB32F:
@@ -223,16 +683,19 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_RGB8:
 	case GL_SRGB8:
 	case GL_RGB565:
+	case GL_RGB16:
 		format = GL_RGB;
 		break;
 	case GL_RG32F:
 	case GL_RG16F:
 	case GL_RG8:
+	case GL_RG16:
 		format = GL_RG;
 		break;
 	case GL_R32F:
 	case GL_R16F:
 	case GL_R8:
+	case GL_R16:
 		format = GL_RED;
 		break;
 	default:
@@ -261,9 +724,18 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_R8:
 		type = GL_UNSIGNED_BYTE;
 		break;
+	case GL_RGBA16:
+	case GL_RGB16:
+	case GL_RG16:
+	case GL_R16:
+		type = GL_UNSIGNED_SHORT;
+		break;
 	case GL_RGB565:
 		type = GL_UNSIGNED_SHORT_5_6_5;
 		break;
+	case GL_RGB10_A2:
+		type = GL_UNSIGNED_INT_2_10_10_10_REV;
+		break;
 	default:
 		// TODO: Add more here as needed.
 		assert(false);
@@ -280,48 +752,296 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	glBindTexture(GL_TEXTURE_2D, 0);
 	check_error();
 
-	Texture2D texture_format;
-	texture_format.internal_format = internal_format;
-	texture_format.width = width;
-	texture_format.height = height;
 	assert(texture_formats.count(texture_num) == 0);
 	texture_formats.insert(make_pair(texture_num, texture_format));
+	total_texture_bytes += estimate_texture_size(texture_format);
 
-	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&texture_lock);
+	check_memory_budget();
 	return texture_num;
 }
 
 void ResourcePool::release_2d_texture(GLuint texture_num)
 {
-	pthread_mutex_lock(&lock);
+	pthread_mutex_lock(&texture_lock);
+	map<GLuint, Texture2D>::const_iterator format_it = texture_formats.find(texture_num);
+	assert(format_it != texture_formats.end());
 	texture_freelist.push_front(texture_num);
-	assert(texture_formats.count(texture_num) != 0);
-	texture_freelist_bytes += estimate_texture_size(texture_formats[texture_num]);
+	texture_freelist_buckets[format_it->second].push_front(texture_freelist.begin());
+	texture_freelist_bytes += estimate_texture_size(format_it->second);
+
+	// Fencing every intermediate texture every frame is not free,
+	// so we only do it once the pool is actually shared between contexts.
+	Fence fence;
+	fence.sync = NULL;
+	fence.context = note_texture_context();
+	if (multiple_texture_contexts) {
+		set_fence(&fence);
+	}
+	assert(texture_fences.count(texture_num) == 0);
+	texture_fences.insert(make_pair(texture_num, fence));
 
 	while (texture_freelist_bytes > texture_freelist_max_bytes) {
-		GLuint free_texture_num = texture_freelist.back();
-		texture_freelist.pop_back();
-		assert(texture_formats.count(free_texture_num) != 0);
-		texture_freelist_bytes -= estimate_texture_size(texture_formats[free_texture_num]);
-		texture_formats.erase(free_texture_num);
-		glDeleteTextures(1, &free_texture_num);
-		check_error();
+		delete_oldest_freelist_texture();
+	}
+	pthread_mutex_unlock(&texture_lock);
+}
+
+GLuint ResourcePool::pop_oldest_freelist_texture()
+{
+	assert(!texture_freelist.empty());
+	GLuint texture_num = texture_freelist.back();
+	map<GLuint, Texture2D>::const_iterator format_it = texture_formats.find(texture_num);
+	assert(format_it != texture_formats.end());
+
+	// The bucket is in the same order as the freelist, so the oldest
+	// texture on the freelist is also the oldest one in its bucket.
+	map<Texture2D, TextureBucket>::iterator bucket_it = texture_freelist_buckets.find(format_it->second);
+	assert(bucket_it != texture_freelist_buckets.end());
+	assert(*bucket_it->second.back() == texture_num);
+	bucket_it->second.pop_back();
+	if (bucket_it->second.empty()) {
+		texture_freelist_buckets.erase(bucket_it);
+	}
+
+	texture_freelist.pop_back();
+	texture_freelist_bytes -= estimate_texture_size(format_it->second);
+	return texture_num;
+}
 
-		// Unlink any lingering FBO related to this texture. We might
-		// not be in the right context, so don't delete it right away;
-		// the cleanup in release_fbo() (which calls cleanup_unlinked_fbos())
-		// will take care of actually doing that later.
-		for (map<pair<void *, GLuint>, FBO>::iterator format_it = fbo_formats.begin();
-		     format_it != fbo_formats.end();
-		     ++format_it) {
-			for (unsigned i = 0; i < num_fbo_attachments; ++i) {
-				if (format_it->second.texture_num[i] == free_texture_num) {
-					format_it->second.texture_num[i] = GL_INVALID_INDEX;
-				}
+void ResourcePool::delete_oldest_freelist_texture()
+{
+	GLuint free_texture_num = pop_oldest_freelist_texture();
+	map<GLuint, Texture2D>::iterator format_it = texture_formats.find(free_texture_num);
+	total_texture_bytes -= estimate_texture_size(format_it->second);
+	texture_formats.erase(format_it);
+	++texture_freelist_evictions;
+	clear_fence(&texture_fences[free_texture_num]);
+	texture_fences.erase(free_texture_num);
+	glDeleteTextures(1, &free_texture_num);
+	check_error();
+
+	// Unlink any lingering FBO related to this texture. We might
+	// not be in the right context, so don't delete it right away;
+	// the cleanup in release_fbo() (which calls cleanup_unlinked_fbos())
+	// will take care of actually doing that later.
+	pthread_mutex_lock(&fbo_lock);
+	for (map<pair<void *, GLuint>, FBO>::iterator format_it = fbo_formats.begin();
+	     format_it != fbo_formats.end();
+	     ++format_it) {
+		for (unsigned i = 0; i < num_fbo_attachments; ++i) {
+			if (format_it->second.texture_num[i] == free_texture_num) {
+				format_it->second.texture_num[i] = GL_INVALID_INDEX;
 			}
 		}
 	}
-	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&fbo_lock);
+}
+
+GLuint ResourcePool::acquire_keyed_texture(const string &key)
+{
+	pthread_mutex_lock(&texture_lock);
+	GLuint texture_num = acquire_keyed_texture_locked(key);
+	pthread_mutex_unlock(&texture_lock);
+	return texture_num;
+}
+
+GLuint ResourcePool::acquire_keyed_texture_locked(const string &key)
+{
+	map<string, GLuint>::const_iterator texture_it = keyed_textures.find(key);
+	if (texture_it == keyed_textures.end()) {
+		return 0;
+	}
+
+	GLuint texture_num = texture_it->second;
+	KeyedTexture &info = keyed_texture_info[texture_num];
+
+	// It could have been filled in a different context.
+	wait_for_fence(info.fence);
+
+	if (info.refcount++ == 0) {
+		// Take it off the freelist.
+		list<GLuint>::iterator freelist_it =
+			find(keyed_texture_freelist.begin(), keyed_texture_freelist.end(), texture_num);
+		assert(freelist_it != keyed_texture_freelist.end());
+		keyed_texture_freelist.erase(freelist_it);
+		keyed_texture_freelist_bytes -= estimate_texture_size(info.format);
+	}
+	return texture_num;
+}
+
+GLuint ResourcePool::add_keyed_texture(const string &key, GLuint texture_num,
+                                       GLint internal_format, GLsizei width, GLsizei height)
+{
+	pthread_mutex_lock(&texture_lock);
+	GLuint existing_texture_num = acquire_keyed_texture_locked(key);
+	if (existing_texture_num != 0) {
+		// Somebody else made the same texture in the meantime.
+		pthread_mutex_unlock(&texture_lock);
+		glDeleteTextures(1, &texture_num);
+		check_error();
+		return existing_texture_num;
+	}
+
+	KeyedTexture info;
+	info.key = key;
+	info.format.internal_format = internal_format;
+	info.format.width = width;
+	info.format.height = height;
+	info.refcount = 1;
+	info.fence.sync = NULL;
+	set_fence(&info.fence);
+	assert(keyed_texture_info.count(texture_num) == 0);
+	keyed_textures.insert(make_pair(key, texture_num));
+	keyed_texture_info.insert(make_pair(texture_num, info));
+	total_texture_bytes += estimate_texture_size(info.format);
+	pthread_mutex_unlock(&texture_lock);
+	check_memory_budget();
+	return texture_num;
+}
+
+void ResourcePool::release_keyed_texture(GLuint texture_num)
+{
+	pthread_mutex_lock(&texture_lock);
+	map<GLuint, KeyedTexture>::iterator info_it = keyed_texture_info.find(texture_num);
+	assert(info_it != keyed_texture_info.end());
+	assert(info_it->second.refcount > 0);
+	if (--info_it->second.refcount == 0) {
+		keyed_texture_freelist.push_front(texture_num);
+		keyed_texture_freelist_bytes += estimate_texture_size(info_it->second.format);
+		shrink_keyed_texture_freelist(texture_freelist_max_bytes);
+	}
+	pthread_mutex_unlock(&texture_lock);
+}
+
+void ResourcePool::shrink_keyed_texture_freelist(size_t max_bytes)
+{
+	while (keyed_texture_freelist_bytes > max_bytes) {
+		delete_oldest_keyed_texture();
+	}
+}
+
+void ResourcePool::delete_oldest_keyed_texture()
+{
+	assert(!keyed_texture_freelist.empty());
+	GLuint free_texture_num = keyed_texture_freelist.back();
+	keyed_texture_freelist.pop_back();
+	map<GLuint, KeyedTexture>::iterator info_it = keyed_texture_info.find(free_texture_num);
+	assert(info_it != keyed_texture_info.end());
+	assert(info_it->second.refcount == 0);
+	keyed_texture_freelist_bytes -= estimate_texture_size(info_it->second.format);
+	total_texture_bytes -= estimate_texture_size(info_it->second.format);
+	keyed_textures.erase(info_it->second.key);
+	clear_fence(&info_it->second.fence);
+	keyed_texture_info.erase(info_it);
+	glDeleteTextures(1, &free_texture_num);
+	check_error();
+}
+
+ResourcePool::Stats ResourcePool::get_stats()
+{
+	Stats stats;
+
+	pthread_mutex_lock(&program_lock);
+	stats.num_live_programs = program_refcount.size();
+	stats.num_free_programs = program_freelist.size();
+	pthread_mutex_unlock(&program_lock);
+
+	pthread_mutex_lock(&texture_lock);
+	for (map<GLuint, Texture2D>::const_iterator format_it = texture_formats.begin();
+	     format_it != texture_formats.end();
+	     ++format_it) {
+		TextureStats &ts = stats.textures[format_it->second.internal_format];
+		++ts.num_live;
+		ts.live_bytes += estimate_texture_size(format_it->second);
+	}
+	for (list<GLuint>::const_iterator freelist_it = texture_freelist.begin();
+	     freelist_it != texture_freelist.end();
+	     ++freelist_it) {
+		const Texture2D &format = texture_formats[*freelist_it];
+		TextureStats &ts = stats.textures[format.internal_format];
+		--ts.num_live;
+		ts.live_bytes -= estimate_texture_size(format);
+		++ts.num_free;
+		ts.free_bytes += estimate_texture_size(format);
+	}
+	for (map<GLuint, KeyedTexture>::const_iterator info_it = keyed_texture_info.begin();
+	     info_it != keyed_texture_info.end();
+	     ++info_it) {
+		TextureStats &ts = stats.keyed_textures[info_it->second.format.internal_format];
+		if (info_it->second.refcount > 0) {
+			++ts.num_live;
+			ts.live_bytes += estimate_texture_size(info_it->second.format);
+		} else {
+			++ts.num_free;
+			ts.free_bytes += estimate_texture_size(info_it->second.format);
+		}
+	}
+	stats.total_texture_bytes = total_texture_bytes;
+	pthread_mutex_unlock(&texture_lock);
+
+	pthread_mutex_lock(&fbo_lock);
+	for (map<pair<void *, GLuint>, FBO>::const_iterator fbo_it = fbo_formats.begin();
+	     fbo_it != fbo_formats.end();
+	     ++fbo_it) {
+		++stats.num_live_fbos[fbo_it->first.first];
+	}
+	for (map<void *, list<FBOFormatIterator> >::const_iterator context_it = fbo_freelist.begin();
+	     context_it != fbo_freelist.end();
+	     ++context_it) {
+		stats.num_live_fbos[context_it->first] -= context_it->second.size();
+		stats.num_free_fbos[context_it->first] = context_it->second.size();
+	}
+	pthread_mutex_unlock(&fbo_lock);
+
+	return stats;
+}
+
+size_t ResourcePool::trim(size_t target_bytes)
+{
+	pthread_mutex_lock(&texture_lock);
+	trim_locked(target_bytes);
+	size_t ret = total_texture_bytes;
+	pthread_mutex_unlock(&texture_lock);
+	return ret;
+}
+
+void ResourcePool::trim_locked(size_t target_bytes)
+{
+	while (total_texture_bytes > target_bytes && !texture_freelist.empty()) {
+		delete_oldest_freelist_texture();
+	}
+	while (total_texture_bytes > target_bytes && !keyed_texture_freelist.empty()) {
+		delete_oldest_keyed_texture();
+	}
+}
+
+void ResourcePool::set_memory_budget(size_t budget_bytes, MemoryPressureCallback callback, void *callback_data)
+{
+	pthread_mutex_lock(&texture_lock);
+	memory_budget_bytes = budget_bytes;
+	memory_pressure_callback = callback;
+	memory_pressure_callback_data = callback_data;
+	pthread_mutex_unlock(&texture_lock);
+}
+
+void ResourcePool::check_memory_budget()
+{
+	pthread_mutex_lock(&texture_lock);
+	if (memory_budget_bytes == 0 || total_texture_bytes <= memory_budget_bytes) {
+		pthread_mutex_unlock(&texture_lock);
+		return;
+	}
+	trim_locked(memory_budget_bytes);
+	size_t bytes_held = total_texture_bytes;
+	bool over_budget = (bytes_held > memory_budget_bytes);
+	MemoryPressureCallback callback = memory_pressure_callback;
+	void *callback_data = memory_pressure_callback_data;
+	pthread_mutex_unlock(&texture_lock);
+
+	if (over_budget && callback != NULL) {
+		callback(this, bytes_held, callback_data);
+	}
 }
 
 GLuint ResourcePool::create_fbo(GLuint texture0_num, GLuint texture1_num, GLuint texture2_num, GLuint texture3_num)
@@ -337,7 +1057,7 @@ GLuint ResourcePool::create_fbo(GLuint texture0_num, GLuint texture1_num, GLuint
 		assert(texture3_num == 0);
 	}
 
-	pthread_mutex_lock(&lock);
+	pthread_mutex_lock(&fbo_lock);
 	if (fbo_freelist.count(context) != 0) {
 		// See if there's an FBO on the freelist we can use.
 		list<FBOFormatIterator>::iterator end = fbo_freelist[context].end();
@@ -349,7 +1069,7 @@ GLuint ResourcePool::create_fbo(GLuint texture0_num, GLuint texture1_num, GLuint
 			    fbo_it->second.texture_num[2] == texture2_num &&
 			    fbo_it->second.texture_num[3] == texture3_num) {
 				fbo_freelist[context].erase(freelist_it);
-				pthread_mutex_unlock(&lock);
+				pthread_mutex_unlock(&fbo_lock);
 				return fbo_it->second.fbo_num;
 			}
 		}
@@ -395,7 +1115,7 @@ GLuint ResourcePool::create_fbo(GLuint texture0_num, GLuint texture1_num, GLuint
 	assert(fbo_formats.count(key) == 0);
 	fbo_formats.insert(make_pair(key, fbo_format));
 
-	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&fbo_lock);
 	return fbo_format.fbo_num;
 }
 
@@ -403,7 +1123,7 @@ void ResourcePool::release_fbo(GLuint fbo_num)
 {
 	void *context = get_gl_context_identifier();
 
-	pthread_mutex_lock(&lock);
+	pthread_mutex_lock(&fbo_lock);
 	FBOFormatIterator fbo_it = fbo_formats.find(make_pair(context, fbo_num));
 	assert(fbo_it != fbo_formats.end());
 	fbo_freelist[context].push_front(fbo_it);
@@ -413,17 +1133,138 @@ void ResourcePool::release_fbo(GLuint fbo_num)
 	cleanup_unlinked_fbos(context);
 
 	shrink_fbo_freelist(context, fbo_freelist_max_length);
-	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&fbo_lock);
+}
+
+GLuint ResourcePool::create_fullscreen_vao(const set<GLint> &attribute_indices)
+{
+	void *context = get_gl_context_identifier();
+
+	pthread_mutex_lock(&fbo_lock);
+	if (vao_freelist.count(context) != 0) {
+		// See if there's a VAO on the freelist we can use.
+		list<VAOFormatIterator>::iterator end = vao_freelist[context].end();
+		for (list<VAOFormatIterator>::iterator freelist_it = vao_freelist[context].begin();
+		     freelist_it != end; ++freelist_it) {
+			VAOFormatIterator vao_it = *freelist_it;
+			if (vao_it->second == attribute_indices) {
+				vao_freelist[context].erase(freelist_it);
+				pthread_mutex_unlock(&fbo_lock);
+				return vao_it->first.second;
+			}
+		}
+	}
+
+	if (fullscreen_vbo == 0) {
+		// A triangle that covers the entire [0,1] square (and then some);
+		// we use the same values for both positions and texture coordinates.
+		static const float vertices[] = {
+			0.0f, 2.0f,
+			0.0f, 0.0f,
+			2.0f, 0.0f
+		};
+		fullscreen_vbo = generate_vbo(sizeof(vertices), vertices);
+	}
+
+	// Create a new one.
+	GLuint vao_num;
+	glGenVertexArrays(1, &vao_num);
+	check_error();
+	glBindVertexArray(vao_num);
+	check_error();
+	glBindBuffer(GL_ARRAY_BUFFER, fullscreen_vbo);
+	check_error();
+
+	for (set<GLint>::const_iterator attr_it = attribute_indices.begin(); attr_it != attribute_indices.end(); ++attr_it) {
+		glEnableVertexAttribArray(*attr_it);
+		check_error();
+		glVertexAttribPointer(*attr_it, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+		check_error();
+	}
+
+	glBindVertexArray(0);
+	check_error();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	check_error();
+
+	pair<void *, GLuint> key(context, vao_num);
+	assert(vao_formats.count(key) == 0);
+	vao_formats.insert(make_pair(key, attribute_indices));
+
+	pthread_mutex_unlock(&fbo_lock);
+	return vao_num;
+}
+
+void ResourcePool::release_fullscreen_vao(GLuint vao_num)
+{
+	void *context = get_gl_context_identifier();
+
+	pthread_mutex_lock(&fbo_lock);
+	VAOFormatIterator vao_it = vao_formats.find(make_pair(context, vao_num));
+	assert(vao_it != vao_formats.end());
+	vao_freelist[context].push_front(vao_it);
+
+	shrink_vao_freelist(context, fbo_freelist_max_length);
+	pthread_mutex_unlock(&fbo_lock);
 }
 
 void ResourcePool::clean_context()
 {
 	void *context = get_gl_context_identifier();
 
-	// Currently, we only need to worry about FBOs, as they are the only
-	// non-shareable resource we hold.
+	// Currently, we only need to worry about FBOs and VAOs, as they are
+	// the only non-shareable resources we hold.
+	pthread_mutex_lock(&fbo_lock);
 	shrink_fbo_freelist(context, 0);
 	fbo_freelist.erase(context);
+
+	shrink_vao_freelist(context, 0);
+	vao_freelist.erase(context);
+	pthread_mutex_unlock(&fbo_lock);
+}
+
+void *ResourcePool::note_texture_context()
+{
+	void *context = get_gl_context_identifier();
+	if (texture_context == NULL) {
+		texture_context = context;
+	} else if (context != texture_context) {
+		multiple_texture_contexts = true;
+	}
+	return context;
+}
+
+void ResourcePool::set_fence(Fence *fence)
+{
+	clear_fence(fence);
+	fence->context = get_gl_context_identifier();
+	if (movit_sync_objects_supported) {
+		fence->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		check_error();
+
+		// Another context waiting for the fence would wait forever
+		// if it never got submitted to the GPU.
+		glFlush();
+		check_error();
+	}
+}
+
+void ResourcePool::wait_for_fence(const Fence &fence)
+{
+	if (fence.sync != NULL && fence.context != get_gl_context_identifier()) {
+		// Make the GPU wait; the CPU can go on queueing up commands.
+		glWaitSync(fence.sync, 0, GL_TIMEOUT_IGNORED);
+		check_error();
+	}
+}
+
+void ResourcePool::clear_fence(Fence *fence)
+{
+	if (fence->sync != NULL) {
+		glDeleteSync(fence->sync);
+		check_error();
+		fence->sync = NULL;
+	}
 }
 
 void ResourcePool::cleanup_unlinked_fbos(void *context)
@@ -463,25 +1304,46 @@ void ResourcePool::shrink_fbo_freelist(void *context, size_t max_length)
 	}
 }
 
+void ResourcePool::shrink_vao_freelist(void *context, size_t max_length)
+{
+	list<VAOFormatIterator> &freelist = vao_freelist[context];
+	while (freelist.size() > max_length) {
+		VAOFormatIterator free_vao_it = freelist.back();
+		GLuint vao_num = free_vao_it->first.second;
+		glDeleteVertexArrays(1, &vao_num);
+		check_error();
+		vao_formats.erase(free_vao_it);
+		freelist.pop_back();
+	}
+}
+
 size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format)
+{
+	return estimate_texture_size(texture_format.internal_format, texture_format.width, texture_format.height);
+}
+
+size_t ResourcePool::estimate_texture_size(GLint internal_format, GLsizei width, GLsizei height)
 {
 	size_t bytes_per_pixel;
 
-	switch (texture_format.internal_format) {
+	switch (internal_format) {
 	case GL_RGBA32F_ARB:
 		bytes_per_pixel = 16;
 		break;
 	case GL_RGBA16F_ARB:
+	case GL_RGBA16:
 		bytes_per_pixel = 8;
 		break;
 	case GL_RGB32F_ARB:
 		bytes_per_pixel = 12;
 		break;
 	case GL_RGB16F_ARB:
+	case GL_RGB16:
 		bytes_per_pixel = 6;
 		break;
 	case GL_RGBA8:
 	case GL_SRGB8_ALPHA8:
+	case GL_RGB10_A2:
 		bytes_per_pixel = 4;
 		break;
 	case GL_RGB8:
@@ -492,12 +1354,14 @@ size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format)
 		bytes_per_pixel = 8;
 		break;
 	case GL_RG16F:
+	case GL_RG16:
 		bytes_per_pixel = 4;
 		break;
 	case GL_R32F:
 		bytes_per_pixel = 4;
 		break;
 	case GL_R16F:
+	case GL_R16:
 		bytes_per_pixel = 2;
 		break;
 	case GL_RG8:
@@ -514,7 +1378,7 @@ size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format)
 		assert(false);
 	}
 
-	return texture_format.width * texture_format.height * bytes_per_pixel;
+	return size_t(width) * height * bytes_per_pixel;
 }
 
 }  // namespace movit
@@ -14,7 +14,20 @@
 //
 // Thread-safety: All functions except the constructor and destructor can be
 // safely called from multiple threads at the same time, provided they have
-// separate (but sharing) OpenGL contexts.
+// separate (but sharing) OpenGL contexts. Programs, textures and FBOs/VAOs
+// are protected by separate locks, so that e.g. allocating a texture on one
+// thread does not need to wait for a program lookup on another.
+//
+// Share groups: A ResourcePool corresponds to one share group, i.e., all the
+// contexts it is used from must share objects with each other. Programs and
+// textures can then be created in one context and reused in another.
+// When a texture moves to a new context, the ResourcePool makes the new
+// context's command stream wait (with glWaitSync(), so the CPU does not block)
+// for whatever the old context had queued up for it, e.g. finishing reading
+// from the texture before it is overwritten. As long as the pool has only
+// been used from a single context, no fences are set. This needs sync objects
+// (see movit_sync_objects_supported); without them, you will have to
+// synchronize the contexts yourself.
 //
 // Memory management (only relevant if you use multiple contexts): Some objects,
 // like FBOs, are not shareable across contexts, and can only be deleted from
@@ -25,10 +38,13 @@
 #include <epoxy/gl.h>
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <list>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 namespace movit {
 
@@ -50,6 +66,81 @@ public:
 	             size_t fbo_freelist_max_length = 100);  // Per context.
 	~ResourcePool();
 
+	// Keep compiled programs on disk in the given directory (which must
+	// already exist), so that later processes can skip compiling and linking
+	// shaders they have seen before. The programs are stored as the driver's
+	// own binary blobs (see glGetProgramBinary()), keyed on the shader sources
+	// and the OpenGL vendor, renderer and version strings; if the driver
+	// refuses to load a blob (e.g. after an upgrade), the program is simply
+	// compiled as usual and the blob overwritten. Several processes can share
+	// the same directory. Does nothing if movit_program_binaries_supported
+	// is false. The default is an empty string, which turns the cache off.
+	void set_program_cache_directory(const std::string &directory);
+
+	// How many programs compile_glsl_program() has been able to load from
+	// the disk cache, and how many it had to compile (only counted while
+	// the disk cache is on). Programs that are already in memory count
+	// as neither.
+	size_t get_program_cache_hits();
+	size_t get_program_cache_misses();
+
+	// Statistics for the freelist behind create_2d_texture(): how many
+	// textures it could hand out again (hits), how many had to be created
+	// anew (misses), how many it has deleted to stay under
+	// texture_freelist_max_bytes or because of trim() (evictions), and the
+	// estimated number of bytes it currently holds (see the constructor).
+	size_t get_texture_freelist_hits();
+	size_t get_texture_freelist_misses();
+	size_t get_texture_freelist_evictions();
+	size_t get_texture_freelist_bytes();
+
+	// A snapshot of everything the pool holds. Texture sizes are estimated
+	// the same way as for texture_freelist_max_bytes (see the constructor),
+	// so they are only good for comparing against each other and against
+	// the limits you set, not against what the driver reports.
+	struct TextureStats {
+		size_t num_live, live_bytes;  // Given out and not yet released.
+		size_t num_free, free_bytes;  // On the freelist.
+	};
+	struct Stats {
+		// Textures from create_2d_texture(), by internal format.
+		std::map<GLint, TextureStats> textures;
+
+		// Keyed textures, by internal format. Live means that somebody
+		// holds a reference to it.
+		std::map<GLint, TextureStats> keyed_textures;
+
+		// The sum of all bytes, live and free, in the two maps above.
+		size_t total_texture_bytes;
+
+		size_t num_live_programs, num_free_programs;
+
+		// By context (see get_gl_context_identifier()).
+		std::map<void *, size_t> num_live_fbos, num_free_fbos;
+	};
+	Stats get_stats();
+
+	// Delete unused textures, first from the regular freelist and then
+	// keyed textures, least recently used first, until the pool holds no
+	// more than <target_bytes> of textures (live and free), or there are
+	// no unused textures left. Returns the number of bytes held afterwards.
+	// Textures that are in use are never touched, so this can be called
+	// at any time, from any thread with a context sharing objects with
+	// the ones the pool is used from.
+	size_t trim(size_t target_bytes);
+
+	// Set an upper limit for the bytes of textures the pool should hold
+	// (live and free; see get_stats()). Whenever an allocation takes the
+	// pool above <budget_bytes>, it first trims itself down to the budget
+	// (see trim()). If that is not enough, because too many textures are
+	// in use, <callback> is called with the number of bytes held, so that
+	// the application can release something (e.g. stop a channel). The
+	// callback is called after the allocation has been done, from the thread
+	// doing it, with no locks held, so it can call back into the pool.
+	// A budget of zero (the default) means no limit.
+	typedef void (*MemoryPressureCallback)(ResourcePool *pool, size_t bytes_held, void *data);
+	void set_memory_budget(size_t budget_bytes, MemoryPressureCallback callback = NULL, void *callback_data = NULL);
+
 	// All remaining functions are intended for calls from EffectChain only.
 
 	// Compile the given vertex+fragment shader pair, or fetch an already
@@ -57,6 +148,37 @@ public:
 	// program; you must call release_glsl_program() instead of deleting it
 	// when you no longer want it.
 	GLuint compile_glsl_program(const std::string& vertex_shader, const std::string& fragment_shader);
+
+	// The same, but with the hash of the sources (from hash_program_sources())
+	// precomputed, e.g. so that it can be kept from one finalize() to the next.
+	// Lookups are by hash; the full sources are only compared on a hit.
+	GLuint compile_glsl_program(const std::string& vertex_shader, const std::string& fragment_shader, uint64_t hash);
+	static uint64_t hash_program_sources(const std::string& vertex_shader, const std::string& fragment_shader);
+
+	// Like compile_glsl_program(), but only submits the program for compiling
+	// and linking, without waiting for the result. You must call
+	// finish_glsl_program() on the returned program before you use it
+	// (calling it more than once is fine). is_glsl_program_ready() returns
+	// whether finish_glsl_program() would return without blocking; without
+	// movit_parallel_shader_compile_supported, we cannot know that, and it
+	// always returns true.
+	//
+	// If the fragment shader has more than one output, <fragment_shader_outputs>
+	// must list them by name, in the order of the draw buffers they go to.
+	// (GLSL ES has no way of binding them from the outside, so there,
+	// the shader has to give them explicit locations itself.)
+	GLuint start_compile_glsl_program(const std::string& vertex_shader, const std::string& fragment_shader, uint64_t hash,
+	                                  const std::vector<std::string>& fragment_shader_outputs = std::vector<std::string>());
+
+	// The same, but for a program consisting of a single compute shader
+	// (see Effect::has_compute_shader()). <hash> is
+	// hash_program_sources("", compute_shader). Finish and release
+	// the program just like any other.
+	GLuint start_compile_glsl_compute_program(const std::string& compute_shader, uint64_t hash);
+
+	bool is_glsl_program_ready(GLuint glsl_program_num);
+	void finish_glsl_program(GLuint glsl_program_num);
+
 	void release_glsl_program(GLuint glsl_program_num);
 
 	// Allocate a 2D texture of the given internal format and dimensions,
@@ -66,6 +188,38 @@ public:
 	GLuint create_2d_texture(GLint internal_format, GLsizei width, GLsizei height);
 	void release_2d_texture(GLuint texture_num);
 
+	// Estimate how many bytes a texture of the given internal format and
+	// dimensions takes up. See the caveats at the constructor.
+	static size_t estimate_texture_size(GLint internal_format, GLsizei width, GLsizei height);
+
+	// Keyed textures are for textures whose contents are entirely given by
+	// some set of parameters (e.g. lookup tables), so that everybody asking
+	// for the same parameters can share the same texture. The key is an
+	// arbitrary string that describes both the contents and the format.
+	//
+	// acquire_keyed_texture() gives you the texture stored under <key> and
+	// takes a reference to it, or returns 0 if there is none. In the latter
+	// case, create and fill the texture yourself, and hand it over with
+	// add_keyed_texture(); this also takes a reference. If somebody else
+	// got there first, your texture is deleted and theirs is returned,
+	// so always use the return value. Either way, call release_keyed_texture()
+	// instead of deleting the texture when you no longer want it.
+	//
+	// Keyed textures that nobody holds a reference to are kept around,
+	// in case somebody wants them again, until they go over
+	// texture_freelist_max_bytes (counted separately from the regular
+	// texture freelist); the least recently used are deleted first.
+	//
+	// Sharing saves creating and uploading the same lookup table over and
+	// over again; it does not save any binds, since every phase binds all of
+	// its samplers every frame anyway. (Packing the tables into one texture
+	// array or atlas would not either, and an atlas cannot give GL_REPEAT,
+	// which the FFT and dither lookups need.)
+	GLuint acquire_keyed_texture(const std::string &key);
+	GLuint add_keyed_texture(const std::string &key, GLuint texture_num,
+	                         GLint internal_format, GLsizei width, GLsizei height);
+	void release_keyed_texture(GLuint texture_num);
+
 	// Allocate an FBO with the the given texture(s) bound as framebuffer attachment(s),
 	// or fetch a previous used if possible. Unbinds GL_FRAMEBUFFER afterwards.
 	// Keeps ownership of the FBO; you must call release_fbo() of deleting
@@ -83,6 +237,20 @@ public:
 	                  GLuint texture3_num = 0);
 	void release_fbo(GLuint fbo_num);
 
+	// Allocate a VAO that has the full-screen triangle used by all EffectChain
+	// phases bound (as a two-component float array) to each of the given vertex
+	// attribute indices, or fetch a previously used one if possible. The VBO
+	// holding the triangle itself is created once and shared between all users
+	// of the ResourcePool. Unbinds the VAO afterwards. Keeps ownership of the VAO;
+	// you must call release_fullscreen_vao() instead of deleting it when you no
+	// longer want it.
+	//
+	// Like FBOs, VAOs are not shareable across contexts, so the same caveats
+	// apply; in particular, the VAO will be kept on a per-context freelist,
+	// so that reusing it from frame to frame is very cheap.
+	GLuint create_fullscreen_vao(const std::set<GLint> &attribute_indices);
+	void release_fullscreen_vao(GLuint vao_num);
+
 	// Informs the ResourcePool that the current context is going away soon,
 	// and that any resources held for it in the freelist should be deleted.
 	//
@@ -95,6 +263,20 @@ private:
 	// Delete the given program and both its shaders.
 	void delete_program(GLuint program_num);
 
+	// Find a program with the given sources in the cache and take a
+	// reference to it, or return 0 if there is none. Must be called with
+	// program_lock held.
+	GLuint take_cached_program(const std::string& vertex_shader, const std::string& fragment_shader, uint64_t hash);
+
+	// Helpers for the disk cache (see set_program_cache_directory()).
+	// load_program_from_disk_cache() returns 0 if the program was not there,
+	// or could not be loaded. These two do file I/O, so they are called
+	// without program_lock held, and get everything they need as arguments.
+	static std::string get_program_cache_gl_id();
+	std::string get_program_cache_filename(uint64_t source_hash);
+	static GLuint load_program_from_disk_cache(const std::string &filename, const std::string &gl_id, const std::string &vertex_shader, const std::string &fragment_shader);
+	static void save_program_to_disk_cache(GLuint glsl_program_num, const std::string &filename, const std::string &gl_id, const std::string &vertex_shader, const std::string &fragment_shader);
+
 	// Deletes all FBOs for the given context that belong to deleted textures.
 	void cleanup_unlinked_fbos(void *context);
 
@@ -102,30 +284,120 @@ private:
 	// is no more than <max_length> elements long.
 	void shrink_fbo_freelist(void *context, size_t max_length);
 
-	// Protects all the other elements in the class.
-	pthread_mutex_t lock;
+	// Same, for VAOs.
+	void shrink_vao_freelist(void *context, size_t max_length);
+
+	// A fence in the command stream of a given context. sync is NULL
+	// if none has been set (or if we do not have sync objects).
+	struct Fence {
+		GLsync sync;
+		void *context;
+	};
+
+	// Replace <fence> with a fence at the current point of the current
+	// context's command stream.
+	static void set_fence(Fence *fence);
+
+	// If <fence> was set in a different context than the current one,
+	// make the current context wait for it (on the GPU side).
+	static void wait_for_fence(const Fence &fence);
+
+	// Delete the sync object in <fence>, if any.
+	static void clear_fence(Fence *fence);
+
+	// Returns the current context, and notes if it is not the first one
+	// textures have been created or released in. Assumes <texture_lock>
+	// is held.
+	void *note_texture_context();
+
+	// Take the least recently freed texture off the texture freelist
+	// (including its bucket; see <texture_freelist_buckets>) and return it.
+	// The texture is not deleted. Assumes <texture_lock> is held.
+	GLuint pop_oldest_freelist_texture();
+
+	// Take the least recently freed texture off the texture freelist and
+	// delete it, unlinking it from any FBOs. Assumes <texture_lock> is held.
+	void delete_oldest_freelist_texture();
+
+	// The same for the keyed texture freelist.
+	void delete_oldest_keyed_texture();
+
+	// trim(), but assumes <texture_lock> is already held.
+	void trim_locked(size_t target_bytes);
+
+	// Called after allocating a texture, with <texture_lock> not held;
+	// see set_memory_budget().
+	void check_memory_budget();
+
+	// Same as acquire_keyed_texture(), but assumes <texture_lock> is already held.
+	GLuint acquire_keyed_texture_locked(const std::string &key);
+
+	// Delete unused keyed textures off the end of the freelist until
+	// it holds no more than <max_bytes>.
+	void shrink_keyed_texture_freelist(size_t max_bytes);
+
+	// Protects all elements related to programs.
+	pthread_mutex_t program_lock;
+
+	// Protects all elements related to textures (including keyed textures).
+	// If you need both this and <fbo_lock>, take this one first.
+	pthread_mutex_t texture_lock;
+
+	// Protects all elements related to FBOs and VAOs (including the VBO).
+	pthread_mutex_t fbo_lock;
 
 	size_t program_freelist_max_length, texture_freelist_max_bytes, fbo_freelist_max_length;
 		
-	// A mapping from vertex/fragment shader source strings to compiled program number.
-	std::map<std::pair<std::string, std::string>, GLuint> programs;
+	// A mapping from the hash of the vertex/fragment shader source strings
+	// (see hash_program_sources()) to compiled program number. Different
+	// sources can in theory have the same hash, so there can be more than one.
+	std::multimap<uint64_t, GLuint> programs;
 
 	// A mapping from compiled program number to number of current users.
 	// Once this reaches zero, the program is taken out of this map and instead
 	// put on the freelist (after which it may be deleted).
 	std::map<GLuint, int> program_refcount;
 
-	// A mapping from program number to vertex and fragment shaders.
-	std::map<GLuint, std::pair<GLuint, GLuint> > program_shaders;
+	// Compute programs have an empty <vertex_shader> and no <vs_obj>,
+	// and keep the compute shader where the fragment shader would be.
+	struct Program {
+		std::string vertex_shader, fragment_shader;
+		uint64_t hash;
+		GLuint vs_obj, fs_obj;  // 0 if loaded from the disk cache.
+
+		// Whether finish_glsl_program() has checked that the program
+		// compiled and linked. If not, and <cache_filename> is set,
+		// it will also save the program to the disk cache.
+		bool finished;
+		std::string cache_filename;
+	};
+
+	// A mapping from program number to its sources and shaders.
+	std::map<GLuint, Program> program_info;
 
 	// A list of programs that are no longer in use, most recently freed first.
 	// Once this reaches <program_freelist_max_length>, the last element
 	// will be deleted.
 	std::list<GLuint> program_freelist;
 
+	// See set_program_cache_directory(). <program_cache_gl_id> is the
+	// vendor, renderer and version strings, filled in on first use.
+	std::string program_cache_directory, program_cache_gl_id;
+	size_t program_cache_hits, program_cache_misses;
+
 	struct Texture2D {
 		GLint internal_format;
 		GLsizei width, height;
+
+		bool operator<(const Texture2D &other) const {
+			if (internal_format != other.internal_format) {
+				return internal_format < other.internal_format;
+			}
+			if (width != other.width) {
+				return width < other.width;
+			}
+			return height < other.height;
+		}
 	};
 
 	// A mapping from texture number to format details. This is filled if the
@@ -141,6 +413,56 @@ private:
 	std::list<GLuint> texture_freelist;
 	size_t texture_freelist_bytes;
 
+	// The same textures, bucketed by format, so that create_2d_texture()
+	// does not need to walk the entire freelist. Each bucket points into
+	// <texture_freelist> and is in the same order (most recently freed
+	// first), so the oldest texture on the freelist is always at the end of
+	// its bucket. Empty buckets are removed.
+	typedef std::list<std::list<GLuint>::iterator> TextureBucket;
+	std::map<Texture2D, TextureBucket> texture_freelist_buckets;
+
+	// See get_texture_freelist_hits() etc.
+	size_t texture_freelist_hits, texture_freelist_misses, texture_freelist_evictions;
+
+	// The estimated size of all textures in <texture_formats> and
+	// <keyed_texture_info>, whether in use or not.
+	size_t total_texture_bytes;
+
+	// See set_memory_budget().
+	size_t memory_budget_bytes;
+	MemoryPressureCallback memory_pressure_callback;
+	void *memory_pressure_callback_data;
+
+	// For each texture on the freelist, the context it was released in,
+	// and a fence set at that point if <multiple_texture_contexts> was true
+	// by then. A texture released without a fence is only given out again
+	// in the same context.
+	std::map<GLuint, Fence> texture_fences;
+
+	// The first context textures were created or released in, and whether
+	// we have seen any others since. Until we have, releasing a texture
+	// does not need a fence.
+	void *texture_context;
+	bool multiple_texture_contexts;
+
+	struct KeyedTexture {
+		std::string key;
+		Texture2D format;
+		int refcount;
+		Fence fence;  // Set when the texture was added.
+	};
+
+	// A mapping from key to keyed texture number, and from keyed texture
+	// number to all the details. Both contain all keyed textures, whether
+	// in use or on the freelist.
+	std::map<std::string, GLuint> keyed_textures;
+	std::map<GLuint, KeyedTexture> keyed_texture_info;
+
+	// Keyed textures with zero refcount, most recently used first,
+	// and an estimate of their memory usage (see <texture_freelist>).
+	std::list<GLuint> keyed_texture_freelist;
+	size_t keyed_texture_freelist_bytes;
+
 	static const unsigned num_fbo_attachments = 4;
 	struct FBO {
 		GLuint fbo_num;
@@ -162,6 +484,16 @@ private:
 	// We store iterators directly into <fbo_format> for efficiency.
 	std::map<void *, std::list<FBOFormatIterator> > fbo_freelist;
 
+	// The VBO holding the full-screen triangle; created on first use.
+	GLuint fullscreen_vbo;
+
+	// For each context, a mapping from VAO number to the vertex attribute
+	// indices it has bound. Works like <fbo_formats>; the freelist is also
+	// limited to <fbo_freelist_max_length> elements.
+	std::map<std::pair<void *, GLuint>, std::set<GLint> > vao_formats;
+	typedef std::map<std::pair<void *, GLuint>, std::set<GLint> >::iterator VAOFormatIterator;
+	std::map<void *, std::list<VAOFormatIterator> > vao_freelist;
+
 	// See the caveats at the constructor.
 	static size_t estimate_texture_size(const Texture2D &texture_format);
 };
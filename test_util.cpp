@@ -44,10 +44,15 @@ void vertical_flip(T *data, unsigned width, unsigned height)
 
 }  // namespace
 
+string BouncingIdentityEffect::output_fragment_shader()
+{
+	return read_file("identity.frag");
+}
+
 EffectChainTester::EffectChainTester(const float *data, unsigned width, unsigned height,
                                      MovitPixelFormat pixel_format, Colorspace color_space, GammaCurve gamma_curve,
-                                     GLenum framebuffer_format)
-	: chain(width, height, get_static_pool()), width(width), height(height), framebuffer_format(framebuffer_format), output_added(false), finalized(false)
+                                     GLenum framebuffer_format, ResourcePool *resource_pool)
+	: chain(width, height, resource_pool != NULL ? resource_pool : get_static_pool()), width(width), height(height), framebuffer_format(framebuffer_format), output_added(false), finalized(false)
 {
 	CHECK(init_movit(".", MOVIT_DEBUG_OFF));
 
@@ -100,16 +105,130 @@ Input *EffectChainTester::add_input(const unsigned char *data, MovitPixelFormat
 
 void EffectChainTester::run(float *out_data, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format)
 {
-	internal_run(out_data, GL_FLOAT, format, color_space, gamma_curve, alpha_format);
+	internal_run<float>(out_data, NULL, NULL, GL_FLOAT, format, color_space, gamma_curve, alpha_format);
 }
 
 void EffectChainTester::run(unsigned char *out_data, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format)
 {
-	internal_run(out_data, GL_UNSIGNED_BYTE, format, color_space, gamma_curve, alpha_format);
+	internal_run<unsigned char>(out_data, NULL, NULL, GL_UNSIGNED_BYTE, format, color_space, gamma_curve, alpha_format);
+}
+
+void EffectChainTester::run(unsigned char *out_data, unsigned char *out_data2, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format)
+{
+	internal_run<unsigned char>(out_data, out_data2, NULL, GL_UNSIGNED_BYTE, format, color_space, gamma_curve, alpha_format);
+}
+
+void EffectChainTester::run(unsigned char *out_data, unsigned char *out_data2, unsigned char *out_data3, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format)
+{
+	internal_run<unsigned char>(out_data, out_data2, out_data3, GL_UNSIGNED_BYTE, format, color_space, gamma_curve, alpha_format);
 }
 
 template<class T>
-void EffectChainTester::internal_run(T *out_data, GLenum internal_format, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format)
+void EffectChainTester::internal_run(T *out_data, T *out_data2, T *out_data3, GLenum internal_format, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format)
+{
+	if (!finalized) {
+		finalize_chain(color_space, gamma_curve, alpha_format);
+	}
+
+	GLuint type;
+	if (framebuffer_format == GL_RGBA8) {
+		type = GL_UNSIGNED_BYTE;
+	} else if (framebuffer_format == GL_RGBA16F || framebuffer_format == GL_RGBA32F) {
+		type = GL_FLOAT;
+	} else {
+		// Add more here as needed.
+		assert(false);
+	}
+
+	T *data[3] = { out_data, out_data2, out_data3 };
+	unsigned num_outputs = 1;
+	while (num_outputs < 3 && data[num_outputs] != NULL) {
+		++num_outputs;
+	}
+
+	GLuint fbo, texnum[3];
+
+	glGenTextures(num_outputs, texnum);
+	check_error();
+	for (unsigned i = 0; i < num_outputs; ++i) {
+		glBindTexture(GL_TEXTURE_2D, texnum[i]);
+		check_error();
+		glTexImage2D(GL_TEXTURE_2D, 0, framebuffer_format, width, height, 0, GL_RGBA, type, NULL);
+		check_error();
+	}
+
+	glGenFramebuffers(1, &fbo);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	for (unsigned i = 0; i < num_outputs; ++i) {
+		glFramebufferTexture2D(
+			GL_FRAMEBUFFER,
+			GL_COLOR_ATTACHMENT0 + i,
+			GL_TEXTURE_2D,
+			texnum[i],
+			0);
+		check_error();
+	}
+	const GLenum bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	glDrawBuffers(num_outputs, bufs);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+
+	chain.render_to_fbo(fbo, width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	for (unsigned i = 0; i < num_outputs; ++i) {
+		T *ptr = data[i];
+		glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+		check_error();
+		if (!epoxy_is_desktop_gl() && (format == GL_RED || format == GL_BLUE || format == GL_ALPHA)) {
+			// GLES will only read GL_RGBA.
+			T *temp = new T[width * height * 4];
+			glReadPixels(0, 0, width, height, GL_RGBA, internal_format, temp);
+			check_error();
+			if (format == GL_ALPHA) {
+				for (unsigned j = 0; j < width * height; ++j) {
+					ptr[j] = temp[j * 4 + 3];
+				}
+			} else if (format == GL_BLUE) {
+				for (unsigned j = 0; j < width * height; ++j) {
+					ptr[j] = temp[j * 4 + 2];
+				}
+			} else {
+				for (unsigned j = 0; j < width * height; ++j) {
+					ptr[j] = temp[j * 4];
+				}
+			}
+			delete[] temp;
+		} else {
+			glReadPixels(0, 0, width, height, format, internal_format, ptr);
+			check_error();
+		}
+
+		if (format == GL_RGBA) {
+			vertical_flip(ptr, width * 4, height);
+		} else {
+			vertical_flip(ptr, width, height);
+		}
+	}
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+
+	glDeleteFramebuffers(1, &fbo);
+	check_error();
+	glDeleteTextures(num_outputs, texnum);
+	check_error();
+}
+
+#ifdef HAVE_BENCHMARK
+
+void EffectChainTester::benchmark(benchmark::State &state, GLenum framebuffer_format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format,
+                                  void (*frame_callback)(void *), void *frame_callback_data)
 {
 	if (!finalized) {
 		finalize_chain(color_space, gamma_curve, alpha_format);
@@ -148,55 +267,45 @@ void EffectChainTester::internal_run(T *out_data, GLenum internal_format, GLenum
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	check_error();
 
-	chain.render_to_fbo(fbo, width, height);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	check_error();
-	if (!epoxy_is_desktop_gl() && (format == GL_RED || format == GL_BLUE || format == GL_ALPHA)) {
-		// GLES will only read GL_RGBA.
-		T *temp = new T[width * height * 4];
-		glReadPixels(0, 0, width, height, GL_RGBA, internal_format, temp);
-		check_error();
-		if (format == GL_ALPHA) {
-			for (unsigned i = 0; i < width * height; ++i) {
-				out_data[i] = temp[i * 4 + 3];
-			}
-		} else if (format == GL_BLUE) {
-			for (unsigned i = 0; i < width * height; ++i) {
-				out_data[i] = temp[i * 4 + 2];
-			}
-		} else {
-			for (unsigned i = 0; i < width * height; ++i) {
-				out_data[i] = temp[i * 4];
-			}
+	const uint64_t start_gl_calls = movit_num_checked_gl_calls;
+	while (state.KeepRunning()) {
+		if (frame_callback != NULL) {
+			frame_callback(frame_callback_data);
 		}
-		delete[] temp;
-	} else {
-		glReadPixels(0, 0, width, height, format, internal_format, out_data);
-		check_error();
+		chain.render_to_fbo(fbo, width, height);
+
+		// Make sure we do not just measure how fast we can queue up commands.
+		glFinish();
+	}
+
+#ifndef NDEBUG
+	// Report the driver work per frame along with the timings.
+	if (state.iterations() > 0) {
+		char buf[256];
+		snprintf(buf, sizeof(buf), "%.1f GL calls/frame",
+			double(movit_num_checked_gl_calls - start_gl_calls) / state.iterations());
+		state.SetLabel(buf);
 	}
+#endif
 
 	glDeleteFramebuffers(1, &fbo);
 	check_error();
 	glDeleteTextures(1, &texnum);
 	check_error();
-
-	if (format == GL_RGBA) {
-		width *= 4;
-	}
-
-	vertical_flip(out_data, width, height);
 }
 
+#endif
+
 void EffectChainTester::add_output(const ImageFormat &format, OutputAlphaFormat alpha_format)
 {
 	chain.add_output(format, alpha_format);
 	output_added = true;
 }
 
-void EffectChainTester::add_ycbcr_output(const ImageFormat &format, OutputAlphaFormat alpha_format, const YCbCrFormat &ycbcr_format)
+void EffectChainTester::add_ycbcr_output(const ImageFormat &format, OutputAlphaFormat alpha_format, const YCbCrFormat &ycbcr_format,
+                                         YCbCrOutputSplitting output_splitting)
 {
-	chain.add_ycbcr_output(format, alpha_format, ycbcr_format);
+	chain.add_ycbcr_output(format, alpha_format, ycbcr_format, output_splitting);
 	output_added = true;
 }
 
@@ -2,6 +2,11 @@
 #define _MOVIT_TEST_UTIL_H 1
 
 #include <epoxy/gl.h>
+#include <string>
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
+#include "effect.h"
 #include "effect_chain.h"
 #include "image_format.h"
 
@@ -9,13 +14,25 @@ namespace movit {
 
 class Input;
 
+// An effect that does nothing, but requests texture bounce; useful for
+// splitting a chain into phases at a given point.
+class BouncingIdentityEffect : public Effect {
+public:
+	BouncingIdentityEffect() {}
+	virtual std::string effect_type_id() const { return "IdentityEffect"; }
+	std::string output_fragment_shader();
+	bool needs_texture_bounce() const { return true; }
+	AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
+};
+
 class EffectChainTester {
 public:
 	EffectChainTester(const float *data, unsigned width, unsigned height,
 	                  MovitPixelFormat pixel_format = FORMAT_GRAYSCALE,
 	                  Colorspace color_space = COLORSPACE_sRGB,
 	                  GammaCurve gamma_curve = GAMMA_LINEAR,
-	                  GLenum framebuffer_format = GL_RGBA16F_ARB);
+	                  GLenum framebuffer_format = GL_RGBA16F_ARB,
+	                  ResourcePool *resource_pool = NULL);
 	~EffectChainTester();
 	
 	EffectChain *get_chain() { return &chain; }
@@ -23,14 +40,32 @@ public:
 	Input *add_input(const unsigned char *data, MovitPixelFormat pixel_format, Colorspace color_space, GammaCurve gamma_curve, int input_width = -1, int input_height = -1);
 	void run(float *out_data, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format = OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
 	void run(unsigned char *out_data, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format = OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+
+	// For chains with more than one output (e.g. split or planar Y'CbCr,
+	// or Y'CbCr and RGBA at the same time); renders into one texture for
+	// each, as consecutive draw buffers, and reads all of them back.
+	void run(unsigned char *out_data, unsigned char *out_data2, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format = OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	void run(unsigned char *out_data, unsigned char *out_data2, unsigned char *out_data3, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format = OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+
 	void add_output(const ImageFormat &format, OutputAlphaFormat alpha_format);
-	void add_ycbcr_output(const ImageFormat &format, OutputAlphaFormat alpha_format, const YCbCrFormat &ycbcr_format);
+	void add_ycbcr_output(const ImageFormat &format, OutputAlphaFormat alpha_format, const YCbCrFormat &ycbcr_format,
+	                      YCbCrOutputSplitting output_splitting = YCBCR_OUTPUT_INTERLEAVED);
+
+#ifdef HAVE_BENCHMARK
+	// Render the chain over and over again into the same FBO for as long as
+	// the benchmark framework wants, without reading back the result.
+	// If frame_callback is set, it is called with frame_callback_data before
+	// every frame (e.g. to give an input new data).
+	void benchmark(benchmark::State &state, GLenum framebuffer_format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format = OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED,
+	               void (*frame_callback)(void *) = NULL, void *frame_callback_data = NULL);
+#endif
 
 private:
 	void finalize_chain(Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format);
 
+	// <out_data2> and <out_data3> may be NULL.
 	template<class T>
-	void internal_run(T *out_data, GLenum internal_format, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format = OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	void internal_run(T *out_data, T *out_data2, T *out_data3, GLenum internal_format, GLenum format, Colorspace color_space, GammaCurve gamma_curve, OutputAlphaFormat alpha_format = OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
 
 	EffectChain chain;
 	unsigned width, height;
@@ -0,0 +1,131 @@
+#include <epoxy/gl.h>
+#include <assert.h>
+
+#include "init.h"
+#include "upload_ring.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+const GLbitfield persistent_map_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+}  // namespace
+
+UploadRing::UploadRing(unsigned num_buffers, size_t buffer_size)
+	: buffers(num_buffers),
+	  buffer_size(buffer_size),
+	  persistent(movit_buffer_storage_supported),
+	  current(0),
+	  in_write(false)
+{
+	assert(num_buffers > 0);
+	for (unsigned i = 0; i < num_buffers; ++i) {
+		Buffer *buf = &buffers[i];
+		glGenBuffers(1, &buf->pbo);
+		check_error();
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, buf->pbo);
+		check_error();
+		if (persistent) {
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER_ARB, buffer_size, NULL, persistent_map_flags);
+			check_error();
+			buf->ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER_ARB, 0, buffer_size, persistent_map_flags);
+			check_error();
+			assert(buf->ptr != NULL);
+		} else {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER_ARB, buffer_size, NULL, GL_STREAM_DRAW);
+			check_error();
+			buf->ptr = NULL;
+		}
+		buf->sync = NULL;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	check_error();
+}
+
+UploadRing::~UploadRing()
+{
+	assert(!in_write);
+	for (unsigned i = 0; i < buffers.size(); ++i) {
+		Buffer *buf = &buffers[i];
+		if (buf->sync != NULL) {
+			glDeleteSync(buf->sync);
+			check_error();
+		}
+		if (persistent) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, buf->pbo);
+			check_error();
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB);
+			check_error();
+		}
+		glDeleteBuffers(1, &buf->pbo);
+		check_error();
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	check_error();
+}
+
+void *UploadRing::begin_write()
+{
+	assert(!in_write);
+	in_write = true;
+
+	Buffer *buf = &buffers[current];
+	if (persistent) {
+		if (buf->sync != NULL) {
+			GLenum ret;
+			do {
+				ret = glClientWaitSync(buf->sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+				check_error();
+			} while (ret == GL_TIMEOUT_EXPIRED);
+			assert(ret != GL_WAIT_FAILED);
+			glDeleteSync(buf->sync);
+			check_error();
+			buf->sync = NULL;
+		}
+		return buf->ptr;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, buf->pbo);
+	check_error();
+	void *ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER_ARB, 0, buffer_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	check_error();
+	assert(ptr != NULL);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	check_error();
+	return ptr;
+}
+
+GLuint UploadRing::end_write()
+{
+	assert(in_write);
+	in_write = false;
+
+	Buffer *buf = &buffers[current];
+	if (!persistent) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, buf->pbo);
+		check_error();
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB);
+		check_error();
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+		check_error();
+	}
+	return buf->pbo;
+}
+
+void UploadRing::fence()
+{
+	assert(!in_write);
+	Buffer *buf = &buffers[current];
+	if (persistent) {
+		assert(buf->sync == NULL);
+		buf->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		check_error();
+	}
+	current = (current + 1) % buffers.size();
+}
+
+}  // namespace movit
@@ -0,0 +1,65 @@
+#ifndef _MOVIT_UPLOAD_RING_H
+#define _MOVIT_UPLOAD_RING_H 1
+
+// An UploadRing is a small set of pixel unpack buffers (PBOs) that an input
+// can cycle through when uploading texture data from client memory.
+// Calling glTexSubImage2D() straight from client memory makes many drivers
+// either stall or make an extra copy behind our back; instead, we copy the
+// data into the next buffer in the ring and upload from there, so that the
+// CPU can fill the buffer for frame N+1 while the GPU is still reading the
+// one for frame N.
+//
+// If the driver supports it (see movit_buffer_storage_supported), the buffers
+// are persistently mapped once and for all, and we wait on a fence before
+// reusing each of them. If not, we map each buffer anew every time with
+// GL_MAP_INVALIDATE_BUFFER_BIT, which allows the driver to orphan the old
+// storage instead of waiting for the GPU.
+//
+// You will normally not use this class directly; set “num_upload_buffers”
+// on the input instead. It must be created, used and destroyed with
+// an OpenGL context current (or one sharing objects with it).
+
+#include <epoxy/gl.h>
+#include <stddef.h>
+#include <vector>
+
+namespace movit {
+
+class UploadRing {
+public:
+	UploadRing(unsigned num_buffers, size_t buffer_size);
+	~UploadRing();
+
+	unsigned get_num_buffers() const { return buffers.size(); }
+	size_t get_buffer_size() const { return buffer_size; }
+
+	// Returns a pointer to the next buffer in the ring, which you can
+	// write up to get_buffer_size() bytes to. If the GPU is still reading
+	// from that buffer, waits until it is done.
+	void *begin_write();
+
+	// Done writing to the buffer returned by begin_write(); returns the PBO
+	// to bind to GL_PIXEL_UNPACK_BUFFER_ARB for the upload(s).
+	GLuint end_write();
+
+	// Call after all the upload commands reading from the buffer have been
+	// issued. Marks the buffer as in use by the GPU, and moves on to the
+	// next one.
+	void fence();
+
+private:
+	struct Buffer {
+		GLuint pbo;
+		void *ptr;  // Only if persistently mapped.
+		GLsync sync;  // NULL if the GPU is not reading from it.
+	};
+	std::vector<Buffer> buffers;
+	size_t buffer_size;
+	bool persistent;
+	unsigned current;
+	bool in_write;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_UPLOAD_RING_H)
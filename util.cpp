@@ -27,6 +27,8 @@ namespace movit {
 
 extern string *movit_data_directory;
 
+uint64_t movit_num_checked_gl_calls = 0;
+
 void hsv2rgb(float h, float s, float v, float *r, float *g, float *b)
 {
 	if (h < 0.0f) {
@@ -136,13 +138,24 @@ string read_version_dependent_file(const string &base, const string &extension)
 }
 
 GLuint compile_shader(const string &shader_src, GLenum type)
+{
+	GLuint obj = start_compile_shader(shader_src, type);
+	check_shader_compiled(obj, shader_src);
+	return obj;
+}
+
+GLuint start_compile_shader(const string &shader_src, GLenum type)
 {
 	GLuint obj = glCreateShader(type);
 	const GLchar* source[] = { shader_src.data() };
 	const GLint length[] = { (GLint)shader_src.size() };
 	glShaderSource(obj, 1, source, length);
 	glCompileShader(obj);
+	return obj;
+}
 
+void check_shader_compiled(GLuint obj, const string &shader_src)
+{
 	GLchar info_log[4096];
 	GLsizei log_length = sizeof(info_log) - 1;
 	glGetShaderInfoLog(obj, log_length, &log_length, info_log);
@@ -157,8 +170,6 @@ GLuint compile_shader(const string &shader_src, GLenum type)
 		fprintf(stderr, "Failed to compile shader: %s\n", shader_src.c_str());
 		exit(1);
 	}
-
-	return obj;
 }
 
 void print_3x3_matrix(const Eigen::Matrix3d& m)
@@ -269,6 +280,21 @@ template
 void combine_two_samples<fp16_int_t>(float w1, float w2, float pos1, float pos2, float num_subtexels, float inv_num_subtexels,
                                      fp16_int_t *offset, fp16_int_t *total_weight, float *sum_sq_error);
 
+GLuint generate_vbo(GLsizeiptr data_size, const GLvoid *data)
+{
+	GLuint vbo;
+	glGenBuffers(1, &vbo);
+	check_error();
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	check_error();
+	glBufferData(GL_ARRAY_BUFFER, data_size, data, GL_STATIC_DRAW);
+	check_error();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	check_error();
+
+	return vbo;
+}
+
 GLuint fill_vertex_attribute(GLuint glsl_program_num, const string &attribute_name, GLint size, GLenum type, GLsizeiptr data_size, const GLvoid *data)
 {
 	int attrib = glGetAttribLocation(glsl_program_num, attribute_name.c_str());
@@ -276,13 +302,9 @@ GLuint fill_vertex_attribute(GLuint glsl_program_num, const string &attribute_na
 		return -1;
 	}
 
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	check_error();
+	GLuint vbo = generate_vbo(data_size, data);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	check_error();
-	glBufferData(GL_ARRAY_BUFFER, data_size, data, GL_STATIC_DRAW);
-	check_error();
 	glEnableVertexAttribArray(attrib);
 	check_error();
 	glVertexAttribPointer(attrib, size, type, GL_FALSE, 0, BUFFER_OFFSET(0));
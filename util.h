@@ -4,6 +4,7 @@
 // Various utilities.
 
 #include <epoxy/gl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <Eigen/Core>
@@ -32,6 +33,14 @@ std::string read_version_dependent_file(const std::string &base, const std::stri
 // and return the object number.
 GLuint compile_shader(const std::string &shader_src, GLenum type);
 
+// The same, in two steps: start_compile_shader() only submits the shader
+// for compilation, and check_shader_compiled() waits for the result and
+// exits with an error message if it failed. Doing other work in-between
+// lets drivers that compile in the background (see
+// movit_parallel_shader_compile_supported) do so in parallel.
+GLuint start_compile_shader(const std::string &shader_src, GLenum type);
+void check_shader_compiled(GLuint obj, const std::string &shader_src);
+
 // Print a 3x3 matrix to standard output. Useful for debugging.
 void print_3x3_matrix(const Eigen::Matrix3d &m);
 
@@ -74,6 +83,9 @@ template<class DestFloat>
 void combine_two_samples(float w1, float w2, float pos1, float pos2, float num_subtexels, float inv_num_subtexels,
                          DestFloat *offset, DestFloat *total_weight, float *sum_sq_error);
 
+// Create a VBO with the given data. Returns the VBO number.
+GLuint generate_vbo(GLsizeiptr data_size, const GLvoid *data);
+
 // Create a VBO with the given data, and bind it to the vertex attribute
 // with name <attribute_name>. Returns the VBO number.
 GLuint fill_vertex_attribute(GLuint glsl_program_num, const std::string &attribute_name, GLint size, GLenum type, GLsizeiptr data_size, const GLvoid *data);
@@ -90,12 +102,18 @@ unsigned next_power_of_two(unsigned v);
 // back into anything you intend to pass into OpenGL.
 void *get_gl_context_identifier();
 
+// How many OpenGL calls have been followed by check_error(), which is
+// nearly all of those Movit makes. Tests and benchmarks can see how much
+// driver work something does by looking at how much this grows.
+// Only counted in debug builds, and not synchronized between threads.
+extern uint64_t movit_num_checked_gl_calls;
+
 }  // namespace movit
 
 #ifdef NDEBUG
 #define check_error()
 #else
-#define check_error() { int err = glGetError(); if (err != GL_NO_ERROR) { printf("GL error 0x%x at %s:%d\n", err, __FILE__, __LINE__); abort(); } }
+#define check_error() { ++movit::movit_num_checked_gl_calls; int err = glGetError(); if (err != GL_NO_ERROR) { printf("GL error 0x%x at %s:%d\n", err, __FILE__, __LINE__); abort(); } }
 #endif
 
 // CHECK() is like assert(), but retains any side effects no matter the compilation mode.
@@ -0,0 +1,123 @@
+#include <epoxy/gl.h>
+#include <assert.h>
+#include <stdio.h>
+
+#include "effect_util.h"
+#include "resource_pool.h"
+#include "util.h"
+#include "v210_input.h"
+#include "ycbcr.h"
+
+using namespace Eigen;
+using namespace std;
+
+namespace movit {
+
+V210Input::V210Input(const ImageFormat &image_format,
+                     const YCbCrFormat &ycbcr_format,
+                     unsigned width, unsigned height)
+	: image_format(image_format),
+	  ycbcr_format(ycbcr_format),
+	  pbo(0),
+	  texture_num(0),
+	  width(width),
+	  height(height),
+	  pitch(get_minimum_v210_stride(width)),
+	  pixel_data(NULL),
+	  resource_pool(NULL)
+{
+	assert(ycbcr_format.chroma_subsampling_x == 2);
+	assert(ycbcr_format.chroma_subsampling_y == 1);
+	assert(ycbcr_format.num_levels == 1024);
+	assert(width % ycbcr_format.chroma_subsampling_x == 0);
+
+	register_uniform_sampler2d("tex_v210", &uniform_tex_v210);
+}
+
+V210Input::~V210Input()
+{
+	invalidate_pixel_data();
+}
+
+void V210Input::set_gl_state(GLuint glsl_program_num, const string& prefix, unsigned *sampler_num)
+{
+	glActiveTexture(GL_TEXTURE0 + *sampler_num);
+	check_error();
+
+	if (texture_num == 0) {
+		// (Re-)upload the texture. Every texel is one 32-bit word,
+		// and a partial block at the end of a row still takes four.
+		unsigned texture_width = (width + 5) / 6 * 4;
+		texture_num = resource_pool->create_2d_texture(GL_RGB10_A2, texture_width, height);
+		glBindTexture(GL_TEXTURE_2D, texture_num);
+		check_error();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		check_error();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		check_error();
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+		check_error();
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		check_error();
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 4);
+		check_error();
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_width, height, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, pixel_data);
+		check_error();
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		check_error();
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+		check_error();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		check_error();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		check_error();
+	} else {
+		glBindTexture(GL_TEXTURE_2D, texture_num);
+		check_error();
+	}
+
+	// Bind it to a sampler.
+	uniform_tex_v210 = *sampler_num;
+	++*sampler_num;
+}
+
+string V210Input::output_fragment_shader()
+{
+	float offset[3];
+	Matrix3d ycbcr_to_rgb;
+	compute_ycbcr_matrix(ycbcr_format, offset, &ycbcr_to_rgb);
+
+	string frag_shader;
+
+	frag_shader = output_glsl_mat3("PREFIX(inv_ycbcr_matrix)", ycbcr_to_rgb);
+	frag_shader += output_glsl_vec3("PREFIX(offset)", offset[0], offset[1], offset[2]);
+	frag_shader += output_glsl_float("PREFIX(cb_x_position)", ycbcr_format.cb_x_position);
+	frag_shader += output_glsl_float("PREFIX(cr_x_position)", ycbcr_format.cr_x_position);
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), "const int PREFIX(width) = %u;\nconst int PREFIX(chroma_width) = %u;\nconst int PREFIX(height) = %u;\n",
+		width, width / 2, height);
+	frag_shader += buf;
+
+	frag_shader += read_file("v210_input.frag");
+	return frag_shader;
+}
+
+void V210Input::invalidate_pixel_data()
+{
+	if (texture_num != 0) {
+		resource_pool->release_2d_texture(texture_num);
+		texture_num = 0;
+	}
+}
+
+bool V210Input::set_int(const std::string& key, int value)
+{
+	if (key == "needs_mipmaps") {
+		// We currently do not support this.
+		return (value == 0);
+	}
+	return Effect::set_int(key, value);
+}
+
+}  // namespace movit
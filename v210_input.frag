@@ -0,0 +1,76 @@
+// Implicit uniforms:
+// uniform sampler2D PREFIX(tex_v210);
+
+// Every block of four 32-bit words (one texel each) contains six pixels,
+// packed into twelve 10-bit slots (three per word, in the R, G and B
+// channels) as Cb0 Y0 Cr0 Y1 Cb1 Y2 Cr1 Y3 Cb2 Y4 Cr2 Y5. Thus, luma
+// sample i is in slot 2 * (i % 6) + 1 of block i / 6, and chroma sample j
+// is in slot 4 * (j % 3) of block j / 3 (plus two for Cr).
+float PREFIX(fetch_slot)(int block, int slot, int row)
+{
+	vec4 word = texelFetch(PREFIX(tex_v210), ivec2(block * 4 + slot / 3, row), 0);
+	return word[slot % 3];
+}
+
+float PREFIX(fetch_luma)(int x, int y)
+{
+	x = clamp(x, 0, PREFIX(width) - 1);
+	y = clamp(y, 0, PREFIX(height) - 1);
+	return PREFIX(fetch_slot)(x / 6, 2 * (x % 6) + 1, y);
+}
+
+// <chroma_slot> is 0 for Cb, 2 for Cr.
+float PREFIX(fetch_chroma)(int x, int y, int chroma_slot)
+{
+	x = clamp(x, 0, PREFIX(chroma_width) - 1);
+	y = clamp(y, 0, PREFIX(height) - 1);
+	return PREFIX(fetch_slot)(x / 3, 4 * (x % 3) + chroma_slot, y);
+}
+
+// Bilinear interpolation between the four samples around <pos>,
+// which is in sample coordinates (sample centers are at integers).
+float PREFIX(interpolate_luma)(vec2 pos)
+{
+	vec2 base = floor(pos);
+	vec2 f = pos - base;
+	int x = int(base.x), y = int(base.y);
+	float top = mix(PREFIX(fetch_luma)(x, y), PREFIX(fetch_luma)(x + 1, y), f.x);
+	float bottom = mix(PREFIX(fetch_luma)(x, y + 1), PREFIX(fetch_luma)(x + 1, y + 1), f.x);
+	return mix(top, bottom, f.y);
+}
+
+float PREFIX(interpolate_chroma)(vec2 pos, int chroma_slot)
+{
+	vec2 base = floor(pos);
+	vec2 f = pos - base;
+	int x = int(base.x), y = int(base.y);
+	float top = mix(PREFIX(fetch_chroma)(x, y, chroma_slot), PREFIX(fetch_chroma)(x + 1, y, chroma_slot), f.x);
+	float bottom = mix(PREFIX(fetch_chroma)(x, y + 1, chroma_slot), PREFIX(fetch_chroma)(x + 1, y + 1, chroma_slot), f.x);
+	return mix(top, bottom, f.y);
+}
+
+vec4 FUNCNAME(vec2 tc) {
+	// OpenGL's origin is bottom-left, but most graphics software assumes
+	// a top-left origin. Thus, for inputs that come from the user,
+	// we flip the y coordinate.
+	tc.y = 1.0 - tc.y;
+
+	// Convert to sample coordinates, where the luma sample centers are at
+	// integers. Chroma sample j is sited at luma position 2j plus
+	// the chroma position from YCbCrFormat.
+	vec2 pos = tc * vec2(PREFIX(width), PREFIX(height)) - 0.5;
+	vec2 cb_pos = vec2((pos.x - PREFIX(cb_x_position)) * 0.5, pos.y);
+	vec2 cr_pos = vec2((pos.x - PREFIX(cr_x_position)) * 0.5, pos.y);
+
+	vec3 ycbcr;
+	ycbcr.x = PREFIX(interpolate_luma)(pos);
+	ycbcr.y = PREFIX(interpolate_chroma)(cb_pos, 0);
+	ycbcr.z = PREFIX(interpolate_chroma)(cr_pos, 2);
+
+	ycbcr -= PREFIX(offset);
+
+	vec4 rgba;
+	rgba.rgb = PREFIX(inv_ycbcr_matrix) * ycbcr;
+	rgba.a = 1.0;
+	return rgba;
+}
@@ -0,0 +1,111 @@
+#ifndef _MOVIT_V210_INPUT_H
+#define _MOVIT_V210_INPUT_H 1
+
+// V210Input is for handling v210, the 10-bit 4:2:2 interleaved Y'CbCr format
+// that is common in SDI capture cards. Every 32-bit little-endian word holds
+// three 10-bit samples (in bits 0–9, 10–19 and 20–29), and every group of
+// four words holds six pixels, ordered Cb Y Cr Y Cb Y Cr Y Cb Y Cr Y.
+//
+// Instead of unpacking this on the CPU, we upload the words as they are,
+// one word per texel, into a GL_RGB10_A2 texture (so that the three samples
+// of each word end up in the R, G and B channels), and pick out the right
+// samples in the shader. This means that every sample is uploaded only once,
+// at 10 bits; expanding to 16-bit planar on the CPU would take 50% more
+// bandwidth, in addition to the CPU time. Since the samples are not
+// where the GPU's filtering would expect them, we do the bilinear
+// interpolation (as in YCbCr422InterleavedInput) ourselves.
+//
+// <ycbcr_format> must have chroma_subsampling_x = 2 and
+// chroma_subsampling_y = 1, and num_levels must be 1024.
+
+#include <epoxy/gl.h>
+#include <assert.h>
+#include <string>
+
+#include "effect.h"
+#include "effect_chain.h"
+#include "image_format.h"
+#include "input.h"
+#include "ycbcr.h"
+
+namespace movit {
+
+class ResourcePool;
+
+class V210Input : public Input {
+public:
+	// <width> is the true width of the image in pixels, ie., the number of
+	// horizontal luma samples. It must be even.
+	V210Input(const ImageFormat &image_format,
+	          const YCbCrFormat &ycbcr_format,
+	          unsigned width, unsigned height);
+	~V210Input();
+
+	virtual std::string effect_type_id() const { return "V210Input"; }
+
+	virtual bool can_output_linear_gamma() const { return false; }
+	virtual AlphaHandling alpha_handling() const { return OUTPUT_BLANK_ALPHA; }
+
+	// We fetch luma, Cb and Cr four times each, and unpack them by hand.
+	virtual float estimated_alu_cost() const { return 40.0f; }
+	virtual float estimated_texture_fetches() const { return 12.0f; }
+
+	std::string output_fragment_shader();
+
+	// Uploads the texture if it has changed since last time.
+	void set_gl_state(GLuint glsl_program_num, const std::string& prefix, unsigned *sampler_num);
+
+	unsigned get_width() const { return width; }
+	unsigned get_height() const { return height; }
+	Colorspace get_color_space() const { return image_format.color_space; }
+	GammaCurve get_gamma_curve() const { return image_format.gamma_curve; }
+	virtual bool can_supply_mipmaps() const { return false; }
+
+	// The number of bytes per row that v210 normally uses; the rows are
+	// padded to a multiple of 48 pixels (128 bytes).
+	static unsigned get_minimum_v210_stride(unsigned width)
+	{
+		return (width + 47) / 48 * 128;
+	}
+
+	// Tells the input where to fetch the actual pixel data; see the comments
+	// on YCbCr422InterleavedInput::set_pixel_data().
+	void set_pixel_data(const unsigned char *pixel_data, GLuint pbo = 0)
+	{
+		this->pixel_data = pixel_data;
+		this->pbo = pbo;
+		invalidate_pixel_data();
+	}
+
+	void invalidate_pixel_data();
+
+	// Unlike the other inputs, the pitch is given in bytes, since v210
+	// rows are not necessarily a whole number of pixels. It must be
+	// a multiple of four. The default is get_minimum_v210_stride(width).
+	void set_pitch(unsigned pitch) {
+		assert(pitch % 4 == 0);
+		this->pitch = pitch;
+		invalidate_pixel_data();
+	}
+
+	virtual void inform_added(EffectChain *chain)
+	{
+		resource_pool = chain->get_resource_pool();
+	}
+
+	bool set_int(const std::string& key, int value);
+
+private:
+	ImageFormat image_format;
+	YCbCrFormat ycbcr_format;
+	GLuint pbo, texture_num;
+	GLint uniform_tex_v210;
+
+	unsigned width, height, pitch;
+	const unsigned char *pixel_data;
+	ResourcePool *resource_pool;
+};
+
+}  // namespace movit
+
+#endif  // !defined(_MOVIT_V210_INPUT_H)
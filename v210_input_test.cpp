@@ -0,0 +1,195 @@
+// Unit tests for V210Input.
+
+#include <epoxy/gl.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "test_util.h"
+#include "util.h"
+#include "v210_input.h"
+#include "ycbcr_input.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// Packs 10-bit 4:2:2 planar samples into v210 with the given stride (in bytes).
+void pack_v210(const unsigned short *y, const unsigned short *cb, const unsigned short *cr,
+               unsigned width, unsigned height, unsigned stride, unsigned char *dst)
+{
+	memset(dst, 0, stride * height);
+	for (unsigned row = 0; row < height; ++row) {
+		unsigned char *line = dst + row * stride;
+		for (unsigned slot = 0; slot < (width + 5) / 6 * 12; ++slot) {
+			// Slots go Cb Y Cr Y Cb Y Cr Y ..., three to a word.
+			unsigned value = 0;
+			if (slot % 2 == 1) {
+				unsigned x = slot / 2;
+				if (x < width) value = y[row * width + x];
+			} else {
+				unsigned x = slot / 4;
+				if (x < width / 2) value = (slot % 4 == 0) ? cb[row * (width / 2) + x] : cr[row * (width / 2) + x];
+			}
+			unsigned char *word = line + (slot / 3) * 4;
+			unsigned shifted = value << (10 * (slot % 3));
+			for (unsigned i = 0; i < 4; ++i) {
+				word[i] |= (shifted >> (8 * i)) & 0xff;
+			}
+		}
+	}
+}
+
+// A straightforward CPU decoder for v210, giving 4:2:2 planar samples
+// in MSB-aligned 16-bit words (as in P210), for comparing against YCbCrInput.
+void decode_v210(const unsigned char *src, unsigned width, unsigned height, unsigned stride,
+                 unsigned short *y, unsigned short *cb, unsigned short *cr)
+{
+	for (unsigned row = 0; row < height; ++row) {
+		const unsigned char *line = src + row * stride;
+		for (unsigned block = 0; block < (width + 5) / 6; ++block) {
+			unsigned short samples[12];
+			for (unsigned w = 0; w < 4; ++w) {
+				const unsigned char *word = line + (block * 4 + w) * 4;
+				unsigned v = word[0] | (word[1] << 8) | (word[2] << 16) | (unsigned(word[3]) << 24);
+				samples[w * 3 + 0] = v & 0x3ff;
+				samples[w * 3 + 1] = (v >> 10) & 0x3ff;
+				samples[w * 3 + 2] = (v >> 20) & 0x3ff;
+			}
+			for (unsigned i = 0; i < 6 && block * 6 + i < width; ++i) {
+				y[row * width + block * 6 + i] = samples[i * 2 + 1] << 6;
+			}
+			for (unsigned i = 0; i < 3 && block * 3 + i < width / 2; ++i) {
+				cb[row * (width / 2) + block * 3 + i] = samples[i * 4] << 6;
+				cr[row * (width / 2) + block * 3 + i] = samples[i * 4 + 2] << 6;
+			}
+		}
+	}
+}
+
+YCbCrFormat get_v210_format()
+{
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_709;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 1024;
+	ycbcr_format.chroma_subsampling_x = 2;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.0f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.0f;
+	ycbcr_format.cr_y_position = 0.5f;
+	return ycbcr_format;
+}
+
+}  // namespace
+
+// Adapted from the Simple422 test from YCbCr422InterleavedInputTest,
+// with the values scaled up to 10-bit.
+TEST(V210InputTest, Simple422) {
+	const int width = 2;
+	const int height = 5;
+
+	// Pure-color test inputs, calculated with the formulas in Rec. 601
+	// section 2.5.4.
+	unsigned short y[width * height] = {
+		64, 64,
+		940, 940,
+		324, 324,
+		580, 580,
+		164, 164,
+	};
+	unsigned short cb[width * height / 2] = {
+		512, 512, 360, 216, 960,
+	};
+	unsigned short cr[width * height / 2] = {
+		512, 512, 960, 136, 440,
+	};
+	float expected_data[4 * width * height] = {
+		0.0, 0.0, 0.0, 1.0,   0.0, 0.0, 0.0, 1.0,
+		1.0, 1.0, 1.0, 1.0,   1.0, 1.0, 1.0, 1.0,
+		1.0, 0.0, 0.0, 1.0,   1.0, 0.0, 0.0, 1.0,
+		0.0, 1.0, 0.0, 1.0,   0.0, 1.0, 0.0, 1.0,
+		0.0, 0.0, 1.0, 1.0,   0.0, 0.0, 1.0, 1.0,
+	};
+	float out_data[4 * width * height];
+
+	const unsigned stride = V210Input::get_minimum_v210_stride(width);
+	vector<unsigned char> v210(stride * height);
+	pack_v210(y, cb, cr, width, height, stride, &v210[0]);
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format = get_v210_format();
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+
+	V210Input *input = new V210Input(format, ycbcr_format, width, height);
+	input->set_pixel_data(&v210[0]);
+	tester.get_chain()->add_input(input);
+
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	// Y'CbCr isn't 100% accurate (the input values are rounded),
+	// so we need some leeway.
+	expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+}
+
+// Decodes pseudo-random v210 data with the CPU decoder above, and checks that
+// YCbCrInput on the decoded data gives the same result as V210Input on the
+// original. The width is not a multiple of six, and the pitch is larger than
+// needed, so that we also test partial blocks and padding.
+TEST(V210InputTest, MatchesReferenceDecoder) {
+	const int width = 10;
+	const int height = 4;
+
+	unsigned short y[width * height], cb[width * height / 2], cr[width * height / 2];
+	for (int i = 0; i < width * height; ++i) {
+		y[i] = 64 + (i * 337) % 877;
+	}
+	for (int i = 0; i < width * height / 2; ++i) {
+		cb[i] = 64 + (i * 211) % 897;
+		cr[i] = 64 + (i * 499) % 897;
+	}
+
+	const unsigned stride = V210Input::get_minimum_v210_stride(width) + 64;
+	vector<unsigned char> v210(stride * height);
+	pack_v210(y, cb, cr, width, height, stride, &v210[0]);
+
+	unsigned short ref_y[width * height], ref_cb[width * height / 2], ref_cr[width * height / 2];
+	decode_v210(&v210[0], width, height, stride, ref_y, ref_cb, ref_cr);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	float out_data[4 * width * height], ref_data[4 * width * height];
+	{
+		EffectChainTester tester(NULL, width, height);
+		V210Input *input = new V210Input(format, get_v210_format(), width, height);
+		input->set_pixel_data(&v210[0]);
+		input->set_pitch(stride);
+		tester.get_chain()->add_input(input);
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+	{
+		EffectChainTester tester(NULL, width, height);
+		YCbCrInput *input = new YCbCrInput(format, get_v210_format(), width, height, YCBCR_INPUT_PLANAR, GL_UNSIGNED_SHORT);
+		input->set_pixel_data(0, ref_y);
+		input->set_pixel_data(1, ref_cb);
+		input->set_pixel_data(2, ref_cr);
+		tester.get_chain()->add_input(input);
+		tester.run(ref_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+
+	expect_equal(ref_data, out_data, 4 * width, height, 0.01, 0.001);
+}
+
+}  // namespace movit
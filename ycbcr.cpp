@@ -3,6 +3,7 @@
 
 #include <Eigen/Core>
 #include <Eigen/LU>
+#include <assert.h>
 
 #include "ycbcr.h"
 
@@ -56,6 +57,17 @@ float compute_chroma_offset(float pos, unsigned subsampling_factor, unsigned res
 	}
 }
 
+namespace {
+
+double get_level_scale(const YCbCrFormat &ycbcr_format)
+{
+	assert(ycbcr_format.num_levels >= 256);
+	assert((ycbcr_format.num_levels & (ycbcr_format.num_levels - 1)) == 0);
+	return ycbcr_format.num_levels / 256.0;
+}
+
+}  // namespace
+
 // Given <ycbcr_format>, compute the values needed to turn Y'CbCr into R'G'B';
 // first subtract the returned offset, then left-multiply the returned matrix
 // (the scaling is already folded into it).
@@ -89,25 +101,28 @@ void compute_ycbcr_matrix(YCbCrFormat ycbcr_format, float* offset, Matrix3d* ycb
 		assert(false);
 	}
 
+	// The 8-bit values below are multiplied by this to get to the
+	// number of levels we actually have, e.g. 4 for 10-bit.
+	const double max_level = ycbcr_format.num_levels - 1;
+	const double level_scale = get_level_scale(ycbcr_format);
+
 	if (ycbcr_format.full_range) {
-		// TODO: Use num_levels.
-		offset[0] = 0.0 / 255.0;
-		offset[1] = 128.0 / 255.0;
-		offset[2] = 128.0 / 255.0;
+		offset[0] = 0.0 / max_level;
+		offset[1] = 128.0 * level_scale / max_level;
+		offset[2] = 128.0 * level_scale / max_level;
 
 		scale[0] = 1.0;
 		scale[1] = 1.0;
 		scale[2] = 1.0;
 	} else {
 		// Rec. 601, page 4; Rec. 709, page 19; Rec. 2020, page 4.
-		// TODO: Use num_levels.
-		offset[0] = 16.0 / 255.0;
-		offset[1] = 128.0 / 255.0;
-		offset[2] = 128.0 / 255.0;
-
-		scale[0] = 255.0 / 219.0;
-		scale[1] = 255.0 / 224.0;
-		scale[2] = 255.0 / 224.0;
+		offset[0] = 16.0 * level_scale / max_level;
+		offset[1] = 128.0 * level_scale / max_level;
+		offset[2] = 128.0 * level_scale / max_level;
+
+		scale[0] = max_level / (219.0 * level_scale);
+		scale[1] = max_level / (224.0 * level_scale);
+		scale[2] = max_level / (224.0 * level_scale);
 	}
 
 	// Matrix to convert RGB to YCbCr. See e.g. Rec. 601.
@@ -133,4 +148,14 @@ void compute_ycbcr_matrix(YCbCrFormat ycbcr_format, float* offset, Matrix3d* ycb
 	*ycbcr_to_rgb *= Map<const Vector3d>(scale).asDiagonal();
 }
 
+void compute_ycbcr_limits(YCbCrFormat ycbcr_format, float *ycbcr_min, float *ycbcr_max)
+{
+	// These limits come from BT.601 page 8, or BT.701, page 5.
+	const double max_level = ycbcr_format.num_levels - 1;
+	const double level_scale = get_level_scale(ycbcr_format);
+	ycbcr_min[0] = ycbcr_min[1] = ycbcr_min[2] = 16.0 * level_scale / max_level;
+	ycbcr_max[0] = 235.0 * level_scale / max_level;
+	ycbcr_max[1] = ycbcr_max[2] = 240.0 * level_scale / max_level;
+}
+
 }  // namespace movit
@@ -29,9 +29,11 @@
 // range, 10-bit goes out of range (white gets to 942), while if you select
 // 10-bit range, 8-bit gets only to 234, making true white impossible.
 //
-// We currently support the 8-bit ranges only, since all of our Y'CbCr
-// handling effects happen to support only 8-bit at the moment. We will need
-// to fix this eventually, though, with an added field to YCbCrFormat.
+// We follow the GPU convention, and interpret the ranges according to
+// num_levels in YCbCrFormat; ie., for 8-bit (256 levels), limited-range
+// luma goes from 16/255 to 235/255, and for 10-bit (1024 levels),
+// from 64/1023 to 940/1023. The inputs are responsible for delivering
+// the code values normalized this way, regardless of how they are stored.
 
 #include "image_format.h"
 
@@ -48,8 +50,9 @@ struct YCbCrFormat {
 	// JPEG uses the Rec. 601 luma coefficients, but full range.
 	bool full_range;
 
-	// Currently unused, but should be set to 256 for future expansion,
-	// indicating 8-bit interpretation (see file-level comment).
+	// Number of code values per channel; 256 for 8-bit, 1024 for 10-bit
+	// and so on (see file-level comment). Must be a power of two,
+	// at least 256.
 	int num_levels;
 
 	// Sampling factors for chroma components. For no subsampling (4:4:4),
@@ -73,6 +76,10 @@ float compute_chroma_offset(float pos, unsigned subsampling_factor, unsigned res
 // (the scaling is already folded into it).
 void compute_ycbcr_matrix(YCbCrFormat ycbcr_format, float *offset, Eigen::Matrix3d *ycbcr_to_rgb);
 
+// Given <ycbcr_format>, compute the normalized limits of the limited-range
+// Y'CbCr code values (e.g. 16/255 and 235/255 for 8-bit luma).
+void compute_ycbcr_limits(YCbCrFormat ycbcr_format, float *ycbcr_min, float *ycbcr_max);
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_YCBCR_INPUT_H)
@@ -28,6 +28,7 @@ YCbCr422InterleavedInput::YCbCr422InterleavedInput(const ImageFormat &image_form
 
 	assert(ycbcr_format.chroma_subsampling_x == 2);
 	assert(ycbcr_format.chroma_subsampling_y == 1);
+	assert(ycbcr_format.num_levels == 256);
 	assert(width % ycbcr_format.chroma_subsampling_x == 0);
 
 	widths[CHANNEL_LUMA] = width;
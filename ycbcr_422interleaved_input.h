@@ -53,6 +53,7 @@ public:
 	//
 	//  * chroma_subsampling_x must be 2.
 	//  * chroma_subsampling_y must be 1.
+	//  * num_levels must be 256 (the input is 8-bit; see V210Input for 10-bit).
 	//
 	// <width> must obviously be an even number. It is the true width of the image
 	// in pixels, ie., the number of horizontal luma samples.
@@ -16,8 +16,13 @@ using namespace Eigen;
 namespace movit {
 
 YCbCrConversionEffect::YCbCrConversionEffect(const YCbCrFormat &ycbcr_format)
-	: ycbcr_format(ycbcr_format)
+	: ycbcr_format(ycbcr_format),
+	  width(1),
+	  height(1)
 {
+	register_int("output_width", &width);
+	register_int("output_height", &height);
+	register_uniform_vec2("image_size", uniform_image_size);
 }
 
 string YCbCrConversionEffect::output_fragment_shader()
@@ -35,13 +40,20 @@ string YCbCrConversionEffect::output_fragment_shader()
 	} else {
 		frag_shader += "#define YCBCR_CLAMP_RANGE 1\n";
 
-		// These limits come from BT.601 page 8, or BT.701, page 5.
-		// TODO: Use num_levels. Currently we support 8-bit levels only.
-		frag_shader += output_glsl_vec3("PREFIX(ycbcr_min)", 16.0 / 255.0, 16.0 / 255.0, 16.0 / 255.0);
-		frag_shader += output_glsl_vec3("PREFIX(ycbcr_max)", 235.0 / 255.0, 240.0 / 255.0, 240.0 / 255.0);
+		float ycbcr_min[3], ycbcr_max[3];
+		compute_ycbcr_limits(ycbcr_format, ycbcr_min, ycbcr_max);
+		frag_shader += output_glsl_vec3("PREFIX(ycbcr_min)", ycbcr_min[0], ycbcr_min[1], ycbcr_min[2]);
+		frag_shader += output_glsl_vec3("PREFIX(ycbcr_max)", ycbcr_max[0], ycbcr_max[1], ycbcr_max[2]);
 	}
 
 	return frag_shader + read_file("ycbcr_conversion_effect.frag");
 }
 
+void YCbCrConversionEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+	uniform_image_size[0] = width;
+	uniform_image_size[1] = height;
+}
+
 }  // namespace movit
@@ -2,8 +2,10 @@
 #define _MOVIT_YCBCR_CONVERSION_EFFECT_H 1
 
 // Converts from R'G'B' to Y'CbCr; that is, more or less the opposite of YCbCrInput,
-// except that it keeps the data as 4:4:4 chunked Y'CbCr; you'll need to subsample
-// and/or convert to planar somehow else.
+// except that it keeps the data as 4:4:4 chunked Y'CbCr; any subsampling and
+// packing is done by the footer of the last phase (see YCbCrOutputSplitting).
+// For that, it also carries the size of the output image (set by EffectChain
+// at render time) in a uniform.
 
 #include <epoxy/gl.h>
 #include <string>
@@ -26,8 +28,12 @@ public:
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
 
+	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
+
 private:
 	YCbCrFormat ycbcr_format;
+	int width, height;
+	float uniform_image_size[2];
 };
 
 }  // namespace movit
@@ -4,6 +4,7 @@
 
 #include <epoxy/gl.h>
 #include <math.h>
+#include <vector>
 
 #include "effect_chain.h"
 #include "gtest/gtest.h"
@@ -372,4 +373,213 @@ TEST(YCbCrConversionEffectTest, OutputChunkyAndRGBA) {
 	expect_equal(expected_rgba, out_rgba, 4 * width, height, 7, 255 * 0.002);
 }
 
+namespace {
+
+// The same pure colors as in the tests above, as a 4x2 image: black, white,
+// red, green on the first line, and blue, black, white, red on the second.
+const int packed_width = 4;
+const int packed_height = 2;
+unsigned char packed_y[packed_width * packed_height] = {
+	16, 235, 81, 145,
+	41, 16, 235, 81,
+};
+unsigned char packed_cb[packed_width * packed_height] = {
+	128, 128, 90, 54,
+	240, 128, 128, 90,
+};
+unsigned char packed_cr[packed_width * packed_height] = {
+	128, 128, 240, 34,
+	110, 128, 128, 240,
+};
+
+// Sets up a chain going from the given 4:4:4 image (by default, the one
+// above) to the given packed output, renders it into a texture of the right
+// size and reads it back. The output origin is top-left, so the first line
+// comes first.
+template<class T>
+void render_packed(YCbCrOutputSplitting output_splitting, const YCbCrFormat &output_ycbcr_format,
+                   GLenum internal_format, GLenum format, GLenum type, std::vector<T> *out_data,
+                   unsigned width = packed_width, unsigned height = packed_height,
+                   const unsigned char *y = packed_y, const unsigned char *cb = packed_cb, const unsigned char *cr = packed_cr)
+{
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat image_format;
+	image_format.color_space = COLORSPACE_sRGB;
+	image_format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat input_ycbcr_format;
+	input_ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	input_ycbcr_format.full_range = false;
+	input_ycbcr_format.num_levels = 256;
+	input_ycbcr_format.chroma_subsampling_x = 1;
+	input_ycbcr_format.chroma_subsampling_y = 1;
+	input_ycbcr_format.cb_x_position = 0.5f;
+	input_ycbcr_format.cb_y_position = 0.5f;
+	input_ycbcr_format.cr_x_position = 0.5f;
+	input_ycbcr_format.cr_y_position = 0.5f;
+
+	YCbCrInput *input = new YCbCrInput(image_format, input_ycbcr_format, width, height);
+	input->set_pixel_data(0, y);
+	input->set_pixel_data(1, cb);
+	input->set_pixel_data(2, cr);
+
+	EffectChain *chain = tester.get_chain();
+	chain->add_input(input);
+	chain->add_ycbcr_output(image_format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, output_ycbcr_format, output_splitting);
+	chain->set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+	chain->finalize();
+
+	unsigned texture_width, texture_height;
+	get_ycbcr_output_texture_size(output_splitting, width, height, &texture_width, &texture_height);
+
+	GLuint texnum, fbo;
+	glGenTextures(1, &texnum);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, texnum);
+	check_error();
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, texture_width, texture_height, 0, format, type, NULL);
+	check_error();
+	glGenFramebuffers(1, &fbo);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texnum, 0);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+
+	// Note: The size of the image, not of the texture.
+	chain->render_to_fbo(fbo, width, height);
+
+	unsigned components = (format == GL_RED) ? 1 : 4;
+	if (type == GL_UNSIGNED_INT_2_10_10_10_REV) {
+		components = 1;
+	}
+	out_data->resize(texture_width * texture_height * components);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	check_error();
+	glReadPixels(0, 0, texture_width, texture_height, format, type, &(*out_data)[0]);
+	check_error();
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+
+	glDeleteFramebuffers(1, &fbo);
+	check_error();
+	glDeleteTextures(1, &texnum);
+	check_error();
+}
+
+YCbCrFormat get_packed_output_format(int num_levels, unsigned chroma_subsampling_y)
+{
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = num_levels;
+	ycbcr_format.chroma_subsampling_x = 2;
+	ycbcr_format.chroma_subsampling_y = chroma_subsampling_y;
+	ycbcr_format.cb_x_position = 0.0f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.0f;
+	ycbcr_format.cr_y_position = 0.5f;
+	return ycbcr_format;
+}
+
+}  // namespace
+
+TEST(YCbCrConversionEffectTest, PackedUYVYOutput) {
+	// Chroma is co-sited with the left pixel of each pair.
+	unsigned char expected_data[packed_width * packed_height * 2] = {
+		128,  16, 128, 235,   90,  81, 240, 145,
+		240,  41, 110,  16,  128, 235, 128,  81,
+	};
+
+	std::vector<unsigned char> out_data;
+	render_packed(YCBCR_OUTPUT_PACKED_UYVY, get_packed_output_format(256, 1), GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, &out_data);
+	ASSERT_EQ(size_t(packed_width * packed_height * 2), out_data.size());
+
+	// Y'CbCr isn't 100% accurate (the values go through R'G'B' in between),
+	// so we need some leeway.
+	expect_equal(expected_data, &out_data[0], packed_width * 2, packed_height, 2);
+}
+
+// v210 packs six pixels into each block of four words, so use an image
+// wide enough to fill one block, end the second in the middle of a word
+// and leave a partial third one. The pure colors from above repeat along
+// each line, shifted by one from one line to the next.
+TEST(YCbCrConversionEffectTest, PackedV210Output) {
+	const int width = 14, height = 2;
+	const unsigned char colors[][3] = {  // Y', Cb, Cr.
+		{ 16, 128, 128 },  // Black.
+		{ 235, 128, 128 },  // White.
+		{ 81, 90, 240 },  // Red.
+		{ 145, 54, 34 },  // Green.
+		{ 41, 240, 110 },  // Blue.
+	};
+	unsigned char y[width * height], cb[width * height], cr[width * height];
+	for (int i = 0; i < width * height; ++i) {
+		const unsigned char *color = colors[(i % width + 4 * (i / width)) % 5];
+		y[i] = color[0];
+		cb[i] = color[1];
+		cr[i] = color[2];
+	}
+
+	std::vector<unsigned> out_data;
+	render_packed(YCBCR_OUTPUT_PACKED_V210, get_packed_output_format(1024, 1), GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, &out_data,
+		width, height, y, cb, cr);
+
+	// Rows are padded to 48 pixels (32 words).
+	ASSERT_EQ(size_t(32 * height), out_data.size());
+	for (int line = 0; line < height; ++line) {
+		// Each block goes Cb Y' Cr Y' for every pair of pixels, with
+		// chroma co-sited with the left pixel. Only check the slots
+		// that are inside the image.
+		for (int slot = 0; slot < width * 2; ++slot) {
+			int block = slot / 12, block_slot = slot % 12;
+			int x = block * 6 + (block_slot / 4) * 2;
+			int expected;
+			switch (block_slot % 4) {
+			case 0:
+				expected = cb[line * width + x];
+				break;
+			case 1:
+				expected = y[line * width + x];
+				break;
+			case 2:
+				expected = cr[line * width + x];
+				break;
+			default:
+				expected = y[line * width + x + 1];
+				break;
+			}
+			unsigned word = out_data[line * 32 + block * 4 + block_slot / 3];
+			int value = (word >> (10 * (block_slot % 3))) & 0x3ff;
+			EXPECT_NEAR(expected * 4, value, 6) << "line " << line << ", slot " << slot;
+		}
+	}
+}
+
+TEST(YCbCrConversionEffectTest, PackedNV12Output) {
+	// Chroma is co-sited with the left pixel of each pair, and halfway
+	// between the two lines, so it is the average of the two lines.
+	unsigned char expected_data[packed_width * packed_height * 3 / 2] = {
+		// Y'.
+		16, 235, 81, 145,
+		41, 16, 235, 81,
+
+		// Cb, Cr.
+		(128 + 240) / 2, (128 + 110) / 2, (90 + 128) / 2, (240 + 128) / 2,
+	};
+
+	std::vector<unsigned char> out_data;
+	render_packed(YCBCR_OUTPUT_PACKED_NV12, get_packed_output_format(256, 2), GL_R8, GL_RED, GL_UNSIGNED_BYTE, &out_data);
+	ASSERT_EQ(size_t(packed_width * packed_height * 3 / 2), out_data.size());
+
+	expect_equal(expected_data, &out_data[0], packed_width, packed_height * 3 / 2, 2);
+}
+
 }  // namespace movit
@@ -6,7 +6,9 @@
 #include <string.h>
 
 #include "effect_util.h"
+#include "init.h"
 #include "resource_pool.h"
+#include "upload_ring.h"
 #include "util.h"
 #include "ycbcr.h"
 #include "ycbcr_input.h"
@@ -19,17 +21,26 @@ namespace movit {
 YCbCrInput::YCbCrInput(const ImageFormat &image_format,
                        const YCbCrFormat &ycbcr_format,
                        unsigned width, unsigned height,
-                       YCbCrInputSplitting ycbcr_input_splitting)
+                       YCbCrInputSplitting ycbcr_input_splitting,
+                       GLenum type)
 	: image_format(image_format),
 	  ycbcr_format(ycbcr_format),
 	  ycbcr_input_splitting(ycbcr_input_splitting),
+	  type(type),
 	  width(width),
 	  height(height),
-	  resource_pool(NULL)
+	  resource_pool(NULL),
+	  num_upload_buffers(0),
+	  upload_ring(NULL),
+	  lent_pbo(0)
 {
 	pbos[0] = pbos[1] = pbos[2] = 0;
 	texture_num[0] = texture_num[1] = texture_num[2] = 0;
 
+	assert(type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_SHORT);
+	assert(type == GL_UNSIGNED_SHORT || ycbcr_format.num_levels == 256);
+	assert(type == GL_UNSIGNED_BYTE || movit_norm16_textures_supported);
+
 	assert(width % ycbcr_format.chroma_subsampling_x == 0);
 	pitch[0] = widths[0] = width;
 	pitch[1] = widths[1] = width / ycbcr_format.chroma_subsampling_x;
@@ -43,6 +54,7 @@ YCbCrInput::YCbCrInput(const ImageFormat &image_format,
 	pixel_data[0] = pixel_data[1] = pixel_data[2] = NULL;
 	owns_texture[0] = owns_texture[1] = owns_texture[2] = false;
 
+	register_int("num_upload_buffers", &num_upload_buffers);
 	register_uniform_sampler2d("tex_y", &uniform_tex_y);
 
 	if (ycbcr_input_splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) {
@@ -61,37 +73,81 @@ YCbCrInput::~YCbCrInput()
 	for (unsigned channel = 0; channel < num_channels; ++channel) {
 		possibly_release_texture(channel);
 	}
+	delete upload_ring;
 }
 
 void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsigned *sampler_num)
 {
+	// If we have been asked to, copy all the channels that need to be
+	// uploaded from client memory into one buffer of our own first.
+	GLuint upload_pbos[3];
+	const unsigned char *upload_data[3];
+	bool use_upload_ring[3];
+	size_t upload_size = 0;
+	for (unsigned channel = 0; channel < num_channels; ++channel) {
+		upload_pbos[channel] = pbos[channel];
+		upload_data[channel] = pixel_data[channel];
+		use_upload_ring[channel] = (num_upload_buffers > 0 &&
+		                            texture_num[channel] == 0 &&
+		                            pbos[channel] == 0 &&
+		                            pixel_data[channel] != NULL);
+		if (use_upload_ring[channel]) {
+			upload_size += get_pixel_data_size(channel);
+		}
+	}
+	bool fence_upload_ring = (upload_size > 0);
+	if (upload_size > 0) {
+		possibly_recreate_upload_ring(upload_size);
+		unsigned char *ptr = (unsigned char *)upload_ring->begin_write();
+		size_t offset = 0;
+		for (unsigned channel = 0; channel < num_channels; ++channel) {
+			if (use_upload_ring[channel]) {
+				size_t size = get_pixel_data_size(channel);
+				memcpy(ptr + offset, pixel_data[channel], size);
+				upload_data[channel] = (const unsigned char *)BUFFER_OFFSET(offset);
+				offset += size;
+			}
+		}
+		GLuint pbo = upload_ring->end_write();
+		for (unsigned channel = 0; channel < num_channels; ++channel) {
+			if (use_upload_ring[channel]) {
+				upload_pbos[channel] = pbo;
+			}
+		}
+	} else if (lent_pbo != 0 && pbos[0] == lent_pbo && texture_num[0] == 0) {
+		// The data was written straight into the ring
+		// (see begin_write_pixel_data()).
+		fence_upload_ring = true;
+		lent_pbo = 0;
+	}
+
 	for (unsigned channel = 0; channel < num_channels; ++channel) {
 		glActiveTexture(GL_TEXTURE0 + *sampler_num + channel);
 		check_error();
 
-		if (texture_num[channel] == 0) {
-			GLenum format, internal_format;
-			if (channel == 1 && ycbcr_input_splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) {
-				format = GL_RG;
-				internal_format = GL_RG8;
-			} else {
-				format = GL_RED;
-				internal_format = GL_R8;
-			}
+		GLenum format, internal_format;
+		if (channel == 1 && ycbcr_input_splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) {
+			format = GL_RG;
+			internal_format = (type == GL_UNSIGNED_SHORT) ? GL_RG16 : GL_RG8;
+		} else {
+			format = GL_RED;
+			internal_format = (type == GL_UNSIGNED_SHORT) ? GL_R16 : GL_R8;
+		}
 
+		if (texture_num[channel] == 0) {
 			// (Re-)upload the texture.
 			texture_num[channel] = resource_pool->create_2d_texture(internal_format, widths[channel], heights[channel]);
 			glBindTexture(GL_TEXTURE_2D, texture_num[channel]);
 			check_error();
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 			check_error();
-			glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbos[channel]);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, upload_pbos[channel]);
 			check_error();
 			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 			check_error();
 			glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch[channel]);
 			check_error();
-			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, widths[channel], heights[channel], format, GL_UNSIGNED_BYTE, pixel_data[channel]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, widths[channel], heights[channel], format, type, upload_data[channel]);
 			check_error();
 			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 			check_error();
@@ -103,11 +159,18 @@ void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, uns
 		} else {
 			glBindTexture(GL_TEXTURE_2D, texture_num[channel]);
 			check_error();
+			if (owns_texture[channel] && !dirty_rects.empty()) {
+				upload_dirty_rects(channel, format);
+			}
 		}
 	}
+	dirty_rects.clear();
 
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
 	check_error();
+	if (fence_upload_ring) {
+		upload_ring->fence();
+	}
 
 	// Bind samplers.
 	uniform_tex_y = *sampler_num + 0;
@@ -125,6 +188,19 @@ string YCbCrInput::output_fragment_shader()
 	Matrix3d ycbcr_to_rgb;
 	compute_ycbcr_matrix(ycbcr_format, offset, &ycbcr_to_rgb);
 
+	if (type == GL_UNSIGNED_SHORT) {
+		// The texture gives us MSB-aligned samples divided by 65535,
+		// but the matrix expects code values divided by (num_levels - 1),
+		// so fold the difference into the offset and matrix.
+		// (For 16-bit data, this is a no-op.)
+		const double levels = ycbcr_format.num_levels;
+		const double k = (65535.0 * levels) / (65536.0 * (levels - 1.0));
+		for (unsigned i = 0; i < 3; ++i) {
+			offset[i] /= k;
+		}
+		ycbcr_to_rgb *= k;
+	}
+
 	string frag_shader;
 
 	frag_shader = output_glsl_mat3("PREFIX(inv_ycbcr_matrix)", ycbcr_to_rgb);
@@ -155,8 +231,86 @@ string YCbCrInput::output_fragment_shader()
 	return frag_shader;
 }
 
+void YCbCrInput::begin_write_pixel_data(unsigned char **channel_data)
+{
+	assert(num_upload_buffers > 0);
+	size_t size = 0;
+	for (unsigned channel = 0; channel < num_channels; ++channel) {
+		size += get_pixel_data_size(channel);
+	}
+	possibly_recreate_upload_ring(size);
+
+	unsigned char *ptr = (unsigned char *)upload_ring->begin_write();
+	for (unsigned channel = 0; channel < num_channels; ++channel) {
+		channel_data[channel] = ptr;
+		ptr += get_pixel_data_size(channel);
+	}
+}
+
+void YCbCrInput::end_write_pixel_data()
+{
+	lent_pbo = upload_ring->end_write();
+	size_t offset = 0;
+	for (unsigned channel = 0; channel < num_channels; ++channel) {
+		pixel_data[channel] = (const unsigned char *)BUFFER_OFFSET(offset);
+		pbos[channel] = lent_pbo;
+		offset += get_pixel_data_size(channel);
+	}
+	invalidate_pixel_data();
+}
+
+void YCbCrInput::possibly_recreate_upload_ring(size_t size)
+{
+	if (upload_ring != NULL &&
+	    (upload_ring->get_num_buffers() != unsigned(num_upload_buffers) ||
+	     upload_ring->get_buffer_size() < size)) {
+		delete upload_ring;
+		upload_ring = NULL;
+	}
+	if (upload_ring == NULL) {
+		upload_ring = new UploadRing(num_upload_buffers, size);
+	}
+}
+
+void YCbCrInput::upload_dirty_rects(unsigned channel, GLenum format)
+{
+	unsigned subsampling_x = 1, subsampling_y = 1;
+	if (channel != 0) {
+		subsampling_x = ycbcr_format.chroma_subsampling_x;
+		subsampling_y = ycbcr_format.chroma_subsampling_y;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbos[channel]);
+	check_error();
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	check_error();
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch[channel]);
+	check_error();
+	for (size_t i = 0; i < dirty_rects.size(); ++i) {
+		// Round outwards to whole chroma samples.
+		const InputRect &rect = dirty_rects[i];
+		unsigned x0 = rect.x / subsampling_x;
+		unsigned y0 = rect.y / subsampling_y;
+		unsigned x1 = (rect.x + rect.width + subsampling_x - 1) / subsampling_x;
+		unsigned y1 = (rect.y + rect.height + subsampling_y - 1) / subsampling_y;
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, x0);
+		check_error();
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, y0);
+		check_error();
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0, y1 - y0, format, type, pixel_data[channel]);
+		check_error();
+	}
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	check_error();
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	check_error();
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	check_error();
+}
+
 void YCbCrInput::invalidate_pixel_data()
 {
+	dirty_rects.clear();
 	for (unsigned channel = 0; channel < 3; ++channel) {
 		possibly_release_texture(channel);
 	}
@@ -171,6 +325,17 @@ bool YCbCrInput::set_int(const std::string& key, int value)
 	return Effect::set_int(key, value);
 }
 
+size_t YCbCrInput::get_pixel_data_size(unsigned channel) const
+{
+	size_t bytes_per_pixel = (channel == 1 && ycbcr_input_splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) ? 2 : 1;
+	if (type == GL_UNSIGNED_SHORT) {
+		bytes_per_pixel *= 2;
+	}
+
+	// The last row does not need to be padded out to the full pitch.
+	return (size_t(pitch[channel]) * (heights[channel] - 1) + widths[channel]) * bytes_per_pixel;
+}
+
 void YCbCrInput::possibly_release_texture(unsigned channel)
 {
 	if (texture_num[channel] != 0 && owns_texture[channel]) {
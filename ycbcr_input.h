@@ -4,13 +4,25 @@
 // YCbCrInput is for handling planar 8-bit Y'CbCr (also sometimes, usually rather
 // imprecisely, called “YUV”), which is typically what you get from a video decoder.
 // It upsamples planes as needed, using the default linear upsampling OpenGL gives you.
+//
+// It can also take 16-bit samples (type GL_UNSIGNED_SHORT), for higher bit depths.
+// The samples are then assumed to be MSB-aligned, as in P010 and P016
+// (use YCBCR_INPUT_SPLIT_Y_AND_CBCR for those); e.g. for 10-bit data
+// (num_levels = 1024), the lowest six bits of every sample should be zero.
+// They are uploaded as-is (to GL_R16/GL_RG16 textures), and the shader
+// rescales them to the 10-bit range, so there is no need to unpack them
+// on the CPU. Note that 16-bit normalized textures are not available on
+// all GLES implementations; check movit_norm16_textures_supported first.
 
 #include <epoxy/gl.h>
 #include <assert.h>
+#include <stddef.h>
 #include <string>
+#include <vector>
 
 #include "effect.h"
 #include "effect_chain.h"
+#include "effect_util.h"
 #include "image_format.h"
 #include "input.h"
 #include "ycbcr.h"
@@ -18,6 +30,7 @@
 namespace movit {
 
 class ResourcePool;
+class UploadRing;
 
 // Whether the data is fully planar (Y', Cb and Cr in one texture each)
 // or not. Note that this input does currently not support fully interleaved
@@ -40,7 +53,8 @@ public:
 	YCbCrInput(const ImageFormat &image_format,
 	           const YCbCrFormat &ycbcr_format,
 	           unsigned width, unsigned height,
-	           YCbCrInputSplitting ycbcr_input_splitting = YCBCR_INPUT_PLANAR);
+	           YCbCrInputSplitting ycbcr_input_splitting = YCBCR_INPUT_PLANAR,
+	           GLenum type = GL_UNSIGNED_BYTE);
 	~YCbCrInput();
 
 	virtual std::string effect_type_id() const { return "YCbCrInput"; }
@@ -69,16 +83,50 @@ public:
 	// asynchronously to the GPU, if you have any CPU-intensive work between the
 	// call to set_pixel_data() and the actual rendering. In either case,
 	// the pointer (and PBO, if set) has to be valid at the time of the render call.
+	//
+	// As with FlatInput, you can set “num_upload_buffers” to have the input
+	// copy data given as regular pointers into PBOs of its own; all the
+	// channels of a frame share one buffer in the ring.
 	void set_pixel_data(unsigned channel, const unsigned char *pixel_data, GLuint pbo = 0)
 	{
+		assert(type == GL_UNSIGNED_BYTE);
 		assert(channel >= 0 && channel < num_channels);
 		this->pixel_data[channel] = pixel_data;
 		this->pbos[channel] = pbo;
 		invalidate_pixel_data();
 	}
 
+	void set_pixel_data(unsigned channel, const unsigned short *pixel_data, GLuint pbo = 0)
+	{
+		assert(type == GL_UNSIGNED_SHORT);
+		assert(channel >= 0 && channel < num_channels);
+		this->pixel_data[channel] = reinterpret_cast<const unsigned char *>(pixel_data);
+		this->pbos[channel] = pbo;
+		invalidate_pixel_data();
+	}
+
+	// Zero-copy alternative to set_pixel_data(); see the comments on
+	// FlatInput::begin_write_pixel_data(). Fills in one pointer for each
+	// channel (two if Cb and Cr are interleaved, otherwise three), all
+	// within the same buffer. The channels are laid out as set_pixel_data()
+	// would expect them with the current pitches.
+	void begin_write_pixel_data(unsigned char **channel_data);
+	void end_write_pixel_data();
+
 	void invalidate_pixel_data();
 
+	// Partial update; see FlatInput::invalidate_pixel_data(x, y, width, height).
+	// The rectangle is given in luma pixels; the corresponding chroma samples
+	// (rounded outwards) are uploaded for the chroma channels.
+	void invalidate_pixel_data(unsigned x, unsigned y, unsigned width, unsigned height)
+	{
+		if ((texture_num[0] != 0 && owns_texture[0]) ||
+		    (texture_num[1] != 0 && owns_texture[1]) ||
+		    (texture_num[2] != 0 && owns_texture[2])) {
+			add_dirty_rect(&dirty_rects, x, y, width, height, this->width, this->height);
+		}
+	}
+
 	void set_pitch(unsigned channel, unsigned pitch) {
 		assert(channel >= 0 && channel < num_channels);
 		this->pitch[channel] = pitch;
@@ -106,10 +154,23 @@ private:
 	// Release the texture in the given channel if we have any, and it is owned by us.
 	void possibly_release_texture(unsigned channel);
 
+	// The number of bytes set_pixel_data() points to for the given channel,
+	// given the pitch.
+	size_t get_pixel_data_size(unsigned channel) const;
+
+	// Create the upload ring if we don't have one, or recreate it if
+	// its number of buffers or their size is not what we need.
+	void possibly_recreate_upload_ring(size_t size);
+
+	// Upload the rectangles in dirty_rects for the given channel
+	// into its (bound) texture.
+	void upload_dirty_rects(unsigned channel, GLenum format);
+
 	ImageFormat image_format;
 	YCbCrFormat ycbcr_format;
 	GLuint num_channels;
 	YCbCrInputSplitting ycbcr_input_splitting;
+	GLenum type;
 	GLuint pbos[3], texture_num[3];
 	GLint uniform_tex_y, uniform_tex_cb, uniform_tex_cr;
 
@@ -118,6 +179,16 @@ private:
 	unsigned pitch[3];
 	bool owns_texture[3];
 	ResourcePool *resource_pool;
+	int num_upload_buffers;
+	UploadRing *upload_ring;  // NULL if not created yet.
+
+	// Parts of the textures that need to be uploaded anew, in luma pixels
+	// (see invalidate_pixel_data(x, y, width, height)).
+	std::vector<InputRect> dirty_rects;
+
+	// The PBO from the last end_write_pixel_data() that has not been
+	// uploaded from yet, or 0.
+	GLuint lent_pbo;
 };
 
 }  // namespace movit
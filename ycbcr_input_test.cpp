@@ -2,9 +2,12 @@
 
 #include <epoxy/gl.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "effect_chain.h"
 #include "gtest/gtest.h"
+#include "init.h"
 #include "test_util.h"
 #include "util.h"
 #include "resource_pool.h"
@@ -485,6 +488,245 @@ TEST(YCbCrInputTest, PBO) {
 	glDeleteBuffers(1, &pbo);
 }
 
+TEST(YCbCrInputTest, UploadRing) {
+	const int width = 1;
+	const int height = 5;
+
+	// Same data as in the PBO test, but uploaded through the input's
+	// own buffers instead.
+	unsigned char data[width * height * 3] = {
+		16, 235, 81, 145, 41,
+		128, 128, 90, 54, 240,
+		128, 128, 240, 34, 110,
+	};
+	float expected_data[4 * width * height] = {
+		0.0, 0.0, 0.0, 1.0,
+		1.0, 1.0, 1.0, 1.0,
+		1.0, 0.0, 0.0, 1.0,
+		0.0, 1.0, 0.0, 1.0,
+		0.0, 0.0, 1.0, 1.0,
+	};
+	float out_data[4 * width * height];
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = 1;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height);
+	ASSERT_TRUE(input->set_int("num_upload_buffers", 2));
+	input->set_pixel_data(0, data);
+	input->set_pixel_data(1, data + width * height);
+	input->set_pixel_data(2, data + width * height * 2);
+	tester.get_chain()->add_input(input);
+
+	// Go around the ring a few times.
+	for (int i = 0; i < 3; ++i) {
+		input->invalidate_pixel_data();
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+		// Y'CbCr isn't 100% accurate (the input values are rounded),
+		// so we need some leeway.
+		expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+	}
+}
+
+TEST(YCbCrInputTest, WriteDirectlyIntoUploadBuffer) {
+	const int width = 1;
+	const int height = 5;
+
+	// Pure-color test inputs, calculated with the formulas in Rec. 601
+	// section 2.5.4.
+	unsigned char y[width * height] = {
+		16, 235, 81, 145, 41,
+	};
+	unsigned char cb[width * height] = {
+		128, 128, 90, 54, 240,
+	};
+	unsigned char cr[width * height] = {
+		128, 128, 240, 34, 110,
+	};
+	float expected_data[4 * width * height] = {
+		0.0, 0.0, 0.0, 1.0,
+		1.0, 1.0, 1.0, 1.0,
+		1.0, 0.0, 0.0, 1.0,
+		0.0, 1.0, 0.0, 1.0,
+		0.0, 0.0, 1.0, 1.0,
+	};
+	float out_data[4 * width * height];
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = 1;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height);
+	ASSERT_TRUE(input->set_int("num_upload_buffers", 2));
+	tester.get_chain()->add_input(input);
+
+	for (int i = 0; i < 3; ++i) {
+		unsigned char *channel_data[3];
+		input->begin_write_pixel_data(channel_data);
+		memcpy(channel_data[0], y, sizeof(y));
+		memcpy(channel_data[1], cb, sizeof(cb));
+		memcpy(channel_data[2], cr, sizeof(cr));
+		input->end_write_pixel_data();
+
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+		// Y'CbCr isn't 100% accurate (the input values are rounded),
+		// so we need some leeway.
+		expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+	}
+}
+
+TEST(YCbCrInputTest, DirtyRectangles) {
+	const int width = 1;
+	const int height = 5;
+
+	// Start out all black.
+	unsigned char y[width * height] = {
+		16, 16, 16, 16, 16,
+	};
+	unsigned char cb[width * height] = {
+		128, 128, 128, 128, 128,
+	};
+	unsigned char cr[width * height] = {
+		128, 128, 128, 128, 128,
+	};
+	float expected_data[4 * width * height] = {
+		0.0, 0.0, 0.0, 1.0,
+		0.0, 0.0, 0.0, 1.0,
+		0.0, 0.0, 0.0, 1.0,
+		0.0, 0.0, 0.0, 1.0,
+		0.0, 0.0, 0.0, 1.0,
+	};
+	float out_data[4 * width * height];
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = 1;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height);
+	input->set_pixel_data(0, y);
+	input->set_pixel_data(1, cb);
+	input->set_pixel_data(2, cr);
+	tester.get_chain()->add_input(input);
+
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+
+	// Make the third pixel red and the fifth blue, but only mark
+	// the third one as changed; the fifth should stay black.
+	y[2] = 81;
+	cb[2] = 90;
+	cr[2] = 240;
+	y[4] = 41;
+	cb[4] = 240;
+	cr[4] = 110;
+	input->invalidate_pixel_data(0, 2, 1, 1);
+	expected_data[4 * 2 + 0] = 1.0;
+
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+}
+
+// Same colors as in Simple444, but as 10-bit values in 16-bit words,
+// with Cb and Cr interleaved (like P010, but without the subsampling).
+TEST(YCbCrInputTest, TenBitInSixteenBitWords) {
+	if (!movit_norm16_textures_supported) {
+		fprintf(stderr, "Skipping test; no support for 16-bit normalized textures.\n");
+		return;
+	}
+
+	const int width = 1;
+	const int height = 5;
+
+	unsigned short y[width * height] = {
+		64 << 6, 940 << 6, 324 << 6, 580 << 6, 164 << 6,
+	};
+	unsigned short cbcr[width * height * 2] = {
+		512 << 6, 512 << 6,
+		512 << 6, 512 << 6,
+		360 << 6, 960 << 6,
+		216 << 6, 136 << 6,
+		960 << 6, 440 << 6,
+	};
+	float expected_data[4 * width * height] = {
+		0.0, 0.0, 0.0, 1.0,
+		1.0, 1.0, 1.0, 1.0,
+		1.0, 0.0, 0.0, 1.0,
+		0.0, 1.0, 0.0, 1.0,
+		0.0, 0.0, 1.0, 1.0,
+	};
+	float out_data[4 * width * height];
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 1024;
+	ycbcr_format.chroma_subsampling_x = 1;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height, YCBCR_INPUT_SPLIT_Y_AND_CBCR, GL_UNSIGNED_SHORT);
+	input->set_pixel_data(0, y);
+	input->set_pixel_data(1, cbcr);
+	tester.get_chain()->add_input(input);
+
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	// Y'CbCr isn't 100% accurate (the input values are rounded),
+	// so we need some leeway.
+	expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+}
+
 TEST(YCbCrInputTest, CombinedCbAndCr) {
 	const int width = 1;
 	const int height = 5;